@@ -227,6 +227,7 @@ LIBS="$PTHREAD_LIBS $LIBS"
 AC_MSG_NOTICE(rechecking with PTHREAD_... options)
 AC_CHECK_LIB(c, pthread_rwlock_init,
   [AC_DEFINE(HAVE_PTHREAD_RWLOCK_INIT_IN_THREAD_LIB,1,[Define if pthread_rwlock_init is provided in the thread library.])])
+AC_CHECK_FUNCS(pthread_mutexattr_setrobust)
 LIBS="$old_LIBS"
 CC="$old_CC"
 CFLAGS="$old_CFLAGS"
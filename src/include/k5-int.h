@@ -237,13 +237,17 @@ typedef unsigned char   u_char;
 #define KRB5_CONF_KCM_SOCKET                   "kcm_socket"
 #define KRB5_CONF_KDC                          "kdc"
 #define KRB5_CONF_KDCDEFAULTS                  "kdcdefaults"
+#define KRB5_CONF_KDC_CONNECTION_REUSE         "kdc_connection_reuse"
 #define KRB5_CONF_KDC_DEFAULT_OPTIONS          "kdc_default_options"
 #define KRB5_CONF_KDC_LISTEN                   "kdc_listen"
 #define KRB5_CONF_KDC_MAX_DGRAM_REPLY_SIZE     "kdc_max_dgram_reply_size"
 #define KRB5_CONF_KDC_PORTS                    "kdc_ports"
+#define KRB5_CONF_KDC_REUSEPORT                "kdc_reuseport"
+#define KRB5_CONF_KDC_SHARED_LOOKASIDE         "kdc_shared_lookaside"
 #define KRB5_CONF_KDC_TCP_PORTS                "kdc_tcp_ports"
 #define KRB5_CONF_KDC_TCP_LISTEN               "kdc_tcp_listen"
 #define KRB5_CONF_KDC_TCP_LISTEN_BACKLOG       "kdc_tcp_listen_backlog"
+#define KRB5_CONF_KDC_TCP_MAX_CONNECTIONS      "kdc_tcp_max_connections"
 #define KRB5_CONF_KDC_TIMESYNC                 "kdc_timesync"
 #define KRB5_CONF_KEY_STASH_FILE               "key_stash_file"
 #define KRB5_CONF_KPASSWD_LISTEN               "kpasswd_listen"
@@ -282,6 +286,9 @@ typedef unsigned char   u_char;
 #define KRB5_CONF_PLUGIN_BASE_DIR              "plugin_base_dir"
 #define KRB5_CONF_PREFERRED_PREAUTH_TYPES      "preferred_preauth_types"
 #define KRB5_CONF_PRIMARY_KDC                  "primary_kdc"
+#define KRB5_CONF_PRINCIPAL_CACHE_SIZE         "principal_cache_size"
+#define KRB5_CONF_PRINCIPAL_CACHE_TTL          "principal_cache_ttl"
+#define KRB5_CONF_PRINCIPAL_NEGATIVE_CACHE_TTL "principal_negative_cache_ttl"
 #define KRB5_CONF_PROXIABLE                    "proxiable"
 #define KRB5_CONF_QUALIFY_SHORTNAME            "qualify_shortname"
 #define KRB5_CONF_RDNS                         "rdns"
@@ -616,8 +623,10 @@ extern char *strdup (const char *);
 /* libos.spec */
 krb5_error_code krb5_lock_file(krb5_context, int, int);
 krb5_error_code krb5_unlock_file(krb5_context, int);
+krb5_error_code k5_lock_file_range(int fd, off_t offset, off_t len, int mode);
 krb5_error_code krb5_sendto_kdc(krb5_context, const krb5_data *,
                                 const krb5_data *, krb5_data *, int *, int);
+void k5_sendto_kdc_free_context(krb5_context);
 
 krb5_error_code krb5int_init_context_kdc(krb5_context *);
 
@@ -1208,6 +1217,7 @@ struct ccselect_module_handle;
 struct localauth_module_handle;
 struct hostrealm_module_handle;
 struct k5_tls_vtable_st;
+struct sendto_conn_pool;
 struct _krb5_context {
     krb5_magic      magic;
     krb5_enctype    *tgs_etypes;
@@ -1248,6 +1258,9 @@ struct _krb5_context {
     /* TLS module vtable (if loaded) */
     struct k5_tls_vtable_st *tls;
 
+    /* Idle TCP and HTTPS connections to KDCs, kept for reuse */
+    struct sendto_conn_pool *kdc_conn_pool;
+
     /* error detail info */
     struct errinfo err;
     char *err_fmt;
@@ -1768,6 +1781,17 @@ krb5int_ldap_decode_sequence_of_keys(const krb5_data *in,
 krb5_error_code
 krb5_encrypt_tkt_part(krb5_context, const krb5_keyblock *, krb5_ticket *);
 
+krb5_error_code
+k5_encrypt_tkt_part_k(krb5_context, krb5_key, krb5_ticket *);
+
+krb5_error_code
+k5_decrypt_tkt_part_k(krb5_context, krb5_key, krb5_ticket *);
+
+/* Like krb5_auth_con_setuseruserkey(), but share a reference to key. */
+krb5_error_code
+k5_auth_con_setuseruserkey_k(krb5_context context,
+                             krb5_auth_context auth_context, krb5_key key);
+
 krb5_error_code
 krb5_encode_kdc_rep(krb5_context, krb5_msgtype, const krb5_enc_kdc_rep_part *,
                     int using_subkey, const krb5_keyblock *, krb5_kdc_rep *,
@@ -302,6 +302,38 @@ static inline int k5_os_mutex_finish_init(k5_os_mutex *m) { return 0; }
 
 #endif /* is pthreads always available? */
 
+/* Process-shared mutexes are also robust, so that a process which dies while
+ * holding one does not deadlock the others. */
+#if defined(_POSIX_THREAD_PROCESS_SHARED) && _POSIX_THREAD_PROCESS_SHARED > 0 \
+    && defined(HAVE_PTHREAD_MUTEXATTR_SETROBUST)
+# define K5_HAVE_SHARED_MUTEX
+# include <errno.h>
+static inline int k5_os_mutex_init_shared(k5_os_mutex *m)
+{
+    pthread_mutexattr_t attr;
+    int ret;
+
+    ret = pthread_mutexattr_init(&attr);
+    if (ret)
+        return ret;
+    ret = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (!ret)
+        ret = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if (!ret)
+        ret = pthread_mutex_init(m, &attr);
+    (void)pthread_mutexattr_destroy(&attr);
+    return ret;
+}
+static inline int k5_os_mutex_lock_shared(k5_os_mutex *m)
+{
+    int ret = pthread_mutex_lock(m);
+
+    if (ret == EOWNERDEAD && pthread_mutex_consistent(m) != 0)
+        return ENOTRECOVERABLE;
+    return ret;
+}
+#endif
+
 #elif defined _WIN32
 
 # define k5_once_t k5_os_nothread_once_t
@@ -388,11 +420,61 @@ static inline void k5_mutex_unlock(k5_mutex_t *m)
     assert(r == 0);
 }
 
+#ifdef K5_HAVE_SHARED_MUTEX
+/*
+ * Initialize a mutex which may be placed in memory shared with other
+ * processes.  If a process dies while holding the mutex, the next
+ * k5_mutex_lock_shared() acquires it and returns EOWNERDEAD, after which the
+ * caller must repair the data it protects.  Otherwise it returns 0.  Release
+ * the mutex with k5_mutex_unlock() and destroy it with k5_mutex_destroy().
+ */
+static inline int k5_mutex_init_shared(k5_mutex_t *m)
+{
+    return k5_os_mutex_init_shared(m);
+}
+
+static inline int k5_mutex_lock_shared(k5_mutex_t *m)
+{
+    int r = k5_os_mutex_lock_shared(m);
+#ifndef NDEBUG
+    if (r != 0 && r != EOWNERDEAD) {
+        fprintf(stderr, "k5_mutex_lock_shared: Received error %d (%s)\n",
+                r, strerror(r));
+    }
+#endif
+    assert(r == 0 || r == EOWNERDEAD);
+    return r;
+}
+#endif
+
 #define k5_mutex_assert_locked(M)       ((void)(M))
 #define k5_mutex_assert_unlocked(M)     ((void)(M))
 #define k5_assert_locked        k5_mutex_assert_locked
 #define k5_assert_unlocked      k5_mutex_assert_unlocked
 
+/*
+ * Load a pointer with acquire ordering, or store one with release ordering, so
+ * that an object initialized before being published through the pointer can
+ * be read without locking.  K5_HAVE_ATOMIC_PTR is not defined if the compiler
+ * offers no suitable primitives; callers must then fall back to a mutex.
+ */
+#ifndef ENABLE_THREADS
+# define K5_HAVE_ATOMIC_PTR
+# define k5_atomic_load_ptr(P)          (*(P))
+# define k5_atomic_store_ptr(P, V)      ((void)(*(P) = (V)))
+#elif defined(__ATOMIC_ACQUIRE)
+# define K5_HAVE_ATOMIC_PTR
+# define k5_atomic_load_ptr(P)          __atomic_load_n((P), __ATOMIC_ACQUIRE)
+# define k5_atomic_store_ptr(P, V)                      \
+    __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+#elif defined(_WIN32)
+# define K5_HAVE_ATOMIC_PTR
+# define k5_atomic_load_ptr(P)                                          \
+    InterlockedCompareExchangePointer((PVOID volatile *)(P), NULL, NULL)
+# define k5_atomic_store_ptr(P, V)                                      \
+    ((void)InterlockedExchangePointer((PVOID volatile *)(P), (V)))
+#endif
+
 /* Thread-specific data; implemented in a support file, because we'll
    need to keep track of some global data for cleanup purposes.
 
@@ -402,6 +402,10 @@ void krb5int_trace(krb5_context context, const char *fmt, ...);
     TRACE(c, "HTTPS error: {str}", errs)
 #define TRACE_SENDTO_KDC_TCP_CONNECT(c, raddr)                  \
     TRACE(c, "Initiating TCP connection to {raddr}", raddr)
+#define TRACE_SENDTO_KDC_TCP_REUSE(c, raddr)                    \
+    TRACE(c, "Reusing TCP connection to {raddr}", raddr)
+#define TRACE_SENDTO_KDC_TCP_REUSE_ERROR(c, raddr)              \
+    TRACE(c, "Reused TCP connection to {raddr} failed, reconnecting", raddr)
 #define TRACE_SENDTO_KDC_TCP_DISCONNECT(c, raddr)               \
     TRACE(c, "Terminating TCP connection to {raddr}", raddr)
 #define TRACE_SENDTO_KDC_TCP_ERROR_CONNECT(c, raddr, err)               \
@@ -371,6 +371,14 @@ krb5_error_code krb5_db_get_principal ( krb5_context kcontext,
                                         krb5_const_principal search_for,
                                         unsigned int flags,
                                         krb5_db_entry **entry );
+/*
+ * Look up count principals at once, with flags[i] applying to search_for[i].
+ * entries[i] is set to NULL for each principal which does not exist.
+ */
+krb5_error_code krb5_db_get_principals ( krb5_context kcontext, size_t count,
+                                         krb5_const_principal *search_for,
+                                         const unsigned int *flags,
+                                         krb5_db_entry **entries );
 void krb5_db_free_principal ( krb5_context kcontext, krb5_db_entry *entry );
 krb5_error_code krb5_db_put_principal ( krb5_context kcontext,
                                         krb5_db_entry *entry );
@@ -703,6 +711,17 @@ void krb5_db_audit_as_req(krb5_context kcontext, krb5_kdc_req *request,
 
 void krb5_db_refresh_config(krb5_context kcontext);
 
+/* Return true if principal lookups through kcontext are cached. */
+krb5_boolean krb5_db_principal_cache_enabled(krb5_context kcontext);
+
+/*
+ * Make kcontext use the principal cache of from (if it has one) in place of
+ * its own, so that contexts used by different threads for the same database
+ * can share cached entries.  Both contexts must have the database open.
+ */
+krb5_error_code krb5_db_share_principal_cache(krb5_context kcontext,
+                                              krb5_context from);
+
 krb5_error_code krb5_db_check_allowed_to_delegate(krb5_context kcontext,
                                                   krb5_const_principal client,
                                                   const krb5_db_entry *server,
@@ -1525,6 +1544,21 @@ typedef struct _kdb_vftabl {
                                void *ad_info);
 
     /* End of minor version 0 for major version 8. */
+
+    /*
+     * Optional: Look up the entries for count principals in one operation,
+     * with flags[i] applying to search_for[i] as for get_principal().  Set
+     * entries[i] to NULL for each principal which does not exist.  Return an
+     * error only if the lookup as a whole fails, with no entries set.  If
+     * this method is not implemented, libkdb5 calls get_principal() for each
+     * principal.
+     */
+    krb5_error_code (*get_principals)(krb5_context kcontext, size_t count,
+                                      krb5_const_principal *search_for,
+                                      const unsigned int *flags,
+                                      krb5_db_entry **entries);
+
+    /* End of minor version 1 for major version 8. */
 } kdb_vftabl;
 
 #endif /* !defined(_WIN32) */
@@ -60,6 +60,8 @@ extern "C" {
  */
 krb5_error_code ulog_map(krb5_context context, const char *logname,
                          uint32_t entries);
+krb5_error_code ulog_map_readonly(krb5_context context, const char *logname,
+                                  uint32_t entries);
 krb5_error_code ulog_init_header(krb5_context context);
 krb5_error_code ulog_add_update(krb5_context context, kdb_incr_update_t *upd);
 krb5_error_code ulog_get_entries(krb5_context context, const kdb_last_t *last,
@@ -104,6 +106,7 @@ typedef struct _kdb_log_context {
     kdb_hlog_t      *ulog;
     uint32_t        ulogentries;
     int             ulogfd;
+    krb5_boolean    readonly;
 } kdb_log_context;
 
 #ifdef  __cplusplus
@@ -66,6 +66,13 @@ krb5_error_code loop_add_rpc_service(int default_port, const char *addresses,
                                      u_long prognum, u_long versnum,
                                      void (*dispatchfn)());
 
+/*
+ * Set the number of TCP and RPC connections to allow before closing the least
+ * recently active one.  The limit is lowered if necessary to fit the open
+ * file limit when the network is set up.
+ */
+void loop_set_max_connections(int max_connections);
+
 krb5_error_code loop_setup_network(verto_ctx *ctx, void *handle,
                                    const char *progname,
                                    int tcp_listen_backlog);
@@ -33,8 +33,6 @@
 #include <arpa/inet.h>
 #include <string.h>
 
-static krb5_int32 last_usec = 0, last_os_random = 0;
-
 static krb5_error_code make_too_big_error(kdc_realm_t *kdc_active_realm,
                                           krb5_data **out);
 
@@ -91,8 +89,9 @@ finish_dispatch_cache(void *arg, krb5_error_code code, krb5_data *response)
 }
 
 static void
-reseed_random(krb5_context kdc_err_context)
+reseed_random(struct server_handle *handle)
 {
+    krb5_context kdc_err_context = handle->kdc_err_context;
     krb5_error_code retval;
     krb5_timestamp now;
     krb5_int32 now_usec, usec_difference;
@@ -100,13 +99,13 @@ reseed_random(krb5_context kdc_err_context)
 
     retval = krb5_crypto_us_timeofday(&now, &now_usec);
     if (retval == 0) {
-        usec_difference = now_usec - last_usec;
-        if (last_os_random == 0)
-            last_os_random = now;
+        usec_difference = now_usec - handle->last_usec;
+        if (handle->last_os_random == 0)
+            handle->last_os_random = now;
         /* Grab random data from OS every hour*/
-        if (ts_delta(now, last_os_random) >= 60 * 60) {
+        if (ts_delta(now, handle->last_os_random) >= 60 * 60) {
             krb5_c_random_os_entropy(kdc_err_context, 0, NULL);
-            last_os_random = now;
+            handle->last_os_random = now;
         }
 
         data.length = sizeof(krb5_int32);
@@ -114,7 +113,7 @@ reseed_random(krb5_context kdc_err_context)
 
         krb5_c_random_add_entropy(kdc_err_context,
                                   KRB5_C_RANDSOURCE_TIMING, &data);
-        last_usec = now_usec;
+        handle->last_usec = now_usec;
     }
 }
 
@@ -122,6 +121,23 @@ void
 dispatch(void *cb, const krb5_fulladdr *local_addr,
          const krb5_fulladdr *remote_addr, krb5_data *pkt, int is_tcp,
          verto_ctx *vctx, loop_respond_fn respond, void *arg)
+{
+    /* In threaded mode, a worker thread calls kdc_dispatch_request() with its
+     * own server handle and loop. */
+    if (kdc_threads_active()) {
+        kdc_threads_dispatch(local_addr, remote_addr, pkt, is_tcp, respond,
+                             arg);
+        return;
+    }
+    kdc_dispatch_request(cb, local_addr, remote_addr, pkt, is_tcp, vctx,
+                         respond, arg);
+}
+
+void
+kdc_dispatch_request(void *cb, const krb5_fulladdr *local_addr,
+                     const krb5_fulladdr *remote_addr, krb5_data *pkt,
+                     int is_tcp, verto_ctx *vctx, loop_respond_fn respond,
+                     void *arg)
 {
     krb5_error_code retval;
     krb5_kdc_req *req = NULL;
@@ -172,7 +188,7 @@ dispatch(void *cb, const krb5_fulladdr *local_addr,
      * is currently being processed. */
     kdc_insert_lookaside(kdc_err_context, pkt, NULL);
 #endif
-    reseed_random(kdc_err_context);
+    reseed_random(handle);
 
     /* try TGS_REQ first; they are more common! */
 
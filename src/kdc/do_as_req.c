@@ -130,23 +130,89 @@ select_client_key(krb5_context context, krb5_db_entry *client,
     return 0;
 }
 
+/*
+ * Look up the client and server of req, and the local TGT tgs unless it is
+ * the requested server, with a single database request where possible.  Set
+ * *client_out or *server_out to NULL if the principal does not exist.  Set
+ * *tgt_out to the local TGT entry, or to NULL if it was not looked up or does
+ * not exist.  On failure, set *status_out to the status of the lookup which
+ * failed.
+ */
 static krb5_error_code
-lookup_client(krb5_context context, krb5_kdc_req *req, unsigned int flags,
-              krb5_db_entry **entry_out)
+lookup_principals(krb5_context context, krb5_kdc_req *req,
+                  krb5_const_principal tgs, unsigned int c_flags,
+                  unsigned int s_flags, krb5_db_entry **client_out,
+                  krb5_db_entry **server_out, krb5_db_entry **tgt_out,
+                  const char **status_out)
 {
+    krb5_error_code ret;
     krb5_pa_data *pa;
     krb5_data cert;
+    krb5_const_principal names[3];
+    unsigned int flags[3];
+    const char *statuses[3];
+    krb5_db_entry *entries[3], *x509_client = NULL;
+    krb5_boolean by_cert, want_tgt;
+    size_t n = 0, i;
+
+    *client_out = *server_out = *tgt_out = NULL;
+    *status_out = NULL;
 
-    *entry_out = NULL;
     pa = krb5int_find_pa_data(context, req->padata, KRB5_PADATA_S4U_X509_USER);
-    if (pa != NULL && pa->length != 0 &&
-        req->client->type == KRB5_NT_X500_PRINCIPAL) {
+    by_cert = (pa != NULL && pa->length != 0 &&
+               req->client->type == KRB5_NT_X500_PRINCIPAL);
+    if (by_cert) {
         cert = make_data(pa->contents, pa->length);
-        return krb5_db_get_s4u_x509_principal(context, &cert, req->client,
-                                              flags, entry_out);
+        ret = krb5_db_get_s4u_x509_principal(context, &cert, req->client,
+                                             c_flags, &x509_client);
+        if (ret && ret != KRB5_KDB_NOENTRY) {
+            *status_out = "LOOKING_UP_CLIENT";
+            return ret;
+        }
     } else {
-        return krb5_db_get_principal(context, req->client, flags, entry_out);
+        names[n] = req->client;
+        flags[n] = c_flags;
+        statuses[n++] = "LOOKING_UP_CLIENT";
+    }
+    names[n] = req->server;
+    flags[n] = s_flags;
+    statuses[n++] = "LOOKING_UP_SERVER";
+    want_tgt = data_eq(req->server->realm, tgs->realm) &&
+        !krb5_principal_compare(context, req->server, tgs);
+    if (want_tgt) {
+        names[n] = tgs;
+        flags[n] = 0;
+        statuses[n++] = "GET_LOCAL_TGT";
+    }
+
+    ret = krb5_db_get_principals(context, n, names, flags, entries);
+    if (ret) {
+        /* The batch result does not say which principal failed, so look them
+         * up individually to report the failure as the separate lookups
+         * would have. */
+        for (i = 0; i < n; i++) {
+            ret = krb5_db_get_principal(context, names[i], flags[i],
+                                        &entries[i]);
+            if (ret == KRB5_KDB_NOENTRY) {
+                entries[i] = NULL;
+                ret = 0;
+            }
+            if (ret) {
+                *status_out = statuses[i];
+                while (i > 0)
+                    krb5_db_free_principal(context, entries[--i]);
+                krb5_db_free_principal(context, x509_client);
+                return ret;
+            }
+        }
     }
+
+    n = 0;
+    *client_out = by_cert ? x509_client : entries[n++];
+    *server_out = entries[n++];
+    if (want_tgt)
+        *tgt_out = entries[n];
+    return 0;
 }
 
 struct as_req_state {
@@ -158,7 +224,7 @@ struct as_req_state {
     krb5_enc_kdc_rep_part reply_encpart;
     krb5_ticket ticket_reply;
     krb5_keyblock local_tgt_key;
-    krb5_keyblock server_keyblock;
+    krb5_key server_key;
     krb5_keyblock client_keyblock;
     krb5_db_entry *client;
     krb5_db_entry *server;
@@ -176,6 +242,7 @@ struct as_req_state {
     unsigned int c_flags;
     krb5_data *req_pkt;
     krb5_data *inner_body;
+    krb5_data req_body;
     struct kdc_request_state *rstate;
     char *sname, *cname;
     void *pa_context;
@@ -219,8 +286,8 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
     if (errcode)
         goto egress;
 
-    errcode = get_first_current_key(kdc_context, state->server,
-                                    &state->server_keyblock);
+    errcode = get_first_current_key_k(kdc_active_realm, state->server,
+                                      &state->server_key);
     if (errcode) {
         state->status = "FINDING_SERVER_KEY";
         goto egress;
@@ -264,7 +331,8 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
     errcode = handle_authdata(kdc_context, state->c_flags, state->client,
                               state->server, NULL, state->local_tgt,
                               &state->local_tgt_key, &state->client_keyblock,
-                              &state->server_keyblock, NULL, state->req_pkt,
+                              &state->server_key->keyblock, NULL,
+                              state->req_pkt,
                               state->request, NULL, NULL, NULL,
                               &state->auth_indicators, &state->enc_tkt_reply);
     if (errcode) {
@@ -281,7 +349,7 @@ finish_process_as_req(struct as_req_state *state, krb5_error_code errcode)
         goto egress;
     }
 
-    errcode = krb5_encrypt_tkt_part(kdc_context, &state->server_keyblock,
+    errcode = k5_encrypt_tkt_part_k(kdc_context, state->server_key,
                                     &state->ticket_reply);
     if (errcode)
         goto egress;
@@ -387,8 +455,7 @@ egress:
                            state->enc_tkt_reply.authorization_data);
     if (state->local_tgt_key.contents != NULL)
         krb5_free_keyblock_contents(kdc_context, &state->local_tgt_key);
-    if (state->server_keyblock.contents != NULL)
-        krb5_free_keyblock_contents(kdc_context, &state->server_keyblock);
+    krb5_k_free_key(kdc_context, state->server_key);
     if (state->client_keyblock.contents != NULL)
         krb5_free_keyblock_contents(kdc_context, &state->client_keyblock);
     if (state->reply.padata != NULL)
@@ -478,6 +545,8 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
     krb5_enctype useenctype;
     struct as_req_state *state;
     krb5_audit_state *au_state = NULL;
+    krb5_db_entry *tgt = NULL;
+    const char *status;
 
     state = k5alloc(sizeof(*state), &errcode);
     if (state == NULL) {
@@ -534,16 +603,16 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
         state->status = "FIND_FAST";
         goto errout;
     }
-    if (state->inner_body == NULL) {
-        /* Not a FAST request; copy the encoded request body. */
-        errcode = krb5_copy_data(kdc_context, &encoded_req_body,
-                                 &state->inner_body);
-        if (errcode)
-            goto errout;
-    }
     au_state->request = state->request;
     state->rock.request = state->request;
-    state->rock.inner_body = state->inner_body;
+    if (state->inner_body != NULL) {
+        state->rock.inner_body = state->inner_body;
+    } else {
+        /* Not a FAST request; use the encoded request body in place, as
+         * req_pkt outlives the request state. */
+        state->req_body = encoded_req_body;
+        state->rock.inner_body = &state->req_body;
+    }
     state->rock.rstate = state->rstate;
     state->rock.vctx = vctx;
     state->rock.auth_indicators = &state->auth_indicators;
@@ -583,40 +652,38 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
     if (include_pac_p(kdc_context, state->request)) {
         setflag(state->c_flags, KRB5_KDB_FLAG_INCLUDE_PAC);
     }
-    errcode = lookup_client(kdc_context, state->request, state->c_flags,
-                            &state->client);
+
+    s_flags = 0;
+    if (isflagset(state->request->kdc_options, KDC_OPT_CANONICALIZE)) {
+        setflag(s_flags, KRB5_KDB_FLAG_CANONICALIZE);
+    }
+
+    /* Fetch the client, server, and local TGT entries together. */
+    errcode = lookup_principals(kdc_context, state->request, tgs_server,
+                                state->c_flags, s_flags, &state->client,
+                                &state->server, &tgt, &status);
     if (errcode == KRB5_KDB_CANTLOCK_DB)
         errcode = KRB5KDC_ERR_SVC_UNAVAILABLE;
-    if (errcode == KRB5_KDB_NOENTRY) {
+    if (errcode) {
+        state->status = status;
+        goto errout;
+    }
+    if (state->client == NULL) {
         state->status = "CLIENT_NOT_FOUND";
         if (vague_errors)
             errcode = KRB5KRB_ERR_GENERIC;
         else
             errcode = KRB5KDC_ERR_C_PRINCIPAL_UNKNOWN;
         goto errout;
-    } else if (errcode) {
-        state->status = "LOOKING_UP_CLIENT";
-        goto errout;
     }
     state->rock.client = state->client;
 
     au_state->stage = SRVC_PRINC;
 
-    s_flags = 0;
-    if (isflagset(state->request->kdc_options, KDC_OPT_CANONICALIZE)) {
-        setflag(s_flags, KRB5_KDB_FLAG_CANONICALIZE);
-    }
-    errcode = krb5_db_get_principal(kdc_context, state->request->server,
-                                    s_flags, &state->server);
-    if (errcode == KRB5_KDB_CANTLOCK_DB)
-        errcode = KRB5KDC_ERR_SVC_UNAVAILABLE;
-    if (errcode == KRB5_KDB_NOENTRY) {
+    if (state->server == NULL) {
         state->status = "SERVER_NOT_FOUND";
         errcode = KRB5KDC_ERR_S_PRINCIPAL_UNKNOWN;
         goto errout;
-    } else if (errcode) {
-        state->status = "LOOKING_UP_SERVER";
-        goto errout;
     }
 
     /* If the KDB module returned a different realm for the client and server,
@@ -629,8 +696,9 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
     }
 
     errcode = get_local_tgt(kdc_context, &state->request->server->realm,
-                            state->server, &state->local_tgt,
+                            state->server, tgt, &state->local_tgt,
                             &state->local_tgt_storage, &state->local_tgt_key);
+    tgt = NULL;
     if (errcode) {
         state->status = "GET_LOCAL_TGT";
         goto errout;
@@ -781,6 +849,7 @@ process_as_req(krb5_kdc_req *request, krb5_data *req_pkt,
     return;
 
 errout:
+    krb5_db_free_principal(kdc_context, tgt);
     finish_process_as_req(state, errcode);
 }
 
@@ -94,7 +94,7 @@ db_get_svc_princ(krb5_context, krb5_principal, krb5_flags,
 
 static krb5_error_code
 search_sprinc(kdc_realm_t *, krb5_kdc_req *, krb5_flags,
-              krb5_db_entry **, const char **);
+              krb5_db_entry **, krb5_db_entry **, const char **);
 
 /*ARGSUSED*/
 krb5_error_code
@@ -116,7 +116,8 @@ process_tgs_req(krb5_kdc_req *request, krb5_data *pkt,
     krb5_enc_tkt_part enc_tkt_reply;
     int newtransited = 0;
     krb5_error_code retval = 0;
-    krb5_keyblock server_keyblock, *encrypting_key;
+    krb5_key server_key = NULL;
+    krb5_keyblock *encrypting_key;
     krb5_timestamp kdc_time, authtime = 0;
     krb5_keyblock session_key, local_tgt_key;
     krb5_keyblock *reply_key = NULL;
@@ -129,11 +130,11 @@ process_tgs_req(krb5_kdc_req *request, krb5_data *pkt,
     krb5_enc_tkt_part *header_enc_tkt = NULL; /* TGT */
     krb5_enc_tkt_part *subject_tkt = NULL; /* TGT or evidence ticket */
     krb5_db_entry *client = NULL, *header_server = NULL;
-    krb5_db_entry *local_tgt, *local_tgt_storage = NULL;
+    krb5_db_entry *local_tgt, *local_tgt_storage = NULL, *tgt = NULL;
     krb5_pa_s4u_x509_user *s4u_x509_user = NULL; /* protocol transition request */
     krb5_authdata **kdc_issued_auth_data = NULL; /* auth data issued by KDC */
     unsigned int c_flags = 0, s_flags = 0;       /* client/server KDB flags */
-    krb5_boolean is_referral, is_crossrealm;
+    krb5_boolean is_referral, is_crossrealm, want_tgt;
     const char *emsg = NULL;
     krb5_kvno ticket_kvno = 0;
     struct kdc_request_state *state = NULL;
@@ -148,7 +149,6 @@ process_tgs_req(krb5_kdc_req *request, krb5_data *pkt,
     memset(&reply_encpart, 0, sizeof(reply_encpart));
     memset(&ticket_reply, 0, sizeof(ticket_reply));
     memset(&enc_tkt_reply, 0, sizeof(enc_tkt_reply));
-    memset(&server_keyblock, 0, sizeof(server_keyblock));
     memset(&local_tgt_key, 0, sizeof(local_tgt_key));
     session_key.contents = NULL;
 
@@ -208,13 +208,6 @@ process_tgs_req(krb5_kdc_req *request, krb5_data *pkt,
         goto cleanup;
     }
 
-    errcode = get_local_tgt(kdc_context, &sprinc->realm, header_server,
-                            &local_tgt, &local_tgt_storage, &local_tgt_key);
-    if (errcode) {
-        status = "GET_LOCAL_TGT";
-        goto cleanup;
-    }
-
     /* Ignore (for now) the request modification due to FAST processing. */
     au_state->request = request;
 
@@ -242,12 +235,25 @@ process_tgs_req(krb5_kdc_req *request, krb5_data *pkt,
         setflag(s_flags, KRB5_KDB_FLAG_CANONICALIZE);
     }
 
+    /* Unless the header ticket is for the local TGS, fetch the local TGT
+     * along with the requested server. */
+    want_tgt = data_eq(request->server->realm, tgs_server->realm) &&
+        !krb5_principal_compare(kdc_context, header_server->princ, tgs_server);
     errcode = search_sprinc(kdc_active_realm, request, s_flags, &server,
-                            &status);
+                            want_tgt ? &tgt : NULL, &status);
     if (errcode != 0)
         goto cleanup;
     sprinc = server->princ;
 
+    errcode = get_local_tgt(kdc_context, &request->server->realm,
+                            header_server, tgt, &local_tgt,
+                            &local_tgt_storage, &local_tgt_key);
+    tgt = NULL;
+    if (errcode) {
+        status = "GET_LOCAL_TGT";
+        goto cleanup;
+    }
+
     /* If we got a cross-realm TGS which is not the requested server, we are
      * issuing a referral (or alternate TGT, which we treat similarly). */
     is_referral = is_cross_tgs_principal(server->princ) &&
@@ -512,12 +518,13 @@ process_tgs_req(krb5_kdc_req *request, krb5_data *pkt,
     if (isflagset(request->kdc_options, KDC_OPT_ENC_TKT_IN_SKEY)) {
         encrypting_key = stkt->enc_part2->session;
     } else {
-        errcode = get_first_current_key(kdc_context, server, &server_keyblock);
+        errcode = get_first_current_key_k(kdc_active_realm, server,
+                                          &server_key);
         if (errcode) {
             status = "FINDING_SERVER_KEY";
             goto cleanup;
         }
-        encrypting_key = &server_keyblock;
+        encrypting_key = &server_key->keyblock;
     }
 
     if (isflagset(c_flags, KRB5_KDB_FLAG_CONSTRAINED_DELEGATION)) {
@@ -634,8 +641,13 @@ process_tgs_req(krb5_kdc_req *request, krb5_data *pkt,
         ticket_kvno = current_kvno(server);
     }
 
-    errcode = krb5_encrypt_tkt_part(kdc_context, encrypting_key,
-                                    &ticket_reply);
+    if (server_key != NULL) {
+        errcode = k5_encrypt_tkt_part_k(kdc_context, server_key,
+                                        &ticket_reply);
+    } else {
+        errcode = krb5_encrypt_tkt_part(kdc_context, encrypting_key,
+                                        &ticket_reply);
+    }
     if (errcode)
         goto cleanup;
     ticket_reply.enc_part.kvno = ticket_kvno;
@@ -725,7 +737,7 @@ process_tgs_req(krb5_kdc_req *request, krb5_data *pkt,
 cleanup:
     if (status == NULL)
         status = "UNKNOWN_REASON";
-    krb5_free_keyblock_contents(kdc_context, &server_keyblock);
+    krb5_k_free_key(kdc_context, server_key);
     if (reply_key)
         krb5_free_keyblock(kdc_context, reply_key);
     if (stkt_server_key)
@@ -777,6 +789,7 @@ cleanup:
     krb5_db_free_principal(kdc_context, header_server);
     krb5_db_free_principal(kdc_context, client);
     krb5_db_free_principal(kdc_context, local_tgt_storage);
+    krb5_db_free_principal(kdc_context, tgt);
     if (local_tgt_key.contents != NULL)
         krb5_free_keyblock_contents(kdc_context, &local_tgt_key);
     if (session_key.contents != NULL)
@@ -891,7 +904,7 @@ decrypt_2ndtkt(kdc_realm_t *kdc_active_realm, krb5_kdc_req *req,
 {
     krb5_error_code retval;
     krb5_db_entry *server = NULL;
-    krb5_keyblock *key = NULL;
+    krb5_key key = NULL;
     krb5_kvno kvno;
     krb5_ticket *stkt;
 
@@ -904,26 +917,27 @@ decrypt_2ndtkt(kdc_realm_t *kdc_active_realm, krb5_kdc_req *req,
         return 0;
 
     stkt = req->second_ticket[0];
-    retval = kdc_get_server_key(kdc_context, stkt, flags, TRUE,
+    retval = kdc_get_server_key(kdc_active_realm, stkt, flags, TRUE,
                                 &server, &key, &kvno);
     if (retval != 0) {
         *status = "2ND_TKT_SERVER";
         goto cleanup;
     }
-    retval = krb5_decrypt_tkt_part(kdc_context, key, stkt);
+    retval = k5_decrypt_tkt_part_k(kdc_context, key, stkt);
     if (retval != 0) {
         *status = "2ND_TKT_DECRYPT";
         goto cleanup;
     }
+    retval = krb5_k_key_keyblock(kdc_context, key, key_out);
+    if (retval != 0)
+        goto cleanup;
     *stkt_out = stkt;
     *server_out = server;
-    *key_out = key;
     server = NULL;
-    key = NULL;
 
 cleanup:
     krb5_db_free_principal(kdc_context, server);
-    krb5_free_keyblock(kdc_context, key);
+    krb5_k_free_key(kdc_context, key);
     return retval;
 }
 
@@ -1165,9 +1179,48 @@ db_get_svc_princ(krb5_context ctx, krb5_principal princ,
     return ret;
 }
 
+/* Look up princ as db_get_svc_princ() does, and the local TGT in the same
+ * database request. */
+static krb5_error_code
+db_get_svc_princ_and_tgt(kdc_realm_t *kdc_active_realm, krb5_principal princ,
+                         krb5_flags flags, krb5_db_entry **server,
+                         krb5_db_entry **tgt_out, const char **status)
+{
+    krb5_error_code ret;
+    krb5_const_principal names[2];
+    unsigned int fl[2];
+    krb5_db_entry *entries[2];
+
+    names[0] = princ;
+    fl[0] = flags;
+    names[1] = tgs_server;
+    fl[1] = 0;
+    ret = krb5_db_get_principals(kdc_context, 2, names, fl, entries);
+    if (ret != 0) {
+        /* The batch result does not say which principal failed.  Look up
+         * the server alone, leaving the local TGT to get_local_tgt() so that
+         * a failure is reported against the right lookup. */
+        *tgt_out = NULL;
+        return db_get_svc_princ(kdc_context, princ, flags, server, status);
+    }
+    *server = entries[0];
+    *tgt_out = entries[1];
+    if (*server == NULL) {
+        *status = "LOOKING_UP_SERVER";
+        return KRB5_KDB_NOENTRY;
+    }
+    return 0;
+}
+
+/*
+ * Find the server entry for req, following referrals where allowed.  If
+ * tgt_out is not NULL, fetch the local TGT entry (or NULL if it does not
+ * exist) into it together with the first server lookup.
+ */
 static krb5_error_code
 search_sprinc(kdc_realm_t *kdc_active_realm, krb5_kdc_req *req,
-              krb5_flags flags, krb5_db_entry **server, const char **status)
+              krb5_flags flags, krb5_db_entry **server,
+              krb5_db_entry **tgt_out, const char **status)
 {
     krb5_error_code ret;
     krb5_principal princ = req->server;
@@ -1180,7 +1233,12 @@ search_sprinc(kdc_realm_t *kdc_active_realm, krb5_kdc_req *req,
     if (!allow_referral)
         flags &= ~KRB5_KDB_FLAG_CANONICALIZE;
 
-    ret = db_get_svc_princ(kdc_context, princ, flags, server, status);
+    if (tgt_out != NULL) {
+        ret = db_get_svc_princ_and_tgt(kdc_active_realm, princ, flags, server,
+                                       tgt_out, status);
+    } else {
+        ret = db_get_svc_princ(kdc_context, princ, flags, server, status);
+    }
     if (ret == 0 || ret != KRB5_KDB_NOENTRY || !allow_referral)
         goto cleanup;
 
@@ -256,8 +256,11 @@ kau_as_req(krb5_context context, const krb5_boolean ev_success,
 
     for (hp = handles; *hp != NULL; hp++) {
         hdl = *hp;
-        if (hdl->vt.as_req != NULL)
+        if (hdl->vt.as_req != NULL) {
+            kdc_module_lock();
             hdl->vt.as_req(hdl->auctx, ev_success, state);
+            kdc_module_unlock();
+        }
     }
 }
 
@@ -273,8 +276,11 @@ kau_tgs_req(krb5_context context, const krb5_boolean ev_success,
 
     for (hp = handles; *hp != NULL; hp++) {
         hdl = *hp;
-        if (hdl->vt.tgs_req != NULL)
+        if (hdl->vt.tgs_req != NULL) {
+            kdc_module_lock();
             hdl->vt.tgs_req(hdl->auctx, ev_success, state);
+            kdc_module_unlock();
+        }
     }
 }
 
@@ -290,8 +296,11 @@ kau_s4u2self(krb5_context context, const krb5_boolean ev_success,
 
     for (hp = handles; *hp != NULL; hp++) {
         hdl = *hp;
-        if (hdl->vt.tgs_s4u2self != NULL)
+        if (hdl->vt.tgs_s4u2self != NULL) {
+            kdc_module_lock();
             hdl->vt.tgs_s4u2self(hdl->auctx, ev_success, state);
+            kdc_module_unlock();
+        }
     }
 }
 
@@ -307,8 +316,11 @@ kau_s4u2proxy(krb5_context context,const krb5_boolean ev_success,
 
     for (hp = handles; *hp != NULL; hp++) {
         hdl = *hp;
-        if (hdl->vt.tgs_s4u2proxy != NULL)
+        if (hdl->vt.tgs_s4u2proxy != NULL) {
+            kdc_module_lock();
             hdl->vt.tgs_s4u2proxy(hdl->auctx, ev_success, state);
+            kdc_module_unlock();
+        }
     }
 }
 
@@ -324,7 +336,10 @@ kau_u2u(krb5_context context, const krb5_boolean ev_success,
 
     for (hp = handles; *hp != NULL; hp++) {
         hdl = *hp;
-        if (hdl->vt.tgs_u2u != NULL)
+        if (hdl->vt.tgs_u2u != NULL) {
+            kdc_module_lock();
             hdl->vt.tgs_u2u(hdl->auctx, ev_success, state);
+            kdc_module_unlock();
+        }
     }
 }
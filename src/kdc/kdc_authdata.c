@@ -822,10 +822,12 @@ handle_authdata(krb5_context context, unsigned int flags,
     if (!isflagset(enc_tkt_reply->flags, TKT_FLG_ANONYMOUS)) {
         for (i = 0; i < n_authdata_modules; i++) {
             h = &authdata_modules[i];
+            kdc_module_lock();
             ret = h->vt.handle(context, h->data, flags, client, server,
                                subject_server, client_key, server_key,
                                subject_key, req_pkt, req, altcprinc,
                                enc_tkt_req, enc_tkt_reply);
+            kdc_module_unlock();
             if (ret)
                 kdc_err(context, ret, "from authdata module %s", h->vt.name);
         }
@@ -102,6 +102,7 @@ typedef struct preauth_system_st {
     krb5_kdcpreauth_return_fn return_padata;
     krb5_kdcpreauth_free_modreq_fn free_modreq;
     krb5_kdcpreauth_loop_fn loop;
+    krb5_boolean thread_safe;   /* Can be called without the module lock */
 } preauth_system;
 
 static preauth_system *preauth_systems;
@@ -112,6 +113,21 @@ make_etype_info(krb5_context context, krb5_boolean etype_info2,
                 krb5_principal client, krb5_key_data *client_key,
                 krb5_enctype enctype, krb5_data **der_out);
 
+/* Take the module lock if calls into sys must be serialized. */
+static void
+lock_pa_system(preauth_system *sys)
+{
+    if (!sys->thread_safe)
+        kdc_module_lock();
+}
+
+static void
+unlock_pa_system(preauth_system *sys)
+{
+    if (!sys->thread_safe)
+        kdc_module_unlock();
+}
+
 /* Get all available kdcpreauth vtables and a count of preauth types they
  * support.  Return an empty list on failure. */
 static void
@@ -247,6 +263,10 @@ load_preauth_plugins(struct server_handle *handle, krb5_context context,
             sys->return_padata = vt->return_padata;
             sys->free_modreq = vt->free_modreq;
             sys->loop = vt->loop;
+            /* The built-in mechanisms keep no state outside of the request
+             * and its context. */
+            sys->thread_safe = (strcmp(vt->name, "encrypted_challenge") == 0 ||
+                                strcmp(vt->name, "encrypted_timestamp") == 0);
             n_systems++;
         }
     }
@@ -335,7 +355,9 @@ free_padata_context(krb5_context kcontext, void *padata_context)
         sys = context->contexts[i].pa_system;
         if (!sys->free_modreq || !context->contexts[i].modreq)
             continue;
+        lock_pa_system(sys);
         sys->free_modreq(kcontext, sys->moddata, context->contexts[i].modreq);
+        unlock_pa_system(sys);
         context->contexts[i].modreq = NULL;
     }
 
@@ -942,8 +964,10 @@ hint_list_next(struct hint_state *state)
 
     state->pa_type = ap->type;
     if (ap->get_edata) {
+        lock_pa_system(ap);
         ap->get_edata(kdc_context, state->request, &callbacks, state->rock,
                       ap->moddata, ap->type, finish_get_edata, state);
+        unlock_pa_system(ap);
     } else
         finish_get_edata(state, 0, NULL);
     return;
@@ -1271,6 +1295,8 @@ finish_verify_padata(void *arg, krb5_error_code code,
 static void
 next_padata(struct padata_state *state)
 {
+    preauth_system *pa_sys;
+
     assert(state);
     if (!state->padata)
         state->padata = state->request->padata;
@@ -1296,11 +1322,13 @@ next_padata(struct padata_state *state)
         goto next;
 
     state->pa_found++;
-    state->pa_sys->verify_padata(state->context, state->req_pkt,
-                                 state->request, state->enc_tkt_reply,
-                                 *state->padata, &callbacks, state->rock,
-                                 state->pa_sys->moddata, finish_verify_padata,
-                                 state);
+    pa_sys = state->pa_sys;
+    lock_pa_system(pa_sys);
+    pa_sys->verify_padata(state->context, state->req_pkt, state->request,
+                          state->enc_tkt_reply, *state->padata, &callbacks,
+                          state->rock, pa_sys->moddata, finish_verify_padata,
+                          state);
+    unlock_pa_system(pa_sys);
     return;
 
 next:
@@ -1436,9 +1464,11 @@ return_padata(krb5_context context, krb5_kdcpreauth_rock rock,
             }
         }
         send_pa = NULL;
+        lock_pa_system(ap);
         retval = ap->return_padata(context, pa, req_pkt, request, reply,
                                    encrypting_key, &send_pa, &callbacks, rock,
                                    ap->moddata, *modreq_ptr);
+        unlock_pa_system(ap);
         if (retval)
             goto cleanup;
 
@@ -0,0 +1,512 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/kdc_threads.c - Worker thread pool for KDC request processing */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * In threaded mode, the main thread continues to run the network loop in
+ * net-server.c, but dispatch() hands each request to a queue serviced by a
+ * pool of worker threads.  When a worker finishes a request, it places the
+ * job on a completion queue and wakes up the main loop through a pipe; the
+ * main thread then invokes the net-server respond callback, so net-server.c
+ * never sees a call from any thread but its own.
+ *
+ * Each worker has its own server handle, whose realms have their own
+ * contexts, KDB handles, and key caches; everything else in the realm data is
+ * shared and read-only.  Requests are therefore processed in parallel.  The
+ * lookaside cache and any KDB principal cache are shared, and lock
+ * themselves.
+ *
+ * The preauth (other than the built-in encrypted timestamp and encrypted
+ * challenge mechanisms), authdata, kdcpolicy, and audit modules were loaded
+ * once and might not be thread-safe, so calls into them are made while
+ * holding the recursive module lock.  Preauth modules share a single event
+ * context, which is only run by a worker holding the module lock, while it
+ * waits for an asynchronous AS request (such as one using the OTP module) to
+ * complete.  Because that worker may block for some time waiting for events,
+ * a thread which wants the module lock wakes up the event context through a
+ * second pipe, and a waiting worker does not retake the lock while another
+ * thread wants it.  A request's asynchronous completion may be run by
+ * whichever worker holds the module lock at the time.
+ */
+
+#include "k5-int.h"
+#include "k5-queue.h"
+#include "kdc_util.h"
+#include "extern.h"
+#include "adm_proto.h"
+#include "realm_data.h"
+#include <syslog.h>
+#include <signal.h>
+
+#ifdef ENABLE_THREADS
+
+#include <pthread.h>
+
+struct worker;
+
+struct job {
+    K5_TAILQ_ENTRY(job) links;
+    struct worker *worker;
+    const krb5_fulladdr *local_addr;
+    const krb5_fulladdr *remote_addr;
+    krb5_data *request;
+    int is_tcp;
+    loop_respond_fn respond;
+    void *arg;
+    krb5_error_code code;
+    krb5_data *response;
+};
+
+K5_TAILQ_HEAD(job_queue, job);
+
+struct worker {
+    pthread_t thread;
+    struct server_handle *handle;
+    unsigned int refresh_gen;
+    krb5_boolean busy;          /* Protected by module_mutex */
+};
+
+/* queue_lock protects everything from here to wakeup_fds. */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct job_queue pending_jobs = K5_TAILQ_HEAD_INITIALIZER(pending_jobs);
+static struct job_queue done_jobs = K5_TAILQ_HEAD_INITIALIZER(done_jobs);
+static krb5_boolean shutting_down;
+static unsigned int refresh_gen;
+
+/* The read and write ends of the completion pipe, and its main loop event. */
+static int wakeup_fds[2] = { -1, -1 };
+static verto_ev *wakeup_ev;
+
+/* module_mutex protects the module lock state and the worker busy flags. */
+static pthread_mutex_t module_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t module_cond = PTHREAD_COND_INITIALIZER;
+static krb5_boolean module_locked;
+static pthread_t module_owner;
+static int module_depth;
+static int module_waiters;
+static krb5_boolean module_polling;
+
+/* The preauth module event context, and the pipe used to interrupt it. */
+static verto_ctx *module_ctx;
+static int module_fds[2] = { -1, -1 };
+static verto_ev *module_ev;
+
+static struct worker *workers;
+static int num_workers;
+
+/* Respond callback for a worker-processed request.  Runs in a worker thread,
+ * though not necessarily the one which began processing the request. */
+static void
+finish_job(void *arg, krb5_error_code code, krb5_data *response)
+{
+    struct job *job = arg;
+    struct worker *w = job->worker;
+    krb5_boolean was_empty;
+    ssize_t st;
+
+    job->code = code;
+    job->response = response;
+
+    pthread_mutex_lock(&queue_lock);
+    was_empty = K5_TAILQ_EMPTY(&done_jobs);
+    K5_TAILQ_INSERT_TAIL(&done_jobs, job, links);
+    pthread_mutex_unlock(&queue_lock);
+
+    /* The main thread drains the pipe before emptying the completion queue,
+     * so it only needs a wakeup when the queue transitions from empty. */
+    if (was_empty) {
+        st = write(wakeup_fds[1], "", 1);
+        (void)st;
+    }
+
+    /* job may be freed by the main thread at any point from here on. */
+    pthread_mutex_lock(&module_mutex);
+    w->busy = FALSE;
+    pthread_cond_broadcast(&module_cond);
+    pthread_mutex_unlock(&module_mutex);
+}
+
+/* Discard the bytes written to interrupt the module loop. */
+static void
+drain_module_fd(verto_ctx *ctx, verto_ev *ev)
+{
+    char buf[64];
+
+    while (read(module_fds[0], buf, sizeof(buf)) > 0);
+}
+
+/* Run the module loop until w's current request completes, giving up the
+ * module lock whenever another thread wants it. */
+static void
+wait_for_request(struct worker *w)
+{
+    pthread_mutex_lock(&module_mutex);
+    while (w->busy) {
+        if (module_locked || module_waiters > 0) {
+            pthread_cond_wait(&module_cond, &module_mutex);
+            continue;
+        }
+        module_locked = TRUE;
+        module_owner = pthread_self();
+        module_depth = 1;
+        module_polling = TRUE;
+        pthread_mutex_unlock(&module_mutex);
+
+        verto_run_once(module_ctx);
+
+        pthread_mutex_lock(&module_mutex);
+        module_polling = FALSE;
+        module_locked = FALSE;
+        module_depth = 0;
+        pthread_cond_broadcast(&module_cond);
+    }
+    pthread_mutex_unlock(&module_mutex);
+}
+
+static void *
+worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct job *job;
+    unsigned int gen;
+
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (!shutting_down && K5_TAILQ_EMPTY(&pending_jobs))
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        if (shutting_down) {
+            pthread_mutex_unlock(&queue_lock);
+            break;
+        }
+        job = K5_TAILQ_FIRST(&pending_jobs);
+        K5_TAILQ_REMOVE(&pending_jobs, job, links);
+        gen = refresh_gen;
+        pthread_mutex_unlock(&queue_lock);
+
+        /* Pick up configuration changes signalled since the last request. */
+        if (gen != w->refresh_gen) {
+            reset_for_hangup(w->handle);
+            w->refresh_gen = gen;
+        }
+
+        job->worker = w;
+        pthread_mutex_lock(&module_mutex);
+        w->busy = TRUE;
+        pthread_mutex_unlock(&module_mutex);
+        kdc_dispatch_request(w->handle, job->local_addr, job->remote_addr,
+                             job->request, job->is_tcp, module_ctx,
+                             finish_job, job);
+        wait_for_request(w);
+    }
+
+    return NULL;
+}
+
+/* Hand completed jobs back to net-server.  Runs in the main thread. */
+static void
+process_completions(verto_ctx *ctx, verto_ev *ev)
+{
+    struct job_queue jobs;
+    struct job *job, *next;
+    char buf[64];
+
+    while (read(wakeup_fds[0], buf, sizeof(buf)) > 0);
+
+    K5_TAILQ_INIT(&jobs);
+    pthread_mutex_lock(&queue_lock);
+    K5_TAILQ_CONCAT(&jobs, &done_jobs, links);
+    pthread_mutex_unlock(&queue_lock);
+
+    K5_TAILQ_FOREACH_SAFE(job, &jobs, links, next) {
+        (*job->respond)(job->arg, job->code, job->response);
+        free(job);
+    }
+}
+
+krb5_boolean
+kdc_threads_active(void)
+{
+    return num_workers > 0;
+}
+
+void
+kdc_threads_dispatch(const krb5_fulladdr *local_addr,
+                     const krb5_fulladdr *remote_addr, krb5_data *request,
+                     int is_tcp, loop_respond_fn respond, void *arg)
+{
+    krb5_error_code ret;
+    struct job *job;
+
+    job = k5alloc(sizeof(*job), &ret);
+    if (job == NULL) {
+        (*respond)(arg, ret, NULL);
+        return;
+    }
+    job->local_addr = local_addr;
+    job->remote_addr = remote_addr;
+    job->request = request;
+    job->is_tcp = is_tcp;
+    job->respond = respond;
+    job->arg = arg;
+
+    pthread_mutex_lock(&queue_lock);
+    K5_TAILQ_INSERT_TAIL(&pending_jobs, job, links);
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+void
+kdc_threads_refresh(void)
+{
+    pthread_mutex_lock(&queue_lock);
+    refresh_gen++;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+void
+kdc_module_lock(void)
+{
+    ssize_t st;
+
+    /* Module calls need no lock until the workers are started. */
+    if (module_ctx == NULL)
+        return;
+
+    pthread_mutex_lock(&module_mutex);
+    if (module_locked && pthread_equal(module_owner, pthread_self())) {
+        module_depth++;
+    } else {
+        module_waiters++;
+        while (module_locked) {
+            /* Interrupt a worker waiting for module events. */
+            if (module_polling) {
+                st = write(module_fds[1], "", 1);
+                (void)st;
+            }
+            pthread_cond_wait(&module_cond, &module_mutex);
+        }
+        module_waiters--;
+        module_locked = TRUE;
+        module_owner = pthread_self();
+        module_depth = 1;
+    }
+    pthread_mutex_unlock(&module_mutex);
+}
+
+void
+kdc_module_unlock(void)
+{
+    if (module_ctx == NULL)
+        return;
+
+    pthread_mutex_lock(&module_mutex);
+    if (--module_depth == 0) {
+        module_locked = FALSE;
+        pthread_cond_broadcast(&module_cond);
+    }
+    pthread_mutex_unlock(&module_mutex);
+}
+
+/* Create a non-blocking, close-on-exec pipe in fds. */
+static krb5_error_code
+make_pipe(int fds[2])
+{
+    int i, flags;
+
+    if (pipe(fds) != 0)
+        return errno;
+    for (i = 0; i < 2; i++) {
+        set_cloexec_fd(fds[i]);
+        flags = fcntl(fds[i], F_GETFL);
+        if (flags == -1 || fcntl(fds[i], F_SETFL, flags | O_NONBLOCK) != 0)
+            return errno;
+    }
+    return 0;
+}
+
+static void
+close_pipe(int fds[2])
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (fds[i] != -1)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+krb5_error_code
+kdc_threads_start(verto_ctx *ctx, struct server_handle **handles,
+                  verto_ctx *mctx, int num)
+{
+    krb5_error_code ret = 0;
+    sigset_t allsigs, oldsigs;
+    int i;
+
+    shutting_down = FALSE;
+
+    ret = make_pipe(wakeup_fds);
+    if (ret)
+        goto cleanup;
+    wakeup_ev = verto_add_io(ctx, VERTO_EV_FLAG_PERSIST |
+                             VERTO_EV_FLAG_IO_READ, process_completions,
+                             wakeup_fds[0]);
+    if (wakeup_ev == NULL) {
+        ret = ENOMEM;
+        goto cleanup;
+    }
+
+    ret = make_pipe(module_fds);
+    if (ret)
+        goto cleanup;
+    module_ev = verto_add_io(mctx, VERTO_EV_FLAG_PERSIST |
+                             VERTO_EV_FLAG_IO_READ, drain_module_fd,
+                             module_fds[0]);
+    if (module_ev == NULL) {
+        ret = ENOMEM;
+        goto cleanup;
+    }
+    module_ctx = mctx;
+
+    workers = calloc(num, sizeof(*workers));
+    if (workers == NULL) {
+        ret = ENOMEM;
+        goto cleanup;
+    }
+
+    /* Leave signal handling to the main thread's loop. */
+    sigfillset(&allsigs);
+    pthread_sigmask(SIG_BLOCK, &allsigs, &oldsigs);
+
+    krb5_klog_syslog(LOG_INFO, _("creating %d worker threads"), num);
+    for (i = 0; i < num; i++) {
+        workers[i].handle = handles[i];
+        ret = pthread_create(&workers[i].thread, NULL, worker_main,
+                             &workers[i]);
+        if (ret)
+            break;
+        num_workers++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+cleanup:
+    if (ret)
+        kdc_threads_stop();
+    return ret;
+}
+
+void
+kdc_threads_stop(void)
+{
+    struct job *job, *next;
+    int i;
+
+    pthread_mutex_lock(&queue_lock);
+    shutting_down = TRUE;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    for (i = 0; i < num_workers; i++)
+        pthread_join(workers[i].thread, NULL);
+    free(workers);
+    workers = NULL;
+    num_workers = 0;
+
+    /* Discard jobs which were never picked up or never responded to.  The
+     * network state they refer to is freed with the main loop. */
+    K5_TAILQ_FOREACH_SAFE(job, &pending_jobs, links, next)
+        free(job);
+    K5_TAILQ_INIT(&pending_jobs);
+    K5_TAILQ_FOREACH_SAFE(job, &done_jobs, links, next) {
+        krb5_free_data(NULL, job->response);
+        free(job);
+    }
+    K5_TAILQ_INIT(&done_jobs);
+
+    if (wakeup_ev != NULL)
+        verto_del(wakeup_ev);
+    wakeup_ev = NULL;
+    close_pipe(wakeup_fds);
+    if (module_ev != NULL)
+        verto_del(module_ev);
+    module_ev = NULL;
+    close_pipe(module_fds);
+    module_ctx = NULL;
+}
+
+#else /* ENABLE_THREADS */
+
+krb5_boolean
+kdc_threads_active(void)
+{
+    return FALSE;
+}
+
+/* main() rejects -t without thread support, so this is never called. */
+void
+kdc_threads_dispatch(const krb5_fulladdr *local_addr,
+                     const krb5_fulladdr *remote_addr, krb5_data *request,
+                     int is_tcp, loop_respond_fn respond, void *arg)
+{
+    (*respond)(arg, ENOTSUP, NULL);
+}
+
+void
+kdc_threads_refresh(void)
+{
+}
+
+void
+kdc_module_lock(void)
+{
+}
+
+void
+kdc_module_unlock(void)
+{
+}
+
+krb5_error_code
+kdc_threads_start(verto_ctx *ctx, struct server_handle **handles,
+                  verto_ctx *mctx, int num)
+{
+    return ENOTSUP;
+}
+
+void
+kdc_threads_stop(void)
+{
+}
+
+#endif /* ENABLE_THREADS */
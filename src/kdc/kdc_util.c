@@ -73,9 +73,9 @@ static krb5_error_code kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
                                      krb5_auth_context auth_context,
                                      krb5_db_entry **server,
                                      krb5_keyblock **tgskey);
-static krb5_error_code find_server_key(krb5_context,
+static krb5_error_code find_server_key(kdc_realm_t *kdc_active_realm,
                                        krb5_db_entry *, krb5_enctype,
-                                       krb5_kvno, krb5_keyblock **,
+                                       krb5_kvno, krb5_key *,
                                        krb5_kvno *);
 
 /*
@@ -295,6 +295,7 @@ kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
     krb5_enctype        search_enctype = apreq->ticket->enc_part.enctype;
     krb5_boolean        match_enctype = 1;
     krb5_kvno           kvno;
+    krb5_key            key = NULL;
     size_t              tries = 3;
 
     /*
@@ -309,8 +310,8 @@ kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
         match_enctype = 0;
     }
 
-    retval = kdc_get_server_key(kdc_context, apreq->ticket, 0, match_enctype,
-                                server, NULL, NULL);
+    retval = kdc_get_server_key(kdc_active_realm, apreq->ticket, 0,
+                                match_enctype, server, NULL, NULL);
     if (retval)
         return retval;
 
@@ -318,16 +319,21 @@ kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
     kvno = apreq->ticket->enc_part.kvno;
     do {
         krb5_free_keyblock(kdc_context, *tgskey);
-        retval = find_server_key(kdc_context,
-                                 *server, search_enctype, kvno, tgskey, &kvno);
+        *tgskey = NULL;
+        krb5_k_free_key(kdc_context, key);
+        retval = find_server_key(kdc_active_realm,
+                                 *server, search_enctype, kvno, &key, &kvno);
         if (retval)
             continue;
+        retval = krb5_k_key_keyblock(kdc_context, key, tgskey);
+        if (retval)
+            break;
 
-        /* Make the TGS key available to krb5_rd_req_decoded_anyflag() */
-        retval = krb5_auth_con_setuseruserkey(kdc_context, auth_context,
-                                              *tgskey);
+        /* Make the TGS key available to krb5_rd_req_decoded_anyflag().  Pass
+         * the cached key object so that its derived keys are reused. */
+        retval = k5_auth_con_setuseruserkey_k(kdc_context, auth_context, key);
         if (retval)
-            return retval;
+            break;
 
         retval = krb5_rd_req_decoded_anyflag(kdc_context, &auth_context, apreq,
                                              apreq->ticket->server,
@@ -341,6 +347,7 @@ kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
     } while (retval && apreq->ticket->enc_part.kvno == 0 && kvno-- > 1 &&
              --tries > 0);
 
+    krb5_k_free_key(kdc_context, key);
     return retval;
 }
 
@@ -353,11 +360,12 @@ kdc_rd_ap_req(kdc_realm_t *kdc_active_realm,
  * This is also used by do_tgs_req() for u2u auth.
  */
 krb5_error_code
-kdc_get_server_key(krb5_context context,
+kdc_get_server_key(kdc_realm_t *kdc_active_realm,
                    krb5_ticket *ticket, unsigned int flags,
                    krb5_boolean match_enctype, krb5_db_entry **server_ptr,
-                   krb5_keyblock **key, krb5_kvno *kvno)
+                   krb5_key *key, krb5_kvno *kvno)
 {
+    krb5_context          context = kdc_context;
     krb5_error_code       retval;
     krb5_db_entry       * server = NULL;
     krb5_enctype          search_enctype = -1;
@@ -390,8 +398,8 @@ kdc_get_server_key(krb5_context context,
     }
 
     if (key) {
-        retval = find_server_key(context, server, search_enctype, search_kvno,
-                                 key, kvno);
+        retval = find_server_key(kdc_active_realm, server, search_enctype,
+                                 search_kvno, key, kvno);
         if (retval)
             goto errout;
     }
@@ -410,45 +418,50 @@ errout:
  */
 static
 krb5_error_code
-find_server_key(krb5_context context,
+find_server_key(kdc_realm_t *kdc_active_realm,
                 krb5_db_entry *server, krb5_enctype enctype, krb5_kvno kvno,
-                krb5_keyblock **key_out, krb5_kvno *kvno_out)
+                krb5_key *key_out, krb5_kvno *kvno_out)
 {
     krb5_error_code       retval;
     krb5_key_data       * server_key;
-    krb5_keyblock       * key;
+    krb5_key              key = NULL, similar_key;
+    krb5_keyblock         kb;
 
     *key_out = NULL;
-    retval = krb5_dbe_find_enctype(context, server, enctype, -1,
+    retval = krb5_dbe_find_enctype(kdc_context, server, enctype, -1,
                                    kvno ? (krb5_int32)kvno : -1, &server_key);
     if (retval)
         return retval;
     if (!server_key)
         return KRB5KDC_ERR_S_PRINCIPAL_UNKNOWN;
-    if ((key = (krb5_keyblock *)malloc(sizeof *key)) == NULL)
-        return ENOMEM;
-    retval = krb5_dbe_decrypt_key_data(context, NULL, server_key,
-                                       key, NULL);
+    retval = kdc_get_cached_key(kdc_active_realm, server, server_key, &key);
     if (retval)
         goto errout;
-    if (enctype != -1) {
+    if (enctype != -1 && enctype != key->keyblock.enctype) {
         krb5_boolean similar;
-        retval = krb5_c_enctype_compare(context, enctype, key->enctype,
-                                        &similar);
+        retval = krb5_c_enctype_compare(kdc_context, enctype,
+                                        key->keyblock.enctype, &similar);
         if (retval)
             goto errout;
         if (!similar) {
             retval = KRB5_KDB_NO_PERMITTED_KEY;
             goto errout;
         }
-        key->enctype = enctype;
+        /* Make an uncached key object labeled with the requested enctype. */
+        kb = key->keyblock;
+        kb.enctype = enctype;
+        retval = krb5_k_create_key(kdc_context, &kb, &similar_key);
+        if (retval)
+            goto errout;
+        krb5_k_free_key(kdc_context, key);
+        key = similar_key;
     }
     *key_out = key;
     key = NULL;
     if (kvno_out)
         *kvno_out = server_key->key_data_kvno;
 errout:
-    krb5_free_keyblock(context, key);
+    krb5_k_free_key(kdc_context, key);
     return retval;
 }
 
@@ -468,20 +481,41 @@ get_first_current_key(krb5_context context, krb5_db_entry *entry,
     return krb5_dbe_decrypt_key_data(context, NULL, kd, key_out, NULL);
 }
 
+/* Like get_first_current_key(), but set *key_out to a key object from the
+ * realm's key cache. */
+krb5_error_code
+get_first_current_key_k(kdc_realm_t *kdc_active_realm, krb5_db_entry *entry,
+                        krb5_key *key_out)
+{
+    krb5_error_code ret;
+    krb5_key_data *kd;
+
+    *key_out = NULL;
+    ret = krb5_dbe_find_enctype(kdc_context, entry, -1, -1, 0, &kd);
+    if (ret)
+        return ret;
+    return kdc_get_cached_key(kdc_active_realm, entry, kd, key_out);
+}
+
 /*
  * If candidate is the local TGT for realm, set *alias_out to candidate and
  * *storage_out to NULL.  Otherwise, load the local TGT into *storage_out and
  * set *alias_out to *storage_out.  In either case, set *key_out to the
  * decrypted first key of the local TGT.
  *
+ * If prefetched is not NULL, it is the local TGT entry as already looked up by
+ * the caller, and is used instead of loading the entry again.  This function
+ * takes ownership of prefetched.
+ *
  * In the future we might generalize this to a small per-request principal
  * cache.  For now, it saves a load operation in the common case where the AS
  * server or TGS header ticket server is the local TGT.
  */
 krb5_error_code
 get_local_tgt(krb5_context context, const krb5_data *realm,
-              krb5_db_entry *candidate, krb5_db_entry **alias_out,
-              krb5_db_entry **storage_out, krb5_keyblock *key_out)
+              krb5_db_entry *candidate, krb5_db_entry *prefetched,
+              krb5_db_entry **alias_out, krb5_db_entry **storage_out,
+              krb5_keyblock *key_out)
 {
     krb5_error_code ret;
     krb5_principal princ;
@@ -497,13 +531,18 @@ get_local_tgt(krb5_context context, const krb5_data *realm,
     if (ret)
         goto cleanup;
 
-    if (!krb5_principal_compare(context, candidate->princ, princ)) {
+    if (krb5_principal_compare(context, candidate->princ, princ)) {
+        tgt = candidate;
+    } else if (prefetched != NULL &&
+               krb5_principal_compare(context, prefetched->princ, princ)) {
+        storage = prefetched;
+        prefetched = NULL;
+        tgt = storage;
+    } else {
         ret = krb5_db_get_principal(context, princ, 0, &storage);
         if (ret)
             goto cleanup;
         tgt = storage;
-    } else {
-        tgt = candidate;
     }
 
     ret = get_first_current_key(context, tgt, key_out);
@@ -516,6 +555,7 @@ get_local_tgt(krb5_context context, const krb5_data *realm,
 
 cleanup:
     krb5_db_free_principal(context, storage);
+    krb5_db_free_principal(context, prefetched);
     krb5_free_principal(context, princ);
     return ret;
 }
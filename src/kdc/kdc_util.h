@@ -65,18 +65,23 @@ kdc_process_tgs_req (kdc_realm_t *, krb5_kdc_req *,
                      krb5_pa_data **pa_tgs_req);
 
 krb5_error_code
-kdc_get_server_key (krb5_context, krb5_ticket *, unsigned int,
+kdc_get_server_key (kdc_realm_t *, krb5_ticket *, unsigned int,
                     krb5_boolean match_enctype,
-                    krb5_db_entry **, krb5_keyblock **, krb5_kvno *);
+                    krb5_db_entry **, krb5_key *, krb5_kvno *);
 
 krb5_error_code
 get_first_current_key(krb5_context context, krb5_db_entry *entry,
                       krb5_keyblock *key_out);
 
+krb5_error_code
+get_first_current_key_k(kdc_realm_t *kdc_active_realm, krb5_db_entry *entry,
+                        krb5_key *key_out);
+
 krb5_error_code
 get_local_tgt(krb5_context context, const krb5_data *realm,
-              krb5_db_entry *candidate, krb5_db_entry **alias_out,
-              krb5_db_entry **storage_out, krb5_keyblock *kb_out);
+              krb5_db_entry *candidate, krb5_db_entry *prefetched,
+              krb5_db_entry **alias_out, krb5_db_entry **storage_out,
+              krb5_keyblock *kb_out);
 
 int
 validate_as_request (kdc_realm_t *, krb5_kdc_req *, krb5_db_entry *,
@@ -160,6 +165,47 @@ dispatch (void *,
           loop_respond_fn,
           void *);
 
+void
+kdc_dispatch_request(void *, const krb5_fulladdr *, const krb5_fulladdr *,
+                     krb5_data *, int, verto_ctx *, loop_respond_fn, void *);
+
+/* kdc_threads.c */
+krb5_error_code
+kdc_threads_start(verto_ctx *ctx, struct server_handle **handles,
+                  verto_ctx *module_ctx, int num);
+
+void
+kdc_threads_stop(void);
+
+krb5_boolean
+kdc_threads_active(void);
+
+void
+kdc_threads_dispatch(const krb5_fulladdr *local_addr,
+                     const krb5_fulladdr *remote_addr, krb5_data *request,
+                     int is_tcp, loop_respond_fn respond, void *arg);
+
+/* Make each worker thread reset its realms before its next request. */
+void
+kdc_threads_refresh(void);
+
+/* Serialize calls into modules which might not be thread-safe.  The lock is
+ * recursive, and does nothing unless worker threads are running. */
+void
+kdc_module_lock(void);
+
+void
+kdc_module_unlock(void);
+
+/* keycache.c */
+krb5_error_code
+kdc_get_cached_key(kdc_realm_t *kdc_active_realm, krb5_db_entry *entry,
+                   krb5_key_data *kd, krb5_key *key_out);
+
+void
+kdc_free_key_cache(kdc_realm_t *kdc_active_realm);
+
+/* main.c */
 void
 kdc_err(krb5_context call_context, errcode_t code, const char *fmt, ...)
 #if !defined(__cplusplus) && (__GNUC__ > 2)
@@ -244,10 +290,19 @@ handle_authdata (krb5_context context,
                  krb5_enc_tkt_part *enc_tkt_reply);
 
 /* replay.c */
-krb5_error_code kdc_init_lookaside(krb5_context context);
+struct lookaside_stats {
+    unsigned long calls;        /* Lookups performed */
+    unsigned long hits;         /* Lookups which found an entry */
+    unsigned long misses;       /* Lookups which found no entry */
+    unsigned long evictions;    /* Entries discarded as stale or for space */
+    int max_hits_per_entry;
+};
+
+krb5_error_code kdc_init_lookaside(krb5_context context, krb5_boolean shared);
 krb5_boolean kdc_check_lookaside (krb5_context, krb5_data *, krb5_data **);
 void kdc_insert_lookaside (krb5_context, krb5_data *, krb5_data *);
 void kdc_remove_lookaside (krb5_context kcontext, krb5_data *);
+void kdc_get_lookaside_stats(struct lookaside_stats *stats);
 void kdc_free_lookaside(krb5_context);
 
 /* kdc_util.c */
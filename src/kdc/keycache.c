@@ -0,0 +1,240 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kdc/keycache.c - Cache of decrypted long-term keys */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A krb5_key caches the derived keys and cipher state computed from it, but
+ * only for as long as the krb5_key lives.  To keep the krbtgt and service keys
+ * from being decrypted with the master key and re-expanded on every request,
+ * each realm keeps the krb5_key objects it creates from KDB key data, keyed by
+ * principal name, kvno, and enctype.  A cached key is only used if the
+ * encrypted key data it was made from matches the key data in the current DB
+ * entry, so a changed key is never served from the cache.
+ *
+ * The cache has no lock.  In threaded mode each worker thread has its own
+ * copy of the realm structure, and so its own cache; krb5_key objects cannot
+ * be shared between threads, as their reference counts and derived keys are
+ * updated without locking.
+ */
+
+#include "k5-int.h"
+#include "k5-queue.h"
+#include "k5-hashtab.h"
+#include "kdc_util.h"
+#include "realm_data.h"
+
+#define MAX_CACHED_KEYS 1024
+
+struct cached_key {
+    K5_TAILQ_ENTRY(cached_key) links;
+    uint8_t *hkey;
+    size_t hkeylen;
+    krb5_data enc;
+    krb5_key key;
+};
+
+K5_TAILQ_HEAD(cached_key_queue, cached_key);
+
+struct key_cache {
+    struct k5_hashtab *table;
+    struct cached_key_queue lru;        /* Least recently used first */
+    size_t count;
+};
+
+/* Make a hash key from entry's principal name and the kvno and enctype of
+ * kd. */
+static krb5_error_code
+make_hkey(krb5_context context, krb5_db_entry *entry, krb5_key_data *kd,
+          uint8_t **hkey_out, size_t *len_out)
+{
+    krb5_error_code ret;
+    char *name;
+    size_t nlen;
+    uint8_t *hkey;
+
+    *hkey_out = NULL;
+    *len_out = 0;
+    ret = krb5_unparse_name(context, entry->princ, &name);
+    if (ret)
+        return ret;
+    nlen = strlen(name);
+    hkey = k5alloc(nlen + 6, &ret);
+    if (hkey != NULL) {
+        memcpy(hkey, name, nlen);
+        store_16_be(kd->key_data_kvno, hkey + nlen);
+        store_32_be(kd->key_data_type[0], hkey + nlen + 2);
+        *hkey_out = hkey;
+        *len_out = nlen + 6;
+    }
+    free(name);
+    return ret;
+}
+
+static void
+discard_key(krb5_context context, struct key_cache *kc, struct cached_key *ck)
+{
+    k5_hashtab_remove(kc->table, ck->hkey, ck->hkeylen);
+    K5_TAILQ_REMOVE(&kc->lru, ck, links);
+    kc->count--;
+    krb5_k_free_key(context, ck->key);
+    free(ck->enc.data);
+    free(ck->hkey);
+    free(ck);
+}
+
+static krb5_error_code
+create_cache(struct key_cache **kc_out)
+{
+    krb5_error_code ret;
+    struct key_cache *kc;
+
+    *kc_out = NULL;
+    kc = k5alloc(sizeof(*kc), &ret);
+    if (kc == NULL)
+        return ret;
+    ret = k5_hashtab_create(NULL, 64, &kc->table);
+    if (ret) {
+        free(kc);
+        return ret;
+    }
+    K5_TAILQ_INIT(&kc->lru);
+    *kc_out = kc;
+    return 0;
+}
+
+/* Decrypt kd and add the result to the cache under hkey, which the cache
+ * takes ownership of. */
+static krb5_error_code
+add_key(krb5_context context, struct key_cache *kc, uint8_t *hkey,
+        size_t hkeylen, krb5_key_data *kd, krb5_key *key_out)
+{
+    krb5_error_code ret;
+    struct cached_key *ck;
+    krb5_keyblock kb;
+
+    *key_out = NULL;
+    ck = k5alloc(sizeof(*ck), &ret);
+    if (ck == NULL) {
+        free(hkey);
+        return ret;
+    }
+    ck->hkey = hkey;
+    ck->hkeylen = hkeylen;
+
+    ret = krb5_dbe_decrypt_key_data(context, NULL, kd, &kb, NULL);
+    if (ret)
+        goto error;
+    ret = krb5_k_create_key(context, &kb, &ck->key);
+    krb5_free_keyblock_contents(context, &kb);
+    if (ret)
+        goto error;
+    ret = alloc_data(&ck->enc, kd->key_data_length[0]);
+    if (ret)
+        goto error;
+    memcpy(ck->enc.data, kd->key_data_contents[0], kd->key_data_length[0]);
+
+    if (kc->count >= MAX_CACHED_KEYS)
+        discard_key(context, kc, K5_TAILQ_FIRST(&kc->lru));
+    ret = k5_hashtab_add(kc->table, ck->hkey, ck->hkeylen, ck);
+    if (ret)
+        goto error;
+    K5_TAILQ_INSERT_TAIL(&kc->lru, ck, links);
+    kc->count++;
+
+    krb5_k_reference_key(context, ck->key);
+    *key_out = ck->key;
+    return 0;
+
+error:
+    krb5_k_free_key(context, ck->key);
+    free(ck->enc.data);
+    free(ck->hkey);
+    free(ck);
+    return ret;
+}
+
+/*
+ * Set *key_out to a krb5_key for the long-term key kd of entry, decrypting it
+ * with the master key only if it is not already cached.  The caller must
+ * release the key with krb5_k_free_key().
+ */
+krb5_error_code
+kdc_get_cached_key(kdc_realm_t *kdc_active_realm, krb5_db_entry *entry,
+                   krb5_key_data *kd, krb5_key *key_out)
+{
+    krb5_error_code ret;
+    struct key_cache *kc;
+    struct cached_key *ck;
+    uint8_t *hkey;
+    size_t hkeylen;
+
+    *key_out = NULL;
+    if (kdc_active_realm->realm_keycache == NULL) {
+        ret = create_cache(&kdc_active_realm->realm_keycache);
+        if (ret)
+            return ret;
+    }
+    kc = kdc_active_realm->realm_keycache;
+
+    ret = make_hkey(kdc_context, entry, kd, &hkey, &hkeylen);
+    if (ret)
+        return ret;
+    ck = k5_hashtab_get(kc->table, hkey, hkeylen);
+    if (ck != NULL) {
+        if (data_eq(ck->enc, make_data(kd->key_data_contents[0],
+                                       kd->key_data_length[0]))) {
+            free(hkey);
+            K5_TAILQ_REMOVE(&kc->lru, ck, links);
+            K5_TAILQ_INSERT_TAIL(&kc->lru, ck, links);
+            krb5_k_reference_key(kdc_context, ck->key);
+            *key_out = ck->key;
+            return 0;
+        }
+        /* The key was changed without changing its kvno. */
+        discard_key(kdc_context, kc, ck);
+    }
+    return add_key(kdc_context, kc, hkey, hkeylen, kd, key_out);
+}
+
+void
+kdc_free_key_cache(kdc_realm_t *kdc_active_realm)
+{
+    struct key_cache *kc = kdc_active_realm->realm_keycache;
+    struct cached_key *ck, *next;
+
+    if (kc == NULL)
+        return;
+    K5_TAILQ_FOREACH_SAFE(ck, &kc->lru, links, next)
+        discard_key(kdc_context, kc, ck);
+    k5_hashtab_free(kc->table);
+    free(kc);
+    kdc_active_realm->realm_keycache = NULL;
+}
@@ -34,6 +34,7 @@
 #include "policy.h"
 #include "kdc5_err.h"
 #include "kdb_kt.h"
+#include "kdb_log.h"
 #include "net-server.h"
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>
@@ -60,6 +61,10 @@ static void finish_realms (void);
 
 static int nofork = 0;
 static int workers = 0;
+static int threads = 0;
+static krb5_boolean reuseport = FALSE;
+static krb5_boolean shared_lookaside = FALSE;
+static int tcp_max_connections = DEFAULT_TCP_MAX_CONNECTIONS;
 static int time_offset = 0;
 static const char *pid_file = NULL;
 static int rkey_init_done = 0;
@@ -76,26 +81,42 @@ static const char *kdc_progname;
  */
 static struct server_handle shandle;
 
+/* In threaded mode, the event context for preauth modules, and the server
+ * handles of the worker threads. */
+static verto_ctx *module_ctx;
+static struct server_handle **worker_handles;
+
 /*
- * We use krb5_klog_init to set up a com_err callback to log error
- * messages.  The callback also pulls the error message out of the
- * context we pass to krb5_klog_init; however, we use realm-specific
- * contexts for most of our krb5 library calls, so the error message
- * isn't present in the global context.  This wrapper ensures that the
- * error message state from the call context is copied into the
- * context known by krb5_klog.  call_context can be NULL if the error
- * code did not come from a krb5 library function.
+ * Log a message in the same form as the com_err callback set up by
+ * krb5_klog_init.  That callback pulls the error message out of the context
+ * we pass to krb5_klog_init; however, we use realm-specific contexts for most
+ * of our krb5 library calls, and in threaded mode those contexts belong to
+ * different threads, so look up the message in the call context instead.
+ * call_context can be NULL if the error code did not come from a krb5 library
+ * function.
  */
 void
 kdc_err(krb5_context call_context, errcode_t code, const char *fmt, ...)
 {
     va_list ap;
+    char *msg;
+    const char *emsg;
 
-    if (call_context)
-        krb5_copy_error_message(shandle.kdc_err_context, call_context);
     va_start(ap, fmt);
-    com_err_va(kdc_progname, code, fmt, ap);
+    if (vasprintf(&msg, fmt, ap) < 0)
+        msg = NULL;
     va_end(ap);
+    if (msg == NULL)
+        return;
+
+    if (code == 0) {
+        krb5_klog_syslog(LOG_INFO, "%s", msg);
+    } else {
+        emsg = krb5_get_error_message(call_context, code);
+        krb5_klog_syslog(LOG_ERR, "%s - %s", emsg, msg);
+        krb5_free_error_message(call_context, emsg);
+    }
+    free(msg);
 }
 
 /*
@@ -133,12 +154,27 @@ setup_server_realm(struct server_handle *handle, krb5_principal sprinc)
         newrealm = kdc_realmlist[0];
     }
     if (newrealm != NULL) {
-        krb5_klog_set_context(newrealm->realm_context);
-        shandle.kdc_err_context = newrealm->realm_context;
+        /* The logging context is only ours to change outside of worker
+         * threads. */
+        if (handle == &shandle)
+            krb5_klog_set_context(newrealm->realm_context);
+        handle->kdc_err_context = newrealm->realm_context;
     }
     return newrealm;
 }
 
+static void
+free_db_args(char **args)
+{
+    char **p;
+
+    if (args == NULL)
+        return;
+    for (p = args; *p != NULL; p++)
+        free(*p);
+    free(args);
+}
+
 static void
 finish_realm(kdc_realm_t *rdp)
 {
@@ -148,6 +184,7 @@ finish_realm(kdc_realm_t *rdp)
         free(rdp->realm_mpname);
     if (rdp->realm_stash)
         free(rdp->realm_stash);
+    free_db_args(rdp->realm_db_args);
     if (rdp->realm_listen)
         free(rdp->realm_listen);
     if (rdp->realm_tcp_listen)
@@ -162,7 +199,9 @@ finish_realm(kdc_realm_t *rdp)
         if (rdp->realm_mprinc)
             krb5_free_principal(rdp->realm_context, rdp->realm_mprinc);
         zapfree(rdp->realm_mkey.contents, rdp->realm_mkey.length);
+        kdc_free_key_cache(rdp);
         krb5_db_fini(rdp->realm_context);
+        ulog_fini(rdp->realm_context);
         if (rdp->realm_tgsprinc)
             krb5_free_principal(rdp->realm_context, rdp->realm_tgsprinc);
         krb5_free_context(rdp->realm_context);
@@ -170,6 +209,32 @@ finish_realm(kdc_realm_t *rdp)
     zapfree(rdp, sizeof(*rdp));
 }
 
+/* Set *args_out to a copy of the null-terminated list args, or to NULL if args
+ * is NULL. */
+static krb5_error_code
+copy_db_args(char **args, char ***args_out)
+{
+    char **copy;
+    size_t i, n;
+
+    *args_out = NULL;
+    if (args == NULL)
+        return 0;
+    for (n = 0; args[n] != NULL; n++);
+    copy = calloc(n + 1, sizeof(*copy));
+    if (copy == NULL)
+        return ENOMEM;
+    for (i = 0; i < n; i++) {
+        copy[i] = strdup(args[i]);
+        if (copy[i] == NULL) {
+            free_db_args(copy);
+            return ENOMEM;
+        }
+    }
+    *args_out = copy;
+    return 0;
+}
+
 /* Set *val_out to an allocated string containing val1 and/or val2, separated
  * by a space if both are set, or NULL if neither is set. */
 static krb5_error_code
@@ -190,6 +255,35 @@ combine(const char *val1, const char *val2, char **val_out)
     return 0;
 }
 
+/*
+ * If the KDB principal cache is enabled and incremental propagation is enabled
+ * for realm, map its update log read-only so that the cache can discard
+ * entries as they change.  The log is left alone if it does not exist yet.
+ * Failure is not fatal, as the cache falls back to its time limit.
+ */
+static void
+map_ulog(krb5_context context, char *realm)
+{
+    krb5_error_code ret;
+    kadm5_config_params params;
+
+    memset(&params, 0, sizeof(params));
+    params.realm = realm;
+    params.mask = KADM5_CONFIG_REALM;
+    ret = kadm5_get_config_params(context, 1, &params, &params);
+    if (ret)
+        return;
+    if (params.iprop_enabled) {
+        ret = ulog_map_readonly(context, params.iprop_logfile,
+                                params.iprop_ulogsize);
+        if (ret && ret != ENOENT) {
+            kdc_err(context, ret, _("while mapping update log %s"),
+                    params.iprop_logfile);
+        }
+    }
+    kadm5_free_config_params(context, &params);
+}
+
 /*
  * Initialize a realm control structure from the alternate profile or from
  * the specified defaults.
@@ -345,6 +439,11 @@ init_realm(kdc_realm_t * rdp, krb5_pointer aprof, char *realm,
         goto whoops;
     }
 
+    /* Remember the database arguments for the worker threads. */
+    kret = copy_db_args(db_args, &rdp->realm_db_args);
+    if (kret)
+        goto whoops;
+
     /* first open the database  before doing anything */
     kdb_open_flags = KRB5_KDB_OPEN_RW | KRB5_KDB_SRV_TYPE_KDC;
     if ((kret = krb5_db_open(rdp->realm_context, db_args, kdb_open_flags))) {
@@ -352,6 +451,8 @@ init_realm(kdc_realm_t * rdp, krb5_pointer aprof, char *realm,
                 _("while initializing database for realm %s"), realm);
         goto whoops;
     }
+    if (krb5_db_principal_cache_enabled(rdp->realm_context))
+        map_ulog(rdp->realm_context, realm);
 
     /* Assemble and parse the master key name */
     if ((kret = krb5_db_setup_mkey_name(rdp->realm_context, rdp->realm_mpname,
@@ -436,6 +537,144 @@ whoops:
     return(kret);
 }
 
+static void
+finish_worker_realm(kdc_realm_t *rdp)
+{
+    if (rdp == NULL)
+        return;
+    if (rdp->realm_context != NULL) {
+        if (rdp->realm_keytab)
+            krb5_kt_close(rdp->realm_context, rdp->realm_keytab);
+        kdc_free_key_cache(rdp);
+        krb5_db_fini(rdp->realm_context);
+        ulog_fini(rdp->realm_context);
+        krb5_free_context(rdp->realm_context);
+    }
+    free(rdp);
+}
+
+/*
+ * Make a copy of the realm rdp for a worker thread, with its own context,
+ * database handle, keytab, and key cache.  The other fields are shared with
+ * rdp and are not modified after initialization.  The principal cache (if
+ * enabled) is shared too.
+ */
+static krb5_error_code
+init_worker_realm(kdc_realm_t *rdp, kdc_realm_t **rdp_out)
+{
+    krb5_error_code kret;
+    kdc_realm_t *wrdp;
+
+    *rdp_out = NULL;
+    wrdp = malloc(sizeof(*wrdp));
+    if (wrdp == NULL)
+        return ENOMEM;
+    *wrdp = *rdp;
+    wrdp->realm_context = NULL;
+    wrdp->realm_keytab = NULL;
+    wrdp->realm_keycache = NULL;
+
+    kret = krb5int_init_context_kdc(&wrdp->realm_context);
+    if (kret) {
+        kdc_err(NULL, kret, _("while getting context for realm %s"),
+                rdp->realm_name);
+        goto cleanup;
+    }
+    if (time_offset != 0)
+        (void)krb5_set_time_offsets(wrdp->realm_context, time_offset, 0);
+    kret = krb5_set_default_realm(wrdp->realm_context, rdp->realm_name);
+    if (kret)
+        goto error;
+    kret = krb5_db_open(wrdp->realm_context, rdp->realm_db_args,
+                        KRB5_KDB_OPEN_RW | KRB5_KDB_SRV_TYPE_KDC);
+    if (kret)
+        goto error;
+    kret = krb5_db_share_principal_cache(wrdp->realm_context,
+                                         rdp->realm_context);
+    if (kret)
+        goto error;
+    if (krb5_db_principal_cache_enabled(wrdp->realm_context))
+        map_ulog(wrdp->realm_context, rdp->realm_name);
+    kret = krb5_db_fetch_mkey_list(wrdp->realm_context, rdp->realm_mprinc,
+                                   &rdp->realm_mkey);
+    if (kret)
+        goto error;
+    kret = krb5_ktkdb_resolve(wrdp->realm_context, NULL, &wrdp->realm_keytab);
+    if (kret)
+        goto error;
+
+    *rdp_out = wrdp;
+    return 0;
+
+error:
+    kdc_err(wrdp->realm_context, kret,
+            _("while initializing realm %s for worker thread"),
+            rdp->realm_name);
+cleanup:
+    finish_worker_realm(wrdp);
+    return kret;
+}
+
+static void
+free_worker_handles(struct server_handle **handles, int num)
+{
+    int i, j;
+
+    if (handles == NULL)
+        return;
+    for (i = 0; i < num && handles[i] != NULL; i++) {
+        for (j = 0; j < handles[i]->kdc_numrealms; j++)
+            finish_worker_realm(handles[i]->kdc_realmlist[j]);
+        free(handles[i]->kdc_realmlist);
+        free(handles[i]);
+    }
+    free(handles);
+}
+
+/* Create num server handles for worker threads, each with its own copy of the
+ * realms in shandle. */
+static krb5_error_code
+create_worker_handles(int num, struct server_handle ***handles_out)
+{
+    krb5_error_code ret;
+    struct server_handle **handles, *h;
+    int i, j;
+
+    *handles_out = NULL;
+    handles = calloc(num, sizeof(*handles));
+    if (handles == NULL)
+        return ENOMEM;
+    for (i = 0; i < num; i++) {
+        h = calloc(1, sizeof(*h));
+        if (h == NULL) {
+            ret = ENOMEM;
+            goto error;
+        }
+        handles[i] = h;
+        h->kdc_realmlist = calloc(shandle.kdc_numrealms,
+                                  sizeof(*h->kdc_realmlist));
+        if (h->kdc_realmlist == NULL) {
+            ret = ENOMEM;
+            goto error;
+        }
+        for (j = 0; j < shandle.kdc_numrealms; j++) {
+            ret = init_worker_realm(shandle.kdc_realmlist[j],
+                                    &h->kdc_realmlist[j]);
+            if (ret)
+                goto error;
+            h->kdc_numrealms++;
+        }
+        h->kdc_err_context = h->kdc_realmlist[0]->realm_context;
+    }
+
+    *handles_out = handles;
+    return 0;
+
+error:
+    free_worker_handles(handles, num);
+    return ret;
+}
+
 static krb5_sigtype
 on_monitor_signal(int signo)
 {
@@ -490,10 +729,13 @@ terminate_workers(pid_t *pids, int bound)
 /*
  * Create num worker processes and return successfully in each child.  The
  * parent process will act as a supervisor and will only return from this
- * function in error cases.
+ * function in error cases.  If reuseport is set, each worker after the first
+ * creates its own listener sockets (sharing the ports via SO_REUSEPORT), so
+ * that the kernel distributes requests among the workers rather than waking
+ * all of them for each one.
  */
 static krb5_error_code
-create_workers(verto_ctx *ctx, int num)
+create_workers(verto_ctx *ctx, int num, int tcp_listen_backlog)
 {
     krb5_error_code retval;
     int i, status;
@@ -543,6 +785,16 @@ create_workers(verto_ctx *ctx, int num)
                 return retval;
             }
 
+            /* The first worker keeps the sockets inherited from the
+             * supervisor, so no requests are lost to a socket which will
+             * never be read. */
+            if (reuseport && i > 0) {
+                retval = loop_setup_network(ctx, &shandle, kdc_progname,
+                                            tcp_listen_backlog);
+                if (retval)
+                    return retval;
+            }
+
             /* Avoid race condition */
             if (signal_received)
                 exit(0);
@@ -607,7 +859,7 @@ usage(char *name)
             _("usage: %s [-x db_args]* [-d dbpathname] [-r dbrealmname]\n"
               "\t\t[-R replaycachename] [-m] [-k masterenctype]\n"
               "\t\t[-M masterkeyname] [-p port] [-P pid_file]\n"
-              "\t\t[-n] [-w numworkers] [/]\n\n"
+              "\t\t[-n] [-w numworkers | -t numthreads] [/]\n\n"
               "where,\n"
               "\t[-x db_args]* - Any number of database specific arguments.\n"
               "\t\t\tLook at each database module documentation for "
@@ -659,12 +911,22 @@ initialize_realms(krb5_context kcontext, int argc, char **argv,
         hierarchy[1] = KRB5_CONF_KDC_MAX_DGRAM_REPLY_SIZE;
         if (krb5_aprof_get_int32(aprof, hierarchy, TRUE, &max_dgram_reply_size))
             max_dgram_reply_size = MAX_DGRAM_SIZE;
+        hierarchy[1] = KRB5_CONF_KDC_REUSEPORT;
+        if (krb5_aprof_get_boolean(aprof, hierarchy, TRUE, &reuseport))
+            reuseport = FALSE;
+        hierarchy[1] = KRB5_CONF_KDC_SHARED_LOOKASIDE;
+        if (krb5_aprof_get_boolean(aprof, hierarchy, TRUE, &shared_lookaside))
+            shared_lookaside = FALSE;
         if (tcp_listen_backlog_out != NULL) {
             hierarchy[1] = KRB5_CONF_KDC_TCP_LISTEN_BACKLOG;
             if (krb5_aprof_get_int32(aprof, hierarchy, TRUE,
                                      tcp_listen_backlog_out))
                 *tcp_listen_backlog_out = DEFAULT_TCP_LISTEN_BACKLOG;
         }
+        hierarchy[1] = KRB5_CONF_KDC_TCP_MAX_CONNECTIONS;
+        if (krb5_aprof_get_int32(aprof, hierarchy, TRUE,
+                                 &tcp_max_connections))
+            tcp_max_connections = DEFAULT_TCP_MAX_CONNECTIONS;
         hierarchy[1] = KRB5_CONF_RESTRICT_ANONYMOUS_TO_TGT;
         if (krb5_aprof_get_boolean(aprof, hierarchy, TRUE, &def_restrict_anon))
             def_restrict_anon = FALSE;
@@ -697,7 +959,7 @@ initialize_realms(krb5_context kcontext, int argc, char **argv,
      * twice if worker processes are used, so we must initialize optind.
      */
     optind = 1;
-    while ((c = getopt(argc, argv, "x:r:d:mM:k:R:e:P:p:s:nw:4:T:X3")) != -1) {
+    while ((c = getopt(argc, argv, "x:r:d:mM:k:R:e:P:p:s:nw:t:4:T:X3")) != -1) {
         switch(c) {
         case 'x':
             db_args_size++;
@@ -782,9 +1044,20 @@ initialize_realms(krb5_context kcontext, int argc, char **argv,
             break;
         case 'w':                       /* create multiple worker processes */
             workers = atoi(optarg);
-            if (workers <= 0)
+            if (workers <= 0 || threads > 0)
                 usage(argv[0]);
             break;
+        case 't':                       /* create multiple worker threads */
+#ifdef ENABLE_THREADS
+            threads = atoi(optarg);
+            if (threads <= 0 || workers > 0)
+                usage(argv[0]);
+#else
+            fprintf(stderr, _("%s: worker threads are not supported in this "
+                              "build\n"), argv[0]);
+            exit(1);
+#endif
+            break;
         case 'k':                       /* enctype for master key */
             if (krb5_string_to_enctype(optarg, &menctype))
                 com_err(argv[0], 0, _("invalid enctype %s"), optarg);
@@ -893,6 +1166,28 @@ finish_realms()
     shandle.kdc_numrealms = 0;
 }
 
+/* SIGHUP handler for threaded mode.  Each worker thread resets its own realms
+ * before processing its next request. */
+static void
+reset_for_hangup_threaded(void *handle)
+{
+    reset_for_hangup(handle);
+    kdc_threads_refresh();
+}
+
+/* Stop the worker threads and free their server handles and the preauth
+ * module event context. */
+static void
+free_threads()
+{
+    kdc_threads_stop();
+    free_worker_handles(worker_handles, threads);
+    worker_handles = NULL;
+    if (module_ctx != NULL)
+        verto_free(module_ctx);
+    module_ctx = NULL;
+}
+
 /*
   outline:
 
@@ -928,6 +1223,9 @@ int main(int argc, char **argv)
     int tcp_listen_backlog;
     int errout = 0;
     int i;
+#ifndef NOCACHE
+    struct lookaside_stats lstats;
+#endif
 
     setlocale(LC_ALL, "");
     if (strrchr(argv[0], '/'))
@@ -969,7 +1267,7 @@ int main(int argc, char **argv)
     initialize_realms(kcontext, argc, argv, &tcp_listen_backlog);
 
 #ifndef NOCACHE
-    retval = kdc_init_lookaside(kcontext);
+    retval = kdc_init_lookaside(kcontext, shared_lookaside);
     if (retval) {
         kdc_err(kcontext, retval, _("while initializing lookaside cache"));
         finish_realms();
@@ -984,7 +1282,18 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    load_preauth_plugins(&shandle, kcontext, ctx);
+    /* In threaded mode, preauth modules get their own event context, which is
+     * run by worker threads instead of the main loop. */
+    if (threads > 0) {
+        module_ctx = verto_new(NULL, VERTO_EV_TYPE_IO | VERTO_EV_TYPE_TIMEOUT);
+        if (module_ctx == NULL) {
+            kdc_err(kcontext, ENOMEM, _("while creating preauth loop"));
+            finish_realms();
+            return 1;
+        }
+    }
+    load_preauth_plugins(&shandle, kcontext,
+                         (module_ctx != NULL) ? module_ctx : ctx);
     load_authdata_plugins(kcontext);
     retval = load_kdcpolicy_plugins(kcontext);
     if (retval) {
@@ -1011,13 +1320,16 @@ int main(int argc, char **argv)
     }
 
     if (workers == 0) {
-        retval = loop_setup_signals(ctx, &shandle, reset_for_hangup);
+        retval = loop_setup_signals(ctx, &shandle,
+                                    (threads > 0) ? reset_for_hangup_threaded :
+                                    reset_for_hangup);
         if (retval) {
             kdc_err(kcontext, retval, _("while initializing signal handlers"));
             finish_realms();
             return 1;
         }
     }
+    loop_set_max_connections(tcp_max_connections);
     if ((retval = loop_setup_network(ctx, &shandle, kdc_progname,
                                      tcp_listen_backlog))) {
     net_init_error:
@@ -1042,8 +1354,15 @@ int main(int argc, char **argv)
             return 1;
         }
     }
+#ifndef SO_REUSEPORT
+    if (reuseport) {
+        krb5_klog_syslog(LOG_WARNING, _("%s is not supported on this system; "
+                                        "ignoring"), KRB5_CONF_KDC_REUSEPORT);
+        reuseport = FALSE;
+    }
+#endif
     if (workers > 0) {
-        retval = create_workers(ctx, workers);
+        retval = create_workers(ctx, workers, tcp_listen_backlog);
         if (retval) {
             kdc_err(kcontext, errno, _("creating worker processes"));
             return 1;
@@ -1052,6 +1371,20 @@ int main(int argc, char **argv)
 
     initialize_realms(kcontext, argc, argv, NULL);
 
+    if (threads > 0) {
+        retval = create_worker_handles(threads, &worker_handles);
+        if (!retval) {
+            retval = kdc_threads_start(ctx, worker_handles, module_ctx,
+                                       threads);
+        }
+        if (retval) {
+            kdc_err(kcontext, retval, _("while creating worker threads"));
+            free_threads();
+            finish_realms();
+            return 1;
+        }
+    }
+
     /* Initialize audit system and audit KDC startup. */
     retval = load_audit_modules(kcontext);
     if (retval) {
@@ -1065,8 +1398,15 @@ int main(int argc, char **argv)
     kau_kdc_start(kcontext, TRUE);
 
     verto_run(ctx);
+    free_threads();
     loop_free(ctx);
     kau_kdc_stop(kcontext, TRUE);
+#ifndef NOCACHE
+    kdc_get_lookaside_stats(&lstats);
+    krb5_klog_syslog(LOG_INFO, _("lookaside cache: %lu lookups, %lu hits, "
+                                 "%lu misses, %lu evictions"), lstats.calls,
+                     lstats.hits, lstats.misses, lstats.evictions);
+#endif
     krb5_klog_syslog(LOG_INFO, _("shutting down"));
     unload_preauth_plugins(kcontext);
     unload_authdata_plugins(kcontext);
@@ -122,8 +122,10 @@ check_kdcpolicy_as(krb5_context context, const krb5_kdc_req *request,
         if (h->vt.check_as == NULL)
             continue;
 
+        kdc_module_lock();
         ret = h->vt.check_as(context, h->moddata, request, client, server,
                              (const char **)ais, status, &life, &rlife);
+        kdc_module_unlock();
         if (ret)
             goto done;
 
@@ -162,8 +164,10 @@ check_kdcpolicy_tgs(krb5_context context, const krb5_kdc_req *request,
         if (h->vt.check_tgs == NULL)
             continue;
 
+        kdc_module_lock();
         ret = h->vt.check_tgs(context, h->moddata, request, server, ticket,
                               (const char **)ais, status, &life, &rlife);
+        kdc_module_unlock();
         if (ret)
             goto done;
 
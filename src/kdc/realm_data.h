@@ -50,6 +50,7 @@ typedef struct __kdc_realm_data {
      * Database per-realm data.
      */
     char *              realm_stash;    /* Stash file name for realm        */
+    char **             realm_db_args;  /* Database module arguments        */
     char *              realm_mpname;   /* Master principal name for realm  */
     krb5_principal      realm_mprinc;   /* Master principal for realm       */
     /*
@@ -57,6 +58,7 @@ typedef struct __kdc_realm_data {
      * latest.
      */
     krb5_keyblock       realm_mkey;     /* Master key for this realm        */
+    struct key_cache    *realm_keycache; /* Decrypted long-term keys       */
     /*
      * TGS per-realm data.
      */
@@ -79,6 +81,8 @@ struct server_handle {
     kdc_realm_t **kdc_realmlist;
     int kdc_numrealms;
     krb5_context kdc_err_context;
+    krb5_int32 last_usec;       /* State for reseed_random() */
+    krb5_int32 last_os_random;
 };
 
 kdc_realm_t *find_realm_data(struct server_handle *, char *, krb5_ui_4);
@@ -25,122 +25,388 @@
  */
 
 #include "k5-int.h"
-#include "k5-queue.h"
 #include "k5-hashtab.h"
 #include "kdc_util.h"
 #include "extern.h"
+#include "adm_proto.h"
+#include <syslog.h>
+#include <sys/mman.h>
 
 #ifndef NOCACHE
 
-struct entry {
-    K5_TAILQ_ENTRY(entry) links;
-    int num_hits;
-    krb5_timestamp timein;
-    krb5_data req_packet;
-    krb5_data reply_packet;
-};
+/*
+ * The lookaside cache stores each entry (its header, request packet, and
+ * reply packet) as a single record in a ring-buffer arena of
+ * LOOKASIDE_MAX_SIZE bytes.  Records are allocated at the tail of the ring and
+ * reclaimed from the head, so memory is reclaimed in the order entries were
+ * inserted, which is also the order in which they become stale.  An entry
+ * which is removed or replaced is unlinked from the hash chains immediately,
+ * and its space is reclaimed when the head of the ring reaches it.  Entries
+ * refer to each other by offset into the ring rather than by pointer.
+ *
+ * The hash chains are divided into stripes, each protected by its own mutex,
+ * so lookups in different stripes do not contend.  Allocating from the ring
+ * requires ring_lock, which is always acquired before a stripe lock.
+ *
+ * A shared cache lives in an anonymous shared mapping created before the KDC
+ * forks its worker processes, using process-shared mutexes, so that a
+ * retransmitted request can be answered by any worker and memory is bounded
+ * once rather than per worker.  The mutexes are robust: if a worker dies
+ * while holding one, the next process to acquire it empties the data it
+ * protects rather than trusting it.
+ */
 
 #ifndef LOOKASIDE_MAX_SIZE
 #define LOOKASIDE_MAX_SIZE (10 * 1024 * 1024)
 #endif
 
-K5_LIST_HEAD(entry_list, entry);
-K5_TAILQ_HEAD(entry_queue, entry);
+#if defined(K5_HAVE_SHARED_MUTEX) && defined(MAP_ANONYMOUS)
+#define SHARED_LOOKASIDE
+#endif
+
+#define NBUCKETS 8192
+#define NSTRIPES 64
+#define NO_ENTRY ((uint32_t)-1)
+#define RECORD_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct entry {
+    uint32_t next;              /* Offset of the next entry in the chain */
+    uint32_t size;              /* Size of this record in the ring */
+    uint64_t hash;
+    krb5_timestamp timein;
+    int num_hits;
+    uint32_t req_len;
+    uint32_t rep_len;
+    krb5_boolean linked;        /* True if present in a hash chain */
+    /* The request and reply packets follow the header. */
+};
+
+struct stripe {
+    k5_mutex_t lock;
+    unsigned long calls;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+struct cache {
+    uint8_t seed[K5_HASH_SEED_LEN];
+    krb5_boolean shared;
+
+    /* ring_lock protects the ring state, evictions, and
+     * max_hits_per_entry. */
+    k5_mutex_t ring_lock;
+    size_t head;                /* Offset of the oldest record */
+    size_t tail;                /* Offset of the next record to allocate */
+    size_t wrap;                /* End of the records before offset 0 */
+    krb5_boolean wrapped;       /* True if the records wrap around */
+    size_t used;
+    unsigned long evictions;
+    int max_hits_per_entry;
+
+    /* Bucket i is protected by the lock of stripe i % NSTRIPES. */
+    struct stripe stripes[NSTRIPES];
+    uint32_t buckets[NBUCKETS];
+};
+
+static struct cache *cache;
+static unsigned char *ring;
+static size_t ring_size = LOOKASIDE_MAX_SIZE;
 
-static struct k5_hashtab *hash_table;
-static struct entry_queue expiration_queue;
+/* The number of cache mutexes initialized, and the process which did so. */
+static int nlocks;
+static pid_t cache_owner;
 
-static int hits = 0;
-static int calls = 0;
-static int max_hits_per_entry = 0;
-static int num_entries = 0;
-static size_t total_size = 0;
+#define CACHE_HDRLEN RECORD_ALIGN(sizeof(struct cache))
+#define ENTRY(off) ((struct entry *)(ring + (off)))
+#define OFFSET(e) ((uint32_t)((unsigned char *)(e) - ring))
+#define REQ(e) ((unsigned char *)((e) + 1))
+#define REP(e) (REQ(e) + (e)->req_len)
 
 #define STALE_TIME      (2*60)            /* two minutes */
 #define STALE(ptr, now) (ts_after(now, ts_incr((ptr)->timein, STALE_TIME)))
 
-/* Return the rough memory footprint of an entry containing req and rep. */
+/* Return the size of the ring record for an entry containing req and rep. */
 static size_t
 entry_size(const krb5_data *req, const krb5_data *rep)
 {
-    return sizeof(struct entry) + req->length +
-        ((rep == NULL) ? 0 : rep->length);
+    return RECORD_ALIGN(sizeof(struct entry) + req->length +
+                        ((rep == NULL) ? 0 : rep->length));
 }
 
-/* Insert an entry into the cache. */
-static struct entry *
-insert_entry(krb5_context context, krb5_data *req, krb5_data *rep,
-             krb5_timestamp time)
+static inline uint64_t
+entry_hash(const krb5_data *req)
 {
-    krb5_error_code ret;
-    struct entry *entry;
-    size_t esize = entry_size(req, rep);
+    return k5_siphash24((uint8_t *)req->data, req->length, cache->seed);
+}
 
-    entry = calloc(1, sizeof(*entry));
-    if (entry == NULL)
-        goto error;
-    entry->timein = time;
+static inline uint32_t *
+bucket(uint64_t hash)
+{
+    return &cache->buckets[hash % NBUCKETS];
+}
 
-    ret = krb5int_copy_data_contents(context, req, &entry->req_packet);
-    if (ret)
-        goto error;
+static inline struct stripe *
+stripe(uint64_t hash)
+{
+    return &cache->stripes[(hash % NBUCKETS) % NSTRIPES];
+}
 
-    if (rep != NULL) {
-        ret = krb5int_copy_data_contents(context, rep, &entry->reply_packet);
-        if (ret)
-            goto error;
-    }
+static krb5_error_code
+init_mutex(k5_mutex_t *lock, krb5_boolean shared)
+{
+#ifdef SHARED_LOOKASIDE
+    if (shared)
+        return k5_mutex_init_shared(lock);
+#endif
+    return k5_mutex_init(lock);
+}
 
-    ret = k5_hashtab_add(hash_table, entry->req_packet.data,
-                         entry->req_packet.length, entry);
-    if (ret)
-        goto error;
-    K5_TAILQ_INSERT_TAIL(&expiration_queue, entry, links);
-    num_entries++;
-    total_size += esize;
+/* Empty the hash chains protected by stripe i, whose lock must be held. */
+static void
+clear_stripe(size_t i)
+{
+    for (; i < NBUCKETS; i += NSTRIPES)
+        cache->buckets[i] = NO_ENTRY;
+}
+
+/* Lock st.  If a worker process died while holding the lock, the hash chains
+ * it protects may be inconsistent, so empty them.  Their records are still
+ * reclaimed from the ring in order. */
+static void
+lock_stripe(struct stripe *st)
+{
+#ifdef SHARED_LOOKASIDE
+    if (cache->shared) {
+        if (k5_mutex_lock_shared(&st->lock) == EOWNERDEAD)
+            clear_stripe(st - cache->stripes);
+        return;
+    }
+#endif
+    k5_mutex_lock(&st->lock);
+}
 
-    return entry;
+/* Lock the ring.  If a worker process died while holding the lock, the ring
+ * may be inconsistent, so empty the whole cache. */
+static void
+lock_ring(void)
+{
+#ifdef SHARED_LOOKASIDE
+    size_t i;
+
+    if (cache->shared) {
+        if (k5_mutex_lock_shared(&cache->ring_lock) == EOWNERDEAD) {
+            for (i = 0; i < NSTRIPES; i++) {
+                lock_stripe(&cache->stripes[i]);
+                clear_stripe(i);
+                k5_mutex_unlock(&cache->stripes[i].lock);
+            }
+            cache->head = cache->tail = cache->used = 0;
+            cache->wrapped = FALSE;
+            cache->wrap = ring_size;
+        }
+        return;
+    }
+#endif
+    k5_mutex_lock(&cache->ring_lock);
+}
 
-error:
-    if (entry != NULL) {
-        krb5_free_data_contents(context, &entry->req_packet);
-        krb5_free_data_contents(context, &entry->reply_packet);
-        free(entry);
+/* Find the entry for req in its chain.  The stripe lock must be held.  If
+ * link_out is not NULL, set it to the link which refers to the entry. */
+static struct entry *
+find_entry(const krb5_data *req, uint64_t hash, uint32_t **link_out)
+{
+    struct entry *e;
+    uint32_t *link;
+
+    for (link = bucket(hash); *link != NO_ENTRY; link = &e->next) {
+        e = ENTRY(*link);
+        if (e->hash == hash && e->req_len == req->length &&
+            memcmp(REQ(e), req->data, req->length) == 0) {
+            if (link_out != NULL)
+                *link_out = link;
+            return e;
+        }
     }
     return NULL;
 }
 
-
-/* Remove entry from its hash bucket and the expiration queue, and free it. */
+/* Remove entry from its hash chain, if it is still present.  The stripe lock
+ * must be held.  The record's space is reclaimed when the head of the ring
+ * reaches it. */
 static void
-discard_entry(krb5_context context, struct entry *entry)
+discard_entry(struct entry *entry)
+{
+    struct entry *e;
+    uint32_t *link;
+
+    for (link = bucket(entry->hash); *link != NO_ENTRY; link = &e->next) {
+        e = ENTRY(*link);
+        if (e == entry) {
+            *link = e->next;
+            break;
+        }
+    }
+    entry->linked = FALSE;
+}
+
+/* Release the oldest record in the ring, discarding its entry if it is still
+ * linked.  If purge is true, only release the record if its entry has been
+ * discarded or is stale as of now, and return false if it is not released.
+ * ring_lock must be held. */
+static krb5_boolean
+release_oldest(krb5_boolean purge, krb5_timestamp now)
+{
+    struct entry *e = ENTRY(cache->head);
+    struct stripe *st = stripe(e->hash);
+
+    lock_stripe(st);
+    if (purge && e->linked && !STALE(e, now)) {
+        k5_mutex_unlock(&st->lock);
+        return FALSE;
+    }
+    if (e->linked) {
+        discard_entry(e);
+        cache->evictions++;
+    }
+    cache->max_hits_per_entry = max(cache->max_hits_per_entry, e->num_hits);
+    k5_mutex_unlock(&st->lock);
+
+    cache->used -= e->size;
+    cache->head += e->size;
+    if (cache->wrapped && cache->head == cache->wrap) {
+        cache->head = 0;
+        cache->wrapped = FALSE;
+        cache->wrap = ring_size;
+    }
+    return TRUE;
+}
+
+/* Allocate a record of size bytes at the tail of the ring, releasing the
+ * oldest records as needed.  ring_lock must be held. */
+static struct entry *
+alloc_record(size_t size)
 {
-    total_size -= entry_size(&entry->req_packet, &entry->reply_packet);
-    num_entries--;
-    k5_hashtab_remove(hash_table, entry->req_packet.data,
-                      entry->req_packet.length);
-    K5_TAILQ_REMOVE(&expiration_queue, entry, links);
-    krb5_free_data_contents(context, &entry->req_packet);
-    krb5_free_data_contents(context, &entry->reply_packet);
-    free(entry);
+    struct entry *e;
+
+    if (size > ring_size)
+        return NULL;
+
+    for (;;) {
+        if (cache->used == 0) {
+            cache->head = cache->tail = 0;
+            cache->wrapped = FALSE;
+            cache->wrap = ring_size;
+        }
+        if (!cache->wrapped) {
+            /* Space is free from the tail to the end of the ring, and from
+             * the start of the ring to the head. */
+            if (ring_size - cache->tail >= size)
+                break;
+            cache->wrap = cache->tail;
+            cache->wrapped = TRUE;
+            cache->tail = 0;
+        } else if (cache->head - cache->tail >= size) {
+            break;
+        } else {
+            (void)release_oldest(FALSE, 0);
+        }
+    }
+
+    e = ENTRY(cache->tail);
+    cache->tail += size;
+    cache->used += size;
+    e->size = size;
+    return e;
+}
+
+/* Insert an entry into the cache.  ring_lock must be held. */
+static struct entry *
+insert_entry(krb5_data *req, krb5_data *rep, krb5_timestamp time)
+{
+    struct entry *e;
+    struct stripe *st;
+    uint64_t hash = entry_hash(req);
+    uint32_t *b = bucket(hash);
+
+    e = alloc_record(entry_size(req, rep));
+    if (e == NULL)
+        return NULL;
+    e->hash = hash;
+    e->timein = time;
+    e->num_hits = 0;
+    e->req_len = req->length;
+    e->rep_len = (rep == NULL) ? 0 : rep->length;
+    memcpy(REQ(e), req->data, req->length);
+    if (e->rep_len > 0)
+        memcpy(REP(e), rep->data, rep->length);
+
+    st = stripe(hash);
+    lock_stripe(st);
+    e->next = *b;
+    *b = OFFSET(e);
+    e->linked = TRUE;
+    k5_mutex_unlock(&st->lock);
+    return e;
 }
 
-/* Initialize the lookaside cache structures and randomize the hash seed. */
+/*
+ * Initialize the lookaside cache structures and randomize the hash seed.  If
+ * shared is true, place the cache in memory which will be shared with any
+ * worker processes forked afterwards.
+ */
 krb5_error_code
-kdc_init_lookaside(krb5_context context)
+kdc_init_lookaside(krb5_context context, krb5_boolean shared)
 {
     krb5_error_code ret;
     uint8_t seed[K5_HASH_SEED_LEN];
     krb5_data d = make_data(seed, sizeof(seed));
+    void *mem;
+    size_t i;
 
     ret = krb5_c_random_make_octets(context, &d);
     if (ret)
         return ret;
-    ret = k5_hashtab_create(seed, 8192, &hash_table);
+
+#ifdef SHARED_LOOKASIDE
+    if (shared) {
+        mem = mmap(NULL, CACHE_HDRLEN + ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return errno;
+    }
+#else
+    if (shared) {
+        krb5_klog_syslog(LOG_WARNING, _("Shared lookaside cache is not "
+                                        "supported on this system"));
+        shared = FALSE;
+    }
+#endif
+    if (!shared) {
+        mem = calloc(1, CACHE_HDRLEN + ring_size);
+        if (mem == NULL)
+            return ENOMEM;
+    }
+    cache = mem;
+    ring = (unsigned char *)mem + CACHE_HDRLEN;
+
+    memcpy(cache->seed, seed, sizeof(seed));
+    cache->shared = shared;
+    cache->wrap = ring_size;
+    for (i = 0; i < NBUCKETS; i++)
+        cache->buckets[i] = NO_ENTRY;
+    cache_owner = getpid();
+    nlocks = 0;
+    ret = init_mutex(&cache->ring_lock, shared);
+    if (!ret)
+        nlocks++;
+    for (i = 0; i < NSTRIPES && !ret; i++) {
+        ret = init_mutex(&cache->stripes[i].lock, shared);
+        if (!ret)
+            nlocks++;
+    }
     if (ret)
-        return ret;
-    K5_TAILQ_INIT(&expiration_queue);
-    return 0;
+        kdc_free_lookaside(context);
+    return ret;
 }
 
 /* Remove the lookaside cache entry for a packet. */
@@ -148,10 +414,15 @@ void
 kdc_remove_lookaside(krb5_context kcontext, krb5_data *req_packet)
 {
     struct entry *e;
+    struct stripe *st;
+    uint64_t hash = entry_hash(req_packet);
 
-    e = k5_hashtab_get(hash_table, req_packet->data, req_packet->length);
+    st = stripe(hash);
+    lock_stripe(st);
+    e = find_entry(req_packet, hash, NULL);
     if (e != NULL)
-        discard_entry(kcontext, e);
+        discard_entry(e);
+    k5_mutex_unlock(&st->lock);
 }
 
 /*
@@ -167,29 +438,44 @@ kdc_check_lookaside(krb5_context kcontext, krb5_data *req_packet,
                     krb5_data **reply_packet_out)
 {
     struct entry *e;
+    struct stripe *st;
+    krb5_data rep;
+    krb5_boolean found = FALSE;
+    uint64_t hash = entry_hash(req_packet);
 
     *reply_packet_out = NULL;
-    calls++;
 
-    e = k5_hashtab_get(hash_table, req_packet->data, req_packet->length);
-    if (e == NULL)
-        return FALSE;
+    st = stripe(hash);
+    lock_stripe(st);
+    st->calls++;
+
+    e = find_entry(req_packet, hash, NULL);
+    if (e == NULL) {
+        st->misses++;
+        goto cleanup;
+    }
 
     e->num_hits++;
-    hits++;
+    st->hits++;
 
     /* Leave *reply_packet_out as NULL for an in-progress entry. */
-    if (e->reply_packet.length == 0)
-        return TRUE;
+    if (e->rep_len == 0) {
+        found = TRUE;
+        goto cleanup;
+    }
+
+    rep = make_data(REP(e), e->rep_len);
+    found = (krb5_copy_data(kcontext, &rep, reply_packet_out) == 0);
 
-    return (krb5_copy_data(kcontext, &e->reply_packet,
-                           reply_packet_out) == 0);
+cleanup:
+    k5_mutex_unlock(&st->lock);
+    return found;
 }
 
 /*
- * Insert a request and reply into the lookaside cache.  Assumes it's not
- * already there, and can fail silently on memory exhaustion.  Also discard old
- * entries in the cache.
+ * Insert a request and reply into the lookaside cache, replacing any existing
+ * entry for the request.  Can fail silently if the entry is too large for the
+ * cache.  Also discard old entries in the cache.
  *
  * The reply_packet may be NULL to indicate a request that is still processing.
  */
@@ -197,35 +483,81 @@ void
 kdc_insert_lookaside(krb5_context kcontext, krb5_data *req_packet,
                      krb5_data *reply_packet)
 {
-    struct entry *e, *next;
+    struct entry *e;
+    struct stripe *st;
     krb5_timestamp timenow;
-    size_t esize = entry_size(req_packet, reply_packet);
+    uint64_t hash = entry_hash(req_packet);
 
     if (krb5_timeofday(kcontext, &timenow))
         return;
 
-    /* Purge stale entries and limit the total size of the entries. */
-    K5_TAILQ_FOREACH_SAFE(e, &expiration_queue, links, next) {
-        if (!STALE(e, timenow) && total_size + esize <= LOOKASIDE_MAX_SIZE)
-            break;
-        max_hits_per_entry = max(max_hits_per_entry, e->num_hits);
-        discard_entry(kcontext, e);
-    }
+    lock_ring();
+
+    /* Worker threads or processes may race to insert the same request; keep
+     * the newest. */
+    st = stripe(hash);
+    lock_stripe(st);
+    e = find_entry(req_packet, hash, NULL);
+    if (e != NULL)
+        discard_entry(e);
+    k5_mutex_unlock(&st->lock);
+
+    /* Purge stale and discarded entries from the head of the ring. */
+    while (cache->used > 0 && release_oldest(TRUE, timenow));
+
+    insert_entry(req_packet, reply_packet, timenow);
+    k5_mutex_unlock(&cache->ring_lock);
+}
 
-    insert_entry(kcontext, req_packet, reply_packet, timenow);
-    return;
+/* Report the lookaside cache counters. */
+void
+kdc_get_lookaside_stats(struct lookaside_stats *stats)
+{
+    struct stripe *st;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < NSTRIPES; i++) {
+        st = &cache->stripes[i];
+        lock_stripe(st);
+        stats->calls += st->calls;
+        stats->hits += st->hits;
+        stats->misses += st->misses;
+        k5_mutex_unlock(&st->lock);
+    }
+    lock_ring();
+    stats->evictions = cache->evictions;
+    stats->max_hits_per_entry = cache->max_hits_per_entry;
+    k5_mutex_unlock(&cache->ring_lock);
 }
 
-/* Free all entries in the lookaside cache. */
+/* Free the lookaside cache. */
 void
 kdc_free_lookaside(krb5_context kcontext)
 {
-    struct entry *e, *next;
+    int i;
 
-    K5_TAILQ_FOREACH_SAFE(e, &expiration_queue, links, next) {
-        discard_entry(kcontext, e);
+    if (cache == NULL)
+        return;
+
+    /* Only the process which created a shared cache destroys its mutexes, as
+     * other processes may still be using them. */
+    if (!cache->shared || getpid() == cache_owner) {
+        if (nlocks > 0)
+            k5_mutex_destroy(&cache->ring_lock);
+        for (i = 0; i < nlocks - 1; i++)
+            k5_mutex_destroy(&cache->stripes[i].lock);
     }
-    k5_hashtab_free(hash_table);
+    nlocks = 0;
+
+#ifdef SHARED_LOOKASIDE
+    if (cache->shared)
+        munmap(cache, CACHE_HDRLEN + ring_size);
+    else
+#endif
+        free(cache);
+    cache = NULL;
+    ring = NULL;
 }
 
 #endif /* NOCACHE */
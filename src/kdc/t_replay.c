@@ -59,9 +59,14 @@ __wrap_krb5_timeofday(krb5_context context, krb5_timestamp *timeret)
 
 #undef krb5_timeofday
 
-#define SEED 0x6F03A219
 #define replay_unit_test(fn)                                            \
     cmocka_unit_test_setup_teardown(fn, setup_lookaside, destroy_lookaside)
+#define shared_unit_test(fn)                                            \
+    cmocka_unit_test_setup_teardown(fn, setup_shared_lookaside,         \
+                                    destroy_lookaside)
+
+/* Room for four records with requests and replies of up to 32 bytes. */
+#define SMALL_RING_SIZE (4 * RECORD_ALIGN(sizeof(struct entry) + 64))
 
 /*
  * Helper functions
@@ -74,6 +79,49 @@ time_return(krb5_timestamp time, krb5_error_code err)
     will_return(__wrap_krb5_timeofday, err);
 }
 
+/* Return the linked entry for req, or NULL if there is none. */
+static struct entry *
+lookup(const krb5_data *req)
+{
+    return find_entry(req, entry_hash(req), NULL);
+}
+
+/* Return true if e contains req and rep (or no reply if rep is NULL). */
+static krb5_boolean
+entry_matches(struct entry *e, const krb5_data *req, const krb5_data *rep)
+{
+    size_t rep_len = (rep == NULL) ? 0 : rep->length;
+
+    if (e->req_len != req->length || memcmp(REQ(e), req->data, req->length))
+        return FALSE;
+    if (e->rep_len != rep_len)
+        return FALSE;
+    return rep_len == 0 || memcmp(REP(e), rep->data, rep_len) == 0;
+}
+
+/* Return the number of entries present in the hash chains. */
+static int
+num_entries(void)
+{
+    int i, count = 0;
+    uint32_t off;
+
+    for (i = 0; i < NBUCKETS; i++) {
+        for (off = cache->buckets[i]; off != NO_ENTRY; off = ENTRY(off)->next)
+            count++;
+    }
+    return count;
+}
+
+static unsigned long
+hits(void)
+{
+    struct lookaside_stats stats;
+
+    kdc_get_lookaside_stats(&stats);
+    return stats.hits;
+}
+
 /*
  * setup/teardown functions
  */
@@ -102,27 +150,20 @@ global_teardown(void **state)
 static int
 setup_lookaside(void **state)
 {
-    krb5_error_code ret;
-    krb5_context context = *state;
-
-    ret = kdc_init_lookaside(context);
-    if (ret)
-        return ret;
-
-    /* Ensure some vars are all set to initial values */
-    hits = 0;
-    calls = 0;
-    max_hits_per_entry = 0;
-    num_entries = 0;
-    total_size = 0;
+    return kdc_init_lookaside(*state, FALSE);
+}
 
-    return 0;
+static int
+setup_shared_lookaside(void **state)
+{
+    return kdc_init_lookaside(*state, TRUE);
 }
 
 static int
 destroy_lookaside(void **state)
 {
     kdc_free_lookaside(*state);
+    ring_size = LOOKASIDE_MAX_SIZE;
     return 0;
 }
 
@@ -137,7 +178,7 @@ test_entry_size_no_response(void **state)
     const krb5_data req = string2data("I'm a test request");
 
     result = entry_size(&req, NULL);
-    assert_int_equal(result, sizeof(struct entry) + 18);
+    assert_int_equal(result, RECORD_ALIGN(sizeof(struct entry) + 18));
 }
 
 static void
@@ -148,7 +189,7 @@ test_entry_size_w_response(void **state)
     const krb5_data rep = string2data("I'm a test response");
 
     result = entry_size(&req, &rep);
-    assert_int_equal(result, sizeof(struct entry) + 18 + 19);
+    assert_int_equal(result, RECORD_ALIGN(sizeof(struct entry) + 18 + 19));
 }
 
 /*
@@ -159,32 +200,29 @@ static void
 test_insert_entry(void **state)
 {
     struct entry *e;
-    krb5_context context = *state;
     krb5_data req = string2data("I'm a test request");
     krb5_data rep = string2data("I'm a test response");
 
-    e = insert_entry(context, &req, &rep, 15);
+    e = insert_entry(&req, &rep, 15);
 
-    assert_ptr_equal(k5_hashtab_get(hash_table, req.data, req.length), e);
-    assert_ptr_equal(K5_TAILQ_FIRST(&expiration_queue), e);
-    assert_true(data_eq(e->req_packet, req));
-    assert_true(data_eq(e->reply_packet, rep));
+    assert_ptr_equal(lookup(&req), e);
+    assert_ptr_equal(ENTRY(cache->head), e);
+    assert_true(entry_matches(e, &req, &rep));
     assert_int_equal(e->timein, 15);
+    assert_int_equal(cache->used, entry_size(&req, &rep));
 }
 
 static void
 test_insert_entry_no_response(void **state)
 {
     struct entry *e;
-    krb5_context context = *state;
     krb5_data req = string2data("I'm a test request");
 
-    e = insert_entry(context, &req, NULL, 10);
+    e = insert_entry(&req, NULL, 10);
 
-    assert_ptr_equal(k5_hashtab_get(hash_table, req.data, req.length), e);
-    assert_ptr_equal(K5_TAILQ_FIRST(&expiration_queue), e);
-    assert_true(data_eq(e->req_packet, req));
-    assert_int_equal(e->reply_packet.length, 0);
+    assert_ptr_equal(lookup(&req), e);
+    assert_ptr_equal(ENTRY(cache->head), e);
+    assert_true(entry_matches(e, &req, NULL));
     assert_int_equal(e->timein, 10);
 }
 
@@ -192,26 +230,24 @@ static void
 test_insert_entry_multiple(void **state)
 {
     struct entry *e1, *e2;
-    krb5_context context = *state;
     krb5_data req1 = string2data("I'm a test request");
     krb5_data rep1 = string2data("I'm a test response");
     krb5_data req2 = string2data("I'm a different test request");
 
-    e1 = insert_entry(context, &req1, &rep1, 20);
+    e1 = insert_entry(&req1, &rep1, 20);
 
-    assert_ptr_equal(k5_hashtab_get(hash_table, req1.data, req1.length), e1);
-    assert_ptr_equal(K5_TAILQ_FIRST(&expiration_queue), e1);
-    assert_true(data_eq(e1->req_packet, req1));
-    assert_true(data_eq(e1->reply_packet, rep1));
+    assert_ptr_equal(lookup(&req1), e1);
+    assert_ptr_equal(ENTRY(cache->head), e1);
+    assert_true(entry_matches(e1, &req1, &rep1));
     assert_int_equal(e1->timein, 20);
 
-    e2 = insert_entry(context, &req2, NULL, 30);
+    e2 = insert_entry(&req2, NULL, 30);
 
-    assert_ptr_equal(k5_hashtab_get(hash_table, req2.data, req2.length), e2);
-    assert_ptr_equal(K5_TAILQ_LAST(&expiration_queue,entry_queue), e2);
-    assert_true(data_eq(e2->req_packet, req2));
-    assert_int_equal(e2->reply_packet.length, 0);
+    assert_ptr_equal(lookup(&req2), e2);
+    assert_ptr_equal(ENTRY(cache->head + e1->size), e2);
+    assert_true(entry_matches(e2, &req2, NULL));
     assert_int_equal(e2->timein, 30);
+    assert_int_equal(cache->used, e1->size + e2->size);
 }
 
 /*
@@ -222,31 +258,28 @@ static void
 test_discard_entry(void **state)
 {
     struct entry *e;
-    krb5_context context = *state;
     krb5_data req = string2data("I'm a test request");
     krb5_data rep = string2data("I'm a test response");
 
-    e = insert_entry(context, &req, &rep, 0);
-    discard_entry(context, e);
+    e = insert_entry(&req, &rep, 0);
+    discard_entry(e);
 
-    assert_null(k5_hashtab_get(hash_table, req.data, req.length));
-    assert_int_equal(num_entries, 0);
-    assert_int_equal(total_size, 0);
+    assert_null(lookup(&req));
+    assert_false(e->linked);
+    assert_int_equal(num_entries(), 0);
 }
 
 static void
 test_discard_entry_no_response(void **state)
 {
     struct entry *e;
-    krb5_context context = *state;
     krb5_data req = string2data("I'm a test request");
 
-    e = insert_entry(context, &req, NULL, 0);
-    discard_entry(context, e);
+    e = insert_entry(&req, NULL, 0);
+    discard_entry(e);
 
-    assert_null(k5_hashtab_get(hash_table, req.data, req.length));
-    assert_int_equal(num_entries, 0);
-    assert_int_equal(total_size, 0);
+    assert_null(lookup(&req));
+    assert_int_equal(num_entries(), 0);
 }
 
 /*
@@ -260,12 +293,11 @@ test_kdc_remove_lookaside(void **state)
     krb5_data req = string2data("I'm a test request");
     krb5_data rep = string2data("I'm a test response");
 
-    insert_entry(context, &req, &rep, 0);
+    insert_entry(&req, &rep, 0);
     kdc_remove_lookaside(context, &req);
 
-    assert_null(k5_hashtab_get(hash_table, req.data, req.length));
-    assert_int_equal(num_entries, 0);
-    assert_int_equal(total_size, 0);
+    assert_null(lookup(&req));
+    assert_int_equal(num_entries(), 0);
 }
 
 static void
@@ -274,11 +306,11 @@ test_kdc_remove_lookaside_empty_cache(void **state)
     krb5_context context = *state;
     krb5_data req = string2data("I'm a test request");
 
-    assert_int_equal(num_entries, 0);
+    assert_int_equal(num_entries(), 0);
     kdc_remove_lookaside(context, &req);
 
-    assert_int_equal(num_entries, 0);
-    assert_int_equal(total_size, 0);
+    assert_int_equal(num_entries(), 0);
+    assert_int_equal(cache->used, 0);
 }
 
 static void
@@ -290,12 +322,11 @@ test_kdc_remove_lookaside_unknown(void **state)
     krb5_data rep1 = string2data("I'm a test response");
     krb5_data req2 = string2data("I'm a different test request");
 
-    e = insert_entry(context, &req1, &rep1, 0);
+    e = insert_entry(&req1, &rep1, 0);
     kdc_remove_lookaside(context, &req2);
 
-    assert_ptr_equal(k5_hashtab_get(hash_table, req1.data, req1.length), e);
-    assert_int_equal(num_entries, 1);
-    assert_int_equal(total_size, entry_size(&req1, &rep1));
+    assert_ptr_equal(lookup(&req1), e);
+    assert_int_equal(num_entries(), 1);
 }
 
 static void
@@ -307,21 +338,19 @@ test_kdc_remove_lookaside_multiple(void **state)
     krb5_data rep1 = string2data("I'm a test response");
     krb5_data req2 = string2data("I'm a different test request");
 
-    e1 = insert_entry(context, &req1, &rep1, 0);
-    insert_entry(context, &req2, NULL, 0);
+    e1 = insert_entry(&req1, &rep1, 0);
+    insert_entry(&req2, NULL, 0);
 
     kdc_remove_lookaside(context, &req2);
 
-    assert_null(k5_hashtab_get(hash_table, req2.data, req2.length));
-    assert_ptr_equal(k5_hashtab_get(hash_table, req1.data, req1.length), e1);
-    assert_int_equal(num_entries, 1);
-    assert_int_equal(total_size, entry_size(&req1, &rep1));
+    assert_null(lookup(&req2));
+    assert_ptr_equal(lookup(&req1), e1);
+    assert_int_equal(num_entries(), 1);
 
     kdc_remove_lookaside(context, &req1);
 
-    assert_null(k5_hashtab_get(hash_table, req1.data, req1.length));
-    assert_int_equal(num_entries, 0);
-    assert_int_equal(total_size, 0);
+    assert_null(lookup(&req1));
+    assert_int_equal(num_entries(), 0);
 }
 
 /*
@@ -338,13 +367,13 @@ test_kdc_check_lookaside_hit(void **state)
     krb5_data req = string2data("I'm a test request");
     krb5_data rep = string2data("I'm a test response");
 
-    e = insert_entry(context, &req, &rep, 0);
+    e = insert_entry(&req, &rep, 0);
 
     result = kdc_check_lookaside(context, &req, &result_data);
 
     assert_true(result);
     assert_true(data_eq(rep, *result_data));
-    assert_int_equal(hits, 1);
+    assert_int_equal(hits(), 1);
     assert_int_equal(e->num_hits, 1);
 
     krb5_free_data(context, result_data);
@@ -357,12 +386,20 @@ test_kdc_check_lookaside_no_hit(void **state)
     krb5_data *result_data;
     krb5_context context = *state;
     krb5_data req = string2data("I'm a test request");
+    krb5_data rep = string2data("I'm a test response");
+    krb5_data req2 = string2data("I'm a different test request");
+    struct lookaside_stats stats;
 
-    result = kdc_check_lookaside(context, &req, &result_data);
+    insert_entry(&req, &rep, 0);
+
+    result = kdc_check_lookaside(context, &req2, &result_data);
 
     assert_false(result);
     assert_null(result_data);
-    assert_int_equal(hits, 0);
+    kdc_get_lookaside_stats(&stats);
+    assert_int_equal(stats.calls, 1);
+    assert_int_equal(stats.hits, 0);
+    assert_int_equal(stats.misses, 1);
 }
 
 static void
@@ -379,7 +416,7 @@ test_kdc_check_lookaside_empty(void **state)
 
     assert_false(result);
     assert_null(result_data);
-    assert_int_equal(hits, 0);
+    assert_int_equal(hits(), 0);
 }
 
 static void
@@ -391,7 +428,7 @@ test_kdc_check_lookaside_no_response(void **state)
     krb5_context context = *state;
     krb5_data req = string2data("I'm a test request");
 
-    e = insert_entry(context, &req, NULL, 0);
+    e = insert_entry(&req, NULL, 0);
 
     /* Set result_data so we can verify that it is reset to NULL. */
     result_data = &req;
@@ -399,7 +436,7 @@ test_kdc_check_lookaside_no_response(void **state)
 
     assert_true(result);
     assert_null(result_data);
-    assert_int_equal(hits, 1);
+    assert_int_equal(hits(), 1);
     assert_int_equal(e->num_hits, 1);
 }
 
@@ -414,14 +451,14 @@ test_kdc_check_lookaside_hit_multiple(void **state)
     krb5_data rep1 = string2data("I'm a test response");
     krb5_data req2 = string2data("I'm a different test request");
 
-    e1 = insert_entry(context, &req1, &rep1, 0);
-    e2 = insert_entry(context, &req2, NULL, 0);
+    e1 = insert_entry(&req1, &rep1, 0);
+    e2 = insert_entry(&req2, NULL, 0);
 
     result = kdc_check_lookaside(context, &req1, &result_data);
 
     assert_true(result);
     assert_true(data_eq(rep1, *result_data));
-    assert_int_equal(hits, 1);
+    assert_int_equal(hits(), 1);
     assert_int_equal(e1->num_hits, 1);
     assert_int_equal(e2->num_hits, 0);
 
@@ -433,7 +470,7 @@ test_kdc_check_lookaside_hit_multiple(void **state)
 
     assert_true(result);
     assert_null(result_data);
-    assert_int_equal(hits, 2);
+    assert_int_equal(hits(), 2);
     assert_int_equal(e1->num_hits, 1);
     assert_int_equal(e2->num_hits, 1);
 }
@@ -448,20 +485,17 @@ test_kdc_insert_lookaside_single(void **state)
     krb5_context context = *state;
     krb5_data req = string2data("I'm a test request");
     krb5_data rep = string2data("I'm a test response");
-    struct entry *hash_ent, *exp_ent;
+    struct entry *e;
 
     time_return(0, 0);
     kdc_insert_lookaside(context, &req, &rep);
 
-    hash_ent = k5_hashtab_get(hash_table, req.data, req.length);
-    assert_non_null(hash_ent);
-    assert_true(data_eq(hash_ent->req_packet, req));
-    assert_true(data_eq(hash_ent->reply_packet, rep));
-    exp_ent = K5_TAILQ_FIRST(&expiration_queue);
-    assert_true(data_eq(exp_ent->req_packet, req));
-    assert_true(data_eq(exp_ent->reply_packet, rep));
-    assert_int_equal(num_entries, 1);
-    assert_int_equal(total_size, entry_size(&req, &rep));
+    e = lookup(&req);
+    assert_non_null(e);
+    assert_true(entry_matches(e, &req, &rep));
+    assert_ptr_equal(ENTRY(cache->head), e);
+    assert_int_equal(num_entries(), 1);
+    assert_int_equal(cache->used, entry_size(&req, &rep));
 }
 
 static void
@@ -469,20 +503,17 @@ test_kdc_insert_lookaside_no_reply(void **state)
 {
     krb5_context context = *state;
     krb5_data req = string2data("I'm a test request");
-    struct entry *hash_ent, *exp_ent;
+    struct entry *e;
 
     time_return(0, 0);
     kdc_insert_lookaside(context, &req, NULL);
 
-    hash_ent = k5_hashtab_get(hash_table, req.data, req.length);
-    assert_non_null(hash_ent);
-    assert_true(data_eq(hash_ent->req_packet, req));
-    assert_int_equal(hash_ent->reply_packet.length, 0);
-    exp_ent = K5_TAILQ_FIRST(&expiration_queue);
-    assert_true(data_eq(exp_ent->req_packet, req));
-    assert_int_equal(exp_ent->reply_packet.length, 0);
-    assert_int_equal(num_entries, 1);
-    assert_int_equal(total_size, entry_size(&req, NULL));
+    e = lookup(&req);
+    assert_non_null(e);
+    assert_true(entry_matches(e, &req, NULL));
+    assert_ptr_equal(ENTRY(cache->head), e);
+    assert_int_equal(num_entries(), 1);
+    assert_int_equal(cache->used, entry_size(&req, NULL));
 }
 
 static void
@@ -494,33 +525,27 @@ test_kdc_insert_lookaside_multiple(void **state)
     size_t e1_size = entry_size(&req1, &rep1);
     krb5_data req2 = string2data("I'm a different test request");
     size_t e2_size = entry_size(&req2, NULL);
-    struct entry *hash1_ent, *hash2_ent, *exp_first, *exp_last;
+    struct entry *e1, *e2;
 
     time_return(0, 0);
     kdc_insert_lookaside(context, &req1, &rep1);
 
-    hash1_ent = k5_hashtab_get(hash_table, req1.data, req1.length);
-    assert_non_null(hash1_ent);
-    assert_true(data_eq(hash1_ent->req_packet, req1));
-    assert_true(data_eq(hash1_ent->reply_packet, rep1));
-    exp_first = K5_TAILQ_FIRST(&expiration_queue);
-    assert_true(data_eq(exp_first->req_packet, req1));
-    assert_true(data_eq(exp_first->reply_packet, rep1));
-    assert_int_equal(num_entries, 1);
-    assert_int_equal(total_size, e1_size);
+    e1 = lookup(&req1);
+    assert_non_null(e1);
+    assert_true(entry_matches(e1, &req1, &rep1));
+    assert_int_equal(num_entries(), 1);
+    assert_int_equal(cache->used, e1_size);
 
     time_return(0, 0);
     kdc_insert_lookaside(context, &req2, NULL);
 
-    hash2_ent = k5_hashtab_get(hash_table, req2.data, req2.length);
-    assert_non_null(hash2_ent);
-    assert_true(data_eq(hash2_ent->req_packet, req2));
-    assert_int_equal(hash2_ent->reply_packet.length, 0);
-    exp_last = K5_TAILQ_LAST(&expiration_queue, entry_queue);
-    assert_true(data_eq(exp_last->req_packet, req2));
-    assert_int_equal(exp_last->reply_packet.length, 0);
-    assert_int_equal(num_entries, 2);
-    assert_int_equal(total_size, e1_size + e2_size);
+    e2 = lookup(&req2);
+    assert_non_null(e2);
+    assert_true(entry_matches(e2, &req2, NULL));
+    assert_ptr_equal(ENTRY(cache->head), e1);
+    assert_ptr_equal(ENTRY(cache->head + e1_size), e2);
+    assert_int_equal(num_entries(), 2);
+    assert_int_equal(cache->used, e1_size + e2_size);
 }
 
 static void
@@ -530,77 +555,195 @@ test_kdc_insert_lookaside_cache_expire(void **state)
     krb5_context context = *state;
     krb5_data req1 = string2data("I'm a test request");
     krb5_data rep1 = string2data("I'm a test response");
-    size_t e1_size = entry_size(&req1, &rep1);
     krb5_data req2 = string2data("I'm a different test request");
     size_t e2_size = entry_size(&req2, NULL);
-    struct entry *hash1_ent, *hash2_ent, *exp_ent;
+    struct lookaside_stats stats;
 
     time_return(0, 0);
     kdc_insert_lookaside(context, &req1, &rep1);
 
-    hash1_ent = k5_hashtab_get(hash_table, req1.data, req1.length);
-    assert_non_null(hash1_ent);
-    assert_true(data_eq(hash1_ent->req_packet, req1));
-    assert_true(data_eq(hash1_ent->reply_packet, rep1));
-    exp_ent = K5_TAILQ_FIRST(&expiration_queue);
-    assert_true(data_eq(exp_ent->req_packet, req1));
-    assert_true(data_eq(exp_ent->reply_packet, rep1));
-    assert_int_equal(num_entries, 1);
-    assert_int_equal(total_size, e1_size);
-
     /* Increase hits on entry */
-    e = k5_hashtab_get(hash_table, req1.data, req1.length);
+    e = lookup(&req1);
     assert_non_null(e);
     e->num_hits = 5;
 
     time_return(STALE_TIME + 1, 0);
     kdc_insert_lookaside(context, &req2, NULL);
 
-    assert_null(k5_hashtab_get(hash_table, req1.data, req1.length));
-    assert_int_equal(max_hits_per_entry, 5);
+    assert_null(lookup(&req1));
+    kdc_get_lookaside_stats(&stats);
+    assert_int_equal(stats.max_hits_per_entry, 5);
+    assert_int_equal(stats.evictions, 1);
 
-    hash2_ent = k5_hashtab_get(hash_table, req2.data, req2.length);
-    assert_non_null(hash2_ent);
-    assert_true(data_eq(hash2_ent->req_packet, req2));
-    assert_int_equal(hash2_ent-> reply_packet.length, 0);
-    exp_ent = K5_TAILQ_FIRST(&expiration_queue);
-    assert_true(data_eq(exp_ent->req_packet, req2));
-    assert_int_equal(exp_ent->reply_packet.length, 0);
-    assert_int_equal(num_entries, 1);
-    assert_int_equal(total_size, e2_size);
+    e = lookup(&req2);
+    assert_non_null(e);
+    assert_true(entry_matches(e, &req2, NULL));
+    assert_ptr_equal(ENTRY(cache->head), e);
+    assert_int_equal(num_entries(), 1);
+    assert_int_equal(cache->used, e2_size);
 }
 
+static void
+test_kdc_insert_lookaside_replace(void **state)
+{
+    krb5_context context = *state;
+    krb5_data req = string2data("I'm a test request");
+    krb5_data rep = string2data("I'm a test response");
+    struct entry *e;
+    struct lookaside_stats stats;
+
+    time_return(0, 0);
+    kdc_insert_lookaside(context, &req, NULL);
+    time_return(0, 0);
+    kdc_insert_lookaside(context, &req, &rep);
+
+    e = lookup(&req);
+    assert_non_null(e);
+    assert_true(entry_matches(e, &req, &rep));
+    assert_int_equal(num_entries(), 1);
+
+    /* The replaced record was at the head of the ring, so it has been
+     * reclaimed without counting as an eviction. */
+    assert_ptr_equal(ENTRY(cache->head), e);
+    assert_int_equal(cache->used, entry_size(&req, &rep));
+    kdc_get_lookaside_stats(&stats);
+    assert_int_equal(stats.evictions, 0);
+}
+
+static void
+test_kdc_insert_lookaside_wrap(void **state)
+{
+    krb5_boolean result;
+    krb5_data *result_data;
+    krb5_context context = *state;
+    krb5_boolean shared = cache->shared;
+    char reqbuf[32], repbuf[32];
+    krb5_data req, rep;
+    struct lookaside_stats stats;
+    int i;
+
+    /* Use a ring with room for only a few records. */
+    kdc_free_lookaside(context);
+    ring_size = SMALL_RING_SIZE;
+    assert_int_equal(kdc_init_lookaside(context, shared), 0);
+
+    for (i = 0; i < 10; i++) {
+        snprintf(reqbuf, sizeof(reqbuf), "request %d", i);
+        snprintf(repbuf, sizeof(repbuf), "reply %d", i);
+        req = string2data(reqbuf);
+        rep = string2data(repbuf);
+        time_return(0, 0);
+        kdc_insert_lookaside(context, &req, &rep);
+        assert_true(cache->used <= ring_size);
+    }
+
+    /* The oldest entries have been evicted to make room for the newest. */
+    req = string2data("request 0");
+    result = kdc_check_lookaside(context, &req, &result_data);
+    assert_false(result);
+    kdc_get_lookaside_stats(&stats);
+    assert_int_equal(stats.evictions, 10 - num_entries());
+
+    for (i = 7; i < 10; i++) {
+        snprintf(reqbuf, sizeof(reqbuf), "request %d", i);
+        snprintf(repbuf, sizeof(repbuf), "reply %d", i);
+        req = string2data(reqbuf);
+        rep = string2data(repbuf);
+        result = kdc_check_lookaside(context, &req, &result_data);
+        assert_true(result);
+        assert_true(data_eq(rep, *result_data));
+        krb5_free_data(context, result_data);
+    }
+}
+
+#ifdef SHARED_LOOKASIDE
+
+#include <sys/wait.h>
+
+static void
+test_kdc_shared_dead_worker(void **state)
+{
+    krb5_boolean result;
+    krb5_data *result_data;
+    krb5_context context = *state;
+    krb5_data req1 = string2data("I'm a test request");
+    krb5_data rep1 = string2data("I'm a test response");
+    krb5_data req2 = string2data("I'm a different test request");
+    krb5_data rep2 = string2data("I'm a different test response");
+    struct stripe *st = stripe(entry_hash(&req1));
+    pid_t pid;
+    int status;
+
+    time_return(0, 0);
+    kdc_insert_lookaside(context, &req1, &rep1);
+
+    /* Simulate a worker process which dies holding the stripe and ring
+     * locks. */
+    pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        k5_mutex_lock_shared(&st->lock);
+        k5_mutex_lock_shared(&cache->ring_lock);
+        _exit(0);
+    }
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+
+    /* The entries behind the abandoned locks are dropped, and the cache
+     * remains usable. */
+    result = kdc_check_lookaside(context, &req1, &result_data);
+    assert_false(result);
+    time_return(0, 0);
+    kdc_insert_lookaside(context, &req2, &rep2);
+    assert_int_equal(num_entries(), 1);
+    result = kdc_check_lookaside(context, &req2, &result_data);
+    assert_true(result);
+    assert_true(data_eq(rep2, *result_data));
+    krb5_free_data(context, result_data);
+}
+
+#endif /* SHARED_LOOKASIDE */
+
+/* Run each test against a private and (if supported) a shared cache. */
+#define REPLAY_TESTS(unit_test)                                         \
+    /* entry_size tests */                                              \
+    unit_test(test_entry_size_no_response),                             \
+    unit_test(test_entry_size_w_response),                              \
+    /* insert_entry tests */                                            \
+    unit_test(test_insert_entry),                                       \
+    unit_test(test_insert_entry_no_response),                           \
+    unit_test(test_insert_entry_multiple),                              \
+    /* discard_entry tests */                                           \
+    unit_test(test_discard_entry),                                      \
+    unit_test(test_discard_entry_no_response),                          \
+    /* kdc_remove_lookaside tests */                                    \
+    unit_test(test_kdc_remove_lookaside),                               \
+    unit_test(test_kdc_remove_lookaside_empty_cache),                   \
+    unit_test(test_kdc_remove_lookaside_unknown),                       \
+    unit_test(test_kdc_remove_lookaside_multiple),                      \
+    /* kdc_check_lookaside tests */                                     \
+    unit_test(test_kdc_check_lookaside_hit),                            \
+    unit_test(test_kdc_check_lookaside_no_hit),                         \
+    unit_test(test_kdc_check_lookaside_empty),                          \
+    unit_test(test_kdc_check_lookaside_no_response),                    \
+    unit_test(test_kdc_check_lookaside_hit_multiple),                   \
+    /* kdc_insert_lookaside tests */                                    \
+    unit_test(test_kdc_insert_lookaside_single),                        \
+    unit_test(test_kdc_insert_lookaside_no_reply),                      \
+    unit_test(test_kdc_insert_lookaside_multiple),                      \
+    unit_test(test_kdc_insert_lookaside_cache_expire),                  \
+    unit_test(test_kdc_insert_lookaside_replace),                       \
+    unit_test(test_kdc_insert_lookaside_wrap)
+
 int main()
 {
     int ret;
 
     const struct CMUnitTest replay_tests[] = {
-        /* entry_size tests */
-        replay_unit_test(test_entry_size_no_response),
-        replay_unit_test(test_entry_size_w_response),
-        /* insert_entry tests */
-        replay_unit_test(test_insert_entry),
-        replay_unit_test(test_insert_entry_no_response),
-        replay_unit_test(test_insert_entry_multiple),
-        /* discard_entry tests */
-        replay_unit_test(test_discard_entry),
-        replay_unit_test(test_discard_entry_no_response),
-        /* kdc_remove_lookaside tests */
-        replay_unit_test(test_kdc_remove_lookaside),
-        replay_unit_test(test_kdc_remove_lookaside_empty_cache),
-        replay_unit_test(test_kdc_remove_lookaside_unknown),
-        replay_unit_test(test_kdc_remove_lookaside_multiple),
-        /* kdc_check_lookaside tests */
-        replay_unit_test(test_kdc_check_lookaside_hit),
-        replay_unit_test(test_kdc_check_lookaside_no_hit),
-        replay_unit_test(test_kdc_check_lookaside_empty),
-        replay_unit_test(test_kdc_check_lookaside_no_response),
-        replay_unit_test(test_kdc_check_lookaside_hit_multiple),
-        /* kdc_insert_lookaside tests */
-        replay_unit_test(test_kdc_insert_lookaside_single),
-        replay_unit_test(test_kdc_insert_lookaside_no_reply),
-        replay_unit_test(test_kdc_insert_lookaside_multiple),
-        replay_unit_test(test_kdc_insert_lookaside_cache_expire)
+        REPLAY_TESTS(replay_unit_test),
+#ifdef SHARED_LOOKASIDE
+        REPLAY_TESTS(shared_unit_test),
+        shared_unit_test(test_kdc_shared_dead_worker),
+#endif
     };
 
     ret = cmocka_run_group_tests_name("replay_lookaside", replay_tests,
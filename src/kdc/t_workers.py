@@ -1,7 +1,60 @@
 from k5test import *
 
-realm = K5Realm(start_kdc=False, create_host=False)
+realm = K5Realm(start_kdc=False)
 realm.start_kdc(['-w', '3'])
 realm.kinit(realm.user_princ, password('user'))
 realm.klist(realm.user_princ)
-success('KDC worker processes')
+realm.stop_kdc()
+
+mark('worker threads')
+realm.start_kdc(['-t', '3'])
+realm.kinit(realm.user_princ, password('user'))
+realm.klist(realm.user_princ)
+realm.run([kvno, realm.host_princ])
+realm.run([kvno, 'nonexistent'], expected_code=1,
+          expected_msg='not found in Kerberos database')
+
+# Each worker thread has its own database handle, so requests can be
+# processed in parallel.
+procs = []
+for i in range(6):
+    ccache = os.path.join(realm.testdir, 'ccache%d' % i)
+    procs.append(subprocess.Popen([kinit, '-k', '-c', ccache,
+                                   realm.host_princ], env=realm.env))
+for p in procs:
+    if p.wait() != 0:
+        fail('kinit failed with worker threads')
+realm.stop()
+
+# The principal cache is shared among the worker threads, so every
+# thread sees a cached negative entry.
+mark('worker threads with principal cache')
+conf = {'dbmodules': {'db': {'principal_cache_size': '100',
+                             'principal_negative_cache_ttl': '1h'}}}
+realm = K5Realm(kdc_conf=conf, start_kdc=False)
+realm.start_kdc(['-t', '3'])
+realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, 'later'], expected_code=1)
+realm.run([kadminl, 'addprinc', '-randkey', 'later'])
+for i in range(6):
+    realm.run([kvno, 'later'], expected_code=1,
+              expected_msg='not found in Kerberos database')
+realm.stop_kdc()
+
+# With kdc_reuseport, each worker after the first sets up its own
+# listener sockets alongside the ones inherited from the supervisor.
+mark('worker processes with kdc_reuseport and kdc_shared_lookaside')
+conf = {'kdcdefaults': {'kdc_reuseport': 'true',
+                        'kdc_shared_lookaside': 'true'}}
+realm = K5Realm(kdc_conf=conf, start_kdc=False)
+realm.start_kdc(['-w', '3'])
+for i in range(5):
+    realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, realm.host_princ])
+realm.stop_kdc()
+with open(os.path.join(realm.testdir, 'kdc.log')) as f:
+    nsetups = f.read().count('setting up network...')
+if nsetups != 3:
+    fail('Expected 3 network setups with kdc_reuseport, got %d' % nsetups)
+
+success('KDC worker processes and threads')
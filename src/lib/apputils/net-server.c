@@ -59,8 +59,10 @@
 
 #include "fake-addrinfo.h"
 #include "net-server.h"
+#include "k5-queue.h"
 #include <signal.h>
 #include <netdb.h>
+#include <sys/resource.h>
 
 #include "udppktinfo.h"
 
@@ -70,6 +72,26 @@
 static int tcp_or_rpc_data_counter;
 static int max_tcp_or_rpc_data_connections = 45;
 
+/* Leave this many file descriptors for listeners, databases, and logs when
+ * fitting the connection limit to the open file limit. */
+#define RESERVED_FDS 64
+
+/* Close TCP connections which have been idle for TCP_IDLE_TIMEOUT seconds,
+ * checking every IDLE_CHECK_INTERVAL milliseconds. */
+#define TCP_IDLE_TIMEOUT 60
+#define IDLE_CHECK_INTERVAL 5000
+
+/* The largest TCP request we will read. */
+#define MAX_TCP_REQUEST (1024 * 1024 - 4)
+
+/* TCP requests of up to POOLED_BUFSIZE bytes are read into buffers from a
+ * pool of at most MAX_POOLED_BUFS, instead of allocating one each time. */
+#define POOLED_BUFSIZE 8192
+#define MAX_POOLED_BUFS 64
+
+static char *buf_pool[MAX_POOLED_BUFS];
+static int buf_pool_count;
+
 static int
 setreuseaddr(int sock, int value)
 {
@@ -144,7 +166,9 @@ struct connection {
     krb5_address remote_addr_buf;
     krb5_fulladdr remote_addr;
 
-    /* Incoming data (TCP) */
+    /* Incoming data (TCP).  offset counts the length prefix, which is read
+     * into msglenbuf; buffer is allocated once the length is known. */
+    unsigned char msglenbuf[4];
     size_t bufsiz;
     size_t offset;
     char *buffer;
@@ -156,9 +180,14 @@ struct connection {
     sg_buf sgbuf[2];
     sg_buf *sgp;
     int sgnum;
+    int close_after_send;
 
-    /* Crude denial-of-service avoidance support (TCP or RPC) */
+    /* Crude denial-of-service avoidance support (TCP or RPC).  Connections
+     * are kept on a list in order of start_time, which is reset when a
+     * reply is sent; ev is NULL while a request is being dispatched. */
     time_t start_time;
+    verto_ev *ev;
+    K5_TAILQ_ENTRY(connection) links;
 
     /* RPC-specific fields */
     SVCXPRT *transp;
@@ -213,9 +242,16 @@ struct bind_address {
     struct rpc_svc_data rpc_svc_data;
 };
 
+/* Events for listener and UDP sockets.  TCP and RPC connections are tracked
+ * on the lists below instead, oldest first. */
 static SET(verto_ev *) events;
 static SET(struct bind_address) bind_addresses;
 
+K5_TAILQ_HEAD(conn_list, connection);
+static struct conn_list tcp_conns = K5_TAILQ_HEAD_INITIALIZER(tcp_conns);
+static struct conn_list rpc_conns = K5_TAILQ_HEAD_INITIALIZER(rpc_conns);
+static verto_ev *idle_timer;
+
 verto_ctx *
 loop_init(verto_ev_type types)
 {
@@ -450,6 +486,60 @@ loop_add_rpc_service(int default_port, const char *addresses, u_long prognum,
 #define SOCKET_ERRNO errno
 #include "foreachaddr.h"
 
+/* Get a buffer of at least len bytes for a TCP request, preferably from the
+ * pool. */
+static char *
+get_request_buffer(size_t len, size_t *size_out)
+{
+    if (len > POOLED_BUFSIZE) {
+        *size_out = len;
+        return malloc(len);
+    }
+    *size_out = POOLED_BUFSIZE;
+    if (buf_pool_count > 0)
+        return buf_pool[--buf_pool_count];
+    return malloc(POOLED_BUFSIZE);
+}
+
+/* Release conn's request buffer, returning it to the pool if possible. */
+static void
+release_request_buffer(struct connection *conn)
+{
+    if (conn->buffer == NULL)
+        return;
+    if (conn->bufsiz == POOLED_BUFSIZE && buf_pool_count < MAX_POOLED_BUFS)
+        buf_pool[buf_pool_count++] = conn->buffer;
+    else
+        free(conn->buffer);
+    conn->buffer = NULL;
+    conn->bufsiz = 0;
+}
+
+static void
+free_buffer_pool(void)
+{
+    while (buf_pool_count > 0)
+        free(buf_pool[--buf_pool_count]);
+}
+
+static inline struct conn_list *
+list_for_conn(struct connection *conn)
+{
+    return (conn->type == CONN_RPC) ? &rpc_conns : &tcp_conns;
+}
+
+/* Move a TCP or RPC connection to the end of its list, marking it as the most
+ * recently active. */
+static void
+touch_connection(struct connection *conn)
+{
+    struct conn_list *list = list_for_conn(conn);
+
+    K5_TAILQ_REMOVE(list, conn, links);
+    conn->start_time = time(0);
+    K5_TAILQ_INSERT_TAIL(list, conn, links);
+}
+
 static void
 free_connection(struct connection *conn)
 {
@@ -457,8 +547,9 @@ free_connection(struct connection *conn)
         return;
     if (conn->response)
         krb5_free_data(get_context(conn->handle), conn->response);
-    if (conn->buffer)
-        free(conn->buffer);
+    release_request_buffer(conn);
+    if (conn->type == CONN_TCP || conn->type == CONN_RPC)
+        K5_TAILQ_REMOVE(list_for_conn(conn), conn, links);
     if (conn->type == CONN_RPC_LISTENER && conn->transp != NULL)
         svc_destroy(conn->transp);
     free(conn);
@@ -485,11 +576,14 @@ free_socket(verto_ctx *ctx, verto_ev *ev)
     fd_set fds;
     int fd;
 
-    remove_event_from_set(ev);
-
     fd = verto_get_fd(ev);
     conn = verto_get_private(ev);
 
+    if (conn != NULL && (conn->type == CONN_TCP || conn->type == CONN_RPC))
+        conn->ev = NULL;
+    else
+        remove_event_from_set(ev);
+
     /* Close the file descriptor. */
     krb5_klog_syslog(LOG_INFO, _("closing down fd %d"), fd);
     if (fd >= 0 && (!conn || conn->type != CONN_RPC || conn->rpc_force_close))
@@ -535,7 +629,9 @@ make_event(verto_ctx *ctx, verto_ev_flag flags, verto_callback callback,
         return NULL;
     }
 
-    if (!ADD(events, ev, tmp)) {
+    if (conn->type == CONN_TCP || conn->type == CONN_RPC) {
+        conn->ev = ev;
+    } else if (!ADD(events, ev, tmp)) {
         com_err(conn->prog, ENOMEM, _("cannot save event"));
         verto_del(ev);
         return NULL;
@@ -555,7 +651,9 @@ add_fd(int sock, enum conn_type conntype, verto_ev_flag flags, void *handle,
     *ev_out = NULL;
 
 #ifndef _WIN32
-    if (sock >= FD_SETSIZE) {
+    /* RPC connections are serviced with svc_getreqset(), which uses an
+     * fd_set. */
+    if (conntype == CONN_RPC && sock >= FD_SETSIZE) {
         com_err(prog, 0, _("file descriptor number %d too high"), sock);
         return EMFILE;
     }
@@ -570,8 +668,16 @@ add_fd(int sock, enum conn_type conntype, verto_ev_flag flags, void *handle,
     newconn->handle = handle;
     newconn->prog = prog;
     newconn->type = conntype;
+    if (conntype == CONN_TCP || conntype == CONN_RPC) {
+        newconn->start_time = time(0);
+        K5_TAILQ_INSERT_TAIL(list_for_conn(newconn), newconn, links);
+    }
 
     *ev_out = make_event(ctx, flags, callback, sock, newconn);
+    if (*ev_out == NULL) {
+        free_connection(newconn);
+        return ENOMEM;
+    }
     return 0;
 }
 
@@ -581,6 +687,7 @@ static void process_tcp_connection_read(verto_ctx *ctx, verto_ev *ev);
 static void process_tcp_connection_write(verto_ctx *ctx, verto_ev *ev);
 static void accept_rpc_connection(verto_ctx *ctx, verto_ev *ev);
 static void process_rpc_connection(verto_ctx *ctx, verto_ev *ev);
+static void expire_idle_connections(verto_ctx *ctx, verto_ev *ev);
 
 /*
  * Create a socket and bind it to addr.  Ensure the socket will work with
@@ -893,6 +1000,55 @@ cleanup:
     return ret;
 }
 
+void
+loop_set_max_connections(int max_connections)
+{
+    if (max_connections > 0)
+        max_tcp_or_rpc_data_connections = max_connections;
+}
+
+/* Make sure the open file limit allows for the maximum number of connections,
+ * raising it if possible or lowering the maximum otherwise.  Running out of
+ * descriptors would leave new clients waiting in the listen queue instead of
+ * displacing the oldest connections. */
+static void
+fit_connection_limit(void)
+{
+    struct rlimit rl;
+    rlim_t want;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY)
+        return;
+    want = (rlim_t)max_tcp_or_rpc_data_connections + RESERVED_FDS;
+    if (want <= rl.rlim_cur)
+        return;
+
+    if (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > rl.rlim_cur) {
+        rl.rlim_cur = (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < want) ?
+            rl.rlim_max : want;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+            (void)getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (want > rl.rlim_cur && rl.rlim_cur > 2 * RESERVED_FDS) {
+        max_tcp_or_rpc_data_connections = rl.rlim_cur - RESERVED_FDS;
+        krb5_klog_syslog(LOG_WARNING, _("limiting connections to %d to fit "
+                                        "the open file limit"),
+                         max_tcp_or_rpc_data_connections);
+    }
+}
+
+/* Close the TCP and RPC connections on list which are waiting for I/O. */
+static void
+close_connections(struct conn_list *list)
+{
+    struct connection *c, *next;
+
+    K5_TAILQ_FOREACH_SAFE(c, list, links, next) {
+        if (c->ev != NULL)
+            verto_del(c->ev);
+    }
+}
+
 krb5_error_code
 loop_setup_network(verto_ctx *ctx, void *handle, const char *prog,
                    int tcp_listen_backlog)
@@ -909,6 +1065,17 @@ loop_setup_network(verto_ctx *ctx, void *handle, const char *prog,
     FOREACH_ELT(events, i, ev)
         verto_del(ev);
     events.n = 0;
+    close_connections(&tcp_conns);
+    close_connections(&rpc_conns);
+
+    fit_connection_limit();
+    if (idle_timer == NULL) {
+        idle_timer = verto_add_timeout(ctx, VERTO_EV_FLAG_PERSIST,
+                                       expire_idle_connections,
+                                       IDLE_CHECK_INTERVAL);
+        if (idle_timer == NULL)
+            return ENOMEM;
+    }
 
     krb5_klog_syslog(LOG_INFO, _("setting up network..."));
     ret = setup_addresses(ctx, handle, prog, tcp_listen_backlog);
@@ -958,6 +1125,7 @@ init_addr(krb5_fulladdr *faddr, struct sockaddr *sa)
 }
 
 struct udp_dispatch_state {
+    struct udp_dispatch_state *next;
     void *handle;
     const char *prog;
     int port_fd;
@@ -971,20 +1139,62 @@ struct udp_dispatch_state {
     struct sockaddr_storage daddr;
     aux_addressing_info auxaddr;
     krb5_data request;
+    krb5_data *response;
     char pktbuf[MAX_DGRAM_SIZE];
 };
 
+/* Dispatch states are large, so keep finished ones around for reuse. */
+static struct udp_dispatch_state *free_udp_states;
+
+/*
+ * While process_packet() is dispatching a batch of datagrams, replies which
+ * are produced synchronously are queued here and sent together once the
+ * batch has been dispatched.
+ */
+static krb5_boolean udp_batching;
+static int udp_batch_fd = -1;
+static struct udp_dispatch_state *udp_replies[UDP_BATCH_MAX];
+static int udp_nreplies;
+
+static struct udp_dispatch_state *
+get_udp_state(void)
+{
+    struct udp_dispatch_state *state = free_udp_states;
+
+    if (state != NULL) {
+        free_udp_states = state->next;
+        return state;
+    }
+    return malloc(sizeof(*state));
+}
+
 static void
-process_packet_response(void *arg, krb5_error_code code, krb5_data *response)
+release_udp_state(struct udp_dispatch_state *state)
 {
-    struct udp_dispatch_state *state = arg;
-    int cc;
+    krb5_free_data(get_context(state->handle), state->response);
+    state->response = NULL;
+    state->next = free_udp_states;
+    free_udp_states = state;
+}
 
-    if (code)
-        com_err(state->prog ? state->prog : NULL, code,
-                _("while dispatching (udp)"));
-    if (code || response == NULL)
-        goto out;
+static void
+free_udp_states_list(void)
+{
+    struct udp_dispatch_state *state, *next;
+
+    for (state = free_udp_states; state != NULL; state = next) {
+        next = state->next;
+        free(state);
+    }
+    free_udp_states = NULL;
+}
+
+/* Send state->response individually, logging any failure. */
+static void
+send_udp_reply(struct udp_dispatch_state *state)
+{
+    krb5_data *response = state->response;
+    int cc;
 
     cc = send_to_from(state->port_fd, response->data,
                       (socklen_t) response->length, 0,
@@ -1013,63 +1223,77 @@ process_packet_response(void *arg, krb5_error_code code, krb5_data *response)
 
         com_err(state->prog, e, _("while sending reply to %s/%s from %s"),
                 saddrbuf, sportbuf, daddrbuf);
-        goto out;
+        return;
     }
     if ((size_t)cc != response->length) {
         com_err(state->prog, 0, _("short reply write %d vs %d\n"),
                 response->length, cc);
     }
-
-out:
-    krb5_free_data(get_context(state->handle), response);
-    free(state);
 }
 
+/* Send the replies queued during a batch, with one system call if
+ * possible. */
 static void
-process_packet(verto_ctx *ctx, verto_ev *ev)
+flush_udp_replies(void)
 {
-    int cc;
-    struct connection *conn;
+    udp_dgram dgrams[UDP_BATCH_MAX];
     struct udp_dispatch_state *state;
+    int i, n;
 
-    conn = verto_get_private(ev);
-
-    state = malloc(sizeof(*state));
-    if (!state) {
-        com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
+    if (udp_nreplies == 0)
         return;
+
+    for (i = 0; i < udp_nreplies; i++) {
+        state = udp_replies[i];
+        dgrams[i].buf = state->response->data;
+        dgrams[i].len = state->response->length;
+        dgrams[i].remote = ss2sa(&state->saddr);
+        dgrams[i].remote_len = &state->saddr_len;
+        dgrams[i].local = ss2sa(&state->daddr);
+        dgrams[i].local_len = &state->daddr_len;
+        dgrams[i].auxaddr = &state->auxaddr;
+    }
+    n = (udp_nreplies > 1) ?
+        send_to_from_batch(udp_batch_fd, dgrams, udp_nreplies, 0) : 0;
+
+    /* Send anything the batch didn't cover one at a time, so that errors are
+     * reported against the right client. */
+    for (i = 0; i < udp_nreplies; i++) {
+        if (i >= n)
+            send_udp_reply(udp_replies[i]);
+        release_udp_state(udp_replies[i]);
     }
+    udp_nreplies = 0;
+}
 
-    state->handle = conn->handle;
-    state->prog = conn->prog;
-    state->port_fd = verto_get_fd(ev);
-    assert(state->port_fd >= 0);
-
-    state->saddr_len = sizeof(state->saddr);
-    state->daddr_len = sizeof(state->daddr);
-    memset(&state->auxaddr, 0, sizeof(state->auxaddr));
-    cc = recv_from_to(state->port_fd, state->pktbuf, sizeof(state->pktbuf), 0,
-                      (struct sockaddr *)&state->saddr, &state->saddr_len,
-                      (struct sockaddr *)&state->daddr, &state->daddr_len,
-                      &state->auxaddr);
-    if (cc == -1) {
-        if (errno != EINTR && errno != EAGAIN
-            /*
-             * This is how Linux indicates that a previous transmission was
-             * refused, e.g., if the client timed out before getting the
-             * response packet.
-             */
-            && errno != ECONNREFUSED
-        )
-            com_err(conn->prog, errno, _("while receiving from network"));
-        free(state);
+static void
+process_packet_response(void *arg, krb5_error_code code, krb5_data *response)
+{
+    struct udp_dispatch_state *state = arg;
+
+    state->response = response;
+    if (code)
+        com_err(state->prog ? state->prog : NULL, code,
+                _("while dispatching (udp)"));
+    if (code || response == NULL) {
+        release_udp_state(state);
         return;
     }
-    if (!cc) { /* zero-length packet? */
-        free(state);
+
+    if (udp_batching && state->port_fd == udp_batch_fd &&
+        udp_nreplies < UDP_BATCH_MAX) {
+        udp_replies[udp_nreplies++] = state;
         return;
     }
 
+    send_udp_reply(state);
+    release_udp_state(state);
+}
+
+static void
+dispatch_udp_state(verto_ctx *ctx, struct connection *conn,
+                   struct udp_dispatch_state *state)
+{
     if (state->daddr_len == 0 && conn->type == CONN_UDP) {
         /*
          * An address couldn't be obtained, so the PKTINFO option probably
@@ -1083,7 +1307,6 @@ process_packet(verto_ctx *ctx, verto_ev *ev)
         /* On failure, keep going anyways. */
     }
 
-    state->request.length = cc;
     state->request.data = state->pktbuf;
 
     state->remote_addr.address = &state->remote_addr_buf;
@@ -1097,39 +1320,130 @@ process_packet(verto_ctx *ctx, verto_ev *ev)
              &state->request, 0, ctx, process_packet_response, state);
 }
 
-static int
-kill_lru_tcp_or_rpc_connection(void *handle, verto_ev *newev)
+/*
+ * Receive and dispatch up to UDP_BATCH_MAX datagrams from a UDP socket, then
+ * send the replies which were generated synchronously in a single batch.
+ * Replies generated asynchronously are sent as they become available.
+ */
+static void
+process_packet(verto_ctx *ctx, verto_ev *ev)
 {
-    struct connection *c = NULL, *oldest_c = NULL;
-    verto_ev *ev, *oldest_ev = NULL;
-    int i, fd = -1;
+    int i, n, count, fd;
+    struct connection *conn;
+    struct udp_dispatch_state *state, *states[UDP_BATCH_MAX];
+    udp_dgram dgrams[UDP_BATCH_MAX];
 
-    krb5_klog_syslog(LOG_INFO, _("too many connections"));
+    conn = verto_get_private(ev);
+    fd = verto_get_fd(ev);
+    assert(fd >= 0);
 
-    FOREACH_ELT (events, i, ev) {
-        if (ev == newev)
-            continue;
+    for (count = 0; count < UDP_BATCH_MAX; count++) {
+        state = get_udp_state();
+        if (state == NULL)
+            break;
+        states[count] = state;
 
-        c = verto_get_private(ev);
-        if (!c)
-            continue;
-        if (c->type != CONN_TCP && c->type != CONN_RPC)
+        state->handle = conn->handle;
+        state->prog = conn->prog;
+        state->port_fd = fd;
+        state->response = NULL;
+        state->saddr_len = sizeof(state->saddr);
+        state->daddr_len = sizeof(state->daddr);
+        memset(&state->auxaddr, 0, sizeof(state->auxaddr));
+
+        dgrams[count].buf = state->pktbuf;
+        dgrams[count].bufsize = sizeof(state->pktbuf);
+        dgrams[count].remote = ss2sa(&state->saddr);
+        dgrams[count].remote_len = &state->saddr_len;
+        dgrams[count].local = ss2sa(&state->daddr);
+        dgrams[count].local_len = &state->daddr_len;
+        dgrams[count].auxaddr = &state->auxaddr;
+    }
+    if (count == 0) {
+        com_err(conn->prog, ENOMEM, _("while dispatching (udp)"));
+        return;
+    }
+
+    n = recv_from_to_batch(fd, dgrams, count, 0);
+    if (n == -1) {
+        if (errno != EINTR && errno != EAGAIN
+            /*
+             * This is how Linux indicates that a previous transmission was
+             * refused, e.g., if the client timed out before getting the
+             * response packet.
+             */
+            && errno != ECONNREFUSED
+        )
+            com_err(conn->prog, errno, _("while receiving from network"));
+        n = 0;
+    }
+
+    udp_batching = TRUE;
+    udp_batch_fd = fd;
+    for (i = 0; i < count; i++) {
+        state = states[i];
+        if (i >= n || dgrams[i].len == 0) { /* zero-length packet? */
+            release_udp_state(state);
             continue;
-        if (oldest_c == NULL
-            || oldest_c->start_time > c->start_time) {
-            oldest_ev = ev;
-            oldest_c = c;
         }
+        state->request.length = dgrams[i].len;
+        dispatch_udp_state(ctx, conn, state);
+    }
+    udp_batching = FALSE;
+    flush_udp_replies();
+    udp_batch_fd = -1;
+}
+
+/* Return the least recently active connection on list which is not being
+ * dispatched and does not belong to newev. */
+static struct connection *
+oldest_connection(struct conn_list *list, verto_ev *newev)
+{
+    struct connection *c;
+
+    K5_TAILQ_FOREACH(c, list, links) {
+        if (c->ev != NULL && c->ev != newev)
+            return c;
     }
+    return NULL;
+}
+
+static void
+kill_lru_tcp_or_rpc_connection(verto_ev *newev)
+{
+    struct connection *oldest_c, *rpc_c;
+
+    krb5_klog_syslog(LOG_INFO, _("too many connections"));
+
+    oldest_c = oldest_connection(&tcp_conns, newev);
+    rpc_c = oldest_connection(&rpc_conns, newev);
+    if (oldest_c == NULL ||
+        (rpc_c != NULL && rpc_c->start_time < oldest_c->start_time))
+        oldest_c = rpc_c;
     if (oldest_c != NULL) {
         krb5_klog_syslog(LOG_INFO, _("dropping %s fd %d from %s"),
-                         c->type == CONN_RPC ? "rpc" : "tcp",
-                         verto_get_fd(oldest_ev), oldest_c->addrbuf);
+                         oldest_c->type == CONN_RPC ? "rpc" : "tcp",
+                         verto_get_fd(oldest_c->ev), oldest_c->addrbuf);
         if (oldest_c->type == CONN_RPC)
             oldest_c->rpc_force_close = 1;
-        verto_del(oldest_ev);
+        verto_del(oldest_c->ev);
+    }
+}
+
+/* Close TCP connections which have been idle for too long.  The list is in
+ * order of activity, so stop at the first recently active connection. */
+static void
+expire_idle_connections(verto_ctx *ctx, verto_ev *ev)
+{
+    struct connection *c, *next;
+    time_t cutoff = time(0) - TCP_IDLE_TIMEOUT;
+
+    K5_TAILQ_FOREACH_SAFE(c, &tcp_conns, links, next) {
+        if (c->start_time > cutoff)
+            break;
+        if (c->ev != NULL)
+            verto_del(c->ev);
     }
-    return fd;
 }
 
 static void
@@ -1149,12 +1463,6 @@ accept_tcp_connection(verto_ctx *ctx, verto_ev *ev)
     if (s < 0)
         return;
     set_cloexec_fd(s);
-#ifndef _WIN32
-    if (s >= FD_SETSIZE) {
-        close(s);
-        return;
-    }
-#endif
     setnbio(s), setnolinger(s), setkeepalive(s);
 
     flags = VERTO_EV_FLAG_IO_READ | VERTO_EV_FLAG_PERSIST;
@@ -1183,20 +1491,10 @@ accept_tcp_connection(verto_ctx *ctx, verto_ev *ev)
 
     newconn->addr_s = addr_s;
     newconn->addrlen = addrlen;
-    newconn->bufsiz = 1024 * 1024;
-    newconn->buffer = malloc(newconn->bufsiz);
-    newconn->start_time = time(0);
 
     if (++tcp_or_rpc_data_counter > max_tcp_or_rpc_data_connections)
-        kill_lru_tcp_or_rpc_connection(conn->handle, newev);
+        kill_lru_tcp_or_rpc_connection(newev);
 
-    if (newconn->buffer == 0) {
-        com_err(conn->prog, errno,
-                _("allocating buffer for new TCP session from %s"),
-                newconn->addrbuf);
-        verto_del(newev);
-        return;
-    }
     newconn->offset = 0;
     newconn->remote_addr.address = &newconn->remote_addr_buf;
     init_addr(&newconn->remote_addr, ss2sa(&newconn->addr_s));
@@ -1223,6 +1521,9 @@ process_tcp_response(void *arg, krb5_error_code code, krb5_data *response)
     assert(state);
     state->conn->response = response;
 
+    /* The request has been processed, so its buffer can be reused. */
+    release_request_buffer(state->conn);
+
     if (code)
         com_err(state->conn->prog, code, _("while dispatching (tcp)"));
     if (code || !response)
@@ -1230,6 +1531,7 @@ process_tcp_response(void *arg, krb5_error_code code, krb5_data *response)
 
     /* Queue outgoing response. */
     store_32_be(response->length, state->conn->lenbuf);
+    SG_SET(&state->conn->sgbuf[0], state->conn->lenbuf, 4);
     SG_SET(&state->conn->sgbuf[1], response->data, response->length);
     state->conn->sgp = state->conn->sgbuf;
     state->conn->sgnum = 2;
@@ -1262,8 +1564,8 @@ prepare_for_dispatch(verto_ctx *ctx, verto_ev *ev)
     state->conn = verto_get_private(ev);
     state->sock = verto_get_fd(ev);
     state->ctx = ctx;
+    state->conn->ev = NULL;
     verto_set_private(ev, NULL, NULL); /* Don't close the fd or free conn! */
-    remove_event_from_set(ev); /* Remove it from the set. */
     verto_del(ev);
     return state;
 }
@@ -1279,10 +1581,9 @@ process_tcp_connection_read(verto_ctx *ctx, verto_ev *ev)
     conn = verto_get_private(ev);
 
     /*
-     * Read message length and data into one big buffer, already allocated
-     * at connect time.  If we have a complete message, we stop reading, so
-     * we should only be here if there is no data in the buffer, or only an
-     * incomplete message.
+     * Read the message length, then the message into a buffer sized for it.
+     * If we have a complete message, we stop reading, so we should only be
+     * here if there is no data in the buffer, or only an incomplete message.
      */
     if (conn->offset < 4) {
         krb5_data *response = NULL;
@@ -1291,22 +1592,21 @@ process_tcp_connection_read(verto_ctx *ctx, verto_ev *ev)
          * here, letting the kernel worry about buffering. */
         len = 4 - conn->offset;
         nread = SOCKET_READ(verto_get_fd(ev),
-                            conn->buffer + conn->offset, len);
+                            conn->msglenbuf + conn->offset, len);
         if (nread < 0) /* error */
             goto kill_tcp_connection;
         if (nread == 0) /* eof */
             goto kill_tcp_connection;
         conn->offset += nread;
         if (conn->offset == 4) {
-            unsigned char *p = (unsigned char *)conn->buffer;
-            conn->msglen = load_32_be(p);
-            if (conn->msglen > conn->bufsiz - 4) {
+            conn->msglen = load_32_be(conn->msglenbuf);
+            if (conn->msglen > MAX_TCP_REQUEST) {
                 krb5_error_code err;
                 /* Message too big. */
                 krb5_klog_syslog(LOG_ERR, _("TCP client %s wants %lu bytes, "
                                             "cap is %lu"), conn->addrbuf,
                                  (unsigned long) conn->msglen,
-                                 (unsigned long) conn->bufsiz - 4);
+                                 (unsigned long) MAX_TCP_REQUEST);
                 /* XXX Should return an error.  */
                 err = make_toolong_error (conn->handle,
                                           &response);
@@ -1322,7 +1622,17 @@ process_tcp_connection_read(verto_ctx *ctx, verto_ev *ev)
                     krb5_free_data(get_context(conn->handle), response);
                     goto kill_tcp_connection;
                 }
+                conn->close_after_send = 1;
                 process_tcp_response(state, 0, response);
+                return;
+            }
+
+            conn->buffer = get_request_buffer(conn->msglen, &conn->bufsiz);
+            if (conn->buffer == NULL) {
+                com_err(conn->prog, ENOMEM,
+                        _("allocating buffer for TCP request from %s"),
+                        conn->addrbuf);
+                goto kill_tcp_connection;
             }
         }
     } else {
@@ -1331,7 +1641,7 @@ process_tcp_connection_read(verto_ctx *ctx, verto_ev *ev)
 
         len = conn->msglen - (conn->offset - 4);
         nread = SOCKET_READ(verto_get_fd(ev),
-                            conn->buffer + conn->offset, len);
+                            conn->buffer + (conn->offset - 4), len);
         if (nread < 0) /* error */
             goto kill_tcp_connection;
         if (nread == 0) /* eof */
@@ -1346,7 +1656,7 @@ process_tcp_connection_read(verto_ctx *ctx, verto_ev *ev)
             goto kill_tcp_connection;
 
         state->request.length = conn->msglen;
-        state->request.data = conn->buffer + 4;
+        state->request.data = conn->buffer;
 
         if (getsockname(verto_get_fd(ev), ss2sa(&state->local_saddr),
                         &local_saddrlen) < 0) {
@@ -1379,32 +1689,55 @@ process_tcp_connection_write(verto_ctx *ctx, verto_ev *ev)
 
     nwrote = SOCKET_WRITEV(sock, conn->sgp,
                            conn->sgnum, tmp);
-    if (nwrote > 0) { /* non-error and non-eof */
-        while (nwrote) {
-            sg_buf *sgp = conn->sgp;
-            if ((size_t)nwrote < SG_LEN(sgp)) {
-                SG_ADVANCE(sgp, (size_t)nwrote);
-                nwrote = 0;
-            } else {
-                nwrote -= SG_LEN(sgp);
-                conn->sgp++;
-                conn->sgnum--;
-                if (conn->sgnum == 0 && nwrote != 0)
-                    abort();
-            }
+    if (nwrote <= 0) { /* error or eof */
+        verto_del(ev);
+        return;
+    }
+    while (nwrote) {
+        sg_buf *sgp = conn->sgp;
+        if ((size_t)nwrote < SG_LEN(sgp)) {
+            SG_ADVANCE(sgp, (size_t)nwrote);
+            nwrote = 0;
+        } else {
+            nwrote -= SG_LEN(sgp);
+            conn->sgp++;
+            conn->sgnum--;
+            if (conn->sgnum == 0 && nwrote != 0)
+                abort();
         }
+    }
 
-        /* If we still have more data to send, just return so that
-         * the main loop can call this function again when the socket
-         * is ready for more writing. */
-        if (conn->sgnum > 0)
-            return;
+    /* If we still have more data to send, just return so that the main loop
+     * can call this function again when the socket is ready for more
+     * writing. */
+    if (conn->sgnum > 0)
+        return;
+
+    /* Finished sending.  If we sent a FIELD_TOOLONG error, we did not read
+     * the request (and RFC 4120 says we have to close the TCP stream if its
+     * length had the high bit set), so close the connection. */
+    if (conn->close_after_send) {
+        verto_del(ev);
+        return;
     }
 
-    /* Finished sending.  We should go back to reading, though if we
-     * sent a FIELD_TOOLONG error in reply to a length with the high
-     * bit set, RFC 4120 says we have to close the TCP stream. */
+    /* Otherwise go back to reading, so that the client can send further
+     * requests on this connection.  Count the connection as new for the
+     * purpose of dropping the oldest one when there are too many. */
+    krb5_free_data(get_context(conn->handle), conn->response);
+    conn->response = NULL;
+    conn->offset = 0;
+    conn->msglen = 0;
+    touch_connection(conn);
+    conn->ev = NULL;
+    verto_set_private(ev, NULL, NULL); /* Don't close the fd or free conn! */
     verto_del(ev);
+    if (make_event(ctx, VERTO_EV_FLAG_IO_READ | VERTO_EV_FLAG_PERSIST,
+                   process_tcp_connection_read, sock, conn) == NULL) {
+        tcp_or_rpc_data_counter--;
+        free_connection(conn);
+        close(sock);
+    }
 }
 
 void
@@ -1414,24 +1747,32 @@ loop_free(verto_ctx *ctx)
     struct bind_address val;
 
     verto_free(ctx);
+    idle_timer = NULL;
 
     /* Free each addresses added to the loop. */
     FOREACH_ELT(bind_addresses, i, val)
         free(val.address);
     FREE_SET_DATA(bind_addresses);
     FREE_SET_DATA(events);
+    free_udp_states_list();
+    free_buffer_pool();
 }
 
 static int
 have_event_for_fd(int fd)
 {
     verto_ev *ev;
+    struct connection *c;
     int i;
 
     FOREACH_ELT(events, i, ev) {
         if (verto_get_fd(ev) == fd)
             return 1;
     }
+    K5_TAILQ_FOREACH(c, &rpc_conns, links) {
+        if (c->ev != NULL && verto_get_fd(c->ev) == fd)
+            return 1;
+    }
 
     return 0;
 }
@@ -1493,10 +1834,9 @@ accept_rpc_connection(verto_ctx *ctx, verto_ev *ev)
 
         newconn->addr_s = addr_s;
         newconn->addrlen = addrlen;
-        newconn->start_time = time(0);
 
         if (++tcp_or_rpc_data_counter > max_tcp_or_rpc_data_connections)
-            kill_lru_tcp_or_rpc_connection(newconn->handle, newev);
+            kill_lru_tcp_or_rpc_connection(newev);
 
         newconn->remote_addr.address = &newconn->remote_addr_buf;
         init_addr(&newconn->remote_addr, ss2sa(&newconn->addr_s));
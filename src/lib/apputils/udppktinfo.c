@@ -44,6 +44,15 @@
 #define HAVE_PKTINFO_SUPPORT
 #endif
 
+#if defined(HAVE_PKTINFO_SUPPORT) && defined(CMSG_SPACE)
+#ifdef HAVE_RECVMMSG
+#define HAVE_BATCH_RECV
+#endif
+#ifdef HAVE_SENDMMSG
+#define HAVE_BATCH_SEND
+#endif
+#endif
+
 /* Use RFC 3542 API below, but fall back from IPV6_RECVPKTINFO to IPV6_PKTINFO
  * for RFC 2292 implementations. */
 #if !defined(IPV6_RECVPKTINFO) && defined(IPV6_PKTINFO)
@@ -496,6 +505,140 @@ use_sendto:
     return sendto(sock, buf, len, flags, to, tolen);
 }
 
+#ifdef HAVE_BATCH_RECV
+
+/*
+ * Receive up to count (at most UDP_BATCH_MAX) datagrams with one system call.
+ * For each datagram received, set len to the message length and fill in the
+ * remote address.  If the local address is requested and can be determined
+ * from pktinfo, fill it in; otherwise set *local_len to 0.
+ *
+ * Returns the number of datagrams received, or -1 with errno set if none
+ * could be received.
+ */
+int
+recv_from_to_batch(int sock, udp_dgram *dgrams, int count, int flags)
+{
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    struct iovec iov[UDP_BATCH_MAX];
+    char cmsg[UDP_BATCH_MAX][CMSG_SPACE(sizeof(union pktinfo))];
+    struct cmsghdr *cmsgptr;
+    struct msghdr *msg;
+    udp_dgram *d;
+    int i, n, wildcard;
+
+    /* Don't use pktinfo if the socket isn't bound to a wildcard address. */
+    wildcard = is_socket_bound_to_wildcard(sock);
+    if (wildcard < 0)
+        return -1;
+
+    if (count > UDP_BATCH_MAX)
+        count = UDP_BATCH_MAX;
+    memset(msgs, 0, count * sizeof(*msgs));
+    for (i = 0; i < count; i++) {
+        d = &dgrams[i];
+        iov[i].iov_base = d->buf;
+        iov[i].iov_len = d->bufsize;
+        msg = &msgs[i].msg_hdr;
+        msg->msg_name = d->remote;
+        msg->msg_namelen = *d->remote_len;
+        msg->msg_iov = &iov[i];
+        msg->msg_iovlen = 1;
+        if (wildcard && d->local != NULL) {
+            msg->msg_control = cmsg[i];
+            msg->msg_controllen = sizeof(cmsg[i]);
+        }
+    }
+
+    n = recvmmsg(sock, msgs, count, flags, NULL);
+    if (n < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        d = &dgrams[i];
+        msg = &msgs[i].msg_hdr;
+        d->len = msgs[i].msg_len;
+        *d->remote_len = msg->msg_namelen;
+        if (d->local == NULL)
+            continue;
+
+        /* See the comment in recv_from_to() about checking controllen. */
+        cmsgptr = (msg->msg_controllen) ? CMSG_FIRSTHDR(msg) : NULL;
+        for (; cmsgptr != NULL; cmsgptr = CMSG_NXTHDR(msg, cmsgptr)) {
+            if (check_cmsg_pktinfo(cmsgptr, d->local, d->local_len,
+                                   d->auxaddr))
+                break;
+        }
+        if (cmsgptr == NULL)
+            *d->local_len = 0;
+    }
+    return n;
+}
+
+#endif /* HAVE_BATCH_RECV */
+
+#ifdef HAVE_BATCH_SEND
+
+/*
+ * Send up to count (at most UDP_BATCH_MAX) datagrams with one system call,
+ * each to its remote address and, where pktinfo allows it, from its local
+ * address.
+ *
+ * Returns the number of datagrams sent, or -1 with errno set if the first
+ * could not be sent.  Sending stops at the first datagram which fails.
+ */
+int
+send_to_from_batch(int sock, udp_dgram *dgrams, int count, int flags)
+{
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    struct iovec iov[UDP_BATCH_MAX];
+    char cbuf[UDP_BATCH_MAX][CMSG_SPACE(sizeof(union pktinfo))];
+    struct cmsghdr *cmsgptr;
+    struct msghdr *msg;
+    udp_dgram *d;
+    int i, wildcard;
+
+    /* Don't use pktinfo if the socket isn't bound to a wildcard address. */
+    wildcard = is_socket_bound_to_wildcard(sock);
+    if (wildcard < 0)
+        return -1;
+
+    if (count > UDP_BATCH_MAX)
+        count = UDP_BATCH_MAX;
+    memset(msgs, 0, count * sizeof(*msgs));
+    memset(cbuf, 0, count * sizeof(*cbuf));
+    for (i = 0; i < count; i++) {
+        d = &dgrams[i];
+        iov[i].iov_base = d->buf;
+        iov[i].iov_len = d->len;
+        msg = &msgs[i].msg_hdr;
+        msg->msg_name = d->remote;
+        msg->msg_namelen = *d->remote_len;
+        msg->msg_iov = &iov[i];
+        msg->msg_iovlen = 1;
+
+        if (!wildcard || d->local == NULL || *d->local_len == 0 ||
+            d->local->sa_family != d->remote->sa_family)
+            continue;
+
+        /* As in send_to_from(), CMSG_FIRSTHDR needs a non-zero
+         * controllen. */
+        msg->msg_control = cbuf[i];
+        msg->msg_controllen = sizeof(cbuf[i]);
+        cmsgptr = CMSG_FIRSTHDR(msg);
+        msg->msg_controllen = 0;
+        if (set_msg_from(d->local->sa_family, msg, cmsgptr, d->local,
+                         *d->local_len, d->auxaddr)) {
+            msg->msg_control = NULL;
+            msg->msg_controllen = 0;
+        }
+    }
+
+    return sendmmsg(sock, msgs, count, flags);
+}
+
+#endif /* HAVE_BATCH_SEND */
+
 #else /* HAVE_PKTINFO_SUPPORT && CMSG_SPACE */
 
 krb5_error_code
@@ -524,3 +667,45 @@ send_to_from(int sock, void *buf, size_t len, int flags,
 }
 
 #endif /* HAVE_PKTINFO_SUPPORT && CMSG_SPACE */
+
+#ifndef HAVE_BATCH_RECV
+
+/* Without recvmmsg() or pktinfo support, receive one datagram at a time. */
+int
+recv_from_to_batch(int sock, udp_dgram *dgrams, int count, int flags)
+{
+    udp_dgram *d = &dgrams[0];
+    int r;
+
+    if (count < 1)
+        return 0;
+    r = recv_from_to(sock, d->buf, d->bufsize, flags, d->remote,
+                     d->remote_len, d->local, d->local_len, d->auxaddr);
+    if (r < 0)
+        return -1;
+    d->len = r;
+    return 1;
+}
+
+#endif /* HAVE_BATCH_RECV */
+
+#ifndef HAVE_BATCH_SEND
+
+/* Without sendmmsg() or pktinfo support, send one datagram at a time. */
+int
+send_to_from_batch(int sock, udp_dgram *dgrams, int count, int flags)
+{
+    udp_dgram *d;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        d = &dgrams[i];
+        if (send_to_from(sock, d->buf, d->len, flags, d->remote,
+                         *d->remote_len, d->local, *d->local_len,
+                         d->auxaddr) < 0)
+            return (i == 0) ? -1 : i;
+    }
+    return count;
+}
+
+#endif /* HAVE_BATCH_SEND */
@@ -55,4 +55,30 @@ send_to_from(int sock, void *buf, size_t len, int flags,
              const struct sockaddr *to, socklen_t tolen, struct sockaddr *from,
              socklen_t fromlen, aux_addressing_info *auxaddr);
 
+/*
+ * A datagram for recv_from_to_batch() or send_to_from_batch().  The address
+ * fields point to caller-owned storage; remote_len and local_len give the
+ * size of that storage on input to recv_from_to_batch() and the address
+ * lengths on output.
+ */
+typedef struct udp_dgram {
+    void *buf;
+    size_t bufsize;             /* Capacity of buf for receiving */
+    size_t len;                 /* Length of the message in buf */
+    struct sockaddr *remote;
+    socklen_t *remote_len;
+    struct sockaddr *local;
+    socklen_t *local_len;
+    aux_addressing_info *auxaddr;
+} udp_dgram;
+
+/* The largest number of datagrams transferred by one batch system call. */
+#define UDP_BATCH_MAX 32
+
+int
+recv_from_to_batch(int sock, udp_dgram *dgrams, int count, int flags);
+
+int
+send_to_from_batch(int sock, udp_dgram *dgrams, int count, int flags);
+
 #endif /* UDPPKTINFO_H */
@@ -0,0 +1,324 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/crypto/builtin/aes/iaes.c - AES-CBC using compiler intrinsics */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements the functions declared in iaes.h using compiler
+ * intrinsics for the AES-NI instructions on x86 or the cryptography
+ * extensions on ARMv8.  It is used in place of the assembly implementations
+ * when yasm is not available or the platform is not x86.
+ *
+ * Every function is compiled for the instruction set named by AES_HW_TARGET
+ * (determined by configure), so the rest of the library can run on CPUs
+ * without the AES instructions.
+ *
+ * Round keys are stored as 16-byte blocks.  The decryption schedule is for the
+ * equivalent inverse cipher: the encryption round keys in reverse order, with
+ * InvMixColumns applied to all but the first and last.
+ */
+
+#include "k5-platform.h"
+#include "iaes.h"
+
+#define HW __attribute__((target(AES_HW_TARGET)))
+
+#define MAX_ROUNDS 14
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+typedef __m128i block;
+
+#define load_block(p) _mm_loadu_si128((const __m128i *)(p))
+#define store_block(p, b) _mm_storeu_si128((__m128i *)(p), b)
+#define xor_block(a, b) _mm_xor_si128(a, b)
+#define inv_mix_columns(b) _mm_aesimc_si128(b)
+
+/* Apply the S-box to each byte of w.  AESKEYGENASSIST places SubWord of its
+ * second input word in the low word of its result. */
+static inline HW uint32_t
+sub_word(uint32_t w)
+{
+    return _mm_cvtsi128_si32(_mm_aeskeygenassist_si128(_mm_set1_epi32(w), 0));
+}
+
+static inline HW block
+encrypt_block(const block *rk, int nr, block b)
+{
+    int i;
+
+    b = _mm_xor_si128(b, rk[0]);
+    for (i = 1; i < nr; i++)
+        b = _mm_aesenc_si128(b, rk[i]);
+    return _mm_aesenclast_si128(b, rk[nr]);
+}
+
+/* Decrypt four blocks at once, so that the latencies of the AESDEC
+ * instructions overlap. */
+static inline HW void
+decrypt4(const block *dk, int nr, block *b)
+{
+    int i, j;
+
+    for (j = 0; j < 4; j++)
+        b[j] = _mm_xor_si128(b[j], dk[0]);
+    for (i = 1; i < nr; i++) {
+        for (j = 0; j < 4; j++)
+            b[j] = _mm_aesdec_si128(b[j], dk[i]);
+    }
+    for (j = 0; j < 4; j++)
+        b[j] = _mm_aesdeclast_si128(b[j], dk[nr]);
+}
+
+static inline HW block
+decrypt_block(const block *dk, int nr, block b)
+{
+    int i;
+
+    b = _mm_xor_si128(b, dk[0]);
+    for (i = 1; i < nr; i++)
+        b = _mm_aesdec_si128(b, dk[i]);
+    return _mm_aesdeclast_si128(b, dk[nr]);
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+typedef uint8x16_t block;
+
+#define load_block(p) vld1q_u8((const uint8_t *)(p))
+#define store_block(p, b) vst1q_u8((uint8_t *)(p), b)
+#define xor_block(a, b) veorq_u8(a, b)
+#define inv_mix_columns(b) vaesimcq_u8(b)
+
+/* Apply the S-box to each byte of w.  With all four columns equal to w,
+ * ShiftRows has no effect, so AESE with a zero key computes SubWord. */
+static inline HW uint32_t
+sub_word(uint32_t w)
+{
+    block b = vreinterpretq_u8_u32(vdupq_n_u32(w));
+
+    b = vaeseq_u8(b, vdupq_n_u8(0));
+    return vgetq_lane_u32(vreinterpretq_u32_u8(b), 0);
+}
+
+/* AESE performs AddRoundKey before SubBytes and ShiftRows, so the last round
+ * key is added separately. */
+static inline HW block
+encrypt_block(const block *rk, int nr, block b)
+{
+    int i;
+
+    for (i = 0; i < nr - 1; i++)
+        b = vaesmcq_u8(vaeseq_u8(b, rk[i]));
+    b = vaeseq_u8(b, rk[nr - 1]);
+    return veorq_u8(b, rk[nr]);
+}
+
+static inline HW void
+decrypt4(const block *dk, int nr, block *b)
+{
+    int i, j;
+
+    for (i = 0; i < nr - 1; i++) {
+        for (j = 0; j < 4; j++)
+            b[j] = vaesimcq_u8(vaesdq_u8(b[j], dk[i]));
+    }
+    for (j = 0; j < 4; j++)
+        b[j] = veorq_u8(vaesdq_u8(b[j], dk[nr - 1]), dk[nr]);
+}
+
+static inline HW block
+decrypt_block(const block *dk, int nr, block b)
+{
+    int i;
+
+    for (i = 0; i < nr - 1; i++)
+        b = vaesimcq_u8(vaesdq_u8(b, dk[i]));
+    b = vaesdq_u8(b, dk[nr - 1]);
+    return veorq_u8(b, dk[nr]);
+}
+
+#else
+#error "No AES intrinsics for this platform"
+#endif
+
+/* Load the round keys of a schedule into rk. */
+static inline HW void
+load_schedule(const uint32_t *ks, int nr, block *rk)
+{
+    int i;
+
+    for (i = 0; i <= nr; i++)
+        rk[i] = load_block((const unsigned char *)ks + 16 * i);
+}
+
+/* Expand the nk-word key into the encryption schedule ks (FIPS 197 section
+ * 5.2).  Words are little-endian, so RotWord is a rotation right and the round
+ * constant goes in the low byte. */
+static HW void
+expand_enc_key(const unsigned char *key, int nk, uint32_t *ks)
+{
+    uint32_t w[4 * (MAX_ROUNDS + 1)], t, rcon = 1;
+    int i, nwords = 4 * (nk + 7);
+
+    for (i = 0; i < nk; i++)
+        w[i] = load_32_le(key + 4 * i);
+    for (i = nk; i < nwords; i++) {
+        t = w[i - 1];
+        if (i % nk == 0) {
+            t = sub_word((t >> 8) | (t << 24)) ^ rcon;
+            rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x11b : 0);
+        } else if (nk > 6 && i % nk == 4) {
+            t = sub_word(t);
+        }
+        w[i] = w[i - nk] ^ t;
+    }
+    for (i = 0; i < nwords; i++)
+        store_32_le(w[i], (unsigned char *)ks + 4 * i);
+    zap(w, sizeof(w));
+}
+
+static HW void
+expand_dec_key(const unsigned char *key, int nk, uint32_t *ks)
+{
+    uint32_t eks[4 * (MAX_ROUNDS + 1)];
+    unsigned char *out = (unsigned char *)ks;
+    block rk[MAX_ROUNDS + 1];
+    int i, nr = nk + 6;
+
+    expand_enc_key(key, nk, eks);
+    load_schedule(eks, nr, rk);
+    store_block(out, rk[nr]);
+    for (i = 1; i < nr; i++)
+        store_block(out + 16 * i, inv_mix_columns(rk[nr - i]));
+    store_block(out + 16 * nr, rk[0]);
+    zap(eks, sizeof(eks));
+    zap(rk, sizeof(rk));
+}
+
+static HW void
+cbc_enc(struct aes_data *data, int nr)
+{
+    block rk[MAX_ROUNDS + 1], iv;
+    const unsigned char *in = data->in_block;
+    unsigned char *out = data->out_block;
+    size_t n;
+
+    load_schedule(data->expanded_key, nr, rk);
+    iv = load_block(data->iv);
+    for (n = data->num_blocks; n > 0; n--, in += 16, out += 16) {
+        iv = encrypt_block(rk, nr, xor_block(load_block(in), iv));
+        store_block(out, iv);
+    }
+    store_block(data->iv, iv);
+    zap(rk, sizeof(rk));
+}
+
+static HW void
+cbc_dec(struct aes_data *data, int nr)
+{
+    block dk[MAX_ROUNDS + 1], iv, c[4], p[4];
+    const unsigned char *in = data->in_block;
+    unsigned char *out = data->out_block;
+    size_t n = data->num_blocks;
+    int j;
+
+    load_schedule(data->expanded_key, nr, dk);
+    iv = load_block(data->iv);
+    for (; n >= 4; n -= 4, in += 64, out += 64) {
+        for (j = 0; j < 4; j++)
+            c[j] = p[j] = load_block(in + 16 * j);
+        decrypt4(dk, nr, p);
+        store_block(out, xor_block(p[0], iv));
+        for (j = 1; j < 4; j++)
+            store_block(out + 16 * j, xor_block(p[j], c[j - 1]));
+        iv = c[3];
+    }
+    for (; n > 0; n--, in += 16, out += 16) {
+        c[0] = load_block(in);
+        store_block(out, xor_block(decrypt_block(dk, nr, c[0]), iv));
+        iv = c[0];
+    }
+    store_block(data->iv, iv);
+    zap(dk, sizeof(dk));
+}
+
+HW void
+k5_iEncExpandKey128(unsigned char *key, uint32_t *expanded_key)
+{
+    expand_enc_key(key, 4, expanded_key);
+}
+
+HW void
+k5_iEncExpandKey256(unsigned char *key, uint32_t *expanded_key)
+{
+    expand_enc_key(key, 8, expanded_key);
+}
+
+HW void
+k5_iDecExpandKey128(unsigned char *key, uint32_t *expanded_key)
+{
+    expand_dec_key(key, 4, expanded_key);
+}
+
+HW void
+k5_iDecExpandKey256(unsigned char *key, uint32_t *expanded_key)
+{
+    expand_dec_key(key, 8, expanded_key);
+}
+
+HW void
+k5_iEnc128_CBC(struct aes_data *data)
+{
+    cbc_enc(data, 10);
+}
+
+HW void
+k5_iEnc256_CBC(struct aes_data *data)
+{
+    cbc_enc(data, 14);
+}
+
+HW void
+k5_iDec128_CBC(struct aes_data *data)
+{
+    cbc_dec(data, 10);
+}
+
+HW void
+k5_iDec256_CBC(struct aes_data *data)
+{
+    cbc_dec(data, 14);
+}
@@ -43,28 +43,28 @@ struct aes_key_info_cache {
 
 #ifdef AESNI
 
-/* Use AES-NI instructions (via assembly functions) when possible. */
+/*
+ * Use AES instructions (via assembly functions or compiler intrinsics) when
+ * possible.  On x86 these are the AES-NI instructions; on ARM they are part of
+ * the ARMv8 cryptography extensions.
+ */
 
-#include <cpuid.h>
+#include "iaes.h"
 
-struct aes_data
+#ifdef __aarch64__
+
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+static krb5_boolean
+aesni_supported_by_cpu()
 {
-    unsigned char *in_block;
-    unsigned char *out_block;
-    uint32_t *expanded_key;
-    unsigned char *iv;
-    size_t num_blocks;
-};
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+}
 
-void k5_iEncExpandKey128(unsigned char *key, uint32_t *expanded_key);
-void k5_iEncExpandKey256(unsigned char *key, uint32_t *expanded_key);
-void k5_iDecExpandKey256(unsigned char *key, uint32_t *expanded_key);
-void k5_iDecExpandKey128(unsigned char *key, uint32_t *expanded_key);
+#else /* x86 */
 
-void k5_iEnc128_CBC(struct aes_data *data);
-void k5_iDec128_CBC(struct aes_data *data);
-void k5_iEnc256_CBC(struct aes_data *data);
-void k5_iDec256_CBC(struct aes_data *data);
+#include <cpuid.h>
 
 static krb5_boolean
 aesni_supported_by_cpu()
@@ -74,6 +74,8 @@ aesni_supported_by_cpu()
     return __get_cpuid(1, &a, &b, &c, &d) && (c & (1 << 25));
 }
 
+#endif
+
 static inline krb5_boolean
 aesni_supported(krb5_key key)
 {
@@ -1,5 +1,6 @@
 /* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "shs.h"
+#include "sha_ni.h"
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
@@ -97,6 +98,64 @@ void shsInit(SHS_INFO *shsInfo)
 
    Note that this corrupts the shsInfo->data area */
 
+#ifdef SHA_NI
+
+/* Perform the transformation with the x86 SHA extensions.  SHA1RNDS4 does
+   four rounds on ABCD (with A in the high lane), given the message words
+   plus E for the first of them; SHA1NEXTE derives the next E term. */
+
+#include <immintrin.h>
+
+/* Do four rounds using round function f (0-3), computing message group i
+   from the previous four groups once past the first four. */
+#define niRound(f)                                                      \
+    do {                                                                \
+        if (i >= 4) {                                                   \
+            t = _mm_sha1msg1_epu32(w[i % 4], w[(i + 1) % 4]);           \
+            t = _mm_xor_si128(t, w[(i + 2) % 4]);                       \
+            w[i % 4] = _mm_sha1msg2_epu32(t, w[(i + 3) % 4]);           \
+        }                                                               \
+        e = (i == 0) ? _mm_add_epi32(e, w[0]) :                         \
+            _mm_sha1nexte_epu32(prev, w[i % 4]);                        \
+        prev = abcd;                                                    \
+        abcd = _mm_sha1rnds4_epu32(abcd, e, f);                         \
+        i++;                                                            \
+    } while (0)
+
+static SHA_NI_TARGET
+void SHSTransformNI(SHS_LONG *digest, const SHS_LONG *data)
+{
+    __m128i abcd, abcd_save, e, e_save, prev, t, w[4];
+    int i;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)digest), 0x1B);
+    e = _mm_set_epi32(digest[4], 0, 0, 0);
+    abcd_save = abcd;
+    e_save = e;
+    prev = abcd;
+    for (i = 0; i < 4; i++) {
+        w[i] = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)
+                                                 (data + 4 * i)), 0x1B);
+    }
+
+    i = 0;
+    while (i < 5)
+        niRound(0);
+    while (i < 10)
+        niRound(1);
+    while (i < 15)
+        niRound(2);
+    while (i < 20)
+        niRound(3);
+
+    e = _mm_sha1nexte_epu32(prev, e_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+    _mm_storeu_si128((__m128i *)digest, _mm_shuffle_epi32(abcd, 0x1B));
+    digest[4] = _mm_extract_epi32(e, 3);
+}
+
+#endif /* SHA_NI */
+
 static void SHSTransform (SHS_LONG *digest, const SHS_LONG *data);
 
 static
@@ -105,6 +164,13 @@ void SHSTransform(SHS_LONG *digest, const SHS_LONG *data)
     SHS_LONG A, B, C, D, E;     /* Local vars */
     SHS_LONG eData[ 16 ];       /* Expanded data */
 
+#ifdef SHA_NI
+    if (k5_sha_ni_supported()) {
+        SHSTransformNI(digest, data);
+        return;
+    }
+#endif
+
     /* Set up first buffer and local data buffer */
     A = digest[ 0 ];
     B = digest[ 1 ];
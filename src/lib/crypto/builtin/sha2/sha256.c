@@ -35,6 +35,7 @@
 
 #include <k5-int.h>
 #include "sha2.h"
+#include "sha_ni.h"
 
 #ifdef K5_BE
 #define WORDS_BIGENDIAN
@@ -117,6 +118,61 @@ k5_sha256_init(SHA256_CTX *m)
     H = 0x5be0cd19;
 }
 
+#ifdef SHA_NI
+
+/*
+ * Use the x86 SHA extensions when the CPU has them.  Each SHA256RNDS2
+ * instruction performs two rounds, using the state split into ABEF and CDGH
+ * halves, and SHA256MSG1/SHA256MSG2 compute the message schedule four words
+ * at a time.
+ */
+
+#include <immintrin.h>
+
+static SHA_NI_TARGET void
+calc_sha_ni(SHA256_CTX *m, const uint32_t *in)
+{
+    __m128i abef, cdgh, abef_save, cdgh_save, tmp, msg, w[4];
+    int i;
+
+    /* Rearrange the state words (A..H in counter[0..7]) into ABEF and CDGH,
+     * with A and C in the high lanes. */
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)&m->counter[0]), 0xB1);
+    cdgh = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)&m->counter[4]), 0x1B);
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+    abef_save = abef;
+    cdgh_save = cdgh;
+
+    for (i = 0; i < 16; i++) {
+        if (i < 4) {
+            w[i] = _mm_loadu_si128((const __m128i *)(in + 4 * i));
+        } else {
+            /* w[i % 4] holds words 4i-16 through 4i-13. */
+            tmp = _mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]);
+            tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) % 4],
+                                                     w[(i + 2) % 4], 4));
+            w[i % 4] = _mm_sha256msg2_epu32(tmp, w[(i + 3) % 4]);
+        }
+        msg = _mm_add_epi32(w[i % 4],
+                            _mm_loadu_si128((const __m128i *)
+                                            &constant_256[4 * i]));
+        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+        abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E));
+    }
+
+    abef = _mm_add_epi32(abef, abef_save);
+    cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    tmp = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *)&m->counter[0],
+                     _mm_blend_epi16(tmp, cdgh, 0xF0));
+    _mm_storeu_si128((__m128i *)&m->counter[4],
+                     _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+#endif /* SHA_NI */
+
 static void
 calc(SHA256_CTX *m, uint32_t *in)
 {
@@ -124,6 +180,13 @@ calc(SHA256_CTX *m, uint32_t *in)
     uint32_t data[64];
     int i;
 
+#ifdef SHA_NI
+    if (k5_sha_ni_supported()) {
+        calc_sha_ni(m, in);
+        return;
+    }
+#endif
+
     AA = A;
     BB = B;
     CC = C;
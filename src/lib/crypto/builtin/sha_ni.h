@@ -0,0 +1,72 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/crypto/builtin/sha_ni.h - x86 SHA extension support declarations */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SHA_NI_H
+#define SHA_NI_H
+
+#ifdef SHA_NI
+
+#include "k5-int.h"
+#include <cpuid.h>
+
+/* Mark a function which uses the SHA extension intrinsics. */
+#define SHA_NI_TARGET __attribute__((target("sha,sse4.1")))
+
+static k5_once_t sha_ni_once = K5_ONCE_INIT;
+static krb5_boolean sha_ni_supported;
+
+static void
+check_sha_ni(void)
+{
+    unsigned int a, b, c, d;
+
+    /* Check for SSE4.1 and then for the SHA extensions. */
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & (1 << 19)))
+        return;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return;
+    __cpuid_count(7, 0, a, b, c, d);
+    sha_ni_supported = (b & (1 << 29)) != 0;
+}
+
+/* Return true if the CPU supports the x86 SHA extensions, querying it only
+ * once. */
+static inline krb5_boolean
+k5_sha_ni_supported(void)
+{
+    k5_once(&sha_ni_once, check_sha_ni);
+    return sha_ni_supported;
+}
+
+#endif /* SHA_NI */
+
+#endif /* SHA_NI_H */
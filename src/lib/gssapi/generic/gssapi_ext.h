@@ -348,6 +348,48 @@ OM_uint32 KRB5_CALLCONV gss_wrap_iov_length
     gss_iov_buffer_desc *, /* iov */
     int);		/* iov_count */
 
+/*
+ * One message of a batch for gss_wrap_iov_batch() or gss_unwrap_iov_batch().
+ * The caller sets iov and iov_count; the remaining fields are outputs giving
+ * the result for this message.
+ */
+typedef struct gss_iov_message_desc_struct {
+    gss_iov_buffer_desc *iov;
+    int iov_count;
+    int conf_state;
+    gss_qop_t qop_state;
+    OM_uint32 major_status;
+    OM_uint32 minor_status;
+} gss_iov_message_desc, *gss_iov_message_t;
+
+/*
+ * Wrap each of a sequence of messages as gss_wrap_iov() would, in order, with
+ * the same conf_req_flag and qop_req.  The per-message results are stored in
+ * each message descriptor, with qop_state set to qop_req.  Returns
+ * GSS_S_COMPLETE if every message was wrapped, or otherwise the status of the
+ * first message which failed.  If the mechanism cannot process the batch at
+ * all, that error is recorded in every message and returned.
+ */
+OM_uint32 KRB5_CALLCONV gss_wrap_iov_batch
+(
+    OM_uint32 *,	/* minor_status */
+    gss_ctx_id_t,	/* context_handle */
+    int,		/* conf_req_flag */
+    gss_qop_t,		/* qop_req */
+    gss_iov_message_desc *, /* messages */
+    size_t);		/* message_count */
+
+/*
+ * Unwrap each of a sequence of messages as gss_unwrap_iov() would, in order.
+ * Results are reported as for gss_wrap_iov_batch().
+ */
+OM_uint32 KRB5_CALLCONV gss_unwrap_iov_batch
+(
+    OM_uint32 *,	/* minor_status */
+    gss_ctx_id_t,	/* context_handle */
+    gss_iov_message_desc *, /* messages */
+    size_t);		/* message_count */
+
 /*
  * Produce a GSSAPI MIC token for a sequence of buffers.  All SIGN_ONLY and
  * DATA buffers will be signed, in the order they appear.  One MIC_TOKEN buffer
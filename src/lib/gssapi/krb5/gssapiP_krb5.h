@@ -475,6 +475,10 @@ OM_uint32 kg_seal_iov_length(OM_uint32 *minor_status,
            int iov_count,
            int toktype);
 
+/* Number of IOV buffers which wrapping into or unwrapping from a STREAM buffer
+ * can rearrange without allocating. */
+#define KG_STREAM_IOV_MAX 8
+
 krb5_cryptotype kg_translate_flag_iov(OM_uint32 type);
 
 OM_uint32 kg_fixup_padding_iov(OM_uint32 *minor_status,
@@ -799,6 +803,15 @@ OM_uint32 KRB5_CALLCONV krb5_gss_wrap_iov_length
  int                        /* iov_count */
 );
 
+OM_uint32 KRB5_CALLCONV krb5_gss_wrap_iov_batch
+(OM_uint32 *,           /* minor_status */
+ gss_ctx_id_t,              /* context_handle */
+ int,                       /* conf_req_flag */
+ gss_qop_t,                 /* qop_req */
+ gss_iov_message_desc *,    /* msgs */
+ size_t                     /* count */
+);
+
 OM_uint32 KRB5_CALLCONV krb5_gss_unwrap
 (OM_uint32 *,           /* minor_status */
  gss_ctx_id_t,               /* context_handle */
@@ -817,6 +830,13 @@ OM_uint32 KRB5_CALLCONV krb5_gss_unwrap_iov
  int                        /* iov_count */
 );
 
+OM_uint32 KRB5_CALLCONV krb5_gss_unwrap_iov_batch
+(OM_uint32 *,           /* minor_status */
+ gss_ctx_id_t,              /* context_handle */
+ gss_iov_message_desc *,    /* msgs */
+ size_t                     /* count */
+);
+
 OM_uint32 KRB5_CALLCONV krb5_gss_wrap_size_limit
 (OM_uint32 *,           /* minor_status */
  gss_ctx_id_t,               /* context_handle */
@@ -915,6 +915,11 @@ static struct gss_config krb5_mechanism = {
     krb5_gss_get_mic_iov,
     krb5_gss_verify_mic_iov,
     krb5_gss_get_mic_iov_length,
+    NULL,               /* query_meta_data */
+    NULL,               /* exchange_meta_data */
+    NULL,               /* query_mechanism_info */
+    krb5_gss_wrap_iov_batch,
+    krb5_gss_unwrap_iov_batch,
 };
 
 /* Functions which use security contexts or acquire creds are IAKERB-specific;
@@ -241,31 +241,16 @@ cleanup:
     return code;
 }
 
-OM_uint32
-kg_seal_iov(OM_uint32 *minor_status,
-            gss_ctx_id_t context_handle,
-            int conf_req_flag,
-            gss_qop_t qop_req,
-            int *conf_state,
-            gss_iov_buffer_desc *iov,
-            int iov_count,
-            int toktype)
+/* Seal a message laid out in HEADER, PADDING, and TRAILER buffers, using
+ * ctx, which the caller has checked is established. */
+static OM_uint32
+seal_iov_token(OM_uint32 *minor_status, krb5_gss_ctx_id_rec *ctx,
+               int conf_req_flag, int *conf_state, gss_iov_buffer_desc *iov,
+               int iov_count, int toktype)
 {
-    krb5_gss_ctx_id_rec *ctx;
     krb5_error_code code;
     krb5_context context;
 
-    if (qop_req != 0) {
-        *minor_status = (OM_uint32)G_UNKNOWN_QOP;
-        return GSS_S_BAD_QOP;
-    }
-
-    ctx = (krb5_gss_ctx_id_rec *)context_handle;
-    if (ctx->terminated || !ctx->established) {
-        *minor_status = KG_CTX_INCOMPLETE;
-        return GSS_S_NO_CONTEXT;
-    }
-
     if (conf_req_flag && kg_integ_only_iov(iov, iov_count)) {
         /* may be more sensible to return an error here */
         conf_req_flag = FALSE;
@@ -297,6 +282,162 @@ kg_seal_iov(OM_uint32 *minor_status,
     return GSS_S_COMPLETE;
 }
 
+/*
+ * Wrap a STREAM | n[SIGN_ONLY] | DATA | m[SIGN_ONLY] message in place.  The
+ * DATA buffer must lie within the STREAM buffer, leaving room before it for
+ * the token header and after it for the padding and trailer.  Lay out
+ * HEADER | DATA | PADDING | TRAILER around the DATA buffer, so that the token
+ * is built without copying the data, and set the STREAM buffer to the token.
+ */
+static OM_uint32
+seal_stream_iov(OM_uint32 *minor_status, krb5_gss_ctx_id_rec *ctx,
+                int conf_req_flag, int *conf_state, gss_iov_buffer_desc *iov,
+                int iov_count)
+{
+    OM_uint32 major = GSS_S_FAILURE, minor = EINVAL;
+    gss_iov_buffer_desc stackiov[KG_STREAM_IOV_MAX], *tiov = stackiov;
+    gss_iov_buffer_t stream, data = NULL;
+    gss_iov_buffer_t theader, tpadding, ttrailer;
+    unsigned char *start, *dstart;
+    size_t room, toklen;
+    int i = 0, j;
+
+    if (ctx->gss_flags & GSS_C_DCE_STYLE)
+        goto cleanup;
+
+    stream = kg_locate_iov(iov, iov_count, GSS_IOV_BUFFER_TYPE_STREAM);
+    if (stream == NULL)
+        goto cleanup;
+
+    if ((size_t)iov_count + 2 > KG_STREAM_IOV_MAX) {
+        tiov = calloc((size_t)iov_count + 2, sizeof(gss_iov_buffer_desc));
+        if (tiov == NULL) {
+            minor = ENOMEM;
+            goto cleanup;
+        }
+    } else {
+        memset(stackiov, 0, sizeof(stackiov));
+    }
+
+    /* HEADER | n[SIGN_ONLY] | DATA | m[SIGN_ONLY] | PADDING | TRAILER */
+    theader = &tiov[i++];
+    theader->type = GSS_IOV_BUFFER_TYPE_HEADER;
+    for (j = 0; j < iov_count; j++) {
+        OM_uint32 type = GSS_IOV_BUFFER_TYPE(iov[j].type);
+
+        if (type == GSS_IOV_BUFFER_TYPE_DATA) {
+            /* only a single DATA buffer can appear */
+            if (data != NULL)
+                goto cleanup;
+            data = &iov[j];
+        } else if (type != GSS_IOV_BUFFER_TYPE_SIGN_ONLY &&
+                   type != GSS_IOV_BUFFER_TYPE_STREAM &&
+                   type != GSS_IOV_BUFFER_TYPE_EMPTY) {
+            goto cleanup;
+        }
+        if (type == GSS_IOV_BUFFER_TYPE_DATA ||
+            type == GSS_IOV_BUFFER_TYPE_SIGN_ONLY)
+            tiov[i++] = iov[j];
+    }
+    if (data == NULL)
+        goto cleanup;
+    tpadding = &tiov[i++];
+    tpadding->type = GSS_IOV_BUFFER_TYPE_PADDING;
+    ttrailer = &tiov[i++];
+    ttrailer->type = GSS_IOV_BUFFER_TYPE_TRAILER;
+
+    major = kg_seal_iov_length(&minor, (gss_ctx_id_t)ctx, conf_req_flag,
+                               GSS_C_QOP_DEFAULT, NULL, tiov, i,
+                               KG_TOK_WRAP_MSG);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    /* Check that the framing fits around the data. */
+    major = GSS_S_FAILURE;
+    minor = KRB5_BAD_MSIZE;
+    start = stream->buffer.value;
+    dstart = data->buffer.value;
+    if (dstart < start ||
+        (size_t)(dstart - start) > stream->buffer.length ||
+        (size_t)(dstart - start) < theader->buffer.length ||
+        data->buffer.length > stream->buffer.length - (dstart - start))
+        goto cleanup;
+    room = stream->buffer.length - (dstart - start) - data->buffer.length;
+    if (tpadding->buffer.length + ttrailer->buffer.length > room)
+        goto cleanup;
+
+    theader->buffer.value = dstart - theader->buffer.length;
+    tpadding->buffer.value = dstart + data->buffer.length;
+    ttrailer->buffer.value = (unsigned char *)tpadding->buffer.value +
+        tpadding->buffer.length;
+    toklen = theader->buffer.length + data->buffer.length +
+        tpadding->buffer.length + ttrailer->buffer.length;
+
+    major = seal_iov_token(&minor, ctx, conf_req_flag, conf_state, tiov, i,
+                           KG_TOK_WRAP_MSG);
+    if (GSS_ERROR(major))
+        goto cleanup;
+
+    /* The token must have come out exactly as long as reported. */
+    if (theader->buffer.length + data->buffer.length +
+        tpadding->buffer.length + ttrailer->buffer.length != toklen) {
+        major = GSS_S_FAILURE;
+        minor = EINVAL;
+        goto cleanup;
+    }
+
+    stream->buffer.value = theader->buffer.value;
+    stream->buffer.length = toklen;
+
+cleanup:
+    if (tiov != stackiov)
+        free(tiov);
+    *minor_status = minor;
+    return major;
+}
+
+/* Seal one message using ctx, which the caller has checked is established. */
+static OM_uint32
+seal_iov_msg(OM_uint32 *minor_status, krb5_gss_ctx_id_rec *ctx,
+             int conf_req_flag, int *conf_state, gss_iov_buffer_desc *iov,
+             int iov_count, int toktype)
+{
+    if (toktype == KG_TOK_WRAP_MSG &&
+        kg_locate_iov(iov, iov_count, GSS_IOV_BUFFER_TYPE_STREAM) != NULL) {
+        return seal_stream_iov(minor_status, ctx, conf_req_flag, conf_state,
+                               iov, iov_count);
+    }
+    return seal_iov_token(minor_status, ctx, conf_req_flag, conf_state, iov,
+                          iov_count, toktype);
+}
+
+OM_uint32
+kg_seal_iov(OM_uint32 *minor_status,
+            gss_ctx_id_t context_handle,
+            int conf_req_flag,
+            gss_qop_t qop_req,
+            int *conf_state,
+            gss_iov_buffer_desc *iov,
+            int iov_count,
+            int toktype)
+{
+    krb5_gss_ctx_id_rec *ctx;
+
+    if (qop_req != 0) {
+        *minor_status = (OM_uint32)G_UNKNOWN_QOP;
+        return GSS_S_BAD_QOP;
+    }
+
+    ctx = (krb5_gss_ctx_id_rec *)context_handle;
+    if (ctx->terminated || !ctx->established) {
+        *minor_status = KG_CTX_INCOMPLETE;
+        return GSS_S_NO_CONTEXT;
+    }
+
+    return seal_iov_msg(minor_status, ctx, conf_req_flag, conf_state, iov,
+                        iov_count, toktype);
+}
+
 #define INIT_IOV_DATA(_iov)     do { (_iov)->buffer.value = NULL;       \
         (_iov)->buffer.length = 0; }                                    \
     while (0)
@@ -488,6 +629,42 @@ krb5_gss_wrap_iov(OM_uint32 *minor_status,
     return major_status;
 }
 
+/*
+ * Wrap a batch of messages, checking the QOP and context state once for the
+ * whole batch.  Record each message's result.
+ */
+OM_uint32 KRB5_CALLCONV
+krb5_gss_wrap_iov_batch(OM_uint32 *minor_status,
+                        gss_ctx_id_t context_handle,
+                        int conf_req_flag,
+                        gss_qop_t qop_req,
+                        gss_iov_message_desc *msgs,
+                        size_t count)
+{
+    krb5_gss_ctx_id_rec *ctx = (krb5_gss_ctx_id_rec *)context_handle;
+    size_t i;
+
+    if (qop_req != 0) {
+        *minor_status = (OM_uint32)G_UNKNOWN_QOP;
+        return GSS_S_BAD_QOP;
+    }
+    if (ctx->terminated || !ctx->established) {
+        *minor_status = KG_CTX_INCOMPLETE;
+        return GSS_S_NO_CONTEXT;
+    }
+
+    for (i = 0; i < count; i++) {
+        msgs[i].major_status = seal_iov_msg(&msgs[i].minor_status, ctx,
+                                            conf_req_flag,
+                                            &msgs[i].conf_state, msgs[i].iov,
+                                            msgs[i].iov_count,
+                                            KG_TOK_WRAP_MSG);
+    }
+
+    *minor_status = 0;
+    return GSS_S_COMPLETE;
+}
+
 OM_uint32 KRB5_CALLCONV
 krb5_gss_wrap_iov_length(OM_uint32 *minor_status,
                          gss_ctx_id_t context_handle,
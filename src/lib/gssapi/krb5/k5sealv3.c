@@ -37,7 +37,8 @@ gss_krb5int_rotate_left (void *ptr, size_t bufsiz, size_t rc)
        debugging, they'll be randomly chosen.
 
        Return 1 for success, 0 for failure (ENOMEM).  */
-    void *tbuf;
+    unsigned char stackbuf[64];
+    void *tbuf = stackbuf;
 
     if (bufsiz == 0)
         return 1;
@@ -45,13 +46,18 @@ gss_krb5int_rotate_left (void *ptr, size_t bufsiz, size_t rc)
     if (rc == 0)
         return 1;
 
-    tbuf = malloc(rc);
-    if (tbuf == 0)
-        return 0;
+    /* Rotation counts are normally the length of a token trailer, which fits
+     * on the stack. */
+    if (rc > sizeof(stackbuf)) {
+        tbuf = malloc(rc);
+        if (tbuf == 0)
+            return 0;
+    }
     memcpy(tbuf, ptr, rc);
     memmove(ptr, (char *)ptr + rc, bufsiz - rc);
     memcpy((char *)ptr + bufsiz - rc, tbuf, rc);
-    free(tbuf);
+    if (tbuf != stackbuf)
+        free(tbuf);
     return 1;
 }
 
@@ -379,7 +379,7 @@ kg_unseal_stream_iov(OM_uint32 *minor_status,
     krb5_context context = ctx->k5_context;
     int conf_req_flag, toktype2;
     int i = 0, j;
-    gss_iov_buffer_desc *tiov = NULL;
+    gss_iov_buffer_desc stackiov[KG_STREAM_IOV_MAX], *tiov = stackiov;
     gss_iov_buffer_t stream, data = NULL;
     gss_iov_buffer_t theader, tdata = NULL, tpadding, ttrailer;
 
@@ -413,10 +413,14 @@ kg_unseal_stream_iov(OM_uint32 *minor_status,
     ptr += 2;
     bodysize -= 2;
 
-    tiov = (gss_iov_buffer_desc *)calloc((size_t)iov_count + 2, sizeof(gss_iov_buffer_desc));
-    if (tiov == NULL) {
-        code = ENOMEM;
-        goto cleanup;
+    if ((size_t)iov_count + 2 > KG_STREAM_IOV_MAX) {
+        tiov = calloc((size_t)iov_count + 2, sizeof(gss_iov_buffer_desc));
+        if (tiov == NULL) {
+            code = ENOMEM;
+            goto cleanup;
+        }
+    } else {
+        memset(stackiov, 0, sizeof(stackiov));
     }
 
     /* HEADER */
@@ -575,7 +579,7 @@ kg_unseal_stream_iov(OM_uint32 *minor_status,
         kg_release_iov(tdata, 1);
 
 cleanup:
-    if (tiov != NULL)
+    if (tiov != stackiov)
         free(tiov);
 
     *minor_status = code;
@@ -583,6 +587,22 @@ cleanup:
     return major_status;
 }
 
+/* Unseal one message using ctx, which the caller has checked is
+ * established. */
+static OM_uint32
+unseal_iov_msg(OM_uint32 *minor_status, krb5_gss_ctx_id_rec *ctx,
+               int *conf_state, gss_qop_t *qop_state,
+               gss_iov_buffer_desc *iov, int iov_count, int toktype)
+{
+    if (kg_locate_iov(iov, iov_count, GSS_IOV_BUFFER_TYPE_STREAM) != NULL) {
+        return kg_unseal_stream_iov(minor_status, ctx, conf_state, qop_state,
+                                    iov, iov_count, toktype);
+    } else {
+        return kg_unseal_iov_token(minor_status, ctx, conf_state, qop_state,
+                                   iov, iov_count, toktype);
+    }
+}
+
 OM_uint32
 kg_unseal_iov(OM_uint32 *minor_status,
               gss_ctx_id_t context_handle,
@@ -593,7 +613,6 @@ kg_unseal_iov(OM_uint32 *minor_status,
               int toktype)
 {
     krb5_gss_ctx_id_rec *ctx;
-    OM_uint32 code;
 
     ctx = (krb5_gss_ctx_id_rec *)context_handle;
     if (ctx->terminated || !ctx->established) {
@@ -601,15 +620,8 @@ kg_unseal_iov(OM_uint32 *minor_status,
         return GSS_S_NO_CONTEXT;
     }
 
-    if (kg_locate_iov(iov, iov_count, GSS_IOV_BUFFER_TYPE_STREAM) != NULL) {
-        code = kg_unseal_stream_iov(minor_status, ctx, conf_state, qop_state,
-                                    iov, iov_count, toktype);
-    } else {
-        code = kg_unseal_iov_token(minor_status, ctx, conf_state, qop_state,
-                                   iov, iov_count, toktype);
-    }
-
-    return code;
+    return unseal_iov_msg(minor_status, ctx, conf_state, qop_state, iov,
+                          iov_count, toktype);
 }
 
 OM_uint32 KRB5_CALLCONV
@@ -629,6 +641,34 @@ krb5_gss_unwrap_iov(OM_uint32 *minor_status,
     return major_status;
 }
 
+/* Unwrap a batch of messages, checking the context state once for the whole
+ * batch.  Record each message's result. */
+OM_uint32 KRB5_CALLCONV
+krb5_gss_unwrap_iov_batch(OM_uint32 *minor_status,
+                          gss_ctx_id_t context_handle,
+                          gss_iov_message_desc *msgs,
+                          size_t count)
+{
+    krb5_gss_ctx_id_rec *ctx = (krb5_gss_ctx_id_rec *)context_handle;
+    size_t i;
+
+    if (ctx->terminated || !ctx->established) {
+        *minor_status = KG_CTX_INCOMPLETE;
+        return GSS_S_NO_CONTEXT;
+    }
+
+    for (i = 0; i < count; i++) {
+        msgs[i].major_status = unseal_iov_msg(&msgs[i].minor_status, ctx,
+                                              &msgs[i].conf_state,
+                                              &msgs[i].qop_state,
+                                              msgs[i].iov, msgs[i].iov_count,
+                                              KG_TOK_WRAP_MSG);
+    }
+
+    *minor_status = 0;
+    return GSS_S_COMPLETE;
+}
+
 OM_uint32 KRB5_CALLCONV
 krb5_gss_verify_mic_iov(OM_uint32 *minor_status,
                         gss_ctx_id_t context_handle,
@@ -82,6 +82,7 @@ static void updateMechList(void);
 static void initMechList(void);
 static void loadInterMech(gss_mech_info aMech);
 static void freeMechList(void);
+static void freeMechSnapshots(void);
 
 static OM_uint32 build_mechSet(void);
 static void free_mechSet(void);
@@ -96,6 +97,26 @@ static k5_mutex_t g_mechListLock = K5_MUTEX_PARTIAL_INITIALIZER;
 static time_t g_confFileModTime = (time_t)0;
 static time_t g_confLastCall = (time_t)0;
 
+/*
+ * A read-only copy of the OID-to-mechanism mappings of the loaded mechanisms,
+ * in mech list order, which gssint_get_mechanism() searches without taking
+ * g_mechListLock.  A new snapshot is published after a lookup misses it and
+ * finds a loaded mechanism in the list.  Readers may still be using an older
+ * snapshot, so replaced snapshots are kept until the library is finalized.
+ */
+struct mech_snapshot_entry {
+	gss_const_OID oid;
+	gss_mechanism mech;
+};
+
+struct mech_snapshot {
+	struct mech_snapshot *prev;	/* the snapshot this one replaced */
+	size_t count;
+	struct mech_snapshot_entry *entries;
+};
+
+static struct mech_snapshot *g_mechSnapshot = NULL;
+
 static gss_OID_set_desc g_mechSet = { 0, NULL };
 static k5_mutex_t g_mechSetLock = K5_MUTEX_PARTIAL_INITIALIZER;
 
@@ -153,6 +174,7 @@ gssint_mechglue_fini(void)
 	k5_mutex_destroy(&g_mechSetLock);
 	k5_mutex_destroy(&g_mechListLock);
 	free_mechSet();
+	freeMechSnapshots();
 	freeMechList();
 	remove_error_table(&et_ggss_error_table);
 	gssint_mecherrmap_destroy();
@@ -782,6 +804,8 @@ build_dynamicMech(void *dl, const gss_OID mech_type)
 	GSS_ADD_DYNAMIC_METHOD_NOLOOP(dl, mech, gssspi_query_meta_data);
 	GSS_ADD_DYNAMIC_METHOD_NOLOOP(dl, mech, gssspi_exchange_meta_data);
 	GSS_ADD_DYNAMIC_METHOD_NOLOOP(dl, mech, gssspi_query_mechanism_info);
+	GSS_ADD_DYNAMIC_METHOD_NOLOOP(dl, mech, gss_wrap_iov_batch);
+	GSS_ADD_DYNAMIC_METHOD_NOLOOP(dl, mech, gss_unwrap_iov_batch);
 
 	assert(mech_type != GSS_C_NO_OID);
 
@@ -886,6 +910,8 @@ build_interMech(void *dl, const gss_OID mech_type)
 	RESOLVE_GSSI_SYMBOL(dl, mech, gssspi, _import_sec_context_by_mech);
 	RESOLVE_GSSI_SYMBOL(dl, mech, gssspi, _import_name_by_mech);
 	RESOLVE_GSSI_SYMBOL(dl, mech, gssspi, _import_cred_by_mech);
+	RESOLVE_GSSI_SYMBOL(dl, mech, gss, _wrap_iov_batch);
+	RESOLVE_GSSI_SYMBOL(dl, mech, gss, _unwrap_iov_batch);
 
 	mech->mech_type = *mech_type;
 	return mech;
@@ -979,6 +1005,19 @@ cleanup:
 	k5_clear_error(&errinfo);
 }
 
+static void
+freeMechSnapshots(void)
+{
+	struct mech_snapshot *snap, *prev;
+
+	for (snap = g_mechSnapshot; snap != NULL; snap = prev) {
+		prev = snap->prev;
+		free(snap->entries);
+		free(snap);
+	}
+	g_mechSnapshot = NULL;
+}
+
 static void
 freeMechList(void)
 {
@@ -1110,37 +1149,91 @@ gssint_make_public_oid_set(OM_uint32 *minor_status, gss_OID oids, int count,
  * Register a mechanism.  Called with g_mechListLock held.
  */
 
+#ifdef K5_HAVE_ATOMIC_PTR
 /*
- * given the mechanism type, return the mechanism structure
- * containing the mechanism library entry points.
- * will return NULL if mech type is not found
- * This function will also trigger the loading of the mechanism
- * module if it has not been already loaded.
+ * Publish a new snapshot of the loaded mechanisms.  Must be invoked with the
+ * g_mechListLock mutex held.  On allocation failure, lookups keep using the
+ * previous snapshot and the mech list.
  */
-gss_mechanism
-gssint_get_mechanism(gss_const_OID oid)
+static void
+publishMechSnapshot(void)
+{
+	struct mech_snapshot *snap;
+	gss_mech_info minfo;
+	size_t n = 0;
+
+	for (minfo = g_mechList; minfo != NULL; minfo = minfo->next) {
+		if (minfo->mech != NULL)
+			n++;
+		if (minfo->int_mech_type != GSS_C_NO_OID)
+			n++;
+	}
+
+	snap = calloc(1, sizeof(*snap));
+	if (snap == NULL)
+		return;
+	snap->entries = calloc(n ? n : 1, sizeof(*snap->entries));
+	if (snap->entries == NULL) {
+		free(snap);
+		return;
+	}
+
+	/* Mirror the search order of getMechanism(). */
+	for (minfo = g_mechList; minfo != NULL; minfo = minfo->next) {
+		if (minfo->mech != NULL) {
+			snap->entries[snap->count].oid = minfo->mech_type;
+			snap->entries[snap->count++].mech = minfo->mech;
+		}
+		if (minfo->int_mech_type != GSS_C_NO_OID) {
+			snap->entries[snap->count].oid = minfo->int_mech_type;
+			snap->entries[snap->count++].mech = minfo->int_mech;
+		}
+	}
+
+	snap->prev = g_mechSnapshot;
+	k5_atomic_store_ptr(&g_mechSnapshot, snap);
+}
+
+/* Look up oid in the current snapshot without locking.  Return NULL if it is
+ * not there. */
+static gss_mechanism
+searchMechSnapshot(gss_const_OID oid)
+{
+	struct mech_snapshot *snap;
+	size_t i;
+
+	snap = k5_atomic_load_ptr(&g_mechSnapshot);
+	if (snap == NULL)
+		return NULL;
+	for (i = 0; i < snap->count; i++) {
+		if (g_OID_equal(snap->entries[i].oid, oid))
+			return snap->entries[i].mech;
+	}
+	return NULL;
+}
+#endif
+
+/*
+ * Return the mechanism for oid, loading its module if necessary.  Must be
+ * invoked with the g_mechListLock mutex held.
+ */
+static gss_mechanism
+getMechanism(gss_const_OID oid)
 {
 	gss_mech_info aMech;
 	gss_mechanism (*sym)(const gss_OID);
 	struct plugin_file_handle *dl;
 	struct errinfo errinfo;
 
-	if (gssint_mechglue_initialize_library() != 0)
-		return (NULL);
-
-	k5_mutex_lock(&g_mechListLock);
-
 	/* Check if the mechanism is already loaded. */
 	aMech = g_mechList;
 	if (oid == GSS_C_NULL_OID)
 		oid = aMech->mech_type;
 	while (aMech != NULL) {
 		if (g_OID_equal(aMech->mech_type, oid) && aMech->mech) {
-			k5_mutex_unlock(&g_mechListLock);
 			return aMech->mech;
 		} else if (aMech->int_mech_type != GSS_C_NO_OID &&
 			   g_OID_equal(aMech->int_mech_type, oid)) {
-			k5_mutex_unlock(&g_mechListLock);
 			return aMech->int_mech;
 		}
 		aMech = aMech->next;
@@ -1155,23 +1248,18 @@ gssint_get_mechanism(gss_const_OID oid)
 	aMech = searchMechList(oid);
 
 	/* is the mechanism present in the list ? */
-	if (aMech == NULL) {
-		k5_mutex_unlock(&g_mechListLock);
+	if (aMech == NULL)
 		return ((gss_mechanism)NULL);
-	}
 
 	/* has another thread loaded the mech */
-	if (aMech->mech) {
-		k5_mutex_unlock(&g_mechListLock);
+	if (aMech->mech)
 		return (aMech->mech);
-	}
 
 	memset(&errinfo, 0, sizeof(errinfo));
 
 	if (krb5int_open_plugin(aMech->uLibName, &dl, &errinfo) != 0 ||
 	    errinfo.code != 0) {
 		k5_clear_error(&errinfo);
-		k5_mutex_unlock(&g_mechListLock);
 		return ((gss_mechanism)NULL);
 	}
 
@@ -1187,14 +1275,50 @@ gssint_get_mechanism(gss_const_OID oid)
 	}
 	if (aMech->mech == NULL) {
 		(void) krb5int_close_plugin(dl);
-		k5_mutex_unlock(&g_mechListLock);
 		return ((gss_mechanism)NULL);
 	}
 
 	aMech->dl_handle = dl;
 
-	k5_mutex_unlock(&g_mechListLock);
 	return (aMech->mech);
+} /* getMechanism */
+
+/*
+ * given the mechanism type, return the mechanism structure
+ * containing the mechanism library entry points.
+ * will return NULL if mech type is not found
+ * This function will also trigger the loading of the mechanism
+ * module if it has not been already loaded.
+ *
+ * Once a mechanism is loaded, lookups of its OID are answered from the
+ * snapshot without locking or re-reading the configuration.
+ */
+gss_mechanism
+gssint_get_mechanism(gss_const_OID oid)
+{
+	gss_mechanism mech;
+
+	if (gssint_mechglue_initialize_library() != 0)
+		return (NULL);
+
+#ifdef K5_HAVE_ATOMIC_PTR
+	if (oid != GSS_C_NULL_OID) {
+		mech = searchMechSnapshot(oid);
+		if (mech != NULL)
+			return (mech);
+	}
+#endif
+
+	k5_mutex_lock(&g_mechListLock);
+	mech = getMechanism(oid);
+#ifdef K5_HAVE_ATOMIC_PTR
+	/* The snapshot cannot answer for the default mech, so publishing after
+	 * such a lookup would only add to the retired snapshots. */
+	if (mech != NULL && oid != GSS_C_NULL_OID)
+		publishMechSnapshot();
+#endif
+	k5_mutex_unlock(&g_mechListLock);
+	return (mech);
 } /* gssint_get_mechanism */
 
 /*
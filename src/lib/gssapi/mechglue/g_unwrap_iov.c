@@ -114,6 +114,67 @@ int			iov_count;
     return (GSS_S_BAD_MECH);
 }
 
+/*
+ * Unwrap each message of a batch in turn, looking up the mechanism only once.
+ * If the mechanism has no batch entry point, call its gss_unwrap_iov for each
+ * message.
+ */
+OM_uint32 KRB5_CALLCONV
+gss_unwrap_iov_batch(OM_uint32 *minor_status, gss_ctx_id_t context_handle,
+		     gss_iov_message_desc *msgs, size_t count)
+{
+    OM_uint32 batch_major = GSS_S_COMPLETE, batch_minor = 0;
+    gss_union_ctx_id_t ctx;
+    gss_mechanism mech;
+    size_t i;
+
+    if (minor_status != NULL)
+	*minor_status = 0;
+    if (minor_status == NULL)
+	return GSS_S_CALL_INACCESSIBLE_WRITE;
+    if (context_handle == GSS_C_NO_CONTEXT)
+	return GSS_S_CALL_INACCESSIBLE_READ | GSS_S_NO_CONTEXT;
+    if (msgs == NULL && count > 0)
+	return GSS_S_CALL_INACCESSIBLE_READ;
+    for (i = 0; i < count; i++) {
+	if (msgs[i].iov == GSS_C_NO_IOV_BUFFER)
+	    return GSS_S_CALL_INACCESSIBLE_READ;
+    }
+
+    ctx = (gss_union_ctx_id_t)context_handle;
+    if (ctx->internal_ctx_id == GSS_C_NO_CONTEXT)
+	return GSS_S_NO_CONTEXT;
+    mech = gssint_get_mechanism(ctx->mech_type);
+    if (mech == NULL)
+	return GSS_S_BAD_MECH;
+    if (mech->gss_unwrap_iov_batch == NULL && mech->gss_unwrap_iov == NULL)
+	return GSS_S_UNAVAILABLE;
+
+    for (i = 0; i < count; i++) {
+	msgs[i].conf_state = 0;
+	msgs[i].qop_state = GSS_C_QOP_DEFAULT;
+	msgs[i].major_status = GSS_S_COMPLETE;
+	msgs[i].minor_status = 0;
+    }
+
+    if (mech->gss_unwrap_iov_batch != NULL) {
+	batch_major = mech->gss_unwrap_iov_batch(&batch_minor,
+						 ctx->internal_ctx_id, msgs,
+						 count);
+    } else {
+	for (i = 0; i < count; i++) {
+	    msgs[i].major_status =
+		mech->gss_unwrap_iov(&msgs[i].minor_status,
+				     ctx->internal_ctx_id,
+				     &msgs[i].conf_state, &msgs[i].qop_state,
+				     msgs[i].iov, msgs[i].iov_count);
+	}
+    }
+
+    return gssint_finish_iov_batch(minor_status, mech, batch_major,
+				   batch_minor, msgs, count);
+}
+
 OM_uint32 KRB5_CALLCONV
 gss_verify_mic_iov(OM_uint32 *minor_status, gss_ctx_id_t context_handle,
 		   gss_qop_t *qop_state, gss_iov_buffer_desc *iov,
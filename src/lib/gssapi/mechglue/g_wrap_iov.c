@@ -179,6 +179,110 @@ int			iov_count;
     return (GSS_S_BAD_MECH);
 }
 
+/*
+ * Map the minor codes of messages in a batch which did not complete, and
+ * return the status of the first message which failed, or of the first
+ * message with supplementary status if none failed.  Set *minor_status to the
+ * minor code of that message.  If no message failed but the mechanism
+ * reported an error for the batch as a whole (batch_major and batch_minor),
+ * record that error in every message and return it.
+ */
+OM_uint32
+gssint_finish_iov_batch(OM_uint32 *minor_status, gss_mechanism mech,
+			OM_uint32 batch_major, OM_uint32 batch_minor,
+			gss_iov_message_desc *msgs, size_t count)
+{
+    size_t i, first = count;
+
+    *minor_status = 0;
+    for (i = 0; i < count; i++) {
+	if (msgs[i].major_status == GSS_S_COMPLETE)
+	    continue;
+	map_error(&msgs[i].minor_status, mech);
+	if (first == count ||
+	    (!GSS_ERROR(msgs[first].major_status) &&
+	     GSS_ERROR(msgs[i].major_status)))
+	    first = i;
+    }
+    if ((first == count || !GSS_ERROR(msgs[first].major_status)) &&
+	GSS_ERROR(batch_major)) {
+	map_error(&batch_minor, mech);
+	for (i = 0; i < count; i++) {
+	    msgs[i].major_status = batch_major;
+	    msgs[i].minor_status = batch_minor;
+	}
+	*minor_status = batch_minor;
+	return batch_major;
+    }
+    if (first == count)
+	return GSS_S_COMPLETE;
+    *minor_status = msgs[first].minor_status;
+    return msgs[first].major_status;
+}
+
+/*
+ * Wrap each message of a batch in turn, looking up the mechanism only once.
+ * If the mechanism has no batch entry point, call its gss_wrap_iov for each
+ * message.
+ */
+OM_uint32 KRB5_CALLCONV
+gss_wrap_iov_batch(OM_uint32 *minor_status, gss_ctx_id_t context_handle,
+		   int conf_req_flag, gss_qop_t qop_req,
+		   gss_iov_message_desc *msgs, size_t count)
+{
+    OM_uint32 batch_major = GSS_S_COMPLETE, batch_minor = 0;
+    gss_union_ctx_id_t ctx;
+    gss_mechanism mech;
+    size_t i;
+
+    if (minor_status != NULL)
+	*minor_status = 0;
+    if (minor_status == NULL)
+	return GSS_S_CALL_INACCESSIBLE_WRITE;
+    if (context_handle == GSS_C_NO_CONTEXT)
+	return GSS_S_CALL_INACCESSIBLE_READ | GSS_S_NO_CONTEXT;
+    if (msgs == NULL && count > 0)
+	return GSS_S_CALL_INACCESSIBLE_READ;
+    for (i = 0; i < count; i++) {
+	if (msgs[i].iov == GSS_C_NO_IOV_BUFFER)
+	    return GSS_S_CALL_INACCESSIBLE_READ;
+    }
+
+    ctx = (gss_union_ctx_id_t)context_handle;
+    if (ctx->internal_ctx_id == GSS_C_NO_CONTEXT)
+	return GSS_S_NO_CONTEXT;
+    mech = gssint_get_mechanism(ctx->mech_type);
+    if (mech == NULL)
+	return GSS_S_BAD_MECH;
+    if (mech->gss_wrap_iov_batch == NULL && mech->gss_wrap_iov == NULL)
+	return GSS_S_UNAVAILABLE;
+
+    for (i = 0; i < count; i++) {
+	msgs[i].conf_state = 0;
+	msgs[i].qop_state = qop_req;
+	msgs[i].major_status = GSS_S_COMPLETE;
+	msgs[i].minor_status = 0;
+    }
+
+    if (mech->gss_wrap_iov_batch != NULL) {
+	batch_major = mech->gss_wrap_iov_batch(&batch_minor,
+					       ctx->internal_ctx_id,
+					       conf_req_flag, qop_req, msgs,
+					       count);
+    } else {
+	for (i = 0; i < count; i++) {
+	    msgs[i].major_status =
+		mech->gss_wrap_iov(&msgs[i].minor_status,
+				   ctx->internal_ctx_id, conf_req_flag,
+				   qop_req, &msgs[i].conf_state, msgs[i].iov,
+				   msgs[i].iov_count);
+	}
+    }
+
+    return gssint_finish_iov_batch(minor_status, mech, batch_major,
+				   batch_minor, msgs, count);
+}
+
 OM_uint32 KRB5_CALLCONV
 gss_get_mic_iov(OM_uint32 *minor_status, gss_ctx_id_t context_handle,
 		gss_qop_t qop_req, gss_iov_buffer_desc *iov, int iov_count)
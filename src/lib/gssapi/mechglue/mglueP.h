@@ -733,6 +733,31 @@ typedef struct gss_config {
 	    unsigned char[16]		/* auth_scheme */
 	/* */);
 
+	/*
+	 * Batched IOV wrapping added in 1.19.  The mechanism records each
+	 * message's result in its descriptor and returns GSS_S_COMPLETE, or
+	 * returns an error without processing any message if the batch as a
+	 * whole cannot be handled.
+	 */
+
+	OM_uint32	(KRB5_CALLCONV *gss_wrap_iov_batch)
+	(
+	    OM_uint32 *,		/* minor_status */
+	    gss_ctx_id_t,		/* context_handle */
+	    int,			/* conf_req_flag */
+	    gss_qop_t,			/* qop_req */
+	    gss_iov_message_desc *,	/* msgs */
+	    size_t			/* count */
+	/* */);
+
+	OM_uint32	(KRB5_CALLCONV *gss_unwrap_iov_batch)
+	(
+	    OM_uint32 *,		/* minor_status */
+	    gss_ctx_id_t,		/* context_handle */
+	    gss_iov_message_desc *,	/* msgs */
+	    size_t			/* count */
+	/* */);
+
 } *gss_mechanism;
 
 /*
@@ -860,6 +885,13 @@ gssint_unwrap_aead (gss_mechanism,	/* mech */
 		    gss_buffer_t,	/* output_payload_buffer */
 		    int *,		/* conf_state */
 		    gss_qop_t *);	/* qop_state */
+OM_uint32
+gssint_finish_iov_batch (OM_uint32 *,	/* minor_status */
+			 gss_mechanism,	/* mech */
+			 OM_uint32,	/* batch_major */
+			 OM_uint32,	/* batch_minor */
+			 gss_iov_message_desc *, /* msgs */
+			 size_t);	/* count */
 
 
 /* Use this to map an error code that was returned from a mech
@@ -691,6 +691,24 @@ spnego_gss_get_mic_iov_length(
 	int iov_count
 );
 
+OM_uint32 KRB5_CALLCONV
+spnego_gss_wrap_iov_batch(
+	OM_uint32 *minor_status,
+	gss_ctx_id_t context_handle,
+	int conf_req_flag,
+	gss_qop_t qop_req,
+	gss_iov_message_desc *msgs,
+	size_t count
+);
+
+OM_uint32 KRB5_CALLCONV
+spnego_gss_unwrap_iov_batch(
+	OM_uint32 *minor_status,
+	gss_ctx_id_t context_handle,
+	gss_iov_message_desc *msgs,
+	size_t count
+);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -279,7 +279,12 @@ static struct gss_config spnego_mechanism =
 	NULL,				/* gssspi_import_cred_by_mech */
 	spnego_gss_get_mic_iov,
 	spnego_gss_verify_mic_iov,
-	spnego_gss_get_mic_iov_length
+	spnego_gss_get_mic_iov_length,
+	NULL,				/* gssspi_query_meta_data */
+	NULL,				/* gssspi_exchange_meta_data */
+	NULL,				/* gssspi_query_mechanism_info */
+	spnego_gss_wrap_iov_batch,
+	spnego_gss_unwrap_iov_batch
 };
 
 #ifdef _GSS_STATIC_LINK
@@ -3104,6 +3109,34 @@ spnego_gss_get_mic_iov_length(OM_uint32 *minor_status,
 				  iov_count);
 }
 
+OM_uint32 KRB5_CALLCONV
+spnego_gss_wrap_iov_batch(OM_uint32 *minor_status,
+			  gss_ctx_id_t context_handle, int conf_req_flag,
+			  gss_qop_t qop_req, gss_iov_message_desc *msgs,
+			  size_t count)
+{
+    spnego_gss_ctx_id_t sc = (spnego_gss_ctx_id_t)context_handle;
+
+    if (sc->ctx_handle == GSS_C_NO_CONTEXT)
+	    return (GSS_S_NO_CONTEXT);
+
+    return gss_wrap_iov_batch(minor_status, sc->ctx_handle, conf_req_flag,
+			      qop_req, msgs, count);
+}
+
+OM_uint32 KRB5_CALLCONV
+spnego_gss_unwrap_iov_batch(OM_uint32 *minor_status,
+			    gss_ctx_id_t context_handle,
+			    gss_iov_message_desc *msgs, size_t count)
+{
+    spnego_gss_ctx_id_t sc = (spnego_gss_ctx_id_t)context_handle;
+
+    if (sc->ctx_handle == GSS_C_NO_CONTEXT)
+	    return (GSS_S_NO_CONTEXT);
+
+    return gss_unwrap_iov_batch(minor_status, sc->ctx_handle, msgs, count);
+}
+
 /*
  * We will release everything but the ctx_handle so that it
  * can be passed back to init/accept context. This routine should
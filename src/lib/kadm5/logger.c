@@ -147,6 +147,10 @@ static struct log_control log_control = {
 };
 static struct log_entry def_log_entry;
 
+/* Serializes output and krb5_klog_reopen(), as the KDC may log from several
+ * threads. */
+static k5_mutex_t log_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+
 /*
  * These macros define any special processing that needs to happen for
  * devices.  For unix, of course, this is hardly anything.
@@ -747,7 +751,9 @@ krb5_klog_syslog(int priority, const char *format, ...)
     va_list     pvar;
 
     va_start(pvar, format);
+    k5_mutex_lock(&log_lock);
     retval = klog_vsyslog(priority, format, pvar);
+    k5_mutex_unlock(&log_lock);
     va_end(pvar);
     return(retval);
 }
@@ -769,6 +775,7 @@ krb5_klog_reopen(krb5_context kcontext)
      * Only logs which are actually files need to be closed
      * and reopened in response to a SIGHUP
      */
+    k5_mutex_lock(&log_lock);
     for (lindex = 0; lindex < log_control.log_nentries; lindex++) {
         if (log_control.log_entries[lindex].log_type == K_LOG_FILE) {
             fclose(log_control.log_entries[lindex].lfu_filep);
@@ -787,4 +794,5 @@ krb5_klog_reopen(krb5_context kcontext)
             }
         }
     }
+    k5_mutex_unlock(&log_lock);
 }
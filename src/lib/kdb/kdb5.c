@@ -328,6 +328,10 @@ copy_vtable(const kdb_vftabl *in, kdb_vftabl *out)
     out->get_authdata_info = in->get_authdata_info;
     out->free_authdata_info = in->free_authdata_info;
 
+    /* Copy fields for minor version 1. */
+    if (in->min_ver >= 1)
+        out->get_principals = in->get_principals;
+
     /* Set defaults for optional fields. */
     if (out->fetch_master_key == NULL)
         out->fetch_master_key = krb5_db_def_fetch_mkey;
@@ -635,6 +639,7 @@ kdb_free_lib_handle(krb5_context kcontext)
     if (status)
         return status;
 
+    kdb_cache_free(kcontext);
     free_mkey_list(kcontext, kcontext->dal_handle->master_keylist);
     krb5_free_principal(kcontext, kcontext->dal_handle->master_princ);
     free(kcontext->dal_handle);
@@ -674,6 +679,10 @@ krb5_db_open(krb5_context kcontext, char **db_args, int mode)
     if (status)
         return status;
     status = v->init_module(kcontext, section, db_args, mode);
+    /* Only the KDC caches principal entries; administrative programs need to
+     * see changes made by other processes right away. */
+    if (!status && (mode & KRB5_KDB_SRV_TYPE_KDC))
+        status = kdb_cache_init(kcontext, section);
     free(section);
     return status;
 }
@@ -786,6 +795,41 @@ krb5_db_unlock(krb5_context kcontext)
     return v->unlock(kcontext);
 }
 
+/*
+ * Look up AS-REQ clients in the database every time so that lockout decisions
+ * see current failure counts.  Entries with module-specific e_data cannot be
+ * copied, so leave those out too.  Lookups which find nothing can be cached
+ * either way.
+ */
+static krb5_boolean
+cacheable_entry(krb5_context kcontext, kdb_vftabl *v, unsigned int flags)
+{
+    return kcontext->dal_handle->princ_cache != NULL &&
+        !(flags & KRB5_KDB_FLAG_CLIENT_REFERRALS_ONLY) &&
+        v->free_principal_e_data == NULL;
+}
+
+/* Finish a module lookup of search_for which produced entry (NULL if the
+ * principal does not exist). */
+static void
+finish_lookup(krb5_context kcontext, kdb_vftabl *v,
+              krb5_const_principal search_for, unsigned int flags,
+              krb5_db_entry *entry)
+{
+    if (entry == NULL) {
+        if (kcontext->dal_handle->princ_cache != NULL)
+            kdb_cache_add(kcontext, search_for, flags, NULL);
+        return;
+    }
+
+    /* Sort the keys in the db entry as some parts of krb5 expect it to be. */
+    if (entry->key_data != NULL)
+        krb5_dbe_sort_key_data(entry->key_data, entry->n_key_data);
+
+    if (cacheable_entry(kcontext, v, flags))
+        kdb_cache_add(kcontext, search_for, flags, entry);
+}
+
 krb5_error_code
 krb5_db_get_principal(krb5_context kcontext, krb5_const_principal search_for,
                       unsigned int flags, krb5_db_entry **entry)
@@ -799,17 +843,118 @@ krb5_db_get_principal(krb5_context kcontext, krb5_const_principal search_for,
         return status;
     if (v->get_principal == NULL)
         return KRB5_PLUGIN_OP_NOTSUPP;
+
+    if (kcontext->dal_handle->princ_cache != NULL) {
+        status = kdb_cache_get(kcontext, search_for, flags, entry);
+        if (status || *entry != NULL)
+            return status;
+    }
+
     status = v->get_principal(kcontext, search_for, flags, entry);
+    if (status == KRB5_KDB_NOENTRY)
+        finish_lookup(kcontext, v, search_for, flags, NULL);
     if (status)
         return status;
 
-    /* Sort the keys in the db entry as some parts of krb5 expect it to be. */
-    if ((*entry)->key_data != NULL)
-        krb5_dbe_sort_key_data((*entry)->key_data, (*entry)->n_key_data);
-
+    finish_lookup(kcontext, v, search_for, flags, *entry);
     return 0;
 }
 
+krb5_error_code
+krb5_db_get_principals(krb5_context kcontext, size_t count,
+                       krb5_const_principal *search_for,
+                       const unsigned int *flags, krb5_db_entry **entries)
+{
+    krb5_error_code status = 0;
+    kdb_vftabl *v;
+    krb5_const_principal *miss_names = NULL;
+    unsigned int *miss_flags = NULL;
+    krb5_db_entry **miss_entries = NULL;
+    size_t *miss_index = NULL, i, nmiss = 0;
+
+    for (i = 0; i < count; i++)
+        entries[i] = NULL;
+    status = get_vftabl(kcontext, &v);
+    if (status)
+        return status;
+    if (v->get_principal == NULL)
+        return KRB5_PLUGIN_OP_NOTSUPP;
+
+    if (count == 0)
+        return 0;
+
+    miss_names = k5calloc(count, sizeof(*miss_names), &status);
+    if (miss_names == NULL)
+        goto cleanup;
+    miss_flags = k5calloc(count, sizeof(*miss_flags), &status);
+    if (miss_flags == NULL)
+        goto cleanup;
+    miss_entries = k5calloc(count, sizeof(*miss_entries), &status);
+    if (miss_entries == NULL)
+        goto cleanup;
+    miss_index = k5calloc(count, sizeof(*miss_index), &status);
+    if (miss_index == NULL)
+        goto cleanup;
+
+    /* Answer what we can from the principal cache, and collect the rest. */
+    for (i = 0; i < count; i++) {
+        if (kcontext->dal_handle->princ_cache != NULL) {
+            status = kdb_cache_get(kcontext, search_for[i], flags[i],
+                                   &entries[i]);
+            if (status == KRB5_KDB_NOENTRY)
+                continue;
+            if (status)
+                goto cleanup;
+            if (entries[i] != NULL)
+                continue;
+        }
+        miss_names[nmiss] = search_for[i];
+        miss_flags[nmiss] = flags[i];
+        miss_index[nmiss++] = i;
+    }
+    status = 0;
+    if (nmiss == 0)
+        goto cleanup;
+
+    if (v->get_principals != NULL) {
+        status = v->get_principals(kcontext, nmiss, miss_names, miss_flags,
+                                   miss_entries);
+        if (status)
+            goto cleanup;
+    } else {
+        for (i = 0; i < nmiss; i++) {
+            status = v->get_principal(kcontext, miss_names[i], miss_flags[i],
+                                      &miss_entries[i]);
+            if (status == KRB5_KDB_NOENTRY)
+                status = 0;
+            if (status)
+                goto cleanup;
+        }
+    }
+
+    for (i = 0; i < nmiss; i++) {
+        finish_lookup(kcontext, v, miss_names[i], miss_flags[i],
+                      miss_entries[i]);
+        entries[miss_index[i]] = miss_entries[i];
+        miss_entries[i] = NULL;
+    }
+
+cleanup:
+    if (status) {
+        for (i = 0; i < count; i++) {
+            krb5_db_free_principal(kcontext, entries[i]);
+            entries[i] = NULL;
+        }
+        for (i = 0; i < nmiss && miss_entries != NULL; i++)
+            krb5_db_free_principal(kcontext, miss_entries[i]);
+    }
+    free(miss_names);
+    free(miss_flags);
+    free(miss_entries);
+    free(miss_index);
+    return status;
+}
+
 static void
 free_tl_data(krb5_tl_data *list)
 {
@@ -940,6 +1085,7 @@ krb5int_put_principal_no_log(krb5_context kcontext, krb5_db_entry *entry)
         return status;
     status = v->put_principal(kcontext, entry, db_args);
     free_db_args(db_args);
+    kdb_cache_invalidate(kcontext, entry->princ);
     return status;
 }
 
@@ -989,7 +1135,9 @@ krb5int_delete_principal_no_log(krb5_context kcontext,
         return status;
     if (v->delete_principal == NULL)
         return KRB5_PLUGIN_OP_NOTSUPP;
-    return v->delete_principal(kcontext, search_for);
+    status = v->delete_principal(kcontext, search_for);
+    kdb_cache_invalidate(kcontext, search_for);
+    return status;
 }
 
 krb5_error_code
@@ -1044,7 +1192,9 @@ krb5_db_rename_principal(krb5_context kcontext, krb5_principal source,
         return KRB5_KDB_INUSE;
     }
 
-    return v->rename_principal(kcontext, source, target);
+    status = v->rename_principal(kcontext, source, target);
+    kdb_cache_flush(kcontext);
+    return status;
 }
 
 /*
@@ -2689,6 +2839,10 @@ krb5_db_audit_as_req(krb5_context kcontext, krb5_kdc_req *request,
         return;
     v->audit_as_req(kcontext, request, local_addr, remote_addr,
                     client, server, authtime, error_code);
+
+    /* The module may have updated the client's lockout state. */
+    if (client != NULL)
+        kdb_cache_invalidate(kcontext, client->princ);
 }
 
 void
@@ -2698,11 +2852,30 @@ krb5_db_refresh_config(krb5_context kcontext)
     kdb_vftabl *v;
 
     status = get_vftabl(kcontext, &v);
-    if (status || v->refresh_config == NULL)
+    if (status)
+        return;
+    kdb_cache_flush(kcontext);
+    if (v->refresh_config == NULL)
         return;
     v->refresh_config(kcontext);
 }
 
+krb5_boolean
+krb5_db_principal_cache_enabled(krb5_context kcontext)
+{
+    return kcontext->dal_handle != NULL &&
+        kcontext->dal_handle->princ_cache != NULL;
+}
+
+krb5_error_code
+krb5_db_share_principal_cache(krb5_context kcontext, krb5_context from)
+{
+    if (kcontext->dal_handle == NULL || from->dal_handle == NULL)
+        return KRB5_KDB_DBNOTINITED;
+    kdb_cache_share(kcontext, from);
+    return 0;
+}
+
 krb5_error_code
 krb5_db_check_allowed_to_delegate(krb5_context kcontext,
                                   krb5_const_principal client,
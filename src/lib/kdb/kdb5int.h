@@ -37,4 +37,35 @@ krb5_error_code
 krb5int_delete_principal_no_log(krb5_context kcontext,
                                 krb5_principal search_for);
 
+/* Principal entry cache (kdb_cache.c) */
+
+krb5_error_code
+kdb_cache_init(krb5_context kcontext, const char *section);
+
+/* Return KRB5_KDB_NOENTRY if search_for is cached as not found, or set
+ * *entry_out to NULL if it is not cached at all. */
+krb5_error_code
+kdb_cache_get(krb5_context kcontext, krb5_const_principal search_for,
+              unsigned int flags, krb5_db_entry **entry_out);
+
+/* Cache entry as the result of looking up search_for, or cache search_for as
+ * not found if entry is NULL. */
+void
+kdb_cache_add(krb5_context kcontext, krb5_const_principal search_for,
+              unsigned int flags, const krb5_db_entry *entry);
+
+void
+kdb_cache_invalidate(krb5_context kcontext, krb5_const_principal princ);
+
+void
+kdb_cache_flush(krb5_context kcontext);
+
+/* Release kcontext's reference to its cache. */
+void
+kdb_cache_free(krb5_context kcontext);
+
+/* Make kcontext share the cache of from, releasing its own. */
+void
+kdb_cache_share(krb5_context kcontext, krb5_context from);
+
 #endif /* __KDB5INT_H__ */
@@ -0,0 +1,530 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/kdb/kdb_cache.c - Principal entry cache for the KDC */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * When the KDC opens a database whose [dbmodules] section sets
+ * principal_cache_size, krb5_db_get_principal() keeps decoded copies of up to
+ * that many entries, keyed by the requested name and the lookup flags, and
+ * hands out copies of them until they are principal_cache_ttl seconds old.
+ * Lookups which find no entry are also remembered, for
+ * principal_negative_cache_ttl seconds, in a separate list of the same
+ * maximum size so that a flood of unknown names cannot push out real entries.
+ * An entry is discarded early when this context writes to the principal, and,
+ * if the update log is mapped, when the ulog records a change to it.
+ *
+ * A cache can be shared by several contexts for the same database (such as
+ * those of the KDC worker threads), so it is reference-counted and each
+ * operation holds its lock.
+ */
+
+#include "k5-int.h"
+#include "k5-queue.h"
+#include "k5-hashtab.h"
+#include "kdb5.h"
+#include "kdb_log.h"
+#include "kdb5int.h"
+
+#define DEFAULT_CACHE_TTL 60
+#define DEFAULT_NEGATIVE_TTL 0
+
+/* Discard everything instead of searching for each principal when a ulog
+ * check turns up more than this many updates. */
+#define MAX_ULOG_INVALIDATIONS 16
+
+struct cache_entry {
+    K5_TAILQ_ENTRY(cache_entry) links;
+    uint8_t *key;
+    size_t keylen;
+    krb5_principal search_for;
+    time_t expires;
+    krb5_db_entry *entry;       /* NULL if the principal was not found */
+};
+
+K5_TAILQ_HEAD(cache_queue, cache_entry);
+
+struct kdb_princ_cache {
+    k5_mutex_t lock;
+    unsigned int refcount;
+    struct k5_hashtab *table;
+    struct cache_queue lru;     /* Least recently used first */
+    struct cache_queue neg_lru; /* Negative entries, oldest first */
+    size_t count;               /* Including negative entries */
+    size_t neg_count;
+    size_t max_entries;
+    krb5_deltat ttl;
+    krb5_deltat negative_ttl;
+    krb5_boolean have_last;
+    kdb_last_t last;
+};
+
+/* Make a hash key from the unparsed form of princ and flags. */
+static krb5_error_code
+make_key(krb5_context context, krb5_const_principal princ, unsigned int flags,
+         uint8_t **key_out, size_t *len_out)
+{
+    krb5_error_code ret;
+    char *name;
+    size_t nlen;
+    uint8_t *key;
+
+    *key_out = NULL;
+    *len_out = 0;
+    ret = krb5_unparse_name(context, princ, &name);
+    if (ret)
+        return ret;
+    nlen = strlen(name);
+    key = k5alloc(nlen + 4, &ret);
+    if (key != NULL) {
+        memcpy(key, name, nlen);
+        store_32_be(flags, key + nlen);
+        *key_out = key;
+        *len_out = nlen + 4;
+    }
+    free(name);
+    return ret;
+}
+
+/* Return a deep copy of in, which must not contain module-specific
+ * e_data. */
+static krb5_error_code
+copy_entry(krb5_context context, const krb5_db_entry *in,
+           krb5_db_entry **out)
+{
+    krb5_error_code ret;
+    krb5_db_entry *e;
+    krb5_tl_data *tl, **tlp;
+    krb5_key_data *kd;
+    int i, j, n;
+
+    *out = NULL;
+    e = k5alloc(sizeof(*e), &ret);
+    if (e == NULL)
+        return ret;
+    *e = *in;
+    e->e_data = NULL;
+    e->princ = NULL;
+    e->tl_data = NULL;
+    e->key_data = NULL;
+    e->n_key_data = 0;
+
+    if (in->e_length > 0) {
+        e->e_data = k5memdup(in->e_data, in->e_length, &ret);
+        if (e->e_data == NULL)
+            goto error;
+    }
+
+    ret = krb5_copy_principal(context, in->princ, &e->princ);
+    if (ret)
+        goto error;
+
+    tlp = &e->tl_data;
+    for (tl = in->tl_data; tl != NULL; tl = tl->tl_data_next) {
+        *tlp = k5alloc(sizeof(**tlp), &ret);
+        if (*tlp == NULL)
+            goto error;
+        (*tlp)->tl_data_type = tl->tl_data_type;
+        (*tlp)->tl_data_length = tl->tl_data_length;
+        if (tl->tl_data_length > 0) {
+            (*tlp)->tl_data_contents = k5memdup(tl->tl_data_contents,
+                                                tl->tl_data_length, &ret);
+            if ((*tlp)->tl_data_contents == NULL)
+                goto error;
+        }
+        tlp = &(*tlp)->tl_data_next;
+    }
+
+    if (in->n_key_data > 0) {
+        e->key_data = k5calloc(in->n_key_data, sizeof(*e->key_data), &ret);
+        if (e->key_data == NULL)
+            goto error;
+    }
+    for (i = 0; i < in->n_key_data; i++) {
+        kd = &e->key_data[i];
+        *kd = in->key_data[i];
+        kd->key_data_contents[0] = kd->key_data_contents[1] = NULL;
+        e->n_key_data = i + 1;
+        n = (kd->key_data_ver == 1) ? 1 : 2;
+        for (j = 0; j < n; j++) {
+            if (in->key_data[i].key_data_contents[j] == NULL)
+                continue;
+            kd->key_data_contents[j] =
+                k5memdup(in->key_data[i].key_data_contents[j],
+                         kd->key_data_length[j], &ret);
+            if (kd->key_data_contents[j] == NULL)
+                goto error;
+        }
+    }
+
+    *out = e;
+    return 0;
+
+error:
+    krb5_db_free_principal(context, e);
+    return ret;
+}
+
+static void
+discard_entry(krb5_context context, struct kdb_princ_cache *cache,
+              struct cache_entry *ce)
+{
+    k5_hashtab_remove(cache->table, ce->key, ce->keylen);
+    if (ce->entry == NULL) {
+        K5_TAILQ_REMOVE(&cache->neg_lru, ce, links);
+        cache->neg_count--;
+    } else {
+        K5_TAILQ_REMOVE(&cache->lru, ce, links);
+    }
+    cache->count--;
+    krb5_db_free_principal(context, ce->entry);
+    krb5_free_principal(context, ce->search_for);
+    free(ce->key);
+    free(ce);
+}
+
+static void
+flush_cache(krb5_context context, struct kdb_princ_cache *cache)
+{
+    struct cache_entry *ce, *next;
+
+    K5_TAILQ_FOREACH_SAFE(ce, &cache->lru, links, next)
+        discard_entry(context, cache, ce);
+    K5_TAILQ_FOREACH_SAFE(ce, &cache->neg_lru, links, next)
+        discard_entry(context, cache, ce);
+}
+
+/* Discard any entries looked up as princ or naming princ. */
+static void
+invalidate(krb5_context context, struct kdb_princ_cache *cache,
+           krb5_const_principal princ)
+{
+    struct cache_entry *ce, *next;
+
+    K5_TAILQ_FOREACH_SAFE(ce, &cache->lru, links, next) {
+        if (krb5_principal_compare(context, ce->search_for, princ) ||
+            krb5_principal_compare(context, ce->entry->princ, princ))
+            discard_entry(context, cache, ce);
+    }
+    K5_TAILQ_FOREACH_SAFE(ce, &cache->neg_lru, links, next) {
+        if (krb5_principal_compare(context, ce->search_for, princ))
+            discard_entry(context, cache, ce);
+    }
+}
+
+static krb5_boolean
+last_equal(const kdb_last_t *a, const kdb_last_t *b)
+{
+    return a->last_sno == b->last_sno &&
+        a->last_time.seconds == b->last_time.seconds &&
+        a->last_time.useconds == b->last_time.useconds;
+}
+
+/*
+ * If the update log is mapped and has changed since we last looked at it,
+ * discard the entries for the principals it names, or the whole cache if we
+ * cannot tell which principals changed.
+ */
+static void
+check_ulog(krb5_context context, struct kdb_princ_cache *cache)
+{
+    kdb_log_context *log_ctx = context->kdblog_context;
+    kdb_hlog_t *ulog;
+    kdb_last_t cur;
+    kdb_incr_result_t res;
+    kdb_incr_update_t *upd;
+    krb5_principal princ;
+    krb5_error_code ret;
+    char *name;
+    unsigned int i;
+
+    if (log_ctx == NULL || log_ctx->ulog == NULL)
+        return;
+    ulog = log_ctx->ulog;
+
+    /* This unlocked read of the header is only a hint; ulog_get_entries()
+     * rereads it under the lock. */
+    cur.last_sno = ulog->kdb_last_sno;
+    cur.last_time = ulog->kdb_last_time;
+    if (cache->have_last && last_equal(&cur, &cache->last))
+        return;
+
+    memset(&res, 0, sizeof(res));
+    if (!cache->have_last || cache->count == 0 ||
+        ulog_get_entries(context, &cache->last, &res) != 0 ||
+        (res.ret != UPDATE_OK && res.ret != UPDATE_NIL) ||
+        res.updates.kdb_ulog_t_len > MAX_ULOG_INVALIDATIONS) {
+        flush_cache(context, cache);
+        cache->have_last = (ulog_get_last(context, &cache->last) == 0);
+        goto cleanup;
+    }
+
+    upd = res.updates.kdb_ulog_t_val;
+    for (i = 0; i < res.updates.kdb_ulog_t_len; i++) {
+        /* The name in the update is not terminated. */
+        name = k5memdup0(upd[i].kdb_princ_name.utf8str_t_val,
+                         upd[i].kdb_princ_name.utf8str_t_len, &ret);
+        if (name == NULL || krb5_parse_name(context, name, &princ) != 0) {
+            free(name);
+            flush_cache(context, cache);
+            break;
+        }
+        free(name);
+        invalidate(context, cache, princ);
+        krb5_free_principal(context, princ);
+    }
+    if (res.ret == UPDATE_OK)
+        cache->last = res.lastentry;
+
+cleanup:
+    ulog_free_entries(res.updates.kdb_ulog_t_val,
+                      res.updates.kdb_ulog_t_len);
+}
+
+/* Read a duration from the database module section. */
+static krb5_error_code
+get_ttl(krb5_context context, const char *section, const char *name,
+        krb5_deltat def, krb5_deltat *ttl_out)
+{
+    krb5_error_code ret;
+    char *str;
+
+    *ttl_out = def;
+    ret = profile_get_string(context->profile, KDB_MODULE_SECTION, section,
+                             name, NULL, &str);
+    if (ret || str == NULL)
+        return ret;
+    ret = krb5_string_to_deltat(str, ttl_out);
+    profile_release_string(str);
+    return ret;
+}
+
+krb5_error_code
+kdb_cache_init(krb5_context context, const char *section)
+{
+    krb5_error_code ret;
+    struct kdb_princ_cache *cache;
+    int size;
+    krb5_deltat ttl, negative_ttl;
+
+    kdb_cache_free(context);
+
+    ret = profile_get_integer(context->profile, KDB_MODULE_SECTION, section,
+                              KRB5_CONF_PRINCIPAL_CACHE_SIZE, 0, &size);
+    if (ret)
+        return ret;
+    if (size <= 0)
+        return 0;
+    ret = get_ttl(context, section, KRB5_CONF_PRINCIPAL_CACHE_TTL,
+                  DEFAULT_CACHE_TTL, &ttl);
+    if (ret)
+        return ret;
+    ret = get_ttl(context, section, KRB5_CONF_PRINCIPAL_NEGATIVE_CACHE_TTL,
+                  DEFAULT_NEGATIVE_TTL, &negative_ttl);
+    if (ret)
+        return ret;
+    if (ttl <= 0 && negative_ttl <= 0)
+        return 0;
+
+    cache = k5alloc(sizeof(*cache), &ret);
+    if (cache == NULL)
+        return ret;
+    ret = k5_mutex_init(&cache->lock);
+    if (ret) {
+        free(cache);
+        return ret;
+    }
+    ret = k5_hashtab_create(NULL, 64, &cache->table);
+    if (ret) {
+        k5_mutex_destroy(&cache->lock);
+        free(cache);
+        return ret;
+    }
+    cache->refcount = 1;
+    K5_TAILQ_INIT(&cache->lru);
+    K5_TAILQ_INIT(&cache->neg_lru);
+    cache->max_entries = size;
+    cache->ttl = ttl;
+    cache->negative_ttl = negative_ttl;
+    context->dal_handle->princ_cache = cache;
+    return 0;
+}
+
+krb5_error_code
+kdb_cache_get(krb5_context context, krb5_const_principal search_for,
+              unsigned int flags, krb5_db_entry **entry_out)
+{
+    krb5_error_code ret;
+    struct kdb_princ_cache *cache = context->dal_handle->princ_cache;
+    struct cache_entry *ce;
+    uint8_t *key;
+    size_t keylen;
+
+    *entry_out = NULL;
+    ret = make_key(context, search_for, flags, &key, &keylen);
+    if (ret)
+        return ret;
+
+    k5_mutex_lock(&cache->lock);
+    check_ulog(context, cache);
+    ce = k5_hashtab_get(cache->table, key, keylen);
+    if (ce == NULL)
+        goto cleanup;
+
+    if (time(NULL) >= ce->expires) {
+        discard_entry(context, cache, ce);
+        goto cleanup;
+    }
+    if (ce->entry == NULL) {
+        ret = KRB5_KDB_NOENTRY;
+        goto cleanup;
+    }
+
+    K5_TAILQ_REMOVE(&cache->lru, ce, links);
+    K5_TAILQ_INSERT_TAIL(&cache->lru, ce, links);
+    ret = copy_entry(context, ce->entry, entry_out);
+
+cleanup:
+    k5_mutex_unlock(&cache->lock);
+    free(key);
+    return ret;
+}
+
+void
+kdb_cache_add(krb5_context context, krb5_const_principal search_for,
+              unsigned int flags, const krb5_db_entry *entry)
+{
+    struct kdb_princ_cache *cache = context->dal_handle->princ_cache;
+    struct cache_entry *ce, *old;
+    struct cache_queue *queue;
+    krb5_deltat ttl;
+    size_t n;
+
+    ttl = (entry == NULL) ? cache->negative_ttl : cache->ttl;
+    if (ttl <= 0)
+        return;
+
+    ce = calloc(1, sizeof(*ce));
+    if (ce == NULL)
+        return;
+    if (make_key(context, search_for, flags, &ce->key, &ce->keylen) != 0 ||
+        krb5_copy_principal(context, search_for, &ce->search_for) != 0 ||
+        (entry != NULL && copy_entry(context, entry, &ce->entry) != 0))
+        goto error;
+    ce->expires = time(NULL) + ttl;
+
+    k5_mutex_lock(&cache->lock);
+    old = k5_hashtab_get(cache->table, ce->key, ce->keylen);
+    if (old != NULL)
+        discard_entry(context, cache, old);
+
+    queue = (entry == NULL) ? &cache->neg_lru : &cache->lru;
+    n = (entry == NULL) ? cache->neg_count : cache->count - cache->neg_count;
+    if (n >= cache->max_entries)
+        discard_entry(context, cache, K5_TAILQ_FIRST(queue));
+
+    if (k5_hashtab_add(cache->table, ce->key, ce->keylen, ce) != 0) {
+        k5_mutex_unlock(&cache->lock);
+        goto error;
+    }
+    K5_TAILQ_INSERT_TAIL(queue, ce, links);
+    cache->count++;
+    if (entry == NULL)
+        cache->neg_count++;
+    k5_mutex_unlock(&cache->lock);
+    return;
+
+error:
+    krb5_db_free_principal(context, ce->entry);
+    krb5_free_principal(context, ce->search_for);
+    free(ce->key);
+    free(ce);
+}
+
+void
+kdb_cache_invalidate(krb5_context context, krb5_const_principal princ)
+{
+    struct kdb_princ_cache *cache = context->dal_handle->princ_cache;
+
+    if (cache == NULL)
+        return;
+    k5_mutex_lock(&cache->lock);
+    invalidate(context, cache, princ);
+    k5_mutex_unlock(&cache->lock);
+}
+
+void
+kdb_cache_flush(krb5_context context)
+{
+    struct kdb_princ_cache *cache = context->dal_handle->princ_cache;
+
+    if (cache == NULL)
+        return;
+    k5_mutex_lock(&cache->lock);
+    flush_cache(context, cache);
+    k5_mutex_unlock(&cache->lock);
+}
+
+void
+kdb_cache_free(krb5_context context)
+{
+    struct kdb_princ_cache *cache = context->dal_handle->princ_cache;
+
+    if (cache == NULL)
+        return;
+    context->dal_handle->princ_cache = NULL;
+
+    k5_mutex_lock(&cache->lock);
+    if (--cache->refcount > 0) {
+        k5_mutex_unlock(&cache->lock);
+        return;
+    }
+    flush_cache(context, cache);
+    k5_mutex_unlock(&cache->lock);
+    k5_hashtab_free(cache->table);
+    k5_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+void
+kdb_cache_share(krb5_context context, krb5_context from)
+{
+    struct kdb_princ_cache *cache = from->dal_handle->princ_cache;
+
+    if (cache == context->dal_handle->princ_cache)
+        return;
+    kdb_cache_free(context);
+    if (cache == NULL)
+        return;
+    k5_mutex_lock(&cache->lock);
+    cache->refcount++;
+    k5_mutex_unlock(&cache->lock);
+    context->dal_handle->princ_cache = cache;
+}
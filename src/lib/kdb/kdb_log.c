@@ -544,6 +544,56 @@ cleanup:
     return retval;
 }
 
+/*
+ * Map an existing update log for reading only, for a process which wants to
+ * follow changes without ever creating, resizing, or resetting the log.  Fail
+ * if the log does not exist or has not been initialized.
+ */
+krb5_error_code
+ulog_map_readonly(krb5_context context, const char *logname,
+                  uint32_t ulogentries)
+{
+    krb5_error_code retval;
+    kdb_log_context *log_ctx;
+    kdb_hlog_t *ulog = NULL;
+    krb5_boolean locked = FALSE;
+
+    log_ctx = create_log_context(context);
+    if (log_ctx == NULL)
+        return ENOMEM;
+
+    log_ctx->ulogfd = open(logname, O_RDONLY);
+    if (log_ctx->ulogfd == -1) {
+        retval = errno;
+        goto cleanup;
+    }
+
+    ulog = mmap(0, MAXLOGLEN, PROT_READ, MAP_SHARED, log_ctx->ulogfd, 0);
+    if (ulog == MAP_FAILED) {
+        retval = errno;
+        goto cleanup;
+    }
+    log_ctx->ulog = ulog;
+    log_ctx->ulogentries = ulogentries;
+    log_ctx->readonly = TRUE;
+
+    retval = lock_ulog(context, KRB5_LOCKMODE_SHARED);
+    if (retval)
+        goto cleanup;
+    locked = TRUE;
+
+    if (ulog->kdb_hmagic != KDB_ULOG_HDR_MAGIC ||
+        ulog->kdb_num > ulogentries)
+        retval = KRB5_LOG_CORRUPT;
+
+cleanup:
+    if (locked)
+        unlock_ulog(context);
+    if (retval)
+        ulog_fini(context);
+    return retval;
+}
+
 /* Get the last set of updates seen, (last+1) to n is returned. */
 krb5_error_code
 ulog_get_entries(krb5_context context, const kdb_last_t *last,
@@ -567,9 +617,14 @@ ulog_get_entries(krb5_context context, const kdb_last_t *last,
         return retval;
 
     /* If another process terminated mid-update, reset the ulog and force full
-     * resyncs. */
-    if (ulog->kdb_state != KDB_STABLE)
+     * resyncs.  A read-only reader can only report that a resync is needed. */
+    if (ulog->kdb_state != KDB_STABLE) {
+        if (log_ctx->readonly) {
+            ulog_handle->ret = UPDATE_FULL_RESYNC_NEEDED;
+            goto cleanup;
+        }
         reset_ulog(log_ctx);
+    }
 
     ulog_handle->ret = get_sno_status(log_ctx, last);
     if (ulog_handle->ret != UPDATE_OK)
@@ -1127,8 +1127,8 @@ decode_sequence(const uint8_t *asn1, size_t len, const struct seq_info *seq,
                 void *val);
 static krb5_error_code
 decode_sequence_of(const uint8_t *asn1, size_t len,
-                   const struct atype_info *elemtype, void **seq_out,
-                   size_t *count_out);
+                   const struct atype_info *elemtype, size_t extra,
+                   void **seq_out, size_t *count_out);
 
 /* Given the enclosing tag t, decode from asn1/len the contents of the ASN.1
  * type specified by a, placing the result into val (caller-allocated). */
@@ -1267,7 +1267,7 @@ decode_cntype(const taginfo *t, const uint8_t *asn1, size_t len,
         const struct ptr_info *ptrinfo = a->tinfo;
         void *seq;
         assert(a->type == atype_ptr);
-        ret = decode_sequence_of(asn1, len, ptrinfo->basetype, &seq,
+        ret = decode_sequence_of(asn1, len, ptrinfo->basetype, 0, &seq,
                                  count_out);
         if (ret)
             return ret;
@@ -1299,23 +1299,17 @@ decode_cntype(const taginfo *t, const uint8_t *asn1, size_t len,
     return 0;
 }
 
-/* Add a null pointer to the end of a sequence.  ptr is consumed on success
- * (to be replaced by *ptr_out), left alone on failure. */
-static krb5_error_code
-null_terminate(const struct atype_info *eltinfo, void *ptr, size_t count,
-               void **ptr_out)
+/* Add a null pointer to the end of a sequence.  The sequence must have been
+ * allocated with room for count + 1 elements. */
+static void
+null_terminate(const struct atype_info *eltinfo, void *ptr, size_t count)
 {
     const struct ptr_info *ptrinfo = eltinfo->tinfo;
     void *endptr;
 
     assert(eltinfo->type == atype_ptr);
-    ptr = realloc(ptr, (count + 1) * eltinfo->size);
-    if (ptr == NULL)
-        return ENOMEM;
     endptr = (char *)ptr + count * eltinfo->size;
     STOREPTR(NULL, ptrinfo, endptr);
-    *ptr_out = ptr;
-    return 0;
 }
 
 static krb5_error_code
@@ -1330,14 +1324,10 @@ decode_atype_to_ptr(const taginfo *t, const uint8_t *asn1, size_t len,
     switch (a->type) {
     case atype_nullterm_sequence_of:
     case atype_nonempty_nullterm_sequence_of:
-        ret = decode_sequence_of(asn1, len, a->tinfo, &ptr, &count);
+        ret = decode_sequence_of(asn1, len, a->tinfo, 1, &ptr, &count);
         if (ret)
             return ret;
-        ret = null_terminate(a->tinfo, ptr, count, &ptr);
-        if (ret) {
-            free_sequence_of(a->tinfo, ptr, count);
-            return ret;
-        }
+        null_terminate(a->tinfo, ptr, count);
         /* Historically we do not enforce non-emptiness of sequences when
          * decoding, even when it is required by the ASN.1 type. */
         break;
@@ -1454,35 +1444,43 @@ error:
     return ret;
 }
 
+/*
+ * Decode a sequence-of encoding into an array of elemtype, allocated with
+ * extra zero-filled elements at the end.  The elements are counted before
+ * decoding so that the array is allocated only once.
+ */
 static krb5_error_code
 decode_sequence_of(const uint8_t *asn1, size_t len,
-                   const struct atype_info *elemtype, void **seq_out,
-                   size_t *count_out)
+                   const struct atype_info *elemtype, size_t extra,
+                   void **seq_out, size_t *count_out)
 {
     krb5_error_code ret;
-    void *seq = NULL, *elem, *newseq;
-    const uint8_t *contents;
-    size_t clen, count = 0;
+    void *seq = NULL, *elem;
+    const uint8_t *contents, *p;
+    size_t clen, plen, n = 0, count = 0;
     taginfo t;
 
     *seq_out = NULL;
     *count_out = 0;
+
+    for (p = asn1, plen = len; plen > 0; n++) {
+        ret = get_tag(p, plen, &t, &contents, &clen, &p, &plen);
+        if (ret)
+            return ret;
+        if (!check_atype_tag(elemtype, &t))
+            return ASN1_BAD_ID;
+    }
+    if (n + extra > 0) {
+        seq = k5calloc(n + extra, elemtype->size, &ret);
+        if (seq == NULL)
+            return ret;
+    }
+
     while (len > 0) {
         ret = get_tag(asn1, len, &t, &contents, &clen, &asn1, &len);
         if (ret)
             goto error;
-        if (!check_atype_tag(elemtype, &t)) {
-            ret = ASN1_BAD_ID;
-            goto error;
-        }
-        newseq = realloc(seq, (count + 1) * elemtype->size);
-        if (newseq == NULL) {
-            ret = ENOMEM;
-            goto error;
-        }
-        seq = newseq;
         elem = (char *)seq + count * elemtype->size;
-        memset(elem, 0, elemtype->size);
         ret = decode_atype(&t, contents, clen, elemtype, elem);
         if (ret)
             goto error;
@@ -42,6 +42,11 @@ krb5_error_code
 k5_cc_retrieve_cred_default(krb5_context, krb5_ccache, krb5_flags,
                             krb5_creds *, krb5_creds *);
 
+krb5_error_code
+k5_cc_retrieve_cred_list(krb5_context context, krb5_flags flags,
+                         krb5_creds *mcreds, krb5_creds *const *list,
+                         size_t ncreds, krb5_creds *creds);
+
 krb5_boolean
 krb5int_cc_creds_match_request(krb5_context, krb5_flags whichfields, krb5_creds *mcreds, krb5_creds *creds);
 
@@ -151,6 +156,10 @@ krb5_error_code
 k5_unmarshal_cred(const unsigned char *data, size_t len, int version,
                   krb5_creds *creds);
 
+krb5_error_code
+k5_unmarshal_cred_prefix(const unsigned char *data, size_t len, int version,
+                         krb5_creds *creds, size_t *len_out);
+
 krb5_error_code
 k5_unmarshal_princ(const unsigned char *data, size_t len, int version,
                    krb5_principal *princ_out);
@@ -54,13 +54,17 @@
  * client.
  *
  * Each of the file ccache functions opens and closes the file whenever it
- * needs to access it.
+ * needs to access it.  To retrieve credentials without reading the file each
+ * time, a cache handle keeps the credentials of the file in memory, indexed by
+ * server name.  The index is reloaded when the file's device, inode, size, or
+ * modification time changes, or when the file is modified through the handle.
  *
  * This module depends on UNIX-like file descriptors, and UNIX-like behavior
  * from the functions: open, close, read, write, lseek.
  */
 
 #include "k5-int.h"
+#include "k5-hashtab.h"
 #include "cc-int.h"
 
 #include <stdio.h>
@@ -94,9 +98,29 @@ static krb5_error_code interpret_errno(krb5_context, int);
 #endif
 #endif
 
+/* A credential in the index, chained with the others having the same server
+ * name (ignoring the realm) in file order. */
+struct index_cred {
+    krb5_creds creds;
+    char *name;
+    struct index_cred *next;
+};
+
+struct fcc_index {
+    struct index_cred *creds;
+    size_t ncreds;
+    struct k5_hashtab *servers; /* First index_cred for each server name */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+};
+
 typedef struct fcc_data_st {
     k5_cc_mutex lock;
     char *filename;
+    struct fcc_index *index;    /* Credentials of the file, if loaded */
 } fcc_data;
 
 /* Iterator over file caches.  */
@@ -439,6 +463,242 @@ read_header(krb5_context context, FILE *fp, int *version_out)
     return 0;
 }
 
+/* Return true if cred is a removed entry (assuming that no legitimate cred
+ * entries will have authtime=-1 and endtime=0). */
+static inline krb5_boolean
+cred_removed(krb5_creds *c)
+{
+    return c->times.endtime == 0 && c->times.authtime == -1;
+}
+
+static void
+free_index(krb5_context context, struct fcc_index *index)
+{
+    size_t i;
+
+    if (index == NULL)
+        return;
+    k5_hashtab_free(index->servers);
+    for (i = 0; i < index->ncreds; i++) {
+        krb5_free_cred_contents(context, &index->creds[i].creds);
+        free(index->creds[i].name);
+    }
+    free(index->creds);
+    free(index);
+}
+
+/* Discard the index of data after modifying its file. */
+static void
+invalidate_index(krb5_context context, fcc_data *data)
+{
+    k5_cc_mutex_assert_locked(context, &data->lock);
+    free_index(context, data->index);
+    data->index = NULL;
+}
+
+static long
+mtime_nsec(const struct stat *sb)
+{
+#if defined HAVE_STRUCT_STAT_ST_MTIMENSEC
+    return sb->st_mtimensec;
+#elif defined HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC
+    return sb->st_mtimespec.tv_nsec;
+#elif defined HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    return sb->st_mtim.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Read len bytes of fp starting at offset into a new buffer.  The file is not
+ * mapped, because a writer which does not lock the file could truncate it
+ * under the mapping and crash us with SIGBUS.
+ */
+static krb5_error_code
+get_contents(krb5_context context, FILE *fp, size_t offset, size_t len,
+             unsigned char **contents_out)
+{
+    unsigned char *contents;
+
+    *contents_out = NULL;
+    contents = malloc(len);
+    if (contents == NULL)
+        return KRB5_CC_NOMEM;
+    if (fseek(fp, offset, SEEK_SET) != 0 ||
+        fread(contents, 1, len, fp) != len) {
+        free(contents);
+        return KRB5_CC_FORMAT;
+    }
+    *contents_out = contents;
+    return 0;
+}
+
+/* Unmarshal the credentials in len bytes of contents into index.  Like an
+ * iteration over the cache, stop without error at the first credential which
+ * cannot be read, and skip removed entries. */
+static krb5_error_code
+parse_creds(krb5_context context, const unsigned char *contents, size_t len,
+            int version, struct fcc_index *index)
+{
+    krb5_error_code ret;
+    struct index_cred *newcreds, *ic;
+    krb5_creds creds;
+    size_t credlen, alloc = 0;
+
+    while (len > 0) {
+        if (k5_unmarshal_cred_prefix(contents, len, version, &creds,
+                                     &credlen) != 0)
+            break;
+        contents += credlen;
+        len -= credlen;
+        if (cred_removed(&creds)) {
+            krb5_free_cred_contents(context, &creds);
+            continue;
+        }
+
+        if (index->ncreds == alloc) {
+            alloc = (alloc == 0) ? 16 : alloc * 2;
+            newcreds = realloc(index->creds, alloc * sizeof(*newcreds));
+            if (newcreds == NULL) {
+                krb5_free_cred_contents(context, &creds);
+                return KRB5_CC_NOMEM;
+            }
+            index->creds = newcreds;
+        }
+        ic = &index->creds[index->ncreds];
+        ic->creds = creds;
+        ic->next = NULL;
+        ret = krb5_unparse_name_flags(context, creds.server,
+                                      KRB5_PRINCIPAL_UNPARSE_NO_REALM,
+                                      &ic->name);
+        if (ret) {
+            krb5_free_cred_contents(context, &creds);
+            return ret;
+        }
+        index->ncreds++;
+    }
+    return 0;
+}
+
+/* Chain the credentials of index by server name in file order, working
+ * backwards so that each one is placed before the ones following it. */
+static krb5_error_code
+link_creds(struct fcc_index *index)
+{
+    krb5_error_code ret;
+    struct index_cred *ic, *head;
+    size_t i, len;
+
+    ret = k5_hashtab_create(NULL, 64, &index->servers);
+    if (ret)
+        return ret;
+    for (i = index->ncreds; i > 0; i--) {
+        ic = &index->creds[i - 1];
+        len = strlen(ic->name);
+        head = k5_hashtab_get(index->servers, ic->name, len);
+        if (head != NULL) {
+            k5_hashtab_remove(index->servers, head->name, len);
+            ic->next = head;
+        }
+        ret = k5_hashtab_add(index->servers, ic->name, len, ic);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/* Read the credentials of the cache file into a new index. */
+static krb5_error_code
+load_index(krb5_context context, fcc_data *data, struct fcc_index **index_out)
+{
+    krb5_error_code ret;
+    struct fcc_index *index = NULL;
+    krb5_principal princ = NULL;
+    unsigned char *contents = NULL;
+    struct stat sb;
+    FILE *fp = NULL;
+    long offset = 0;
+    size_t len = 0;
+    int version;
+
+    *index_out = NULL;
+
+    ret = open_cache_file(context, data->filename, FALSE, &fp);
+    if (ret)
+        goto cleanup;
+    ret = read_header(context, fp, &version);
+    if (ret)
+        goto cleanup;
+    ret = read_principal(context, fp, version, &princ);
+    if (ret)
+        goto cleanup;
+
+    index = k5alloc(sizeof(*index), &ret);
+    if (index == NULL)
+        goto cleanup;
+    if (fstat(fileno(fp), &sb) == -1) {
+        ret = interpret_errno(context, errno);
+        goto cleanup;
+    }
+    index->dev = sb.st_dev;
+    index->ino = sb.st_ino;
+    index->size = sb.st_size;
+    index->mtime = sb.st_mtime;
+    index->mtime_nsec = mtime_nsec(&sb);
+
+    offset = ftell(fp);
+    if (offset == -1) {
+        ret = interpret_errno(context, errno);
+        goto cleanup;
+    }
+    if (sb.st_size > offset) {
+        if (sizeof(off_t) > sizeof(size_t) &&
+            sb.st_size > (off_t)(SIZE_MAX / 2)) {
+            ret = KRB5_CC_NOMEM;
+            goto cleanup;
+        }
+        len = sb.st_size - offset;
+        ret = get_contents(context, fp, offset, len, &contents);
+        if (ret)
+            goto cleanup;
+        ret = parse_creds(context, contents, len, version, index);
+        if (ret)
+            goto cleanup;
+    }
+    ret = link_creds(index);
+    if (ret)
+        goto cleanup;
+
+    *index_out = index;
+    index = NULL;
+
+cleanup:
+    zapfree(contents, len);
+    (void)close_cache_file(context, fp);
+    krb5_free_principal(context, princ);
+    free_index(context, index);
+    return ret;
+}
+
+/* Make sure the index of data reflects the current contents of its file. */
+static krb5_error_code
+update_index(krb5_context context, fcc_data *data)
+{
+    struct fcc_index *index = data->index;
+    struct stat sb;
+
+    k5_cc_mutex_assert_locked(context, &data->lock);
+    if (index != NULL && stat(data->filename, &sb) == 0 &&
+        sb.st_dev == index->dev && sb.st_ino == index->ino &&
+        sb.st_size == index->size && sb.st_mtime == index->mtime &&
+        mtime_nsec(&sb) == index->mtime_nsec)
+        return 0;
+
+    invalidate_index(context, data);
+    return load_index(context, data, &data->index);
+}
+
 /* Create or overwrite the cache file with a header and default principal. */
 static krb5_error_code KRB5_CALLCONV
 fcc_initialize(krb5_context context, krb5_ccache id, krb5_principal princ)
@@ -516,6 +776,7 @@ cleanup:
         krb5_unlock_file(context, fd);
     if (fd != -1)
         close(fd);
+    invalidate_index(context, data);
     k5_cc_mutex_unlock(context, &data->lock);
     krb5_change_cache();
     return set_errmsg_filename(context, ret, data->filename);
@@ -526,6 +787,7 @@ static void
 free_fccdata(krb5_context context, fcc_data *data)
 {
     k5_cc_mutex_assert_unlocked(context, &data->lock);
+    free_index(context, data->index);
     free(data->filename);
     k5_cc_mutex_destroy(&data->lock);
     free(data);
@@ -661,6 +923,7 @@ fcc_resolve(krb5_context context, krb5_ccache *id, const char *residual)
     data = malloc(sizeof(fcc_data));
     if (data == NULL)
         return KRB5_CC_NOMEM;
+    data->index = NULL;
     data->filename = strdup(residual);
     if (data->filename == NULL) {
         free(data);
@@ -737,14 +1000,6 @@ cleanup:
     return set_errmsg_filename(context, ret, data->filename);
 }
 
-/* Return true if cred is a removed entry (assuming that no legitimate cred
- * entries will have authtime=-1 and endtime=0). */
-static inline krb5_boolean
-cred_removed(krb5_creds *c)
-{
-    return c->times.endtime == 0 && c->times.authtime == -1;
-}
-
 /* Get the next credential from the cache file. */
 static krb5_error_code KRB5_CALLCONV
 fcc_next_cred(krb5_context context, krb5_ccache id, krb5_cc_cursor *cursor,
@@ -837,6 +1092,7 @@ krb5int_fcc_new_unique(krb5_context context, char *template, krb5_ccache *id)
         return KRB5_CC_NOMEM;
     }
 
+    data->index = NULL;
     data->filename = strdup(template);
     if (data->filename == NULL) {
         free(data);
@@ -961,15 +1217,56 @@ cleanup:
     return set_errmsg_filename(context, ret, data->filename);
 }
 
-/* Search for a credential within the cache file. */
+/* Search for a credential within the cache file, using the index if a server
+ * name is given. */
 static krb5_error_code KRB5_CALLCONV
 fcc_retrieve(krb5_context context, krb5_ccache id, krb5_flags whichfields,
              krb5_creds *mcreds, krb5_creds *creds)
 {
     krb5_error_code ret;
+    fcc_data *data = id->data;
+    struct index_cred *ic;
+    krb5_creds **list = NULL, **newlist;
+    size_t n = 0, alloc = 0;
+    char *name = NULL;
+
+    if (mcreds->server == NULL) {
+        ret = k5_cc_retrieve_cred_default(context, id, whichfields, mcreds,
+                                          creds);
+        return set_errmsg_filename(context, ret, data->filename);
+    }
+
+    ret = krb5_unparse_name_flags(context, mcreds->server,
+                                  KRB5_PRINCIPAL_UNPARSE_NO_REALM, &name);
+    if (ret)
+        return ret;
+
+    k5_cc_mutex_lock(context, &data->lock);
+    ret = update_index(context, data);
+    if (ret)
+        goto cleanup;
+
+    ic = k5_hashtab_get(data->index->servers, name, strlen(name));
+    for (; ic != NULL; ic = ic->next) {
+        if (n == alloc) {
+            alloc = (alloc == 0) ? 8 : alloc * 2;
+            newlist = realloc(list, alloc * sizeof(*list));
+            if (newlist == NULL) {
+                ret = KRB5_CC_NOMEM;
+                goto cleanup;
+            }
+            list = newlist;
+        }
+        list[n++] = &ic->creds;
+    }
+    ret = k5_cc_retrieve_cred_list(context, whichfields, mcreds, list, n,
+                                   creds);
 
-    ret = k5_cc_retrieve_cred_default(context, id, whichfields, mcreds, creds);
-    return set_errmsg_filename(context, ret, ((fcc_data *)id->data)->filename);
+cleanup:
+    k5_cc_mutex_unlock(context, &data->lock);
+    free(list);
+    free(name);
+    return set_errmsg_filename(context, ret, data->filename);
 }
 
 /* Store a credential in the cache file. */
@@ -1010,6 +1307,7 @@ fcc_store(krb5_context context, krb5_ccache id, krb5_creds *creds)
 cleanup:
     k5_buf_free(&buf);
     ret2 = close_cache_file(context, fp);
+    invalidate_index(context, data);
     k5_cc_mutex_unlock(context, &data->lock);
     return set_errmsg_filename(context, ret ? ret : ret2, data->filename);
 }
@@ -1129,6 +1427,7 @@ fcc_remove_cred(krb5_context context, krb5_ccache cache, krb5_flags flags,
                 krb5_creds *creds)
 {
     krb5_error_code ret;
+    fcc_data *data = cache->data;
     krb5_cc_cursor cursor;
     krb5_creds cur;
 
@@ -1149,6 +1448,10 @@ fcc_remove_cred(krb5_context context, krb5_ccache cache, krb5_flags flags,
     }
 
     krb5_cc_end_seq_get(context, cache, &cursor);
+
+    k5_cc_mutex_lock(context, &data->lock);
+    invalidate_index(context, data);
+    k5_cc_mutex_unlock(context, &data->lock);
     return (ret == KRB5_CC_END) ? 0 : ret;
 }
 
@@ -274,3 +274,48 @@ k5_cc_retrieve_cred_default(krb5_context context, krb5_ccache id,
                                           0, 0);
     }
 }
+
+/*
+ * Select a credential matching mcreds from the ncreds credentials in list,
+ * which are in cache order, as k5_cc_retrieve_cred_default() would for a cache
+ * containing them.  Place a copy of the selected credential in *creds.
+ */
+krb5_error_code
+k5_cc_retrieve_cred_list(krb5_context context, krb5_flags flags,
+                         krb5_creds *mcreds, krb5_creds *const *list,
+                         size_t ncreds, krb5_creds *creds)
+{
+    krb5_enctype *ktypes = NULL;
+    krb5_creds *best = NULL;
+    krb5_error_code ret, nomatch_err = KRB5_CC_NOTFOUND;
+    int nktypes = 0, p, best_pref = 0;
+    size_t i;
+
+    if (flags & KRB5_TC_SUPPORTED_KTYPES) {
+        ret = krb5_get_tgs_ktypes(context, mcreds->server, &ktypes);
+        if (ret)
+            return ret;
+        nktypes = k5_count_etypes(ktypes);
+    }
+
+    for (i = 0; i < ncreds; i++) {
+        if (!krb5int_cc_creds_match_request(context, flags, mcreds, list[i]))
+            continue;
+        if (ktypes == NULL) {
+            best = list[i];
+            break;
+        }
+        p = pref(list[i]->keyblock.enctype, nktypes, ktypes);
+        if (p < 0) {
+            nomatch_err = KRB5_CC_NOT_KTYPE;
+        } else if (best == NULL || p < best_pref) {
+            best = list[i];
+            best_pref = p;
+        }
+    }
+    free(ktypes);
+
+    if (best == NULL)
+        return nomatch_err;
+    return k5_copy_creds_contents(context, best, creds);
+}
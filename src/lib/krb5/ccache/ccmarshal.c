@@ -281,6 +281,29 @@ unmarshal_authdata(struct k5input *in, int version)
     return authdata;
 }
 
+static krb5_error_code
+unmarshal_cred(struct k5input *in, int version, krb5_creds *creds)
+{
+    creds->client = unmarshal_princ(in, version);
+    creds->server = unmarshal_princ(in, version);
+    unmarshal_keyblock(in, version, &creds->keyblock);
+    creds->times.authtime = get32(in, version);
+    creds->times.starttime = get32(in, version);
+    creds->times.endtime = get32(in, version);
+    creds->times.renew_till = get32(in, version);
+    creds->is_skey = k5_input_get_byte(in);
+    creds->ticket_flags = get32(in, version);
+    creds->addresses = unmarshal_addrs(in, version);
+    creds->authdata = unmarshal_authdata(in, version);
+    get_data(in, version, &creds->ticket);
+    get_data(in, version, &creds->second_ticket);
+    if (in->status) {
+        krb5_free_cred_contents(NULL, creds);
+        memset(creds, 0, sizeof(*creds));
+    }
+    return (in->status == EINVAL) ? KRB5_CC_FORMAT : in->status;
+}
+
 /* Unmarshal a credential using the specified file ccache version (expressed as
  * an integer from 1 to 4).  Does not check for trailing garbage. */
 krb5_error_code
@@ -290,24 +313,25 @@ k5_unmarshal_cred(const unsigned char *data, size_t len, int version,
     struct k5input in;
 
     k5_input_init(&in, data, len);
-    creds->client = unmarshal_princ(&in, version);
-    creds->server = unmarshal_princ(&in, version);
-    unmarshal_keyblock(&in, version, &creds->keyblock);
-    creds->times.authtime = get32(&in, version);
-    creds->times.starttime = get32(&in, version);
-    creds->times.endtime = get32(&in, version);
-    creds->times.renew_till = get32(&in, version);
-    creds->is_skey = k5_input_get_byte(&in);
-    creds->ticket_flags = get32(&in, version);
-    creds->addresses = unmarshal_addrs(&in, version);
-    creds->authdata = unmarshal_authdata(&in, version);
-    get_data(&in, version, &creds->ticket);
-    get_data(&in, version, &creds->second_ticket);
-    if (in.status) {
-        krb5_free_cred_contents(NULL, creds);
-        memset(creds, 0, sizeof(*creds));
-    }
-    return (in.status == EINVAL) ? KRB5_CC_FORMAT : in.status;
+    return unmarshal_cred(&in, version, creds);
+}
+
+/* Unmarshal a credential from the beginning of data, as for
+ * k5_unmarshal_cred(), and set *len_out to the length of its marshalled
+ * form. */
+krb5_error_code
+k5_unmarshal_cred_prefix(const unsigned char *data, size_t len, int version,
+                         krb5_creds *creds, size_t *len_out)
+{
+    krb5_error_code ret;
+    struct k5input in;
+
+    *len_out = 0;
+    k5_input_init(&in, data, len);
+    ret = unmarshal_cred(&in, version, creds);
+    if (!ret)
+        *len_out = len - in.len;
+    return ret;
 }
 
 /* Unmarshal a principal using the specified file ccache version (expressed as
@@ -560,6 +560,88 @@ test_memory_concurrent(krb5_context context)
     free_test_cred(context);
 }
 
+/* Check that retrievals through one file ccache handle reflect changes made
+ * through another. */
+static void
+test_file_index(krb5_context context)
+{
+    krb5_error_code kret;
+    krb5_ccache id1, id2;
+    krb5_creds creds, mcreds;
+    krb5_principal server;
+    krb5_flags matchflags = KRB5_TC_MATCH_IS_SKEY;
+    char name[300];
+
+    kret = init_test_cred(context);
+    CHECK(kret, "init_creds");
+
+    snprintf(name, sizeof(name), "FILE:/tmp/ccindex.%ld", (long)getpid());
+    kret = krb5_cc_resolve(context, name, &id1);
+    CHECK(kret, "resolve 1");
+    kret = krb5_cc_resolve(context, name, &id2);
+    CHECK(kret, "resolve 2");
+    kret = krb5_cc_initialize(context, id1, test_creds.client);
+    CHECK(kret, "initialize");
+
+    memset(&mcreds, 0, sizeof(mcreds));
+    mcreds.client = test_creds.client;
+    mcreds.server = test_creds.server;
+    mcreds.is_skey = test_creds.is_skey;
+    kret = krb5_cc_retrieve_cred(context, id2, matchflags, &mcreds, &creds);
+    CHECK_BOOL(kret != KRB5_CC_NOTFOUND, "unexpected result",
+               "retrieve from empty cache");
+
+    kret = krb5_cc_store_cred(context, id1, &test_creds);
+    CHECK(kret, "store");
+    kret = krb5_cc_retrieve_cred(context, id2, matchflags, &mcreds, &creds);
+    CHECK(kret, "retrieve after store");
+    krb5_free_cred_contents(context, &creds);
+
+    /* Look up the server name in a different realm. */
+    kret = krb5_build_principal(context, &server, 5, "OTHER", "server-comp1",
+                                "server-comp2", NULL);
+    CHECK(kret, "build_principal");
+    mcreds.server = server;
+    kret = krb5_cc_retrieve_cred(context, id2, matchflags, &mcreds, &creds);
+    CHECK_BOOL(kret != KRB5_CC_NOTFOUND, "unexpected result",
+               "retrieve with other realm");
+    kret = krb5_cc_retrieve_cred(context, id2,
+                                 matchflags | KRB5_TC_MATCH_SRV_NAMEONLY,
+                                 &mcreds, &creds);
+    CHECK(kret, "retrieve with other realm, name only");
+    krb5_free_cred_contents(context, &creds);
+    mcreds.server = test_creds.server;
+    krb5_free_principal(context, server);
+
+    /* Removal overwrites the entry without changing the file size. */
+    kret = krb5_cc_remove_cred(context, id1, matchflags, &test_creds);
+    CHECK(kret, "remove");
+    kret = krb5_cc_retrieve_cred(context, id2, matchflags, &mcreds, &creds);
+    CHECK_BOOL(kret != KRB5_CC_NOTFOUND, "unexpected result",
+               "retrieve after remove");
+
+    kret = krb5_cc_store_cred(context, id1, &test_creds);
+    CHECK(kret, "store again");
+    kret = krb5_cc_retrieve_cred(context, id2, matchflags, &mcreds, &creds);
+    CHECK(kret, "retrieve after second store");
+    krb5_free_cred_contents(context, &creds);
+
+    kret = krb5_cc_initialize(context, id1, test_creds.client);
+    CHECK(kret, "reinitialize");
+    kret = krb5_cc_retrieve_cred(context, id2, matchflags, &mcreds, &creds);
+    CHECK_BOOL(kret != KRB5_CC_NOTFOUND, "unexpected result",
+               "retrieve after reinitialize");
+
+    kret = krb5_cc_destroy(context, id1);
+    CHECK(kret, "destroy");
+    kret = krb5_cc_retrieve_cred(context, id2, matchflags, &mcreds, &creds);
+    CHECK_BOOL(kret != KRB5_FCC_NOFILE, "unexpected result",
+               "retrieve after destroy");
+    krb5_cc_close(context, id2);
+
+    free_test_cred(context);
+}
+
 extern const krb5_cc_ops krb5_mcc_ops;
 extern const krb5_cc_ops krb5_fcc_ops;
 
@@ -609,6 +691,7 @@ main(void)
     do_test(context, "FILE:");
 
     test_memory_concurrent(context);
+    test_file_index(context);
 
     krb5_free_context(context);
     return 0;
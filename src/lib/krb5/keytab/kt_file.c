@@ -54,8 +54,10 @@
 #ifndef LEAN_CLIENT
 
 #include "k5-int.h"
+#include "k5-hashtab.h"
 #include "../os/os-proto.h"
 #include <stdio.h>
+#include <sys/stat.h>
 
 /*
  * Information needed by internal routines of the file-based ticket
@@ -75,6 +77,32 @@
 /*
  * Types
  */
+
+/*
+ * To avoid reading the file for each krb5_ktfile_get_entry() call, a keytab
+ * handle keeps the entries of the file in memory, chained by principal name
+ * in file order.  The index is reloaded when the file's device, inode, size,
+ * or modification time changes, or when the file is modified through the
+ * handle.
+ */
+struct index_entry {
+    krb5_keytab_entry entry;
+    char *name;                 /* Unparsed principal name */
+    struct index_entry *next;   /* Next entry with the same name */
+};
+
+struct kt_index {
+    struct index_entry *entries;
+    size_t nentries;
+    struct k5_hashtab *names;   /* First index_entry for each name */
+    krb5_error_code read_err;   /* Error which ended the read, if not EOF */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+};
+
 typedef struct _krb5_ktfile_data {
     char *name;                 /* Name of the file */
     FILE *openf;                /* open file, if any. */
@@ -82,7 +110,8 @@ typedef struct _krb5_ktfile_data {
     int version;                /* Version number of keytab */
     unsigned int iter_count;    /* Number of active iterators */
     long start_offset;          /* Starting offset after version */
-    k5_mutex_t lock;            /* Protect openf, version */
+    struct kt_index *index;     /* Entries of the file, if loaded */
+    k5_mutex_t lock;            /* Protect openf, version, index */
 } krb5_ktfile_data;
 
 /*
@@ -113,6 +142,7 @@ typedef struct _krb5_ktfile_data {
 #define KTVERSION(id) (((krb5_ktfile_data *)(id)->data)->version)
 #define KTITERS(id) (((krb5_ktfile_data *)(id)->data)->iter_count)
 #define KTSTARTOFF(id) (((krb5_ktfile_data *)(id)->data)->start_offset)
+#define KTINDEX(id) (((krb5_ktfile_data *)(id)->data)->index)
 #define KTLOCK(id) k5_mutex_lock(&((krb5_ktfile_data *)(id)->data)->lock)
 #define KTUNLOCK(id) k5_mutex_unlock(&((krb5_ktfile_data *)(id)->data)->lock)
 #define KTCHECKLOCK(id) k5_mutex_assert_locked(&((krb5_ktfile_data *)(id)->data)->lock)
@@ -175,6 +205,9 @@ krb5_ktfileint_internal_read_entry(krb5_context, krb5_keytab,
 static krb5_error_code
 krb5_ktfileint_size_entry(krb5_context, krb5_keytab_entry *, krb5_int32 *);
 
+static void
+free_index(krb5_context, struct kt_index *);
+
 static krb5_error_code
 krb5_ktfileint_find_slot(krb5_context, krb5_keytab, krb5_int32 *,
                          krb5_int32 *);
@@ -244,6 +277,7 @@ krb5_ktfile_close(krb5_context context, krb5_keytab id)
  * This routine should undo anything done by krb5_ktfile_resolve().
  */
 {
+    free_index(context, KTINDEX(id));
     free(KTFILENAME(id));
     zap(KTFILEBUFP(id), BUFSIZ);
     k5_mutex_destroy(&((krb5_ktfile_data *)id->data)->lock);
@@ -275,10 +309,205 @@ more_recent(const krb5_keytab_entry *k1, const krb5_keytab_entry *k2)
     return k1->vno > k2->vno;
 }
 
+static long
+mtime_nsec(const struct stat *st)
+{
+#if defined HAVE_STRUCT_STAT_ST_MTIMENSEC
+    return st->st_mtimensec;
+#elif defined HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC
+    return st->st_mtimespec.tv_nsec;
+#elif defined HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    return st->st_mtim.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+static void
+free_index(krb5_context context, struct kt_index *index)
+{
+    size_t i;
+
+    if (index == NULL)
+        return;
+    k5_hashtab_free(index->names);
+    for (i = 0; i < index->nentries; i++) {
+        krb5_kt_free_entry(context, &index->entries[i].entry);
+        free(index->entries[i].name);
+    }
+    free(index->entries);
+    free(index);
+}
+
+/* Read the entries of the keytab file into index.  If reading stops with an
+ * error other than the end of the file, keep the entries read so far and
+ * remember the error. */
+static krb5_error_code
+read_index_entries(krb5_context context, krb5_keytab id,
+                   struct kt_index *index)
+{
+    krb5_error_code ret;
+    struct index_entry *newents;
+    krb5_keytab_entry entry;
+    size_t alloc = 0;
+    struct stat st;
+
+    if (fstat(fileno(KTFILEP(id)), &st) != 0)
+        return errno;
+    index->dev = st.st_dev;
+    index->ino = st.st_ino;
+    index->size = st.st_size;
+    index->mtime = st.st_mtime;
+    index->mtime_nsec = mtime_nsec(&st);
+
+    for (;;) {
+        ret = krb5_ktfileint_read_entry(context, id, &entry);
+        if (ret) {
+            index->read_err = (ret == KRB5_KT_END) ? 0 : ret;
+            return 0;
+        }
+        if (index->nentries == alloc) {
+            alloc = (alloc == 0) ? 16 : alloc * 2;
+            newents = realloc(index->entries, alloc * sizeof(*newents));
+            if (newents == NULL) {
+                krb5_kt_free_entry(context, &entry);
+                return ENOMEM;
+            }
+            index->entries = newents;
+        }
+        index->entries[index->nentries].entry = entry;
+        index->entries[index->nentries].next = NULL;
+        ret = krb5_unparse_name(context, entry.principal,
+                                &index->entries[index->nentries].name);
+        if (ret) {
+            krb5_kt_free_entry(context, &entry);
+            return ret;
+        }
+        index->nentries++;
+    }
+}
+
+/* Chain the entries of index by name in file order, working backwards so that
+ * each entry is placed before the ones following it in the file. */
+static krb5_error_code
+link_index_entries(struct kt_index *index)
+{
+    krb5_error_code ret;
+    struct index_entry *e, *head;
+    size_t i, len;
+
+    ret = k5_hashtab_create(NULL, 64, &index->names);
+    if (ret)
+        return ret;
+    for (i = index->nentries; i > 0; i--) {
+        e = &index->entries[i - 1];
+        len = strlen(e->name);
+        head = k5_hashtab_get(index->names, e->name, len);
+        if (head != NULL) {
+            k5_hashtab_remove(index->names, head->name, len);
+            e->next = head;
+        }
+        ret = k5_hashtab_add(index->names, e->name, len, e);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/* Load the contents of the keytab file into a new index. */
+static krb5_error_code
+load_index(krb5_context context, krb5_keytab id, struct kt_index **index_out)
+{
+    krb5_error_code ret;
+    struct kt_index *index;
+    int was_open = (KTFILEP(id) != NULL);
+
+    *index_out = NULL;
+
+    /* If an iterator is active, the file is already open and locked. */
+    if (was_open) {
+        if (fseek(KTFILEP(id), KTSTARTOFF(id), SEEK_SET) == -1)
+            return errno;
+    } else {
+        ret = krb5_ktfileint_openr(context, id);
+        if (ret)
+            return ret;
+    }
+
+    index = k5alloc(sizeof(*index), &ret);
+    if (index != NULL) {
+        ret = read_index_entries(context, id, index);
+        if (!ret)
+            ret = link_index_entries(index);
+    }
+
+    if (!was_open) {
+        if (ret)
+            (void)krb5_ktfileint_close(context, id);
+        else
+            ret = krb5_ktfileint_close(context, id);
+    }
+    if (ret) {
+        free_index(context, index);
+        return ret;
+    }
+    *index_out = index;
+    return 0;
+}
+
+/* Make sure the index of id reflects the current contents of its file. */
+static krb5_error_code
+update_index(krb5_context context, krb5_keytab id)
+{
+    struct kt_index *index = KTINDEX(id);
+    struct stat st;
+
+    KTCHECKLOCK(id);
+    if (index != NULL && stat(KTFILENAME(id), &st) == 0 &&
+        st.st_dev == index->dev && st.st_ino == index->ino &&
+        st.st_size == index->size && st.st_mtime == index->mtime &&
+        mtime_nsec(&st) == index->mtime_nsec)
+        return 0;
+
+    free_index(context, index);
+    KTINDEX(id) = NULL;
+    return load_index(context, id, &KTINDEX(id));
+}
+
+/* Discard the index of id after modifying its file. */
+static void
+invalidate_index(krb5_context context, krb5_keytab id)
+{
+    KTCHECKLOCK(id);
+    free_index(context, KTINDEX(id));
+    KTINDEX(id) = NULL;
+}
+
+static krb5_error_code
+copy_entry(krb5_context context, const krb5_keytab_entry *in,
+           krb5_keytab_entry *out)
+{
+    krb5_error_code ret;
+
+    *out = *in;
+    out->principal = NULL;
+    out->key.contents = NULL;
+    ret = krb5_copy_principal(context, in->principal, &out->principal);
+    if (ret)
+        return ret;
+    ret = krb5_copy_keyblock_contents(context, &in->key, &out->key);
+    if (ret) {
+        krb5_free_principal(context, out->principal);
+        out->principal = NULL;
+    }
+    return ret;
+}
+
 /*
  * This is the get_entry routine for the file based keytab implementation.
- * It opens the keytab file, and either retrieves the entry or returns
- * an error.
+ * It looks up the entry in the index of the keytab file, reading the file
+ * only if it has changed, and returns a copy of the entry or an error.  The
+ * result is the same as that of reading the file sequentially.
  */
 
 static krb5_error_code KRB5_CALLCONV
@@ -286,126 +515,78 @@ krb5_ktfile_get_entry(krb5_context context, krb5_keytab id,
                       krb5_const_principal principal, krb5_kvno kvno,
                       krb5_enctype enctype, krb5_keytab_entry *entry)
 {
-    krb5_keytab_entry cur_entry, new_entry;
+    krb5_keytab_entry *cur_entry = NULL, *e;
+    struct index_entry *ie;
     krb5_error_code kerror = 0;
+    krb5_boolean exact = FALSE;
     int found_wrong_kvno = 0;
-    int was_open;
     char *princname;
 
-    KTLOCK(id);
-
-    if (KTFILEP(id) != NULL) {
-        was_open = 1;
-
-        if (fseek(KTFILEP(id), KTSTARTOFF(id), SEEK_SET) == -1) {
-            KTUNLOCK(id);
-            return errno;
-        }
-    } else {
-        was_open = 0;
-
-        /* Open the keyfile for reading */
-        if ((kerror = krb5_ktfileint_openr(context, id))) {
-            KTUNLOCK(id);
-            return(kerror);
-        }
-    }
-
-    /*
-     * For efficiency and simplicity, we'll use a while true that
-     * is exited with a break statement.
-     */
-    cur_entry.principal = 0;
-    cur_entry.vno = 0;
-    cur_entry.key.contents = 0;
+    kerror = krb5_unparse_name(context, principal, &princname);
+    if (kerror)
+        return kerror;
 
-    while (TRUE) {
-        if ((kerror = krb5_ktfileint_read_entry(context, id, &new_entry)))
-            break;
+    KTLOCK(id);
 
-        /* by the time this loop exits, it must either free cur_entry,
-           and copy new_entry there, or free new_entry.  Otherwise, it
-           leaks. */
+    kerror = update_index(context, id);
+    if (kerror)
+        goto cleanup;
 
-        /* if the principal isn't the one requested, free new_entry
-           and continue to the next. */
+    ie = k5_hashtab_get(KTINDEX(id)->names, princname, strlen(princname));
+    for (; ie != NULL; ie = ie->next) {
+        e = &ie->entry;
 
-        if (!krb5_principal_compare(context, principal, new_entry.principal)) {
-            krb5_kt_free_entry(context, &new_entry);
+        if (!krb5_principal_compare(context, principal, e->principal))
             continue;
-        }
 
-        /* If the enctype is not ignored and doesn't match, free new_entry and
-           continue to the next. */
-        if (enctype != IGNORE_ENCTYPE && enctype != new_entry.key.enctype) {
-            krb5_kt_free_entry(context, &new_entry);
+        /* If the enctype is not ignored and doesn't match, continue to the
+           next. */
+        if (enctype != IGNORE_ENCTYPE && enctype != e->key.enctype)
             continue;
-        }
 
-        if (kvno == IGNORE_VNO || new_entry.vno == IGNORE_VNO) {
-            /* If this entry is more recent (or the first match), free the
-             * current and keep the new.  Otherwise, free the new. */
-            if (cur_entry.principal == NULL ||
-                more_recent(&new_entry, &cur_entry)) {
-                krb5_kt_free_entry(context, &cur_entry);
-                cur_entry = new_entry;
-            } else {
-                krb5_kt_free_entry(context, &new_entry);
-            }
+        if (kvno == IGNORE_VNO || e->vno == IGNORE_VNO) {
+            /* If this entry is more recent (or the first match), keep it. */
+            if (cur_entry == NULL || more_recent(e, cur_entry))
+                cur_entry = e;
         } else {
             /*
-             * If this kvno matches exactly, free the current, keep the new,
-             * and break out.  If it matches the low 8 bits of the desired
-             * kvno, remember the first match (because the recorded kvno may
-             * have been truncated due to pre-1.14 keytab format or kadmin
-             * protocol limitations) but keep looking for an exact match.
-             * Otherwise, remember that we were here so we can return the right
-             * error, and free the new.
+             * If this kvno matches exactly, keep it and stop.  If it matches
+             * the low 8 bits of the desired kvno, remember the first match
+             * (because the recorded kvno may have been truncated due to
+             * pre-1.14 keytab format or kadmin protocol limitations) but keep
+             * looking for an exact match.  Otherwise, remember that we were
+             * here so we can return the right error.
              */
-            if (new_entry.vno == kvno) {
-                krb5_kt_free_entry(context, &cur_entry);
-                cur_entry = new_entry;
-                if (new_entry.vno == kvno)
-                    break;
-            } else if (new_entry.vno == (kvno & 0xff) &&
-                       cur_entry.principal == NULL) {
-                cur_entry = new_entry;
+            if (e->vno == kvno) {
+                cur_entry = e;
+                exact = TRUE;
+                break;
+            } else if (e->vno == (kvno & 0xff) && cur_entry == NULL) {
+                cur_entry = e;
             } else {
                 found_wrong_kvno++;
-                krb5_kt_free_entry(context, &new_entry);
             }
         }
     }
 
-    if (kerror == KRB5_KT_END) {
-        if (cur_entry.principal)
-            kerror = 0;
-        else if (found_wrong_kvno)
-            kerror = KRB5_KT_KVNONOTFOUND;
-        else {
-            kerror = KRB5_KT_NOTFOUND;
-            if (krb5_unparse_name(context, principal, &princname) == 0) {
-                k5_setmsg(context, kerror,
-                          _("No key table entry found for %s"), princname);
-                free(princname);
-            }
-        }
-    }
-    if (kerror) {
-        if (was_open == 0)
-            (void) krb5_ktfileint_close(context, id);
-        KTUNLOCK(id);
-        krb5_kt_free_entry(context, &cur_entry);
-        return kerror;
-    }
-    if (was_open == 0 && (kerror = krb5_ktfileint_close(context, id)) != 0) {
-        KTUNLOCK(id);
-        krb5_kt_free_entry(context, &cur_entry);
-        return kerror;
+    /* A sequential read of the file would have hit any read error before
+     * completing the search, unless it found an exact match. */
+    if (!exact && KTINDEX(id)->read_err) {
+        kerror = KTINDEX(id)->read_err;
+    } else if (cur_entry != NULL) {
+        kerror = copy_entry(context, cur_entry, entry);
+    } else if (found_wrong_kvno) {
+        kerror = KRB5_KT_KVNONOTFOUND;
+    } else {
+        kerror = KRB5_KT_NOTFOUND;
+        k5_setmsg(context, kerror, _("No key table entry found for %s"),
+                  princname);
     }
+
+cleanup:
     KTUNLOCK(id);
-    *entry = cur_entry;
-    return 0;
+    free(princname);
+    return kerror;
 }
 
 /*
@@ -547,6 +728,7 @@ krb5_ktfile_add(krb5_context context, krb5_keytab id, krb5_keytab_entry *entry)
     }
     retval = krb5_ktfileint_write_entry(context, id, entry);
     krb5_ktfileint_close(context, id);
+    invalidate_index(context, id);
     KTUNLOCK(id);
     return retval;
 }
@@ -612,6 +794,7 @@ krb5_ktfile_remove(krb5_context context, krb5_keytab id, krb5_keytab_entry *entr
     } else {
         kerror = krb5_ktfileint_close(context, id);
     }
+    invalidate_index(context, id);
     KTUNLOCK(id);
     return kerror;
 }
@@ -394,6 +394,79 @@ kt_test(krb5_context context, const char *name)
 
 }
 
+/* Check that a keytab handle's lookups reflect changes made to the file
+ * through a different handle. */
+static void
+test_index(krb5_context context)
+{
+    krb5_error_code kret;
+    krb5_keytab kt1, kt2;
+    krb5_keytab_entry kent, kent2;
+    krb5_principal princ;
+    char *filename, *name;
+
+    fprintf(stderr, "Testing keytab index invalidation\n");
+
+    if (asprintf(&filename, "/tmp/ktindex.%ld", (long)getpid()) < 0 ||
+        asprintf(&name, "WRFILE:%s", filename) < 0) {
+        perror("asprintf");
+        exit(1);
+    }
+    kret = krb5_kt_resolve(context, name, &kt1);
+    CHECK(kret, "resolve 1");
+    kret = krb5_kt_resolve(context, name, &kt2);
+    CHECK(kret, "resolve 2");
+    kret = krb5_parse_name(context, "index/test@TEST.MIT.EDU", &princ);
+    CHECK(kret, "parsing principal");
+
+    memset(&kent, 0, sizeof(kent));
+    kent.magic = KV5M_KEYTAB_ENTRY;
+    kent.principal = princ;
+    kent.vno = 1;
+    kent.key.magic = KV5M_KEYBLOCK;
+    kent.key.enctype = ENCTYPE_AES128_CTS_HMAC_SHA256_128;
+    kent.key.length = 1;
+    kent.key.contents = (krb5_octet *)"1";
+    kret = krb5_kt_add_entry(context, kt1, &kent);
+    CHECK(kret, "Adding kvno 1");
+
+    kret = krb5_kt_get_entry(context, kt2, princ, 0, 0, &kent2);
+    CHECK(kret, "Looking up kvno 1");
+    CHECK_ERR(kent2.vno, 1, "Checking kvno 1");
+    krb5_kt_free_entry(context, &kent2);
+
+    kent.vno = 2;
+    kent.key.contents = (krb5_octet *)"2";
+    kret = krb5_kt_add_entry(context, kt1, &kent);
+    CHECK(kret, "Adding kvno 2");
+
+    kret = krb5_kt_get_entry(context, kt2, princ, 0, 0, &kent2);
+    CHECK(kret, "Looking up latest kvno");
+    CHECK_ERR(kent2.vno, 2, "Checking latest kvno");
+    krb5_kt_free_entry(context, &kent2);
+
+    /* Removing an entry doesn't change the file size. */
+    kret = krb5_kt_remove_entry(context, kt1, &kent);
+    CHECK(kret, "Removing kvno 2");
+
+    kret = krb5_kt_get_entry(context, kt2, princ, 2, 0, &kent2);
+    CHECK_ERR(kret, KRB5_KT_KVNONOTFOUND, "Looking up removed kvno");
+    kret = krb5_kt_get_entry(context, kt2, princ, 0, 0, &kent2);
+    CHECK(kret, "Looking up latest kvno after removal");
+    CHECK_ERR(kent2.vno, 1, "Checking latest kvno after removal");
+    krb5_kt_free_entry(context, &kent2);
+
+    unlink(filename);
+    kret = krb5_kt_get_entry(context, kt2, princ, 0, 0, &kent2);
+    CHECK_ERR(kret, ENOENT, "Looking up in removed keytab");
+
+    krb5_free_principal(context, princ);
+    krb5_kt_close(context, kt1);
+    krb5_kt_close(context, kt2);
+    free(filename);
+    free(name);
+}
+
 static void
 do_test(krb5_context context, const char *prefix, krb5_boolean delete)
 {
@@ -436,6 +509,7 @@ main(void)
     CHECK_ERR(kret, KRB5_KT_TYPE_EXISTS, "register ktf_writable");
 
     test_misc(context);
+    test_index(context);
     do_test(context, "WRFILE:", FALSE);
     do_test(context, "MEMORY:", TRUE);
 
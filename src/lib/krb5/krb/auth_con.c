@@ -173,6 +173,16 @@ krb5_auth_con_setuseruserkey(krb5_context context, krb5_auth_context auth_contex
     return(krb5_k_create_key(context, keyblock, &(auth_context->key)));
 }
 
+krb5_error_code
+k5_auth_con_setuseruserkey_k(krb5_context context,
+                             krb5_auth_context auth_context, krb5_key key)
+{
+    krb5_k_free_key(context, auth_context->key);
+    auth_context->key = key;
+    krb5_k_reference_key(context, key);
+    return 0;
+}
+
 krb5_error_code KRB5_CALLCONV
 krb5_auth_con_getkey(krb5_context context, krb5_auth_context auth_context, krb5_keyblock **keyblock)
 {
@@ -38,6 +38,23 @@
 krb5_error_code KRB5_CALLCONV
 krb5_decrypt_tkt_part(krb5_context context, const krb5_keyblock *srv_key,
                       krb5_ticket *ticket)
+{
+    krb5_error_code retval;
+    krb5_key key;
+
+    retval = krb5_k_create_key(context, srv_key, &key);
+    if (retval)
+        return retval;
+    retval = k5_decrypt_tkt_part_k(context, key, ticket);
+    krb5_k_free_key(context, key);
+    return retval;
+}
+
+/* Like krb5_decrypt_tkt_part(), but use a krb5_key so that the caller can
+ * reuse its derived keys across tickets. */
+krb5_error_code
+k5_decrypt_tkt_part_k(krb5_context context, krb5_key srv_key,
+                      krb5_ticket *ticket)
 {
     krb5_enc_tkt_part *dec_tkt_part;
     krb5_data scratch;
@@ -54,7 +71,7 @@ krb5_decrypt_tkt_part(krb5_context context, const krb5_keyblock *srv_key,
         return(ENOMEM);
 
     /* call the encryption routine */
-    if ((retval = krb5_c_decrypt(context, srv_key,
+    if ((retval = krb5_k_decrypt(context, srv_key,
                                  KRB5_KEYUSAGE_KDC_REP_TICKET, 0,
                                  &ticket->enc_part, &scratch))) {
         free(scratch.data);
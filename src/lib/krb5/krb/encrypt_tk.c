@@ -41,25 +41,56 @@
 krb5_error_code
 krb5_encrypt_tkt_part(krb5_context context, const krb5_keyblock *srv_key,
                       krb5_ticket *dec_ticket)
+{
+    krb5_error_code retval;
+    krb5_key key;
+
+    retval = krb5_k_create_key(context, srv_key, &key);
+    if (retval)
+        return retval;
+    retval = k5_encrypt_tkt_part_k(context, key, dec_ticket);
+    krb5_k_free_key(context, key);
+    return retval;
+}
+
+/* Like krb5_encrypt_tkt_part(), but use a krb5_key so that the caller can
+ * reuse its derived keys across tickets. */
+krb5_error_code
+k5_encrypt_tkt_part_k(krb5_context context, krb5_key srv_key,
+                      krb5_ticket *dec_ticket)
 {
     krb5_data *scratch;
     krb5_error_code retval;
     krb5_enc_tkt_part *dec_tkt_part = dec_ticket->enc_part2;
+    krb5_enc_data *enc = &dec_ticket->enc_part;
+    size_t enclen;
 
     /*  start by encoding the to-be-encrypted part. */
     if ((retval = encode_krb5_enc_tkt_part(dec_tkt_part, &scratch))) {
         return retval;
     }
 
-#define cleanup_scratch() { (void) memset(scratch->data, 0, scratch->length); \
-        krb5_free_data(context, scratch); }
+    retval = krb5_c_encrypt_length(context, srv_key->keyblock.enctype,
+                                   scratch->length, &enclen);
+    if (retval)
+        goto cleanup;
+    enc->ciphertext.length = enclen;
+    enc->ciphertext.data = malloc(enclen);
+    if (enc->ciphertext.data == NULL) {
+        retval = ENOMEM;
+        goto cleanup;
+    }
 
     /* call the encryption routine */
-    retval = krb5_encrypt_helper(context, srv_key,
-                                 KRB5_KEYUSAGE_KDC_REP_TICKET, scratch,
-                                 &dec_ticket->enc_part);
-
-    cleanup_scratch();
+    retval = krb5_k_encrypt(context, srv_key, KRB5_KEYUSAGE_KDC_REP_TICKET,
+                            NULL, scratch, enc);
+    if (retval) {
+        free(enc->ciphertext.data);
+        enc->ciphertext.data = NULL;
+    }
 
-    return(retval);
+cleanup:
+    zapfree(scratch->data, scratch->length);
+    free(scratch);
+    return retval;
 }
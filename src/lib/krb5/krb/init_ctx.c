@@ -308,6 +308,8 @@ krb5_free_context(krb5_context ctx)
 {
     if (ctx == NULL)
         return;
+    /* Close idle KDC connections while the TLS module is still loaded. */
+    k5_sendto_kdc_free_context(ctx);
     k5_os_free_context(ctx);
 
     free(ctx->tgs_etypes);
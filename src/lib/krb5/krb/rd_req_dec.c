@@ -484,6 +484,7 @@ rd_req_decoded_opt(krb5_context context, krb5_auth_context *auth_context,
     krb5_enctype         *permitted_etypes = NULL;
     int                   permitted_etypes_len = 0;
     krb5_keyblock         decrypt_key;
+    krb5_key              ukey;
 
     decrypt_key.enctype = ENCTYPE_NULL;
     decrypt_key.contents = NULL;
@@ -494,15 +495,17 @@ rd_req_decoded_opt(krb5_context context, krb5_auth_context *auth_context,
 
     /* decrypt the ticket */
     if ((*auth_context)->key) { /* User to User authentication */
-        if ((retval = krb5_decrypt_tkt_part(context,
-                                            &(*auth_context)->key->keyblock,
-                                            req->ticket)))
+        ukey = (*auth_context)->key;
+        if ((retval = k5_decrypt_tkt_part_k(context, ukey, req->ticket)))
             goto cleanup;
+        /* The key may be shared with the caller, so copy its keyblock. */
         if (check_valid_flag) {
-            decrypt_key = (*auth_context)->key->keyblock;
-            (*auth_context)->key->keyblock.contents = NULL;
+            retval = krb5_copy_keyblock_contents(context, &ukey->keyblock,
+                                                 &decrypt_key);
+            if (retval)
+                goto cleanup;
         }
-        krb5_k_free_key(context, (*auth_context)->key);
+        krb5_k_free_key(context, ukey);
         (*auth_context)->key = NULL;
         if (server == NULL)
             server = req->ticket->server;
@@ -107,6 +107,53 @@ check_context(krb5_context c, krb5_context r)
     }
 }
 
+/* Check that a modification to c's profile is not visible through r's.  Discard
+ * c's profile afterwards so that the modification isn't written out. */
+static void
+check_profile_private(krb5_context c, krb5_context r)
+{
+    const char *names[] = { "libdefaults", "t_copy_context", NULL };
+    char *val;
+
+    check(profile_add_relation(c->profile, names, "yes") == 0);
+    check(profile_get_string(c->profile, "libdefaults", "t_copy_context", NULL,
+                             NULL, &val) == 0);
+    compare_string(val, "yes");
+    profile_release_string(val);
+    check(profile_get_string(r->profile, "libdefaults", "t_copy_context", NULL,
+                             NULL, &val) == 0);
+    check(val == NULL);
+    profile_abandon(c->profile);
+    c->profile = NULL;
+}
+
+/* Check that copying a context whose only profile file has been modified and
+ * then removed fails as profile_init() would, rather than yielding an empty
+ * profile. */
+static void
+check_profile_copy_missing(void)
+{
+    const char *fname = "t_copy_context.conf";
+    const char *files[] = { fname, NULL };
+    const char *names[] = { "libdefaults", "t_copy_context", NULL };
+    krb5_context ctx, ctx2;
+    FILE *fp;
+
+    fp = fopen(fname, "w");
+    check(fp != NULL);
+    fputs("[libdefaults]\n", fp);
+    check(fclose(fp) == 0);
+    check(krb5_init_context(&ctx) == 0);
+    profile_abandon(ctx->profile);
+    check(profile_init(files, &ctx->profile) == 0);
+    check(profile_add_relation(ctx->profile, names, "yes") == 0);
+    check(unlink(fname) == 0);
+    check(krb5_copy_context(ctx, &ctx2) == ENOENT);
+    profile_abandon(ctx->profile);
+    ctx->profile = NULL;
+    krb5_free_context(ctx);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -120,6 +167,7 @@ main(int argc, char **argv)
     check(krb5_init_context(&ctx) == 0);
     check(krb5_copy_context(ctx, &ctx2) == 0);
     check_context(ctx2, ctx);
+    check_profile_private(ctx2, ctx);
     krb5_free_context(ctx2);
 
     /* Set non-default values for all of the propagated fields in ctx. */
@@ -153,5 +201,7 @@ main(int argc, char **argv)
     krb5_free_context(ctx2);
 
     krb5_free_context(ctx);
+
+    check_profile_copy_missing();
     return 0;
 }
@@ -10,6 +10,7 @@
 #include "k5-platform.h"
 #include "cc-int.h"
 #include "kt-int.h"
+#include "rc-int.h"
 #include "os-proto.h"
 
 /*
@@ -48,6 +49,9 @@ int krb5int_lib_init(void)
     if (err)
         return err;
     err = k5_mutex_finish_init(&krb5int_us_time_mutex);
+    if (err)
+        return err;
+    err = k5_rc_mem_initialize();
     if (err)
         return err;
 
@@ -78,6 +82,7 @@ void krb5int_lib_fini(void)
 #endif
 
     k5_mutex_destroy(&krb5int_us_time_mutex);
+    k5_rc_mem_finalize();
 
     krb5int_cc_finalize();
 #ifndef LEAN_CLIENT
@@ -169,6 +169,40 @@ krb5_lock_file(krb5_context context, int fd, int mode)
 
     return retval;
 }
+
+/*
+ * Lock (KRB5_LOCKMODE_EXCLUSIVE or KRB5_LOCKMODE_SHARED) or unlock
+ * (KRB5_LOCKMODE_UNLOCK) len bytes of fd at offset with an OFD lock, waiting
+ * for a conflicting lock to be released.  Return EINVAL if OFD locks are not
+ * supported, as there is no fallback which would contend with them.
+ */
+krb5_error_code
+k5_lock_file_range(int fd, off_t offset, off_t len, int mode)
+{
+#if defined(POSIX_FILE_LOCKS) && defined(F_OFD_SETLKW)
+    fcntl_lock_st lock_arg = { 0 };
+
+    switch (mode) {
+    case KRB5_LOCKMODE_SHARED:
+        lock_arg.l_type = F_RDLCK;
+        break;
+    case KRB5_LOCKMODE_EXCLUSIVE:
+        lock_arg.l_type = F_WRLCK;
+        break;
+    case KRB5_LOCKMODE_UNLOCK:
+        lock_arg.l_type = F_UNLCK;
+        break;
+    default:
+        return KRB5_LIBOS_BADLOCKFLAG;
+    }
+    lock_arg.l_whence = SEEK_SET;
+    lock_arg.l_start = offset;
+    lock_arg.l_len = len;
+    return (fcntl(fd, F_OFD_SETLKW, &lock_arg) == -1) ? errno : 0;
+#else
+    return EINVAL;
+#endif
+}
 #else   /* Windows or Macintosh */
 
 krb5_error_code
@@ -179,4 +213,10 @@ krb5_lock_file(context, fd, mode)
 {
     return 0;
 }
+
+krb5_error_code
+k5_lock_file_range(int fd, off_t offset, off_t len, int mode)
+{
+    return EINVAL;
+}
 #endif
@@ -51,7 +51,8 @@
  */
 
 /* Send packet to KDC for realm; wait for response, retransmitting
- * as necessary. */
+ * as necessary.  The exchange can also be driven by the caller's event loop
+ * using the krb5_sendto_kdc_context functions. */
 
 #include "k5-int.h"
 #include "k5-tls.h"
@@ -79,6 +80,8 @@
 #define DEFAULT_UDP_PREF_LIMIT   1465
 #define HARD_UDP_LIMIT          32700 /* could probably do 64K-epsilon ? */
 #define PORT_LENGTH                 6 /* decimal repr of UINT16_MAX */
+#define MAX_IDLE_CONNS              8
+#define IDLE_CONN_TIMEOUT       30000 /* milliseconds */
 
 /* Select state flags.  */
 #define SSF_READ 0x01
@@ -136,15 +139,40 @@ struct conn_state {
     struct conn_state *next;
     time_ms endtime;
     krb5_boolean defer;
+    krb5_boolean reused;        /* fd was taken from the idle pool */
+    krb5_boolean no_reuse;      /* don't take fd from the idle pool */
     struct {
         const char *uri_path;
         const char *servername;
         char port[PORT_LENGTH];
         char *https_request;
         k5_tls_handle tls;
+        krb5_boolean keepalive;
     } http;
 };
 
+/* An idle TCP or HTTPS connection kept for reuse with a later message. */
+struct idle_conn {
+    SOCKET fd;
+    struct remote_address addr;
+    k5_tls_handle tls;          /* HTTPS only */
+    char *servername;           /* HTTPS only */
+    char *realm;                /* HTTPS only; selects the trust anchors */
+    time_ms idle_since;
+    struct idle_conn *next;
+};
+
+/* The idle connections of a krb5_context, most recently used first.  The
+ * connections belong to the process which opened them. */
+struct sendto_conn_pool {
+    krb5_boolean enabled;
+    struct idle_conn *conns;
+    int count;
+#ifndef _WIN32
+    pid_t pid;
+#endif
+};
+
 /* Set up context->tls.  On allocation failure, return ENOMEM.  On plugin load
  * failure, set context->tls to point to a nulled vtable and return 0. */
 static krb5_error_code
@@ -195,6 +223,221 @@ free_http_tls_data(krb5_context context, struct conn_state *state)
     state->http.https_request = NULL;
 }
 
+static void
+free_idle_conn(krb5_context context, struct idle_conn *ic)
+{
+    if (ic->tls != NULL)
+        context->tls->free_handle(context, ic->tls);
+    closesocket(ic->fd);
+    free(ic->servername);
+    free(ic->realm);
+    free(ic);
+}
+
+static void
+free_idle_conns(krb5_context context, struct sendto_conn_pool *pool)
+{
+    struct idle_conn *ic, *next;
+
+    for (ic = pool->conns; ic != NULL; ic = next) {
+        next = ic->next;
+        free_idle_conn(context, ic);
+    }
+    pool->conns = NULL;
+    pool->count = 0;
+}
+
+/* Get the idle connection pool of context, creating it if necessary.  Return
+ * NULL if the pool cannot be allocated. */
+static struct sendto_conn_pool *
+get_conn_pool(krb5_context context)
+{
+    struct sendto_conn_pool *pool = context->kdc_conn_pool;
+    int enabled;
+
+    if (pool != NULL) {
+#ifndef _WIN32
+        /* If the context was inherited across a fork, the pooled sockets and
+         * TLS sessions are shared with the parent process.  Close our copies
+         * without using them.  (Freeing a TLS handle does not write to the
+         * socket.) */
+        if (pool->pid != getpid()) {
+            free_idle_conns(context, pool);
+            pool->pid = getpid();
+        }
+#endif
+        return pool;
+    }
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    if (profile_get_boolean(context->profile, KRB5_CONF_LIBDEFAULTS,
+                            KRB5_CONF_KDC_CONNECTION_REUSE, NULL, TRUE,
+                            &enabled) != 0)
+        enabled = TRUE;
+    pool->enabled = enabled;
+#ifndef _WIN32
+    pool->pid = getpid();
+#endif
+    context->kdc_conn_pool = pool;
+    return pool;
+}
+
+static krb5_boolean
+conn_reuse_enabled(krb5_context context)
+{
+    struct sendto_conn_pool *pool = get_conn_pool(context);
+
+    return pool != NULL && pool->enabled;
+}
+
+void
+k5_sendto_kdc_free_context(krb5_context context)
+{
+    struct sendto_conn_pool *pool = context->kdc_conn_pool;
+
+    if (pool == NULL)
+        return;
+    free_idle_conns(context, pool);
+    free(pool);
+    context->kdc_conn_pool = NULL;
+}
+
+/* Return true if fd has nothing to read and has not been closed by the peer,
+ * as expected of an idle connection. */
+static krb5_boolean
+conn_is_idle(SOCKET fd)
+{
+#ifdef USE_POLL
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) == 0;
+#else
+    fd_set rfds;
+    struct timeval tv = { 0, 0 };
+
+#ifndef _WIN32
+    if (fd >= FD_SETSIZE)
+        return FALSE;
+#endif
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    return select(fd + 1, &rfds, NULL, NULL, &tv) == 0;
+#endif
+}
+
+static krb5_boolean
+idle_conn_matches(struct idle_conn *ic, struct conn_state *state,
+                  const krb5_data *realm)
+{
+    if (ic->addr.transport != state->addr.transport ||
+        ic->addr.family != state->addr.family ||
+        ic->addr.len != state->addr.len ||
+        memcmp(&ic->addr.saddr, &state->addr.saddr, ic->addr.len) != 0)
+        return FALSE;
+    if (state->addr.transport != HTTPS)
+        return TRUE;
+    return strcmp(ic->servername, state->http.servername) == 0 &&
+        data_eq_string(*realm, ic->realm);
+}
+
+/*
+ * Look for an idle connection to the server of state in the pool.  If one is
+ * found, remove it from the pool, give its socket and TLS handle to state, and
+ * return true.  Discard connections which have been idle too long or which
+ * the server has closed.
+ */
+static krb5_boolean
+take_idle_conn(krb5_context context, struct conn_state *state,
+               const krb5_data *realm)
+{
+    struct sendto_conn_pool *pool = get_conn_pool(context);
+    struct idle_conn *ic, **icp;
+    time_ms now;
+
+    if (pool == NULL || !pool->enabled || pool->conns == NULL)
+        return FALSE;
+    if (get_curtime_ms(&now) != 0)
+        return FALSE;
+
+    icp = &pool->conns;
+    while ((ic = *icp) != NULL) {
+        if (now - ic->idle_since > IDLE_CONN_TIMEOUT ||
+            (idle_conn_matches(ic, state, realm) && !conn_is_idle(ic->fd))) {
+            *icp = ic->next;
+            pool->count--;
+            free_idle_conn(context, ic);
+            continue;
+        }
+        if (idle_conn_matches(ic, state, realm)) {
+            *icp = ic->next;
+            pool->count--;
+            state->fd = ic->fd;
+            state->http.tls = ic->tls;
+            ic->tls = NULL;
+            ic->fd = INVALID_SOCKET;
+            free(ic->servername);
+            free(ic->realm);
+            free(ic);
+            return TRUE;
+        }
+        icp = &ic->next;
+    }
+    return FALSE;
+}
+
+/* Move the socket and TLS handle of state into the idle pool, closing the
+ * least recently used idle connection if the pool is full.  On allocation
+ * failure, leave state unchanged. */
+static void
+save_idle_conn(krb5_context context, struct conn_state *state,
+               const krb5_data *realm)
+{
+    struct sendto_conn_pool *pool = get_conn_pool(context);
+    struct idle_conn *ic, **icp;
+    krb5_error_code ret;
+
+    if (pool == NULL || !pool->enabled)
+        return;
+
+    ic = k5alloc(sizeof(*ic), &ret);
+    if (ic == NULL)
+        return;
+    if (state->addr.transport == HTTPS) {
+        ic->servername = strdup(state->http.servername);
+        ic->realm = k5memdup0(realm->data, realm->length, &ret);
+        if (ic->servername == NULL || ic->realm == NULL) {
+            free(ic->servername);
+            free(ic->realm);
+            free(ic);
+            return;
+        }
+    }
+    if (get_curtime_ms(&ic->idle_since) != 0) {
+        free(ic->servername);
+        free(ic->realm);
+        free(ic);
+        return;
+    }
+    ic->fd = state->fd;
+    ic->addr = state->addr;
+    ic->tls = state->http.tls;
+    state->fd = INVALID_SOCKET;
+    state->http.tls = NULL;
+
+    ic->next = pool->conns;
+    pool->conns = ic;
+    if (++pool->count > MAX_IDLE_CONNS) {
+        for (icp = &pool->conns; (*icp)->next != NULL; icp = &(*icp)->next);
+        free_idle_conn(context, *icp);
+        *icp = NULL;
+        pool->count--;
+    }
+}
+
 #ifdef USE_POLL
 
 /* Find a pollfd in selstate by fd, or abort if we can't find it. */
@@ -270,6 +513,16 @@ cm_get_ssflags(struct select_state *selstate, int fd)
         ((pfd->revents & POLLERR) ? SSF_EXCEPTION : 0);
 }
 
+/* Get the events we will poll for on fd in the form of ssflags. */
+static unsigned int
+cm_get_interest(struct select_state *selstate, int fd)
+{
+    struct pollfd *pfd = find_pollfd(selstate, fd);
+
+    return ((pfd->events & POLLIN) ? SSF_READ : 0) |
+        ((pfd->events & POLLOUT) ? SSF_WRITE : 0);
+}
+
 #else /* not USE_POLL */
 
 static void
@@ -337,6 +590,14 @@ cm_get_ssflags(struct select_state *selstate, int fd)
         (FD_ISSET(fd, &selstate->xfds) ? SSF_EXCEPTION : 0);
 }
 
+/* Get the events we will select for on fd in the form of ssflags. */
+static unsigned int
+cm_get_interest(struct select_state *selstate, int fd)
+{
+    return (FD_ISSET(fd, &selstate->rfds) ? SSF_READ : 0) |
+        (FD_ISSET(fd, &selstate->wfds) ? SSF_WRITE : 0);
+}
+
 #endif /* not USE_POLL */
 
 static krb5_error_code
@@ -423,6 +684,94 @@ krb5_set_kdc_recv_hook(krb5_context context, krb5_post_recv_fn recv_hook,
     context->kdc_recv_hook_data = data;
 }
 
+/* Choose a transport strategy for message, reading the UDP preference limit
+ * into context if we haven't already. */
+static krb5_error_code
+choose_strategy(krb5_context context, const krb5_data *message, int no_udp,
+                k5_transport_strategy *strategy_out)
+{
+    krb5_error_code retval;
+    int tmp;
+
+    if (!no_udp && context->udp_pref_limit < 0) {
+        retval = profile_get_integer(context->profile,
+                                     KRB5_CONF_LIBDEFAULTS, KRB5_CONF_UDP_PREFERENCE_LIMIT, 0,
+                                     DEFAULT_UDP_PREF_LIMIT, &tmp);
+        if (retval)
+            return retval;
+        if (tmp < 0)
+            tmp = DEFAULT_UDP_PREF_LIMIT;
+        else if (tmp > HARD_UDP_LIMIT)
+            /* In the unlikely case that a *really* big value is
+               given, let 'em use as big as we think we can
+               support.  */
+            tmp = HARD_UDP_LIMIT;
+        context->udp_pref_limit = tmp;
+    }
+
+    if (no_udp)
+        *strategy_out = NO_UDP;
+    else if (message->length <= (unsigned int) context->udp_pref_limit)
+        *strategy_out = UDP_FIRST;
+    else
+        *strategy_out = UDP_LAST;
+    return 0;
+}
+
+/*
+ * Translate the result retval of k5_sendto() for realm, where err is the KDC
+ * error seen by check_for_svc_unavailable(), and run the post-receive hook.
+ * On success, place the reply in *reply_out, taking ownership of *reply.  Set
+ * *overridden_out to true if the hook supplied a reply in place of an error.
+ */
+static krb5_error_code
+finish_sendto_kdc(krb5_context context, krb5_error_code retval,
+                  krb5_error_code err, const krb5_data *realm,
+                  const krb5_data *message, krb5_data *reply,
+                  krb5_data *reply_out, krb5_boolean *overridden_out)
+{
+    krb5_error_code oldret;
+    krb5_data *hook_reply = NULL;
+
+    *overridden_out = FALSE;
+
+    if (retval == KRB5_KDC_UNREACH) {
+        if (err == KDC_ERR_SVC_UNAVAILABLE) {
+            retval = KRB5KDC_ERR_SVC_UNAVAILABLE;
+        } else {
+            k5_setmsg(context, retval,
+                      _("Cannot contact any KDC for realm '%.*s'"),
+                      realm->length, realm->data);
+        }
+    }
+
+    if (context->kdc_recv_hook != NULL) {
+        oldret = retval;
+        retval = context->kdc_recv_hook(context, context->kdc_recv_hook_data,
+                                        retval, realm, message, reply,
+                                        &hook_reply);
+        if (oldret && !retval) {
+            /*
+             * The hook must set a reply if it overrides an error from
+             * k5_sendto().
+             */
+            assert(hook_reply != NULL);
+            *overridden_out = TRUE;
+        }
+    }
+    if (retval)
+        return retval;
+
+    if (hook_reply != NULL) {
+        *reply_out = *hook_reply;
+        free(hook_reply);
+    } else {
+        *reply_out = *reply;
+        *reply = empty_data();
+    }
+    return 0;
+}
+
 /*
  * send the formatted request 'message' to a KDC for realm 'realm' and
  * return the response (if any) in 'reply'.
@@ -439,11 +788,12 @@ krb5_sendto_kdc(krb5_context context, const krb5_data *message,
                 const krb5_data *realm, krb5_data *reply_out, int *use_primary,
                 int no_udp)
 {
-    krb5_error_code retval, oldret, err;
+    krb5_error_code retval, err;
     struct serverlist servers;
     int server_used;
     k5_transport_strategy strategy;
     krb5_data reply = empty_data(), *hook_message = NULL, *hook_reply = NULL;
+    krb5_boolean overridden;
 
     *reply_out = empty_data();
 
@@ -462,29 +812,9 @@ krb5_sendto_kdc(krb5_context context, const krb5_data *message,
 
     TRACE_SENDTO_KDC(context, message->length, realm, *use_primary, no_udp);
 
-    if (!no_udp && context->udp_pref_limit < 0) {
-        int tmp;
-        retval = profile_get_integer(context->profile,
-                                     KRB5_CONF_LIBDEFAULTS, KRB5_CONF_UDP_PREFERENCE_LIMIT, 0,
-                                     DEFAULT_UDP_PREF_LIMIT, &tmp);
-        if (retval)
-            return retval;
-        if (tmp < 0)
-            tmp = DEFAULT_UDP_PREF_LIMIT;
-        else if (tmp > HARD_UDP_LIMIT)
-            /* In the unlikely case that a *really* big value is
-               given, let 'em use as big as we think we can
-               support.  */
-            tmp = HARD_UDP_LIMIT;
-        context->udp_pref_limit = tmp;
-    }
-
-    if (no_udp)
-        strategy = NO_UDP;
-    else if (message->length <= (unsigned int) context->udp_pref_limit)
-        strategy = UDP_FIRST;
-    else
-        strategy = UDP_LAST;
+    retval = choose_strategy(context, message, no_udp, &strategy);
+    if (retval)
+        return retval;
 
     retval = k5_locate_kdc(context, realm, &servers, *use_primary, no_udp);
     if (retval)
@@ -511,45 +841,17 @@ krb5_sendto_kdc(krb5_context context, const krb5_data *message,
     retval = k5_sendto(context, message, realm, &servers, strategy, NULL,
                        &reply, NULL, NULL, &server_used,
                        check_for_svc_unavailable, &err);
-    if (retval == KRB5_KDC_UNREACH) {
-        if (err == KDC_ERR_SVC_UNAVAILABLE) {
-            retval = KRB5KDC_ERR_SVC_UNAVAILABLE;
-        } else {
-            k5_setmsg(context, retval,
-                      _("Cannot contact any KDC for realm '%.*s'"),
-                      realm->length, realm->data);
-        }
-    }
-
-    if (context->kdc_recv_hook != NULL) {
-        oldret = retval;
-        retval = context->kdc_recv_hook(context, context->kdc_recv_hook_data,
-                                        retval, realm, message, &reply,
-                                        &hook_reply);
-        if (oldret && !retval) {
-            /*
-             * The hook must set a reply if it overrides an error from
-             * k5_sendto().  Treat this reply as coming from the primary
-             * KDC.
-             */
-            assert(hook_reply != NULL);
-            *use_primary = 1;
-        }
-    }
+    retval = finish_sendto_kdc(context, retval, err, realm, message, &reply,
+                               reply_out, &overridden);
     if (retval)
         goto cleanup;
 
-    if (hook_reply != NULL) {
-        *reply_out = *hook_reply;
-        free(hook_reply);
-    } else {
-        *reply_out = reply;
-        reply = empty_data();
-    }
-
-    /* Set use_primary to 1 if we ended up talking to a primary when we didn't
-     * explicitly request to. */
-    if (*use_primary == 0) {
+    /* Treat a reply supplied by the post-receive hook in place of an error as
+     * coming from the primary KDC.  Otherwise, set use_primary to 1 if we
+     * ended up talking to a primary when we didn't explicitly request to. */
+    if (overridden) {
+        *use_primary = 1;
+    } else if (*use_primary == 0) {
         *use_primary = k5_kdc_is_primary(context, realm,
                                          &servers.servers[server_used]);
         TRACE_SENDTO_KDC_PRIMARY(context, *use_primary);
@@ -627,6 +929,8 @@ make_proxy_request(struct conn_state *state, const krb5_data *realm,
     k5_buf_add(&buf, "Cache-Control: no-cache\r\n");
     k5_buf_add(&buf, "Pragma: no-cache\r\n");
     k5_buf_add(&buf, "User-Agent: kerberos/1.0\r\n");
+    if (state->http.keepalive)
+        k5_buf_add(&buf, "Connection: keep-alive\r\n");
     k5_buf_add(&buf, "Content-type: application/kerberos\r\n");
     k5_buf_add_fmt(&buf, "Content-Length: %d\r\n\r\n", encoded_pm->length);
     k5_buf_add_len(&buf, encoded_pm->data, encoded_pm->length);
@@ -864,11 +1168,10 @@ resolve_server(krb5_context context, const krb5_data *realm,
     return retval;
 }
 
+/* Create a socket for state and start connecting it.  Return 0 on success or
+ * a negative value on failure, as for start_connection(). */
 static int
-start_connection(krb5_context context, struct conn_state *state,
-                 const krb5_data *message, struct select_state *selstate,
-                 const krb5_data *realm,
-                 struct sendto_callback_info *callback_info)
+open_connection(krb5_context context, struct conn_state *state)
 {
     int fd, e, type;
     static const int one = 1;
@@ -912,6 +1215,38 @@ start_connection(krb5_context context, struct conn_state *state,
         state->fd = fd;
     }
 
+    return 0;
+}
+
+static int
+start_connection(krb5_context context, struct conn_state *state,
+                 const krb5_data *message, struct select_state *selstate,
+                 const krb5_data *realm,
+                 struct sendto_callback_info *callback_info)
+{
+    int e;
+
+    /* Reuse an idle connection to the same server if we have one. */
+    if (callback_info == NULL && !state->no_reuse &&
+        socktype_for_transport(state->addr.transport) == SOCK_STREAM &&
+        take_idle_conn(context, state, realm)) {
+        TRACE_SENDTO_KDC_TCP_REUSE(context, &state->addr);
+        state->reused = TRUE;
+        state->state = WRITING;
+        /* Record this connection's timeout as service_tcp_connect would. */
+        if (get_curtime_ms(&state->endtime) == 0)
+            state->endtime += 10000;
+    } else {
+        e = open_connection(context, state);
+        if (e != 0)
+            return e;
+    }
+
+    /* Ask an HTTPS proxy to keep the connection open if we may reuse it. */
+    if (state->addr.transport == HTTPS)
+        state->http.keepalive = callback_info == NULL &&
+            conn_reuse_enabled(context);
+
     /*
      * Here's where KPASSWD callback gets the socket information it needs for
      * a kpasswd request
@@ -921,7 +1256,7 @@ start_connection(krb5_context context, struct conn_state *state,
         e = callback_info->pfn_callback(state->fd, callback_info->data,
                                         &state->callback_buffer);
         if (e != 0) {
-            (void) closesocket(fd);
+            (void) closesocket(state->fd);
             state->fd = INVALID_SOCKET;
             state->state = FAILED;
             return -3;
@@ -1276,6 +1611,44 @@ service_https_write(krb5_context context, const krb5_data *realm,
     return FALSE;
 }
 
+/*
+ * Return true if the HTTP response in in->buf has a Content-Length header and
+ * its body has been read.  In that case, set *keepalive_out to whether the
+ * server agreed to keep the connection open.
+ */
+static krb5_boolean
+http_response_complete(struct incoming_message *in,
+                       krb5_boolean *keepalive_out)
+{
+    const char *line, *end, *body, *val;
+    krb5_boolean have_length = FALSE, keepalive = FALSE;
+    unsigned long length = 0;
+
+    body = strstr(in->buf, "\r\n\r\n");
+    if (body == NULL)
+        return FALSE;
+    body += 4;
+
+    /* Scan the header lines following the status line. */
+    line = strstr(in->buf, "\r\n") + 2;
+    while (line < body - 2) {
+        end = strstr(line, "\r\n");
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            length = strtoul(line + 15, NULL, 10);
+            have_length = TRUE;
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            for (val = line + 11; *val == ' ' || *val == '\t'; val++);
+            keepalive = (strncasecmp(val, "keep-alive", 10) == 0);
+        }
+        line = end + 2;
+    }
+
+    if (!have_length || (size_t)(in->buf + in->pos - body) < length)
+        return FALSE;
+    *keepalive_out = keepalive;
+    return TRUE;
+}
+
 /* Return true on finished data.  Call a cm_read/write function and return
  * false if the TLS layer needs it.  Kill the connection on error. */
 static krb5_boolean
@@ -1310,10 +1683,19 @@ https_read_bytes(krb5_context context, struct conn_state *conn,
 
         in->pos += nread;
         in->buf[in->pos] = '\0';
+
+        /* If we asked the proxy to keep the connection open, the response
+         * is complete when we have read the advertised body length. */
+        if (conn->http.keepalive &&
+            http_response_complete(in, &conn->http.keepalive))
+            return TRUE;
     }
 
-    if (st == DONE)
+    if (st == DONE) {
+        /* The proxy closed the connection. */
+        conn->http.keepalive = FALSE;
         return TRUE;
+    }
 
     if (st == WANT_READ) {
         cm_read(selstate, conn->fd);
@@ -1387,66 +1769,95 @@ get_endtime(time_ms endtime, struct conn_state *conns)
     return endtime;
 }
 
-static krb5_boolean
-service_fds(krb5_context context, struct select_state *selstate,
-            time_ms interval, struct conn_state *conns,
-            struct select_state *seltemp, const krb5_data *realm,
-            int (*msg_handler)(krb5_context, const krb5_data *, void *),
-            void *msg_handler_data, struct conn_state **winner_out)
-{
-    int e, selret = 0;
-    time_ms endtime;
-    struct conn_state *state;
-
-    *winner_out = NULL;
-
-    e = get_curtime_ms(&endtime);
-    if (e)
-        return TRUE;
-    endtime += interval;
-
-    e = 0;
-    while (selstate->nfds > 0) {
-        e = cm_select_or_poll(selstate, get_endtime(endtime, conns),
-                              seltemp, &selret);
-        if (e == EINTR)
-            continue;
-        if (e != 0)
-            break;
+/* Stages of the transmission schedule described above k5_sendto(). */
+enum sendto_phase {
+    FIRST_PASS,                 /* resolving servers, contacting preferred */
+    DEFERRED,                   /* contacting non-preferred transports */
+    RETRANSMIT                  /* later passes over all connections */
+};
 
-        if (selret == 0)
-            /* Timeout, return to caller.  */
-            return FALSE;
+/* State of a message exchange, which may be driven by k5_sendto() or by the
+ * caller's event loop through the krb5_sendto_kdc_context API. */
+struct sendto_state {
+    const krb5_data *message;
+    const krb5_data *realm;
+    const struct serverlist *servers;
+    k5_transport_strategy strategy;
+    struct sendto_callback_info *callback_info;
+    int (*msg_handler)(krb5_context, const krb5_data *, void *);
+    void *msg_handler_data;
+
+    struct conn_state *conns;
+    char *udpbuf;
+    krb5_boolean udpbuf_in_reply;
+
+    /* One listing all of our fds in use, and one for the results of the last
+     * poll. */
+    struct select_state *selstate;
+    struct select_state *seltemp;
+
+    enum sendto_phase phase;
+    size_t server_index;        /* next server to resolve */
+    struct conn_state *next_conn; /* next connection to contact */
+    int pass;
+    time_ms delay;              /* backoff at the end of the next pass */
+    time_ms endtime;            /* end of the current wait */
 
-        /* Got something on a socket, process it.  */
-        for (state = conns; state != NULL; state = state->next) {
-            int ssflags;
+    krb5_boolean done;
+    struct conn_state *winner;
+};
 
-            if (state->fd == INVALID_SOCKET)
-                continue;
-            ssflags = cm_get_ssflags(seltemp, state->fd);
-            if (!ssflags)
-                continue;
+/* The server may close an idle connection at any time.  If a connection
+ * taken from the idle pool fails, send the message again over a new one. */
+static void
+retry_conn(krb5_context context, struct sendto_state *st,
+           struct conn_state *conn)
+{
+    TRACE_SENDTO_KDC_TCP_REUSE_ERROR(context, &conn->addr);
+    free(conn->in.buf);
+    memset(&conn->in, 0, sizeof(conn->in));
+    conn->out.sgp = conn->out.sgbuf;
+    conn->reused = FALSE;
+    conn->no_reuse = TRUE;
+    conn->state = INITIALIZING;
+    (void)maybe_send(context, conn, st->message, st->selstate, st->realm,
+                     st->callback_info);
+}
 
-            if (service_dispatch(context, realm, state, selstate, ssflags)) {
-                int stop = 1;
+/* Process the socket events in st->seltemp.  Set st->done and st->winner if a
+ * connection yields a reply accepted by the message handler. */
+static void
+service_events(krb5_context context, struct sendto_state *st)
+{
+    struct conn_state *state;
+    krb5_data reply;
+    int ssflags, stop;
 
-                if (msg_handler != NULL) {
-                    krb5_data reply = make_data(state->in.buf, state->in.pos);
+    for (state = st->conns; state != NULL; state = state->next) {
+        if (state->fd == INVALID_SOCKET)
+            continue;
+        ssflags = cm_get_ssflags(st->seltemp, state->fd);
+        if (!ssflags)
+            continue;
 
-                    stop = (msg_handler(context, &reply, msg_handler_data) != 0);
-                }
+        if (service_dispatch(context, st->realm, state, st->selstate,
+                             ssflags)) {
+            stop = 1;
+            if (st->msg_handler != NULL) {
+                reply = make_data(state->in.buf, state->in.pos);
+                stop = (st->msg_handler(context, &reply,
+                                        st->msg_handler_data) != 0);
+            }
 
-                if (stop) {
-                    *winner_out = state;
-                    return TRUE;
-                }
+            if (stop) {
+                st->winner = state;
+                st->done = TRUE;
+                return;
             }
+        } else if (state->state == FAILED && state->reused) {
+            retry_conn(context, st, state);
         }
     }
-    if (e != 0)
-        return TRUE;
-    return FALSE;
 }
 
 /*
@@ -1474,6 +1885,280 @@ service_fds(krb5_context context, struct select_state *selstate,
  * moving on.  This reduces network traffic significantly in a TCP environment.
  */
 
+
+/*
+ * Make the next transmission in the schedule, resolving servers as needed.
+ * Set *wait_out to the time to wait for replies afterwards, or to -1 if the
+ * schedule is exhausted.
+ */
+static krb5_error_code
+next_transmission(krb5_context context, struct sendto_state *st,
+                  time_ms *wait_out)
+{
+    krb5_error_code ret;
+    struct conn_state *state, **tailptr;
+
+    *wait_out = -1;
+
+    if (st->phase == FIRST_PASS) {
+        /* Resolve server hosts, communicate with resulting addresses of the
+         * preferred transport, and wait 1s for an answer from each. */
+        for (;;) {
+            while ((state = st->next_conn) != NULL) {
+                st->next_conn = state->next;
+                /* Defer those which use the non-preferred RFC 4120
+                 * transport. */
+                if (state->defer)
+                    continue;
+                if (maybe_send(context, state, st->message, st->selstate,
+                               st->realm, st->callback_info))
+                    continue;
+                *wait_out = 1000;
+                return 0;
+            }
+            if (st->server_index >= st->servers->nservers)
+                break;
+
+            /* Find the current tail pointer. */
+            for (tailptr = &st->conns; *tailptr != NULL;
+                 tailptr = &(*tailptr)->next);
+            ret = resolve_server(context, st->realm, st->servers,
+                                 st->server_index, st->strategy, st->message,
+                                 &st->udpbuf, &st->conns);
+            if (ret)
+                return ret;
+            st->server_index++;
+            st->next_conn = *tailptr;
+        }
+        st->phase = DEFERRED;
+        st->next_conn = st->conns;
+    }
+
+    if (st->phase == DEFERRED) {
+        /* Complete the first pass by contacting servers of the non-preferred
+         * RFC 4120 transport (if given), waiting 1s for an answer from
+         * each. */
+        while ((state = st->next_conn) != NULL) {
+            st->next_conn = state->next;
+            if (!state->defer)
+                continue;
+            if (maybe_send(context, state, st->message, st->selstate,
+                           st->realm, st->callback_info))
+                continue;
+            *wait_out = 1000;
+            return 0;
+        }
+
+        /* Wait for two seconds at the end of the first pass. */
+        st->phase = RETRANSMIT;
+        st->pass = 1;
+        st->next_conn = st->conns;
+        *wait_out = 2000;
+        st->delay = 4000;
+        return 0;
+    }
+
+    /* Make remaining passes over all of the connections. */
+    while (st->pass < MAX_PASS && st->selstate->nfds > 0) {
+        while ((state = st->next_conn) != NULL) {
+            st->next_conn = state->next;
+            if (maybe_send(context, state, st->message, st->selstate,
+                           st->realm, st->callback_info))
+                continue;
+            *wait_out = 1000;
+            return 0;
+        }
+
+        /* Wait for the delay backoff at the end of this pass. */
+        st->pass++;
+        st->next_conn = st->conns;
+        *wait_out = st->delay;
+        st->delay *= 2;
+        return 0;
+    }
+
+    return 0;
+}
+
+/*
+ * Advance the schedule past any wait which has ended, until we are waiting
+ * for replies on at least one socket or there is nothing left to do.  A wait
+ * ends immediately if there are no sockets to wait on, and is extended for
+ * active TCP connections.
+ */
+static krb5_error_code
+sendto_advance(krb5_context context, struct sendto_state *st)
+{
+    krb5_error_code ret;
+    time_ms now, wait;
+
+    while (!st->done) {
+        if (st->selstate->nfds > 0) {
+            ret = get_curtime_ms(&now);
+            if (ret) {
+                st->done = TRUE;
+                return 0;
+            }
+            if (now < get_endtime(st->endtime, st->conns))
+                return 0;
+        }
+
+        ret = next_transmission(context, st, &wait);
+        if (ret)
+            return ret;
+        if (wait < 0) {
+            st->done = TRUE;
+            return 0;
+        }
+        ret = get_curtime_ms(&now);
+        if (ret) {
+            st->done = TRUE;
+            return 0;
+        }
+        st->endtime = now + wait;
+    }
+    return 0;
+}
+
+static void
+sendto_free(krb5_context context, struct sendto_state *st)
+{
+    struct conn_state *state, *next;
+
+    if (st == NULL)
+        return;
+
+    for (state = st->conns; state != NULL; state = next) {
+        next = state->next;
+        if (state->fd != INVALID_SOCKET) {
+            if (socktype_for_transport(state->addr.transport) == SOCK_STREAM)
+                TRACE_SENDTO_KDC_TCP_DISCONNECT(context, &state->addr);
+            closesocket(state->fd);
+            free_http_tls_data(context, state);
+        }
+        if (state->in.buf != st->udpbuf)
+            free(state->in.buf);
+        if (st->callback_info) {
+            st->callback_info->pfn_cleanup(st->callback_info->data,
+                                           &state->callback_buffer);
+        }
+        free(state);
+    }
+
+    if (!st->udpbuf_in_reply)
+        free(st->udpbuf);
+    free(st->selstate);
+    free(st);
+}
+
+/* Create an exchange of message with the servers in servers and make the
+ * first transmission.  The parameters are as for k5_sendto(). */
+static krb5_error_code
+sendto_begin(krb5_context context, const krb5_data *message,
+             const krb5_data *realm, const struct serverlist *servers,
+             k5_transport_strategy strategy,
+             struct sendto_callback_info *callback_info,
+             int (*msg_handler)(krb5_context, const krb5_data *, void *),
+             void *msg_handler_data, struct sendto_state **st_out)
+{
+    krb5_error_code ret;
+    struct sendto_state *st;
+
+    *st_out = NULL;
+
+    st = k5alloc(sizeof(*st), &ret);
+    if (st == NULL)
+        return ret;
+    st->message = message;
+    st->realm = realm;
+    st->servers = servers;
+    st->strategy = strategy;
+    st->callback_info = callback_info;
+    st->msg_handler = msg_handler;
+    st->msg_handler_data = msg_handler_data;
+    st->phase = FIRST_PASS;
+
+    st->selstate = malloc(2 * sizeof(*st->selstate));
+    if (st->selstate == NULL) {
+        free(st);
+        return ENOMEM;
+    }
+    st->seltemp = &st->selstate[1];
+    cm_init_selstate(st->selstate);
+
+    ret = sendto_advance(context, st);
+    if (ret) {
+        sendto_free(context, st);
+        return ret;
+    }
+
+    *st_out = st;
+    return 0;
+}
+
+/* Poll the sockets of st (until the end of the current wait if block is true,
+ * or without waiting otherwise), process their events, and advance the
+ * schedule. */
+static krb5_error_code
+sendto_step(krb5_context context, struct sendto_state *st,
+            krb5_boolean block)
+{
+    krb5_error_code ret;
+    int selret = 0;
+    time_ms endtime;
+
+    if (st->done)
+        return 0;
+
+    endtime = block ? get_endtime(st->endtime, st->conns) : 0;
+    ret = cm_select_or_poll(st->selstate, endtime, st->seltemp, &selret);
+    if (ret == EINTR)
+        return 0;
+    if (ret) {
+        st->done = TRUE;
+        return 0;
+    }
+
+    if (selret > 0) {
+        service_events(context, st);
+        if (st->done)
+            return 0;
+    }
+    return sendto_advance(context, st);
+}
+
+/* Get the result of a finished exchange.  The output parameters are as for
+ * k5_sendto(). */
+static krb5_error_code
+sendto_result(krb5_context context, struct sendto_state *st,
+              krb5_data *reply, struct sockaddr *remoteaddr,
+              socklen_t *remoteaddrlen, int *server_used)
+{
+    struct conn_state *winner = st->winner;
+
+    *reply = empty_data();
+
+    if (st->selstate->nfds == 0 || winner == NULL)
+        return KRB5_KDC_UNREACH;
+
+    *reply = make_data(winner->in.buf, winner->in.pos);
+    winner->in.buf = NULL;
+    if (reply->data == st->udpbuf)
+        st->udpbuf_in_reply = TRUE;
+    if (server_used != NULL)
+        *server_used = winner->server_index;
+    if (remoteaddr != NULL && remoteaddrlen != 0 && *remoteaddrlen > 0)
+        (void)getpeername(winner->fd, remoteaddr, remoteaddrlen);
+    TRACE_SENDTO_KDC_RESPONSE(context, reply->length, &winner->addr);
+
+    /* Keep the winning stream connection open for the next message. */
+    if (st->callback_info == NULL && (winner->addr.transport == TCP ||
+                                      (winner->addr.transport == HTTPS &&
+                                       winner->http.keepalive)))
+        save_idle_conn(context, winner, st->realm);
+    return 0;
+}
+
 krb5_error_code
 k5_sendto(krb5_context context, const krb5_data *message,
           const krb5_data *realm, const struct serverlist *servers,
@@ -1485,123 +2170,233 @@ k5_sendto(krb5_context context, const krb5_data *message,
           int (*msg_handler)(krb5_context, const krb5_data *, void *),
           void *msg_handler_data)
 {
-    int pass;
-    time_ms delay;
     krb5_error_code retval;
-    struct conn_state *conns = NULL, *state, **tailptr, *next, *winner;
-    size_t s;
-    struct select_state *sel_state = NULL, *seltemp;
-    char *udpbuf = NULL;
-    krb5_boolean done = FALSE;
+    struct sendto_state *st;
 
     *reply = empty_data();
 
-    /* One for use here, listing all our fds in use, and one for
-     * temporary use in service_fds, for the fds of interest.  */
-    sel_state = malloc(2 * sizeof(*sel_state));
-    if (sel_state == NULL) {
-        retval = ENOMEM;
-        goto cleanup;
-    }
-    seltemp = &sel_state[1];
-    cm_init_selstate(sel_state);
+    retval = sendto_begin(context, message, realm, servers, strategy,
+                          callback_info, msg_handler, msg_handler_data, &st);
+    if (retval)
+        return retval;
 
-    /* First pass: resolve server hosts, communicate with resulting addresses
-     * of the preferred transport, and wait 1s for an answer from each. */
-    for (s = 0; s < servers->nservers && !done; s++) {
-        /* Find the current tail pointer. */
-        for (tailptr = &conns; *tailptr != NULL; tailptr = &(*tailptr)->next);
-        retval = resolve_server(context, realm, servers, s, strategy, message,
-                                &udpbuf, &conns);
+    while (!st->done) {
+        retval = sendto_step(context, st, TRUE);
         if (retval)
             goto cleanup;
-        for (state = *tailptr; state != NULL && !done; state = state->next) {
-            /* Contact each new connection, deferring those which use the
-             * non-preferred RFC 4120 transport. */
-            if (state->defer)
-                continue;
-            if (maybe_send(context, state, message, sel_state, realm,
-                           callback_info))
-                continue;
-            done = service_fds(context, sel_state, 1000, conns, seltemp,
-                               realm, msg_handler, msg_handler_data, &winner);
+    }
+
+    retval = sendto_result(context, st, reply, remoteaddr, remoteaddrlen,
+                           server_used);
+
+cleanup:
+    sendto_free(context, st);
+    return retval;
+}
+
+struct _krb5_sendto_kdc_context {
+    krb5_data message;
+    krb5_data realm;
+    krb5_data *hook_message;
+    krb5_data *hook_reply;
+    struct serverlist servers;
+    struct sendto_state *st;
+    krb5_error_code err;
+    krb5_sendto_kdc_fd *fds;
+    size_t fds_alloc;
+    int use_primary;
+};
+
+krb5_error_code KRB5_CALLCONV
+krb5_sendto_kdc_init(krb5_context context, const krb5_data *message,
+                     const krb5_data *realm, krb5_flags options,
+                     krb5_sendto_kdc_context *ctx_out)
+{
+    krb5_error_code ret;
+    krb5_sendto_kdc_context ctx;
+    k5_transport_strategy strategy;
+    int use_primary = (options & KRB5_SENDTO_KDC_USE_PRIMARY) != 0;
+    int no_udp = (options & KRB5_SENDTO_KDC_NO_UDP) != 0;
+    const krb5_data *msg;
+
+    *ctx_out = NULL;
+
+    TRACE_SENDTO_KDC(context, message->length, realm, use_primary, no_udp);
+
+    ctx = k5alloc(sizeof(*ctx), &ret);
+    if (ctx == NULL)
+        return ret;
+    ctx->use_primary = use_primary;
+    ret = krb5int_copy_data_contents(context, message, &ctx->message);
+    if (ret)
+        goto cleanup;
+    ret = krb5int_copy_data_contents(context, realm, &ctx->realm);
+    if (ret)
+        goto cleanup;
+
+    ret = choose_strategy(context, message, no_udp, &strategy);
+    if (ret)
+        goto cleanup;
+
+    ret = k5_locate_kdc(context, realm, &ctx->servers, use_primary, no_udp);
+    if (ret)
+        goto cleanup;
+
+    msg = &ctx->message;
+    if (context->kdc_send_hook != NULL) {
+        ret = context->kdc_send_hook(context, context->kdc_send_hook_data,
+                                     &ctx->realm, &ctx->message,
+                                     &ctx->hook_message, &ctx->hook_reply);
+        if (ret)
+            goto cleanup;
+
+        /* If the hook synthesized a reply, return it from the first step. */
+        if (ctx->hook_reply != NULL) {
+            *ctx_out = ctx;
+            return 0;
         }
+
+        if (ctx->hook_message != NULL)
+            msg = ctx->hook_message;
     }
 
-    /* Complete the first pass by contacting servers of the non-preferred RFC
-     * 4120 transport (if given), waiting 1s for an answer from each. */
-    for (state = conns; state != NULL && !done; state = state->next) {
-        if (!state->defer)
-            continue;
-        if (maybe_send(context, state, message, sel_state, realm,
-                       callback_info))
+    ret = sendto_begin(context, msg, &ctx->realm, &ctx->servers, strategy,
+                       NULL, check_for_svc_unavailable, &ctx->err, &ctx->st);
+    if (ret)
+        goto cleanup;
+
+    *ctx_out = ctx;
+    ctx = NULL;
+
+cleanup:
+    krb5_sendto_kdc_free(context, ctx);
+    return ret;
+}
+
+krb5_error_code KRB5_CALLCONV
+krb5_sendto_kdc_get_fds(krb5_context context, krb5_sendto_kdc_context ctx,
+                        const krb5_sendto_kdc_fd **fds_out, size_t *nfds_out,
+                        int *timeout_out)
+{
+    struct sendto_state *st = ctx->st;
+    struct conn_state *state;
+    krb5_sendto_kdc_fd *fds;
+    krb5_error_code ret;
+    time_ms now, endtime;
+    size_t n, count;
+    unsigned int interest;
+
+    *fds_out = NULL;
+    *nfds_out = 0;
+    *timeout_out = 0;
+
+    /* If the exchange is over, the next step will return the result. */
+    if (st == NULL || st->done)
+        return 0;
+
+    count = 0;
+    for (state = st->conns; state != NULL; state = state->next)
+        count++;
+    if (count > ctx->fds_alloc) {
+        fds = realloc(ctx->fds, count * sizeof(*fds));
+        if (fds == NULL)
+            return ENOMEM;
+        ctx->fds = fds;
+        ctx->fds_alloc = count;
+    }
+
+    n = 0;
+    for (state = st->conns; state != NULL; state = state->next) {
+        if (state->fd == INVALID_SOCKET)
             continue;
-        done = service_fds(context, sel_state, 1000, conns, seltemp,
-                           realm, msg_handler, msg_handler_data, &winner);
+        interest = cm_get_interest(st->selstate, state->fd);
+        ctx->fds[n].fd = state->fd;
+        ctx->fds[n].events = ((interest & SSF_READ) ?
+                              KRB5_SENDTO_KDC_FD_READ : 0) |
+            ((interest & SSF_WRITE) ? KRB5_SENDTO_KDC_FD_WRITE : 0);
+        n++;
     }
 
-    /* Wait for two seconds at the end of the first pass. */
-    if (!done) {
-        done = service_fds(context, sel_state, 2000, conns, seltemp,
-                           realm, msg_handler, msg_handler_data, &winner);
+    ret = get_curtime_ms(&now);
+    if (ret)
+        return ret;
+    endtime = get_endtime(st->endtime, st->conns);
+    if (endtime > now)
+        *timeout_out = (endtime - now > INT_MAX) ? INT_MAX : endtime - now;
+
+    *fds_out = ctx->fds;
+    *nfds_out = n;
+    return 0;
+}
+
+krb5_error_code KRB5_CALLCONV
+krb5_sendto_kdc_step(krb5_context context, krb5_sendto_kdc_context ctx,
+                     krb5_data *reply_out, unsigned int *flags_out)
+{
+    krb5_error_code ret;
+    krb5_data reply = empty_data();
+    const krb5_data *msg;
+    krb5_boolean overridden;
+    int server_used, is_primary;
+
+    *reply_out = empty_data();
+    *flags_out = 0;
+
+    if (ctx->hook_reply != NULL) {
+        *reply_out = *ctx->hook_reply;
+        free(ctx->hook_reply);
+        ctx->hook_reply = NULL;
+        if (ctx->use_primary)
+            *flags_out = KRB5_SENDTO_KDC_STEP_FLAG_PRIMARY;
+        return 0;
     }
+    if (ctx->st == NULL)
+        return EINVAL;
 
-    /* Make remaining passes over all of the connections. */
-    delay = 4000;
-    for (pass = 1; pass < MAX_PASS && !done; pass++) {
-        for (state = conns; state != NULL && !done; state = state->next) {
-            if (maybe_send(context, state, message, sel_state, realm,
-                           callback_info))
-                continue;
-            done = service_fds(context, sel_state, 1000, conns, seltemp,
-                               realm, msg_handler, msg_handler_data, &winner);
-            if (sel_state->nfds == 0)
-                break;
-        }
-        /* Wait for the delay backoff at the end of this pass. */
-        if (!done) {
-            done = service_fds(context, sel_state, delay, conns, seltemp,
-                               realm, msg_handler, msg_handler_data, &winner);
-        }
-        if (sel_state->nfds == 0)
-            break;
-        delay *= 2;
+    ret = sendto_step(context, ctx->st, FALSE);
+    if (!ret && !ctx->st->done) {
+        *flags_out = KRB5_SENDTO_KDC_STEP_FLAG_CONTINUE;
+        return 0;
     }
 
-    if (sel_state->nfds == 0 || !done || winner == NULL) {
-        retval = KRB5_KDC_UNREACH;
-        goto cleanup;
+    if (!ret) {
+        ret = sendto_result(context, ctx->st, &reply, NULL, NULL,
+                            &server_used);
     }
-    /* Success!  */
-    *reply = make_data(winner->in.buf, winner->in.pos);
-    retval = 0;
-    winner->in.buf = NULL;
-    if (server_used != NULL)
-        *server_used = winner->server_index;
-    if (remoteaddr != NULL && remoteaddrlen != 0 && *remoteaddrlen > 0)
-        (void)getpeername(winner->fd, remoteaddr, remoteaddrlen);
-    TRACE_SENDTO_KDC_RESPONSE(context, reply->length, &winner->addr);
+    msg = (ctx->hook_message != NULL) ? ctx->hook_message : &ctx->message;
+    ret = finish_sendto_kdc(context, ret, ctx->err, &ctx->realm, msg, &reply,
+                            reply_out, &overridden);
+    krb5_free_data_contents(context, &reply);
 
-cleanup:
-    for (state = conns; state != NULL; state = next) {
-        next = state->next;
-        if (state->fd != INVALID_SOCKET) {
-            if (socktype_for_transport(state->addr.transport) == SOCK_STREAM)
-                TRACE_SENDTO_KDC_TCP_DISCONNECT(context, &state->addr);
-            closesocket(state->fd);
-            free_http_tls_data(context, state);
-        }
-        if (state->in.buf != udpbuf)
-            free(state->in.buf);
-        if (callback_info) {
-            callback_info->pfn_cleanup(callback_info->data,
-                                       &state->callback_buffer);
+    /* As in krb5_sendto_kdc(), a reply supplied by the post-receive hook in
+     * place of an error is treated as coming from a primary KDC. */
+    if (!ret) {
+        if (ctx->use_primary || overridden) {
+            is_primary = 1;
+        } else {
+            is_primary = k5_kdc_is_primary(context, &ctx->realm,
+                                           &ctx->servers.servers[server_used]);
+            TRACE_SENDTO_KDC_PRIMARY(context, is_primary);
         }
-        free(state);
+        if (is_primary)
+            *flags_out = KRB5_SENDTO_KDC_STEP_FLAG_PRIMARY;
     }
+    sendto_free(context, ctx->st);
+    ctx->st = NULL;
+    return ret;
+}
 
-    if (reply->data != udpbuf)
-        free(udpbuf);
-    free(sel_state);
-    return retval;
+void KRB5_CALLCONV
+krb5_sendto_kdc_free(krb5_context context, krb5_sendto_kdc_context ctx)
+{
+    if (ctx == NULL)
+        return;
+    sendto_free(context, ctx->st);
+    krb5_free_data_contents(context, &ctx->message);
+    krb5_free_data_contents(context, &ctx->realm);
+    krb5_free_data(context, ctx->hook_message);
+    krb5_free_data(context, ctx->hook_reply);
+    k5_free_serverlist(&ctx->servers);
+    free(ctx->fds);
+    free(ctx);
 }
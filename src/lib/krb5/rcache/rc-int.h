@@ -47,11 +47,22 @@ struct krb5_rc_st {
 
 extern const krb5_rc_ops k5_rc_dfl_ops;
 extern const krb5_rc_ops k5_rc_file2_ops;
+extern const krb5_rc_ops k5_rc_mem_ops;
 extern const krb5_rc_ops k5_rc_none_ops;
 
+/* The number of bytes of each tag recorded in the file2 format. */
+#define RCFILE2_TAG_LEN 12
+
+/* Fill in the file2 form of tag_data, truncated or zero-padded. */
+void k5_rcfile2_make_tag(const krb5_data *tag_data,
+                         uint8_t tag_out[RCFILE2_TAG_LEN]);
+
 /* Check and store a replay record in an open (but not locked) file descriptor,
  * using the file2 format.  fd is assumed to be at offset 0. */
 krb5_error_code k5_rcfile2_store(krb5_context context, int fd,
                                  const krb5_data *tag_data);
 
+int k5_rc_mem_initialize(void);
+void k5_rc_mem_finalize(void);
+
 #endif /* RC_INT_H */
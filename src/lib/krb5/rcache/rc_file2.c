@@ -38,8 +38,20 @@
 #include <sys/stat.h>
 #endif
 
+/*
+ * Where open file description locks are available, stores lock only a stripe
+ * byte of the hash seed and the record they write, so that processes storing
+ * different tags in the same file do not wait for each other.  These locks
+ * contend with the whole-file locks taken by krb5_lock_file(), which are used
+ * otherwise.
+ */
+#ifdef F_OFD_SETLKW
+#define RANGE_LOCKS
+#define NSTRIPES K5_HASH_SEED_LEN
+#endif
+
 #define MAX_SIZE INT32_MAX
-#define TAG_LEN 12
+#define TAG_LEN RCFILE2_TAG_LEN
 #define RECORD_LEN (TAG_LEN + 4)
 #define FIRST_TABLE_RECORDS 1023
 
@@ -131,36 +143,21 @@ expired(uint32_t timestamp, uint32_t now, uint32_t skew)
     return ts_after(now, ts_incr(timestamp, skew));
 }
 
-/* Check and store a record into an open and locked file.  fd is assumed to be
- * at offset 0. */
+/* Search the tables of fd for tag, reading only the records it could occupy.
+ * Return KRB5KRB_AP_ERR_REPEAT if it is found, or set *avail_out to the offset
+ * of the first record available for writing it. */
 static krb5_error_code
-store(krb5_context context, int fd, const uint8_t tag[TAG_LEN], uint32_t now,
-      uint32_t skew)
+find_tag(int fd, const uint8_t seed_in[K5_HASH_SEED_LEN],
+         const uint8_t tag[TAG_LEN], uint32_t now, uint32_t skew,
+         off_t *avail_out)
 {
     krb5_error_code ret;
-    krb5_data d;
     off_t table_offset = -1, nrecords = 0, avail_offset = -1, record_offset;
-    ssize_t st;
     int ind, nread;
     uint8_t seed[K5_HASH_SEED_LEN], r1tag[TAG_LEN], r2tag[TAG_LEN];
     uint32_t r1stamp, r2stamp;
 
-    /* Read or generate the hash seed. */
-    st = read(fd, seed, sizeof(seed));
-    if (st < 0)
-        return errno;
-    if ((size_t)st < sizeof(seed)) {
-        d = make_data(seed, sizeof(seed));
-        ret = krb5_c_random_make_octets(context, &d);
-        if (ret)
-            return ret;
-        st = write(fd, seed, sizeof(seed));
-        if (st < 0)
-            return errno;
-        if ((size_t)st != sizeof(seed))
-            return EIO;
-    }
-
+    memcpy(seed, seed_in, sizeof(seed));
     for (;;) {
         ret = next_table(&table_offset, &nrecords);
         if (ret)
@@ -169,8 +166,8 @@ store(krb5_context context, int fd, const uint8_t tag[TAG_LEN], uint32_t now,
         ind = k5_siphash24(tag, TAG_LEN, seed) % nrecords;
         record_offset = table_offset + ind * RECORD_LEN;
 
-        ret = read_records(fd, record_offset, r1tag, &r1stamp, r2tag, &r2stamp,
-                           &nread);
+        ret = read_records(fd, record_offset, r1tag, &r1stamp, r2tag,
+                           &r2stamp, &nread);
         if (ret)
             return ret;
 
@@ -189,33 +186,168 @@ store(krb5_context context, int fd, const uint8_t tag[TAG_LEN], uint32_t now,
 
         /* Stop searching if we encountered an empty record or one beyond the
          * end of the file, as tag would have been written there previously. */
-        if (nread < 2 || !r1stamp || !r2stamp)
-            return write_record(fd, avail_offset, tag, now);
+        if (nread < 2 || !r1stamp || !r2stamp) {
+            *avail_out = avail_offset;
+            return 0;
+        }
 
         /* Use a different hash seed for the next table we search. */
         seed[0]++;
     }
 }
 
+/* Check and store a record into an open and locked file.  fd is assumed to be
+ * at offset 0. */
+static krb5_error_code
+store(krb5_context context, int fd, const uint8_t tag[TAG_LEN], uint32_t now,
+      uint32_t skew)
+{
+    krb5_error_code ret;
+    krb5_data d;
+    off_t avail_offset;
+    ssize_t st;
+    uint8_t seed[K5_HASH_SEED_LEN];
+
+    /* Read or generate the hash seed. */
+    st = read(fd, seed, sizeof(seed));
+    if (st < 0)
+        return errno;
+    if ((size_t)st < sizeof(seed)) {
+        d = make_data(seed, sizeof(seed));
+        ret = krb5_c_random_make_octets(context, &d);
+        if (ret)
+            return ret;
+        st = write(fd, seed, sizeof(seed));
+        if (st < 0)
+            return errno;
+        if ((size_t)st != sizeof(seed))
+            return EIO;
+    }
+
+    ret = find_tag(fd, seed, tag, now, skew, &avail_offset);
+    if (ret)
+        return ret;
+    return write_record(fd, avail_offset, tag, now);
+}
+
+#ifdef RANGE_LOCKS
+
+/* Set *avail_out to true if the record at offset in fd, which must be locked,
+ * is empty, expired, or beyond the end of the file. */
+static krb5_error_code
+record_available(int fd, off_t offset, uint32_t now, uint32_t skew,
+                 krb5_boolean *avail_out)
+{
+    uint8_t record[RECORD_LEN];
+    uint32_t stamp;
+    ssize_t st;
+
+    *avail_out = FALSE;
+    st = pread(fd, record, RECORD_LEN, offset);
+    if (st < 0)
+        return errno;
+    if (st < RECORD_LEN) {
+        *avail_out = TRUE;
+        return 0;
+    }
+    stamp = load_32_be(record + TAG_LEN);
+    *avail_out = (!stamp || expired(stamp, now, skew));
+    return 0;
+}
+
+/*
+ * Check and store a record without locking the whole file.  Stores of tags in
+ * the same stripe are serialized by a lock on one byte of the hash seed, so
+ * that a tag cannot be stored twice.  Only the record to be written is locked
+ * while the tables are searched; if another tag was written there after the
+ * search, search again.
+ *
+ * Return false if the whole file must be locked instead, because the file has
+ * no hash seed yet or open file description locks are not supported by the
+ * kernel.  Otherwise set *ret_out to the result of the store and return true.
+ */
+static krb5_boolean
+store_ranges(int fd, const uint8_t tag[TAG_LEN], uint32_t now, uint32_t skew,
+             krb5_error_code *ret_out)
+{
+    krb5_error_code ret;
+    off_t stripe = load_32_be(tag) % NSTRIPES, avail_offset;
+    krb5_boolean avail;
+    uint8_t seed[K5_HASH_SEED_LEN];
+    ssize_t st;
+
+    *ret_out = 0;
+    ret = k5_lock_file_range(fd, stripe, 1, KRB5_LOCKMODE_EXCLUSIVE);
+    if (ret == EINVAL)
+        return FALSE;
+    if (ret) {
+        *ret_out = ret;
+        return TRUE;
+    }
+
+    /* The seed is only written under a whole-file lock, which contends with
+     * the stripe lock, so we can't see a partial seed. */
+    st = pread(fd, seed, sizeof(seed), 0);
+    if (st >= 0 && (size_t)st < sizeof(seed)) {
+        (void)k5_lock_file_range(fd, stripe, 1, KRB5_LOCKMODE_UNLOCK);
+        return FALSE;
+    }
+    ret = (st < 0) ? errno : 0;
+
+    while (!ret) {
+        ret = find_tag(fd, seed, tag, now, skew, &avail_offset);
+        if (ret)
+            break;
+
+        ret = k5_lock_file_range(fd, avail_offset, RECORD_LEN,
+                                 KRB5_LOCKMODE_EXCLUSIVE);
+        if (ret)
+            break;
+        ret = record_available(fd, avail_offset, now, skew, &avail);
+        if (!ret && avail)
+            ret = write_record(fd, avail_offset, tag, now);
+        (void)k5_lock_file_range(fd, avail_offset, RECORD_LEN,
+                                 KRB5_LOCKMODE_UNLOCK);
+        if (avail)
+            break;
+    }
+
+    (void)k5_lock_file_range(fd, stripe, 1, KRB5_LOCKMODE_UNLOCK);
+    *ret_out = ret;
+    return TRUE;
+}
+
+#endif /* RANGE_LOCKS */
+
+void
+k5_rcfile2_make_tag(const krb5_data *tag_data, uint8_t tag_out[TAG_LEN])
+{
+    if (tag_data->length >= TAG_LEN) {
+        memcpy(tag_out, tag_data->data, TAG_LEN);
+    } else {
+        memcpy(tag_out, tag_data->data, tag_data->length);
+        memset(tag_out + tag_data->length, 0, TAG_LEN - tag_data->length);
+    }
+}
+
 krb5_error_code
 k5_rcfile2_store(krb5_context context, int fd, const krb5_data *tag_data)
 {
     krb5_error_code ret;
     krb5_timestamp now;
-    uint8_t tagbuf[TAG_LEN], *tag;
+    uint8_t tag[TAG_LEN];
 
     ret = krb5_timeofday(context, &now);
     if (ret)
         return ret;
 
     /* Extract a tag from the authenticator checksum. */
-    if (tag_data->length >= TAG_LEN) {
-        tag = (uint8_t *)tag_data->data;
-    } else {
-        memcpy(tagbuf, tag_data->data, tag_data->length);
-        memset(tagbuf + tag_data->length, 0, TAG_LEN - tag_data->length);
-        tag = tagbuf;
-    }
+    k5_rcfile2_make_tag(tag_data, tag);
+
+#ifdef RANGE_LOCKS
+    if (store_ranges(fd, tag, now, context->clockskew, &ret))
+        return ret;
+#endif
 
     ret = krb5_lock_file(context, fd, KRB5_LOCKMODE_EXCLUSIVE);
     if (ret)
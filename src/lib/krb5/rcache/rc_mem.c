@@ -0,0 +1,236 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/krb5/rcache/rc_mem.c - in-process sharded replay cache */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The mem rcache type checks replays against a table held in process memory,
+ * so that threads accepting authenticators concurrently do not serialize on a
+ * single lock.  All rcache handles with the same residual share one table.
+ * The table is split into shards by tag, each with its own lock and memrcache.
+ *
+ * Records are never written to a file, so replays are detected only within
+ * the process, and are forgotten when it exits.  A table is kept after its
+ * last handle is closed so that later handles see its records, but only the
+ * MAX_IDLE_TABLES most recently used tables without handles are kept.
+ */
+
+#include "k5-int.h"
+#include "k5-thread.h"
+#include "rc-int.h"
+#include "memrcache.h"
+
+#define NSHARDS 32
+#define MAX_IDLE_TABLES 8
+
+struct shard {
+    k5_mutex_t lock;
+    k5_memrcache mrc;
+};
+
+struct memrc {
+    struct memrc *next;
+    char *name;
+    unsigned int refcount;
+    struct shard shards[NSHARDS];
+};
+
+/* Protects the list of tables and their reference counts. */
+static k5_mutex_t memrc_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct memrc *memrc_list;
+
+static struct shard *
+get_shard(struct memrc *m, const uint8_t *tag)
+{
+    return &m->shards[load_32_n(tag) % NSHARDS];
+}
+
+/* Check and record tag in the table. */
+static krb5_error_code
+check_tag(krb5_context context, struct memrc *m, const uint8_t *tag)
+{
+    krb5_error_code ret;
+    struct shard *sh = get_shard(m, tag);
+    krb5_data d = make_data((uint8_t *)tag, RCFILE2_TAG_LEN);
+
+    k5_mutex_lock(&sh->lock);
+    ret = k5_memrcache_store(context, sh->mrc, &d);
+    k5_mutex_unlock(&sh->lock);
+    return ret;
+}
+
+/* Free m, whose first nlocks shard mutexes have been initialized. */
+static void
+free_memrc(krb5_context context, struct memrc *m, int nlocks)
+{
+    int i;
+
+    if (m == NULL)
+        return;
+    for (i = 0; i < NSHARDS; i++)
+        k5_memrcache_free(context, m->shards[i].mrc);
+    for (i = 0; i < nlocks; i++)
+        k5_mutex_destroy(&m->shards[i].lock);
+    free(m->name);
+    free(m);
+}
+
+static krb5_error_code
+create_memrc(krb5_context context, const char *residual, struct memrc **out)
+{
+    krb5_error_code ret;
+    struct memrc *m;
+    int i, nlocks = 0;
+
+    *out = NULL;
+    m = k5alloc(sizeof(*m), &ret);
+    if (m == NULL)
+        return ret;
+    m->name = strdup(residual);
+    if (m->name == NULL)
+        goto oom;
+
+    for (i = 0; i < NSHARDS; i++) {
+        ret = k5_mutex_init(&m->shards[i].lock);
+        if (ret)
+            goto error;
+        nlocks++;
+    }
+    for (i = 0; i < NSHARDS; i++) {
+        ret = k5_memrcache_create(context, &m->shards[i].mrc);
+        if (ret)
+            goto error;
+    }
+
+    *out = m;
+    return 0;
+
+oom:
+    ret = ENOMEM;
+error:
+    free_memrc(context, m, nlocks);
+    return ret;
+}
+
+static krb5_error_code
+mem_resolve(krb5_context context, const char *residual, void **rcdata_out)
+{
+    krb5_error_code ret = 0;
+    struct memrc *m;
+
+    *rcdata_out = NULL;
+
+    /* Hold the list lock while creating a table, so that concurrent resolves
+     * of the same name don't create two. */
+    k5_mutex_lock(&memrc_lock);
+    for (m = memrc_list; m != NULL; m = m->next) {
+        if (strcmp(m->name, residual) == 0)
+            break;
+    }
+    if (m == NULL) {
+        ret = create_memrc(context, residual, &m);
+        if (!ret) {
+            m->next = memrc_list;
+            memrc_list = m;
+        }
+    }
+    if (!ret) {
+        m->refcount++;
+        *rcdata_out = m;
+    }
+    k5_mutex_unlock(&memrc_lock);
+    return ret;
+}
+
+static void
+mem_close(krb5_context context, void *rcdata)
+{
+    struct memrc *m = rcdata, *t, **pp;
+    int nidle = 0;
+
+    k5_mutex_lock(&memrc_lock);
+    if (--m->refcount == 0) {
+        /* Keep the table for later handles, at the front of the list so that
+         * the least recently used idle tables are discarded first. */
+        for (pp = &memrc_list; *pp != m; pp = &(*pp)->next);
+        *pp = m->next;
+        m->next = memrc_list;
+        memrc_list = m;
+
+        pp = &memrc_list;
+        while (*pp != NULL) {
+            t = *pp;
+            if (t->refcount == 0 && ++nidle > MAX_IDLE_TABLES) {
+                *pp = t->next;
+                free_memrc(context, t, NSHARDS);
+            } else {
+                pp = &t->next;
+            }
+        }
+    }
+    k5_mutex_unlock(&memrc_lock);
+}
+
+static krb5_error_code
+mem_store(krb5_context context, void *rcdata, const krb5_data *tag_data)
+{
+    struct memrc *m = rcdata;
+    uint8_t tag[RCFILE2_TAG_LEN];
+
+    k5_rcfile2_make_tag(tag_data, tag);
+    return check_tag(context, m, tag);
+}
+
+const krb5_rc_ops k5_rc_mem_ops =
+{
+    "mem",
+    mem_resolve,
+    mem_close,
+    mem_store
+};
+
+int
+k5_rc_mem_initialize(void)
+{
+    return k5_mutex_finish_init(&memrc_lock);
+}
+
+void
+k5_rc_mem_finalize(void)
+{
+    struct memrc *m, *next;
+
+    for (m = memrc_list; m != NULL; m = next) {
+        next = m->next;
+        free_memrc(NULL, m, NSHARDS);
+    }
+    memrc_list = NULL;
+    k5_mutex_destroy(&memrc_lock);
+}
@@ -46,6 +46,13 @@
  *     spawn <nprocesses> subprocesses, each of which tries to store the same
  *     tag and reports success or failure.  The master process verifies that
  *     exactly one subprocess succeeds.  Repeat <reps> times.
+ *
+ *   t_rcfile2 <filename> stripe <nprocesses> <nreps>
+ *     create the file, then spawn <nprocesses> subprocesses which all store
+ *     tags in the same lock stripe.  Each subprocess stores <nreps> unique
+ *     tags, and also tries to store <nreps> tags shared by all of the
+ *     subprocesses.  The master process verifies that each shared tag was
+ *     stored exactly once, and that every tag then appears as a replay.
  */
 
 #include "rc_file2.c"
@@ -174,6 +181,87 @@ race_test(const char *filename, int nchildren, int reps)
     }
 }
 
+/* Make a tag in the lock stripe of the tag with all zero bytes.  The stripe
+ * is selected by the first four bytes of the tag, modulo the hash seed
+ * length. */
+static void
+make_stripe_tag(uint32_t id, uint32_t n, uint8_t tag[TAG_LEN])
+{
+    memset(tag, 0, TAG_LEN);
+    store_32_be(n * K5_HASH_SEED_LEN, tag);
+    store_32_be(id, tag + 4);
+}
+
+/* Store this subprocess's unique tags and try to store the shared tags
+ * (id 0), interleaved.  Write a byte to fd for each shared tag stored. */
+static void
+store_stripe(const char *filename, int id, int reps, int fd)
+{
+    krb5_error_code ret;
+    uint8_t tag[TAG_LEN];
+    int i;
+
+    for (i = 0; i < reps; i++) {
+        make_stripe_tag(id + 1, i, tag);
+        if (test_store(filename, tag, 1000, 100) != 0)
+            _exit(1);
+        make_stripe_tag(0, i, tag);
+        ret = test_store(filename, tag, 1000, 100);
+        if (ret == 0 && write(fd, "", 1) != 1)
+            _exit(1);
+        else if (ret != 0 && ret != KRB5KRB_AP_ERR_REPEAT)
+            _exit(1);
+    }
+}
+
+/* Spawn multiple child processes contending for one lock stripe of a file
+ * which already has a hash seed, so that no store falls back to locking the
+ * whole file. */
+static void
+stripe_test(const char *filename, int nchildren, int reps)
+{
+    krb5_error_code ret;
+    uint8_t tag[TAG_LEN];
+    int i, j, status, fds[2], nstored = 0;
+    char buf[256];
+    ssize_t st;
+    pid_t pid;
+
+    make_stripe_tag(UINT32_MAX, 0, tag);
+    ret = test_store(filename, tag, 1000, 100);
+    assert(ret == 0);
+
+    st = pipe(fds);
+    assert(st == 0);
+    for (i = 0; i < nchildren; i++) {
+        pid = fork();
+        assert(pid != -1);
+        if (pid == 0) {
+            close(fds[0]);
+            store_stripe(filename, i, reps, fds[1]);
+            _exit(0);
+        }
+    }
+    close(fds[1]);
+    while ((st = read(fds[0], buf, sizeof(buf))) > 0)
+        nstored += st;
+    assert(st == 0);
+    close(fds[0]);
+    for (i = 0; i < nchildren; i++) {
+        pid = wait(&status);
+        assert(pid != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    assert(nstored == reps);
+
+    for (i = 0; i <= nchildren; i++) {
+        for (j = 0; j < reps; j++) {
+            make_stripe_tag(i, j, tag);
+            ret = test_store(filename, tag, 1000, 100);
+            assert(ret == KRB5KRB_AP_ERR_REPEAT);
+        }
+    }
+}
+
 int
 main(int argc, char **argv)
 {
@@ -200,6 +288,9 @@ main(int argc, char **argv)
     } else if (strcmp(cmd, "race") == 0) {
         assert(argv[0] != NULL && argv[1] != NULL);
         race_test(filename, atoi(argv[0]), atoi(argv[1]));
+    } else if (strcmp(cmd, "stripe") == 0) {
+        assert(argv[0] != NULL && argv[1] != NULL);
+        stripe_test(filename, atoi(argv[0]), atoi(argv[1]));
     } else {
         abort();
     }
@@ -0,0 +1,116 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/krb5/rcache/t_rcmem.c - mem replay cache tests */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "k5-int.h"
+#include "rc-int.h"
+
+static krb5_context ctx;
+
+/* Store tag number i in rc, and check that the result is expected. */
+static void
+store_tag(krb5_rcache rc, int i, krb5_error_code expected)
+{
+    krb5_error_code ret;
+    uint8_t tag[RCFILE2_TAG_LEN] = { 0 };
+    krb5_data tag_data = make_data(tag, sizeof(tag));
+
+    store_32_be(i, tag);
+    store_32_be(i * 7, tag + 4);
+    ret = rc->ops->store(ctx, rc->data, &tag_data);
+    if (ret != expected) {
+        fprintf(stderr, "store %s %d: got %d, expected %d\n", rc->name, i,
+                (int)ret, (int)expected);
+        exit(1);
+    }
+}
+
+static void
+store_tags(const char *name, int start, int count, krb5_error_code expected)
+{
+    krb5_error_code ret;
+    krb5_rcache rc;
+    int i;
+
+    ret = k5_rc_resolve(ctx, name, &rc);
+    assert(ret == 0);
+    for (i = start; i < start + count; i++)
+        store_tag(rc, i, expected);
+    k5_rc_close(ctx, rc);
+}
+
+int
+main()
+{
+    krb5_error_code ret;
+    krb5_rcache rc1, rc2;
+    char name[32];
+    int i;
+
+    ret = krb5_init_context(&ctx);
+    assert(ret == 0);
+
+    /* Tags stored through one handle are replays through another handle with
+     * the same name. */
+    ret = k5_rc_resolve(ctx, "mem:", &rc1);
+    assert(ret == 0);
+    ret = k5_rc_resolve(ctx, "mem:", &rc2);
+    assert(ret == 0);
+    for (i = 0; i < 1000; i++)
+        store_tag(rc1, i, 0);
+    for (i = 0; i < 1000; i++)
+        store_tag(rc2, i, KRB5KRB_AP_ERR_REPEAT);
+    k5_rc_close(ctx, rc1);
+    k5_rc_close(ctx, rc2);
+
+    /* The table outlives its handles. */
+    store_tags("mem:", 0, 1000, KRB5KRB_AP_ERR_REPEAT);
+
+    /* Tables with different names are separate. */
+    store_tags("mem:other", 0, 1000, 0);
+
+    /* Only the eight most recently used tables without handles are kept.  A
+     * table with an open handle is never discarded. */
+    ret = k5_rc_resolve(ctx, "mem:open", &rc1);
+    assert(ret == 0);
+    store_tag(rc1, 0, 0);
+    for (i = 0; i < 8; i++) {
+        snprintf(name, sizeof(name), "mem:%d", i);
+        store_tags(name, 0, 1, 0);
+    }
+    store_tags("mem:", 0, 1, 0);
+    store_tags("mem:7", 0, 1, KRB5KRB_AP_ERR_REPEAT);
+    store_tag(rc1, 0, KRB5KRB_AP_ERR_REPEAT);
+    k5_rc_close(ctx, rc1);
+
+    krb5_free_context(ctx);
+    return 0;
+}
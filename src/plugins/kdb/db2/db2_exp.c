@@ -117,6 +117,13 @@ WRAP_K (krb5_db2_get_principal,
          unsigned int f,
          krb5_db_entry **d),
         (ctx, p, f, d));
+WRAP_K (krb5_db2_get_principals,
+        (krb5_context ctx,
+         size_t n,
+         krb5_const_principal *p,
+         const unsigned int *f,
+         krb5_db_entry **d),
+        (ctx, n, p, f, d));
 WRAP_K (krb5_db2_put_principal,
         (krb5_context ctx,
          krb5_db_entry *d,
@@ -200,7 +207,7 @@ hack_cleanup (void)
 
 kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_db2, kdb_function_table) = {
     KRB5_KDB_DAL_MAJOR_VERSION,             /* major version number */
-    0,                                      /* minor version number 0 */
+    1,                                      /* minor version number 1 */
     /* init_library */                  hack_init,
     /* fini_library */                  hack_cleanup,
     /* init_module */                   wrap_krb5_db2_open,
@@ -226,5 +233,6 @@ kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_db2, kdb_function_table) = {
     /* check_policy_as */               wrap_krb5_db2_check_policy_as,
     0,
     /* audit_as_req */                  wrap_krb5_db2_audit_as_req,
-    0, 0
+    0, 0, 0, 0, 0, 0, 0,
+    /* get_principals */                wrap_krb5_db2_get_principals
 };
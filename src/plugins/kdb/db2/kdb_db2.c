@@ -751,11 +751,12 @@ cleanup:
     return retval;
 }
 
-krb5_error_code
-krb5_db2_get_principal(krb5_context context, krb5_const_principal searchfor,
-                       unsigned int flags, krb5_db_entry **entry)
+/* Fetch and decode the entry for searchfor.  The caller must hold a shared
+ * lock on the database. */
+static krb5_error_code
+fetch_entry(krb5_context context, krb5_db2_context *dbc,
+            krb5_const_principal searchfor, krb5_db_entry **entry)
 {
-    krb5_db2_context *dbc;
     krb5_error_code retval;
     DB     *db;
     DBT     key, contents;
@@ -763,19 +764,11 @@ krb5_db2_get_principal(krb5_context context, krb5_const_principal searchfor,
     int     dbret;
 
     *entry = NULL;
-    if (!inited(context))
-        return KRB5_KDB_DBNOTINITED;
-
-    dbc = context->dal_handle->db_context;
-
-    retval = ctx_lock(context, dbc, KRB5_LOCKMODE_SHARED);
-    if (retval)
-        return retval;
 
     /* XXX deal with wildcard lookups */
     retval = krb5_encode_princ_dbkey(context, &keydata, searchfor);
     if (retval)
-        goto cleanup;
+        return retval;
     key.data = keydata.data;
     key.size = keydata.length;
 
@@ -785,23 +778,80 @@ krb5_db2_get_principal(krb5_context context, krb5_const_principal searchfor,
     krb5_free_data_contents(context, &keydata);
     switch (dbret) {
     case 1:
-        retval = KRB5_KDB_NOENTRY;
-        /* Fall through. */
+        return KRB5_KDB_NOENTRY;
     case -1:
     default:
-        goto cleanup;
+        return retval;
     case 0:
         contdata.data = contents.data;
         contdata.length = contents.size;
-        retval = krb5_decode_princ_entry(context, &contdata, entry);
-        break;
+        return krb5_decode_princ_entry(context, &contdata, entry);
     }
+}
+
+krb5_error_code
+krb5_db2_get_principal(krb5_context context, krb5_const_principal searchfor,
+                       unsigned int flags, krb5_db_entry **entry)
+{
+    krb5_db2_context *dbc;
+    krb5_error_code retval;
+
+    *entry = NULL;
+    if (!inited(context))
+        return KRB5_KDB_DBNOTINITED;
+
+    dbc = context->dal_handle->db_context;
+
+    retval = ctx_lock(context, dbc, KRB5_LOCKMODE_SHARED);
+    if (retval)
+        return retval;
+
+    retval = fetch_entry(context, dbc, searchfor, entry);
 
-cleanup:
     (void) krb5_db2_unlock(context); /* unlock read lock */
     return retval;
 }
 
+/* Look up several principals under one shared lock of the database. */
+krb5_error_code
+krb5_db2_get_principals(krb5_context context, size_t count,
+                        krb5_const_principal *search_for,
+                        const unsigned int *flags, krb5_db_entry **entries)
+{
+    krb5_db2_context *dbc;
+    krb5_error_code retval = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        entries[i] = NULL;
+    if (!inited(context))
+        return KRB5_KDB_DBNOTINITED;
+
+    dbc = context->dal_handle->db_context;
+
+    retval = ctx_lock(context, dbc, KRB5_LOCKMODE_SHARED);
+    if (retval)
+        return retval;
+
+    for (i = 0; i < count; i++) {
+        retval = fetch_entry(context, dbc, search_for[i], &entries[i]);
+        if (retval == KRB5_KDB_NOENTRY)
+            retval = 0;
+        if (retval)
+            break;
+    }
+
+    (void) krb5_db2_unlock(context); /* unlock read lock */
+
+    if (retval) {
+        for (i = 0; i < count; i++) {
+            krb5_db_free_principal(context, entries[i]);
+            entries[i] = NULL;
+        }
+    }
+    return retval;
+}
+
 krb5_error_code
 krb5_db2_put_principal(krb5_context context, krb5_db_entry *entry,
                        char **db_args)
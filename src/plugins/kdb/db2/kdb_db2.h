@@ -55,6 +55,10 @@ krb5_error_code krb5_db2_fini(krb5_context);
 krb5_error_code krb5_db2_get_age(krb5_context, char *, time_t *);
 krb5_error_code krb5_db2_get_principal(krb5_context, krb5_const_principal,
                                        unsigned int, krb5_db_entry **);
+krb5_error_code krb5_db2_get_principals(krb5_context, size_t,
+                                        krb5_const_principal *,
+                                        const unsigned int *,
+                                        krb5_db_entry **);
 krb5_error_code krb5_db2_put_principal(krb5_context, krb5_db_entry *,
                                        char **db_args);
 krb5_error_code krb5_db2_iterate(krb5_context, char *,
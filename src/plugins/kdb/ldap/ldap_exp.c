@@ -47,7 +47,7 @@
 
 kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_ldap, kdb_function_table) = {
     KRB5_KDB_DAL_MAJOR_VERSION,             /* major version number */
-    0,                                      /* minor version number 0 */
+    1,                                      /* minor version number 1 */
     /* init_library */                      krb5_ldap_lib_init,
     /* fini_library */                      krb5_ldap_lib_cleanup,
     /* init_module */                       krb5_ldap_open,
@@ -82,6 +82,12 @@ kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_ldap, kdb_function_table) = {
     /* check_policy_tgs */                  NULL,
     /* audit_as_req */                      krb5_ldap_audit_as_req,
     /* refresh_config */                    NULL,
-    /* check_allowed_to_delegate */         krb5_ldap_check_allowed_to_delegate
+    /* check_allowed_to_delegate */         krb5_ldap_check_allowed_to_delegate,
+    /* free_principal_e_data */             NULL,
+    /* get_s4u_x509_principal */            NULL,
+    /* allowed_to_delegate_from */          NULL,
+    /* get_authdata_info */                 NULL,
+    /* free_authdata_info */                NULL,
+    /* get_principals */                    krb5_ldap_get_principals
 
 };
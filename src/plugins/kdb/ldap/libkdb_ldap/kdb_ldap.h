@@ -160,6 +160,14 @@ extern int set_ldap_error (krb5_context ctx, int st, int op);
 #define HNDL_LOCK(lcontext) k5_mutex_lock(&lcontext->hndl_lock)
 #define HNDL_UNLOCK(lcontext) k5_mutex_unlock(&lcontext->hndl_lock)
 
+/* A server's connections may grow to this many times ldap_conns_per_server
+ * while every handle is busy, but no further. */
+#define LDAP_CONNS_GROWTH_FACTOR 2
+
+#define TRACE_LDAP_POOL_GROW(c, server, nconns, ms)                     \
+    TRACE(c, "LDAP handle pool exhausted, opened connection {int} to "  \
+          "{str} in {long}ms", nconns, server, ms)
+
 /* ldap server info structure */
 
 typedef enum _server_type {PRIMARY, SECONDARY} krb5_ldap_server_type;
@@ -258,7 +258,12 @@ krb5_ldap_db_init(krb5_context context, krb5_ldap_context *ctx)
 
 
 /*
- * get a single handle. Do not lock the mutex
+ * get a single handle. Do not lock the mutex.  Servers which are up are
+ * grown past ldap_conns_per_server when every handle is busy, up to
+ * LDAP_CONNS_GROWTH_FACTOR times that number; krb5_ldap_put_handle_to_pool()
+ * closes the surplus afterwards.  Servers marked down are only retried if no
+ * live server accepts a connection, so a burst does not wait on connection
+ * timeouts.  Fail if every server is at the limit.
  */
 
 krb5_error_code
@@ -266,30 +271,43 @@ krb5_ldap_db_single_init(krb5_ldap_context *ldap_context)
 {
     krb5_error_code             st=0;
     int                         cnt=0;
+    krb5_boolean                tried=FALSE;
     krb5_ldap_server_info       *server_info=NULL;
+    krb5_ui_4                   limit;
 
+    limit = ldap_context->max_server_conns * LDAP_CONNS_GROWTH_FACTOR;
     while (ldap_context->server_info_list[cnt] != NULL) {
         server_info = ldap_context->server_info_list[cnt];
-        if ((server_info->server_status == NOTSET || server_info->server_status == ON)) {
-            if (server_info->num_conns < ldap_context->max_server_conns-1) {
-                st = initialize_server(ldap_context, server_info);
-                if (st == LDAP_SUCCESS)
-                    goto cleanup;
-            }
+        if ((server_info->server_status == NOTSET || server_info->server_status == ON) &&
+            server_info->num_conns < limit) {
+            tried = TRUE;
+            st = initialize_server(ldap_context, server_info);
+            if (st == LDAP_SUCCESS)
+                goto cleanup;
         }
         ++cnt;
     }
 
-    /* If we are here, try to connect to all the servers */
+    /* If we are here, try to connect to the servers marked down. */
 
     cnt = 0;
     while (ldap_context->server_info_list[cnt] != NULL) {
         server_info = ldap_context->server_info_list[cnt];
-        st = initialize_server(ldap_context, server_info);
-        if (st == LDAP_SUCCESS)
-            goto cleanup;
+        if (server_info->server_status == OFF &&
+            server_info->num_conns < limit) {
+            tried = TRUE;
+            st = initialize_server(ldap_context, server_info);
+            if (st == LDAP_SUCCESS)
+                goto cleanup;
+        }
         ++cnt;
     }
+
+    if (!tried) {
+        st = KRB5_KDB_ACCESS_ERROR;
+        k5_setmsg(ldap_context->kcontext, st,
+                  _("All LDAP servers have %u connections open"), limit);
+    }
 cleanup:
     return (st);
 }
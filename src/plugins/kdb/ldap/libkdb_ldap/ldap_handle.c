@@ -110,10 +110,39 @@ krb5_ldap_cleanup_handles(krb5_ldap_server_info *ldap_server_info)
         /* ldap_unbind_s(ldap_server_handle); */
         free (ldap_server_handle);
         ldap_server_handle = NULL;
+        if (ldap_server_info->num_conns > 0)
+            ldap_server_info->num_conns--;
     }
     return 0;
 }
 
+/*
+ * Open a new connection when the pool is exhausted, tracing the time the
+ * caller spent waiting for it.  Do not lock the mutex here.
+ */
+static krb5_ldap_server_handle *
+grow_pool(krb5_ldap_context *ldap_context, krb5_error_code *st)
+{
+    krb5_ldap_server_handle *handle;
+    krb5_int32 sec0 = 0, usec0 = 0, sec1 = 0, usec1 = 0;
+    long long usec;
+
+    (void)krb5_us_timeofday(ldap_context->kcontext, &sec0, &usec0);
+    handle = krb5_retry_get_ldap_handle(ldap_context, st);
+    (void)krb5_us_timeofday(ldap_context->kcontext, &sec1, &usec1);
+
+    usec = ((long long)sec1 - sec0) * 1000000 + usec1 - usec0;
+    if (usec < 0)
+        usec = 0;
+    if (handle != NULL) {
+        TRACE_LDAP_POOL_GROW(ldap_context->kcontext,
+                             handle->server_info->server_name,
+                             (int)handle->server_info->num_conns,
+                             (long)(usec / 1000));
+    }
+    return handle;
+}
+
 /*
  * wrapper function called from outside to get a handle.
  */
@@ -129,7 +158,7 @@ krb5_ldap_request_handle_from_pool(krb5_ldap_context *ldap_context,
 
     HNDL_LOCK(ldap_context);
     if (((*ldap_server_handle)=krb5_get_ldap_handle(ldap_context)) == NULL)
-        (*ldap_server_handle)=krb5_retry_get_ldap_handle(ldap_context, &st);
+        (*ldap_server_handle)=grow_pool(ldap_context, &st);
     HNDL_UNLOCK(ldap_context);
     return st;
 }
@@ -153,22 +182,34 @@ krb5_ldap_request_next_handle_from_pool(krb5_ldap_context *ldap_context,
     krb5_ldap_cleanup_handles((*ldap_server_handle)->server_info);
 
     if (((*ldap_server_handle)=krb5_get_ldap_handle(ldap_context)) == NULL)
-        (*ldap_server_handle)=krb5_retry_get_ldap_handle(ldap_context, &st);
+        (*ldap_server_handle)=grow_pool(ldap_context, &st);
     HNDL_UNLOCK(ldap_context);
     return st;
 }
 
 /*
- * wrapper function to call krb5_put_ldap_handle.
+ * wrapper function to call krb5_put_ldap_handle.  If the pool grew beyond
+ * ldap_conns_per_server during a burst and the server already has an idle
+ * handle, close this one instead of keeping it.
  */
 
 void
 krb5_ldap_put_handle_to_pool(krb5_ldap_context *ldap_context,
                              krb5_ldap_server_handle *ldap_server_handle)
 {
+    krb5_ldap_server_info *info;
+
     if (ldap_server_handle != NULL) {
         HNDL_LOCK(ldap_context);
-        krb5_put_ldap_handle(ldap_server_handle);
+        info = ldap_server_handle->server_info;
+        if (info->num_conns > ldap_context->max_server_conns &&
+            info->ldap_server_handles != NULL) {
+            ldap_unbind_ext_s(ldap_server_handle->ldap_handle, NULL, NULL);
+            free(ldap_server_handle);
+            info->num_conns--;
+        } else {
+            krb5_put_ldap_handle(ldap_server_handle);
+        }
         HNDL_UNLOCK(ldap_context);
     }
     return;
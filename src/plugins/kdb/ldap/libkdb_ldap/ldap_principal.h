@@ -102,6 +102,10 @@ krb5_error_code
 krb5_ldap_get_principal(krb5_context , krb5_const_principal ,
                         unsigned int, krb5_db_entry **);
 
+krb5_error_code
+krb5_ldap_get_principals(krb5_context, size_t, krb5_const_principal *,
+                         const unsigned int *, krb5_db_entry **);
+
 krb5_error_code
 krb5_ldap_delete_principal(krb5_context, krb5_const_principal);
 
@@ -251,6 +251,194 @@ cleanup:
     return st;
 }
 
+/*
+ * Make a DB entry for the directory entry ent, which was found under the name
+ * user (the unparsed form of searchfor).  If user is an alias, name the entry
+ * with the canonical name.
+ */
+static krb5_error_code
+load_found_entry(krb5_context context, krb5_ldap_context *ldap_context,
+                 LDAP *ld, LDAPMessage *ent, const char *user,
+                 krb5_const_principal searchfor, krb5_db_entry **entry_out)
+{
+    krb5_error_code st = 0;
+    char **values, *cname = NULL;
+    krb5_principal cprinc = NULL;
+    krb5_db_entry *entry = NULL;
+
+    *entry_out = NULL;
+
+    values = ldap_get_values(ld, ent, "krbcanonicalname");
+    if (values != NULL) {
+        if (values[0] && strcmp(values[0], user) != 0) {
+            /* We matched an alias, not the canonical name. */
+            st = krb5_ldap_parse_principal_name(values[0], &cname);
+            if (st == 0)
+                st = krb5_parse_name(context, cname, &cprinc);
+        }
+        ldap_value_free(values);
+        if (st)
+            goto cleanup;
+    }
+
+    entry = k5alloc(sizeof(*entry), &st);
+    if (entry == NULL)
+        goto cleanup;
+    st = populate_krb5_db_entry(context, ldap_context, ld, ent,
+                                cprinc ? cprinc : searchfor, entry);
+    if (st)
+        goto cleanup;
+
+    *entry_out = entry;
+    entry = NULL;
+
+cleanup:
+    krb5_db_free_principal(context, entry);
+    krb5_free_principal(context, cprinc);
+    free(cname);
+    return st;
+}
+
+/*
+ * look up several principals in the directory, with one search per subtree
+ * using a filter which matches any of their names.
+ */
+
+krb5_error_code
+krb5_ldap_get_principals(krb5_context context, size_t count,
+                         krb5_const_principal *search_for,
+                         const unsigned int *flags, krb5_db_entry **entries)
+{
+    char                        **users=NULL, *filtuser=NULL;
+    char                        **values=NULL, **subtree=NULL;
+    unsigned int                tree=0, ntrees=1;
+    size_t                      i=0, j=0, nleft=0;
+    krb5_error_code             tempst=0, st=0;
+    LDAP                        *ld=NULL;
+    LDAPMessage                 *result=NULL, *ent=NULL;
+    krb5_ldap_context           *ldap_context=NULL;
+    krb5_ldap_server_handle     *ldap_server_handle=NULL;
+    struct k5buf                filter;
+
+    k5_buf_init_dynamic(&filter);
+    for (i = 0; i < count; i++)
+        entries[i] = NULL;
+
+    /* Clear the global error string */
+    krb5_clear_error_message(context);
+
+    ldap_context = (krb5_ldap_context *)context->dal_handle->db_context;
+
+    CHECK_LDAP_HANDLE(ldap_context);
+
+    users = k5calloc(count, sizeof(*users), &st);
+    if (users == NULL)
+        goto cleanup;
+
+    /* Principals outside the realm are left unmatched, with the message a
+     * single lookup would set. */
+    k5_buf_add(&filter, "(&(|(objectclass=krbprincipalaux)"
+               "(objectclass=krbprincipal))(|");
+    for (i = 0; i < count; i++) {
+        if (!is_principal_in_realm(ldap_context, search_for[i])) {
+            k5_setmsg(context, KRB5_KDB_NOENTRY,
+                      _("Principal does not belong to realm"));
+            continue;
+        }
+        if ((st=krb5_unparse_name(context, search_for[i], &users[i])) != 0)
+            goto cleanup;
+        if ((st=krb5_ldap_unparse_principal_name(users[i])) != 0)
+            goto cleanup;
+        filtuser = ldap_filter_correct(users[i]);
+        if (filtuser == NULL) {
+            st = ENOMEM;
+            goto cleanup;
+        }
+        k5_buf_add_fmt(&filter, "(krbprincipalname=%s)", filtuser);
+        free(filtuser);
+        filtuser = NULL;
+        nleft++;
+    }
+    k5_buf_add(&filter, "))");
+    if (k5_buf_status(&filter) != 0) {
+        st = ENOMEM;
+        goto cleanup;
+    }
+    if (nleft == 0)
+        goto cleanup;
+
+    if ((st = krb5_get_subtree_info(ldap_context, &subtree, &ntrees)) != 0)
+        goto cleanup;
+
+    GET_HANDLE();
+    for (tree=0; tree < ntrees && nleft > 0; ++tree) {
+
+        LDAP_SEARCH(subtree[tree], ldap_context->lrparams->search_scope,
+                    filter.data, principal_attributes);
+        for (ent=ldap_first_entry(ld, result); ent != NULL && nleft > 0;
+             ent=ldap_next_entry(ld, ent)) {
+
+            values = ldap_get_values(ld, ent, "krbprincipalname");
+            if (values == NULL)
+                continue;
+
+            /* Match the entry's names against each outstanding lookup.  As
+             * with single lookups, compare exactly because a wild-card in a
+             * principal name can match other entries. */
+            for (i = 0; i < count; i++) {
+                if (users[i] == NULL || entries[i] != NULL)
+                    continue;
+                for (j = 0; values[j] != NULL; j++) {
+                    if (strcmp(values[j], users[i]) == 0)
+                        break;
+                }
+                if (values[j] == NULL)
+                    continue;
+                st = load_found_entry(context, ldap_context, ld, ent,
+                                      users[i], search_for[i], &entries[i]);
+                if (st)
+                    goto cleanup;
+                nleft--;
+            }
+            ldap_value_free(values);
+            values = NULL;
+        }
+        ldap_msgfree(result);
+        result = NULL;
+    } /* for (tree=0 ... */
+
+cleanup:
+    if (values)
+        ldap_value_free(values);
+    ldap_msgfree(result);
+    k5_buf_free(&filter);
+
+    if (subtree) {
+        for (; ntrees; --ntrees)
+            if (subtree[ntrees-1])
+                free (subtree[ntrees-1]);
+        free (subtree);
+    }
+
+    if (ldap_server_handle)
+        krb5_ldap_put_handle_to_pool(ldap_context, ldap_server_handle);
+
+    if (users) {
+        for (i = 0; i < count; i++)
+            free(users[i]);
+        free(users);
+    }
+    free(filtuser);
+
+    if (st) {
+        for (i = 0; i < count; i++) {
+            krb5_db_free_principal(context, entries[i]);
+            entries[i] = NULL;
+        }
+    }
+    return st;
+}
+
 typedef enum{ ADD_PRINCIPAL, MODIFY_PRINCIPAL } OPERATION;
 /*
  * ptype is creating confusions. Additionally the logic
@@ -322,6 +322,20 @@ fetch(krb5_context context, MDB_dbi db, MDB_val *key, MDB_val *val_out)
     return ret;
 }
 
+/* Try to fetch the lockout attributes for key within the lockout environment
+ * transaction txn and set them in entry. */
+static void
+fetch_lockout_txn(krb5_context context, MDB_txn *txn, MDB_val *key,
+                  krb5_db_entry *entry)
+{
+    klmdb_context *dbc = context->dal_handle->db_context;
+    MDB_val val;
+
+    if (mdb_get(txn, dbc->lockout_db, key, &val) == 0 &&
+        val.mv_size >= LOCKOUT_RECORD_LEN)
+        klmdb_decode_princ_lockout(context, entry, val.mv_data);
+}
+
 /* If we are using a lockout database, try to fetch the lockout attributes for
  * key and set them in entry. */
 static void
@@ -329,16 +343,11 @@ fetch_lockout(krb5_context context, MDB_val *key, krb5_db_entry *entry)
 {
     klmdb_context *dbc = context->dal_handle->db_context;
     MDB_txn *txn = NULL;
-    MDB_val val;
-    int err;
 
     if (dbc->lockout_env == NULL)
         return;
-    err = mdb_txn_begin(dbc->lockout_env, NULL, MDB_RDONLY, &txn);
-    if (!err)
-        err = mdb_get(txn, dbc->lockout_db, key, &val);
-    if (!err && val.mv_size >= LOCKOUT_RECORD_LEN)
-        klmdb_decode_princ_lockout(context, entry, val.mv_data);
+    if (mdb_txn_begin(dbc->lockout_env, NULL, MDB_RDONLY, &txn) == 0)
+        fetch_lockout_txn(context, txn, key, entry);
     mdb_txn_abort(txn);
 }
 
@@ -743,6 +752,78 @@ cleanup:
     return ret;
 }
 
+/* Look up several principals within one read transaction of the primary
+ * environment (and one of the lockout environment, if used). */
+static krb5_error_code
+klmdb_get_principals(krb5_context context, size_t count,
+                     krb5_const_principal *search_for,
+                     const unsigned int *flags, krb5_db_entry **entries)
+{
+    krb5_error_code ret = 0;
+    klmdb_context *dbc = context->dal_handle->db_context;
+    MDB_txn *lockout_txn = NULL;
+    MDB_val key, val;
+    char *name = NULL;
+    size_t i;
+    int err;
+
+    for (i = 0; i < count; i++)
+        entries[i] = NULL;
+    if (dbc == NULL)
+        return KRB5_KDB_DBNOTINITED;
+
+    if (dbc->read_txn == NULL)
+        err = mdb_txn_begin(dbc->env, NULL, MDB_RDONLY, &dbc->read_txn);
+    else
+        err = mdb_txn_renew(dbc->read_txn);
+    if (err)
+        return klerr(context, err, _("LMDB read failure"));
+
+    if (dbc->lockout_env != NULL &&
+        mdb_txn_begin(dbc->lockout_env, NULL, MDB_RDONLY, &lockout_txn) != 0)
+        lockout_txn = NULL;
+
+    for (i = 0; i < count; i++) {
+        ret = krb5_unparse_name(context, search_for[i], &name);
+        if (ret)
+            goto cleanup;
+
+        key.mv_data = name;
+        key.mv_size = strlen(name);
+        err = mdb_get(dbc->read_txn, dbc->princ_db, &key, &val);
+        if (err == MDB_NOTFOUND) {
+            krb5_free_unparsed_name(context, name);
+            name = NULL;
+            continue;
+        } else if (err) {
+            ret = klerr(context, err, _("LMDB read failure"));
+            goto cleanup;
+        }
+
+        ret = klmdb_decode_princ(context, name, strlen(name),
+                                 val.mv_data, val.mv_size, &entries[i]);
+        if (ret)
+            goto cleanup;
+
+        if (lockout_txn != NULL)
+            fetch_lockout_txn(context, lockout_txn, &key, entries[i]);
+        krb5_free_unparsed_name(context, name);
+        name = NULL;
+    }
+
+cleanup:
+    krb5_free_unparsed_name(context, name);
+    mdb_txn_abort(lockout_txn);
+    mdb_txn_reset(dbc->read_txn);
+    if (ret) {
+        for (i = 0; i < count; i++) {
+            krb5_db_free_principal(context, entries[i]);
+            entries[i] = NULL;
+        }
+    }
+    return ret;
+}
+
 static krb5_error_code
 klmdb_put_principal(krb5_context context, krb5_db_entry *entry, char **db_args)
 {
@@ -1121,7 +1202,7 @@ cleanup:
 
 kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_lmdb, kdb_function_table) = {
     .maj_ver = KRB5_KDB_DAL_MAJOR_VERSION,
-    .min_ver = 0,
+    .min_ver = 1,
     .init_library = klmdb_lib_init,
     .fini_library = klmdb_lib_cleanup,
     .init_module = klmdb_open,
@@ -1139,5 +1220,6 @@ kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_lmdb, kdb_function_table) = {
     .delete_policy = klmdb_delete_policy,
     .promote_db = klmdb_promote_db,
     .check_policy_as = klmdb_check_policy_as,
-    .audit_as_req = klmdb_audit_as_req
+    .audit_as_req = klmdb_audit_as_req,
+    .get_principals = klmdb_get_principals
 };
@@ -0,0 +1,129 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* tests/getprincs.c - krb5_db_get_principals test harness */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Usage: getprincs [-c command] princ1 princ2 ...
+ *
+ * This program opens the KDB as the KDC does (so that the principal cache
+ * is used if configured) and looks up the named principals with one call to
+ * krb5_db_get_principals(), printing each principal's kvno or "not found".
+ * With -c, it then runs command and looks up the principals again.
+ */
+
+#include "k5-int.h"
+#include <kdb.h>
+
+static krb5_context ctx;
+
+static void
+check(krb5_error_code code)
+{
+    const char *errmsg;
+
+    if (code) {
+        errmsg = krb5_get_error_message(ctx, code);
+        fprintf(stderr, "%s\n", errmsg);
+        krb5_free_error_message(ctx, errmsg);
+        exit(1);
+    }
+}
+
+static void
+lookup(char **names, krb5_const_principal *princs, unsigned int *flags,
+       krb5_db_entry **entries, int count)
+{
+    int i;
+
+    check(krb5_db_get_principals(ctx, count, princs, flags, entries));
+    for (i = 0; i < count; i++) {
+        if (entries[i] == NULL) {
+            printf("%s: not found\n", names[i]);
+            continue;
+        }
+        printf("%s: kvno %d\n", names[i],
+               (entries[i]->n_key_data > 0) ?
+               entries[i]->key_data[0].key_data_kvno : 0);
+        krb5_db_free_principal(ctx, entries[i]);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *command = NULL;
+    krb5_principal princ;
+    krb5_const_principal *princs;
+    krb5_db_entry **entries;
+    unsigned int *flags;
+    int i, count;
+
+    argv++;
+    argc--;
+    if (argc >= 2 && strcmp(*argv, "-c") == 0) {
+        command = argv[1];
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc < 1) {
+        fprintf(stderr, "Usage: getprincs [-c command] princ ...\n");
+        exit(1);
+    }
+    count = argc;
+
+    check(krb5_init_context_profile(NULL, KRB5_INIT_CONTEXT_KDC, &ctx));
+    check(krb5_db_open(ctx, NULL, KRB5_KDB_OPEN_RO | KRB5_KDB_SRV_TYPE_KDC));
+
+    princs = calloc(count, sizeof(*princs));
+    flags = calloc(count, sizeof(*flags));
+    entries = calloc(count, sizeof(*entries));
+    assert(princs != NULL && flags != NULL && entries != NULL);
+    for (i = 0; i < count; i++) {
+        check(krb5_parse_name(ctx, argv[i], &princ));
+        princs[i] = princ;
+    }
+
+    lookup(argv, princs, flags, entries, count);
+    if (command != NULL) {
+        if (system(command) != 0)
+            abort();
+        lookup(argv, princs, flags, entries, count);
+    }
+
+    for (i = 0; i < count; i++)
+        krb5_free_principal(ctx, (krb5_principal)princs[i]);
+    free(princs);
+    free(flags);
+    free(entries);
+    check(krb5_db_fini(ctx));
+    krb5_free_context(ctx);
+    return 0;
+}
@@ -196,6 +196,153 @@ test_standard_wrap(gss_ctx_id_t ctx1, gss_ctx_id_t ctx2, int conf)
     (void)gss_release_iov_buffer(&minor, stiov, 2);
 }
 
+/* Wrap a message in place within a buffer with headroom and tailroom using
+ * ctx1, and make sure the result is a standard token which ctx2 can unwrap. */
+static void
+test_stream_wrap(gss_ctx_id_t ctx1, gss_ctx_id_t ctx2, int conf)
+{
+    OM_uint32 major, minor;
+    gss_iov_buffer_desc iov[4], stiov[2];
+    gss_buffer_desc input, output;
+    gss_qop_t qop;
+    const char *string = "This message is wrapped where it lies.";
+    char buf[1024], *data;
+    size_t headroom, tailroom, len = strlen(string);
+    int oconf;
+
+    /* Query the framing lengths for the message. */
+    iov[0].type = GSS_IOV_BUFFER_TYPE_HEADER;
+    iov[1].type = GSS_IOV_BUFFER_TYPE_DATA;
+    iov[1].buffer.value = (char *)string;
+    iov[1].buffer.length = len;
+    iov[2].type = GSS_IOV_BUFFER_TYPE_PADDING;
+    iov[3].type = GSS_IOV_BUFFER_TYPE_TRAILER;
+    major = gss_wrap_iov_length(&minor, ctx1, conf, GSS_C_QOP_DEFAULT, NULL,
+                                iov, 4);
+    check_gsserr("gss_wrap_iov_length(stream)", major, minor);
+    headroom = iov[0].buffer.length;
+    tailroom = iov[2].buffer.length + iov[3].buffer.length;
+
+    /* Leave extra room on both sides, which should not end up in the
+     * token. */
+    data = buf + headroom + 10;
+    memcpy(data, string, len);
+    stiov[0].type = GSS_IOV_BUFFER_TYPE_STREAM;
+    stiov[0].buffer.value = buf;
+    stiov[0].buffer.length = headroom + 10 + len + tailroom + 10;
+    stiov[1].type = GSS_IOV_BUFFER_TYPE_DATA;
+    stiov[1].buffer.value = data;
+    stiov[1].buffer.length = len;
+    major = gss_wrap_iov(&minor, ctx1, conf, GSS_C_QOP_DEFAULT, &oconf, stiov,
+                         2);
+    check_gsserr("gss_wrap_iov(stream)", major, minor);
+    if (oconf != conf)
+        errout("gss_wrap_iov(stream) conf");
+    if (stiov[0].buffer.value != data - headroom ||
+        stiov[0].buffer.length != headroom + len + tailroom)
+        errout("gss_wrap_iov(stream) token location");
+    check_encrypted("gss_wrap_iov(stream) encryption", conf, data, string);
+
+    input = stiov[0].buffer;
+    major = gss_unwrap(&minor, ctx2, &input, &output, &oconf, &qop);
+    check_gsserr("gss_unwrap(stream)", major, minor);
+    if (oconf != conf || qop != GSS_C_QOP_DEFAULT)
+        errout("gss_unwrap(stream) conf/qop");
+    if (output.length != len || memcmp(output.value, string, len) != 0)
+        errout("gss_unwrap(stream) decryption");
+    (void)gss_release_buffer(&minor, &output);
+
+    /* Too little headroom must be refused. */
+    memcpy(data, string, len);
+    stiov[0].buffer.value = data - headroom + 1;
+    stiov[0].buffer.length = headroom - 1 + len + tailroom;
+    stiov[1].buffer.value = data;
+    major = gss_wrap_iov(&minor, ctx1, conf, GSS_C_QOP_DEFAULT, NULL, stiov,
+                         2);
+    if (!GSS_ERROR(major))
+        errout("gss_wrap_iov(stream) accepted short headroom");
+
+    /* So must a DATA buffer which begins past the end of the STREAM
+     * buffer. */
+    stiov[0].buffer.value = buf;
+    stiov[0].buffer.length = 10;
+    major = gss_wrap_iov(&minor, ctx1, conf, GSS_C_QOP_DEFAULT, NULL, stiov,
+                         2);
+    if (!GSS_ERROR(major))
+        errout("gss_wrap_iov(stream) accepted data outside stream");
+}
+
+/* Wrap several messages with one gss_wrap_iov_batch() call using ctx1, and
+ * unwrap them with one gss_unwrap_iov_batch() call using ctx2.  Corrupt the
+ * last message and make sure only it fails.  (Its sequence number is never
+ * accepted, so the next batch in this direction starts with a gap.) */
+static void
+test_batch(gss_ctx_id_t ctx1, gss_ctx_id_t ctx2, int conf)
+{
+    OM_uint32 major, minor;
+    gss_iov_buffer_desc iov[3][4];
+    gss_iov_message_desc msgs[3];
+    const char *strings[3] = { "first batch message", "second", "3" };
+    char data[3][64];
+    size_t i, len;
+
+    for (i = 0; i < 3; i++) {
+        memcpy(data[i], strings[i], strlen(strings[i]) + 1);
+        iov[i][0].type = GSS_IOV_BUFFER_TYPE_HEADER |
+            GSS_IOV_BUFFER_FLAG_ALLOCATE;
+        iov[i][1].type = GSS_IOV_BUFFER_TYPE_DATA;
+        iov[i][1].buffer.value = data[i];
+        iov[i][1].buffer.length = strlen(strings[i]);
+        iov[i][2].type = GSS_IOV_BUFFER_TYPE_PADDING |
+            GSS_IOV_BUFFER_FLAG_ALLOCATE;
+        iov[i][3].type = GSS_IOV_BUFFER_TYPE_TRAILER |
+            GSS_IOV_BUFFER_FLAG_ALLOCATE;
+        msgs[i].iov = iov[i];
+        msgs[i].iov_count = 4;
+    }
+
+    major = gss_wrap_iov_batch(&minor, ctx1, conf, GSS_C_QOP_DEFAULT, msgs, 3);
+    check_gsserr("gss_wrap_iov_batch", major, minor);
+    for (i = 0; i < 3; i++) {
+        if (msgs[i].major_status != GSS_S_COMPLETE ||
+            msgs[i].conf_state != conf)
+            errout("gss_wrap_iov_batch message status");
+        check_encrypted("gss_wrap_iov_batch encryption", conf, data[i],
+                        strings[i]);
+    }
+
+    /* Flip a bit in the last message, which can then no longer be verified
+     * (or decrypted).  The other messages must still unwrap. */
+    data[2][0] ^= 1;
+    major = gss_unwrap_iov_batch(&minor, ctx2, msgs, 3);
+    if (major != GSS_S_BAD_SIG)
+        errout("gss_unwrap_iov_batch did not report the corrupt message");
+    if (msgs[2].major_status != GSS_S_BAD_SIG)
+        errout("gss_unwrap_iov_batch corrupt message status");
+    for (i = 0; i < 2; i++) {
+        len = strlen(strings[i]);
+        if (GSS_ERROR(msgs[i].major_status) || msgs[i].conf_state != conf ||
+            msgs[i].qop_state != GSS_C_QOP_DEFAULT)
+            errout("gss_unwrap_iov_batch message status");
+        if (iov[i][1].buffer.length != len ||
+            memcmp(iov[i][1].buffer.value, strings[i], len) != 0)
+            errout("gss_unwrap_iov_batch decryption");
+    }
+
+    for (i = 0; i < 3; i++)
+        (void)gss_release_iov_buffer(&minor, iov[i], 4);
+
+    /* A QOP the mechanism does not support fails the whole batch, and must be
+     * reported as such. */
+    major = gss_wrap_iov_batch(&minor, ctx1, conf, 1, msgs, 3);
+    if (major != GSS_S_BAD_QOP)
+        errout("gss_wrap_iov_batch accepted an unsupported QOP");
+    for (i = 0; i < 3; i++) {
+        if (msgs[i].major_status != GSS_S_BAD_QOP)
+            errout("gss_wrap_iov_batch unsupported QOP message status");
+    }
+}
+
 /*
  * Wrap an AEAD token (HEADER | SIGN_ONLY | DATA | PADDING | TRAILER) using the
  * caller-provided array iov, which must have space for five elements, and the
@@ -519,6 +666,18 @@ main(int argc, char *argv[])
     test_standard_wrap(actx, ictx, 0);
     test_standard_wrap(actx, ictx, 1);
 
+    /* Test wrapping in place within a stream buffer. */
+    test_stream_wrap(ictx, actx, 0);
+    test_stream_wrap(ictx, actx, 1);
+    test_stream_wrap(actx, ictx, 0);
+    test_stream_wrap(actx, ictx, 1);
+
+    /* Test batched wrapping and unwrapping. */
+    test_batch(ictx, actx, 0);
+    test_batch(ictx, actx, 1);
+    test_batch(actx, ictx, 0);
+    test_batch(actx, ictx, 1);
+
     /* Test AEAD wrapping. */
     test_aead(ictx, actx, 0);
     test_aead(ictx, actx, 1);
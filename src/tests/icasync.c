@@ -0,0 +1,175 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* tests/icasync.c - asynchronous KDC exchange test harness */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This test harness obtains initial credentials for several principals
+ * concurrently on one thread, using krb5_init_creds_step() to produce
+ * requests and the krb5_sendto_kdc_context functions to exchange them with
+ * the KDC from a single poll() loop.  All principals must have the same
+ * password (or not require a password).
+ */
+
+#include "k5-int.h"
+#include <poll.h>
+
+static krb5_context ctx;
+
+static void
+check(krb5_error_code code)
+{
+    const char *errmsg;
+
+    if (code) {
+        errmsg = krb5_get_error_message(ctx, code);
+        fprintf(stderr, "%s\n", errmsg);
+        krb5_free_error_message(ctx, errmsg);
+        exit(1);
+    }
+}
+
+/* Produce the next request for client i and start sending it, or finish the
+ * client if no more requests are needed. */
+static void
+next_request(krb5_init_creds_context *iccs, krb5_sendto_kdc_context *scs,
+             krb5_data *reps, int i)
+{
+    krb5_data req = empty_data(), realm = empty_data();
+    unsigned int flags;
+
+    check(krb5_init_creds_step(ctx, iccs[i], &reps[i], &req, &realm, &flags));
+    krb5_free_data_contents(ctx, &reps[i]);
+    if (!(flags & KRB5_INIT_CREDS_STEP_FLAG_CONTINUE)) {
+        printf("finish %d\n", i + 1);
+        krb5_init_creds_free(ctx, iccs[i]);
+        iccs[i] = NULL;
+        return;
+    }
+
+    check(krb5_sendto_kdc_init(ctx, &req, &realm, 0, &scs[i]));
+    krb5_free_data_contents(ctx, &req);
+    krb5_free_data_contents(ctx, &realm);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *password;
+    char **princstrs;
+    krb5_principal client;
+    krb5_init_creds_context *iccs;
+    krb5_sendto_kdc_context *scs;
+    const krb5_sendto_kdc_fd *fds;
+    struct pollfd *pfds;
+    krb5_data *reps;
+    size_t nfds, j;
+    int i, nclients, npfds, timeout, t, maxfds;
+    unsigned int flags;
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: icasync password princ1 princ2 ...\n");
+        exit(1);
+    }
+    password = argv[1];
+    princstrs = argv + 2;
+    nclients = argc - 2;
+
+    check(krb5_init_context(&ctx));
+
+    iccs = calloc(nclients, sizeof(*iccs));
+    scs = calloc(nclients, sizeof(*scs));
+    reps = calloc(nclients, sizeof(*reps));
+    assert(iccs != NULL && scs != NULL && reps != NULL);
+
+    /* Create an initial creds context for each client principal and start
+     * sending its first request. */
+    for (i = 0; i < nclients; i++) {
+        check(krb5_parse_name(ctx, princstrs[i], &client));
+        check(krb5_init_creds_init(ctx, client, NULL, NULL, 0, NULL,
+                                   &iccs[i]));
+        check(krb5_init_creds_set_password(ctx, iccs[i], password));
+        krb5_free_principal(ctx, client);
+        next_request(iccs, scs, reps, i);
+    }
+
+    maxfds = 0;
+    pfds = NULL;
+    for (;;) {
+        /* Gather the sockets and the earliest timeout of all exchanges. */
+        npfds = 0;
+        timeout = -1;
+        for (i = 0; i < nclients; i++) {
+            if (scs[i] == NULL)
+                continue;
+            check(krb5_sendto_kdc_get_fds(ctx, scs[i], &fds, &nfds, &t));
+            if (npfds + (int)nfds > maxfds) {
+                maxfds = npfds + nfds;
+                pfds = realloc(pfds, maxfds * sizeof(*pfds));
+                assert(pfds != NULL);
+            }
+            for (j = 0; j < nfds; j++) {
+                pfds[npfds].fd = fds[j].fd;
+                pfds[npfds].events =
+                    ((fds[j].events & KRB5_SENDTO_KDC_FD_READ) ? POLLIN : 0) |
+                    ((fds[j].events & KRB5_SENDTO_KDC_FD_WRITE) ? POLLOUT : 0);
+                npfds++;
+            }
+            if (timeout < 0 || t < timeout)
+                timeout = t;
+        }
+        if (timeout < 0)
+            break;
+
+        if (poll(pfds, npfds, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            exit(1);
+        }
+
+        /* Step every exchange; those with nothing to do return quickly. */
+        for (i = 0; i < nclients; i++) {
+            if (scs[i] == NULL)
+                continue;
+            check(krb5_sendto_kdc_step(ctx, scs[i], &reps[i], &flags));
+            if (flags & KRB5_SENDTO_KDC_STEP_FLAG_CONTINUE)
+                continue;
+            krb5_sendto_kdc_free(ctx, scs[i]);
+            scs[i] = NULL;
+            next_request(iccs, scs, reps, i);
+        }
+    }
+
+    free(pfds);
+    free(reps);
+    free(scs);
+    free(iccs);
+    krb5_free_context(ctx);
+    return 0;
+}
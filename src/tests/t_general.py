@@ -1,3 +1,4 @@
+import socket
 from k5test import *
 
 for realm in multipass_realms(create_host=False):
@@ -50,6 +51,44 @@ mark('#8060 regression test')
 realm.run([kinit, '-C', 'notfoundprinc'], expected_code=1,
           expected_msg='not found in Kerberos database')
 
+# Test concurrent stepwise initial creds operations whose KDC
+# exchanges are driven from one poll loop, over UDP and then TCP.
+mark('asynchronous KDC exchanges')
+realm.run([kadminl, 'addprinc', '-pw', 'pw', 'async1'])
+realm.run([kadminl, 'addprinc', '+requires_preauth', '-pw', 'pw', 'async2'])
+realm.run([kadminl, 'addprinc', '+requires_preauth', '-pw', 'pw', 'async3'])
+tcp_conf = {'libdefaults': {'udp_preference_limit': '1'}}
+tcp_env = realm.special_env('tcp', False, krb5_conf=tcp_conf)
+for env in (None, tcp_env):
+    out = realm.run(['./icasync', 'pw', 'async1', 'async2', 'async3'],
+                    env=env,
+                    expected_trace=('Response was not from primary KDC',))
+    if sorted(out.splitlines()) != ['finish 1', 'finish 2', 'finish 3']:
+        fail('unexpected output from icasync')
+
+# Test that the exchanges report replies from a primary KDC.
+primary_conf = {'realms': {'$realm': {'primary_kdc': '$hostname:$port0'}}}
+primary_env = realm.special_env('primary', False, krb5_conf=primary_conf)
+realm.run(['./icasync', 'pw', 'async1'], env=primary_env,
+          expected_trace=('Response was from primary KDC',))
+
+# Test that TCP connections to the KDC are reused within a context,
+# and that a new connection is made if reuse is disabled.
+mark('KDC connection reuse')
+realm.run([kadminl, 'addprinc', '-randkey', 'svc1'])
+realm.run([kadminl, 'addprinc', '-randkey', 'svc2'])
+realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, 'svc1', 'svc2'], env=tcp_env,
+          expected_trace=('Initiating TCP connection',
+                          'Reusing TCP connection'))
+noreuse_conf = {'libdefaults': {'udp_preference_limit': '1',
+                                'kdc_connection_reuse': 'false'}}
+noreuse_env = realm.special_env('noreuse', False, krb5_conf=noreuse_conf)
+out, trace = realm.run([kvno, 'svc1', 'svc2'], env=noreuse_env,
+                       return_trace=True)
+if 'Reusing TCP connection' in trace:
+    fail('TCP connection reused with kdc_connection_reuse = false')
+
 # Spot-check KRB5_TRACE output
 mark('KRB5_TRACE spot check')
 expected_trace = ('Sending initial UDP request',
@@ -61,4 +100,26 @@ expected_trace = ('Sending initial UDP request',
                   'Storing user@KRBTEST.COM')
 realm.kinit(realm.user_princ, password('user'), expected_trace=expected_trace)
 
+# Test that the KDC closes its least recently active TCP connection
+# when it has too many, and keeps answering requests over TCP.
+mark('KDC TCP connection limit')
+realm.stop()
+conf = {'kdcdefaults': {'kdc_tcp_max_connections': '2'}}
+realm = K5Realm(create_host=False, kdc_conf=conf)
+socks = [socket.create_connection((hostname, realm.portbase))
+         for i in range(3)]
+socks[0].settimeout(5)
+if socks[0].recv(1) != b'':
+    fail('oldest TCP connection not closed')
+socks[2].settimeout(0.5)
+try:
+    socks[2].recv(1)
+    fail('newest TCP connection closed')
+except socket.timeout:
+    pass
+tcp_env = realm.special_env('tcp', False, krb5_conf=tcp_conf)
+realm.kinit(realm.user_princ, password('user'), env=tcp_env)
+for s in socks:
+    s.close()
+
 success('FAST kinit, trace logging')
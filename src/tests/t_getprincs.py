@@ -0,0 +1,50 @@
+from k5test import *
+
+realm = K5Realm(create_host=False, start_kdc=False)
+realm.addprinc('alice')
+realm.addprinc('bob')
+
+# Names which do not exist yield empty entries without failing the batch.
+# The DB2 module implements the batch lookup natively.
+mark('DB2 batch lookup')
+out = realm.run(['./getprincs', 'alice', 'nobody', realm.krbtgt_princ,
+                 'bob'])
+if out != ('alice: kvno 1\nnobody: not found\n%s: kvno 1\nbob: kvno 1\n' %
+           realm.krbtgt_princ):
+    fail('unexpected getprincs output')
+
+# With the principal cache, a second batch is answered from the cache, so
+# changes made by another process are not seen.
+mark('principal cache hits')
+cpw = kadminl + ' cpw -randkey alice >/dev/null'
+out = realm.run(['./getprincs', '-c', cpw, 'alice', 'bob'])
+if out != 'alice: kvno 1\nbob: kvno 1\nalice: kvno 2\nbob: kvno 1\n':
+    fail('unexpected getprincs output without the cache')
+conf = {'dbmodules': {'db': {'principal_cache_size': '100',
+                             'principal_cache_ttl': '1h',
+                             'principal_negative_cache_ttl': '1h'}}}
+cache_env = realm.special_env('cache', True, kdc_conf=conf)
+addprinc = kadminl + ' addprinc -nokey nobody >/dev/null'
+out = realm.run(['./getprincs', '-c', cpw + '; ' + addprinc, 'alice',
+                 'nobody', 'bob'], env=cache_env)
+if out != ('alice: kvno 2\nnobody: not found\nbob: kvno 1\n'
+           'alice: kvno 2\nnobody: not found\nbob: kvno 1\n'):
+    fail('unexpected getprincs output with the cache')
+realm.stop()
+
+# The test module does not implement the batch lookup, so libkdb5 looks
+# up each name in turn.  (The test module only reports a missing entry for
+# a principal in another realm.)
+mark('fallback to single lookups')
+testprincs = {'krbtgt/KRBTEST.COM': {'keys': 'aes128-cts'},
+              'user': {'keys': '3 aes128-cts'}}
+kdcconf = {'realms': {'$realm': {'database_module': 'test'}},
+           'dbmodules': {'test': {'db_library': 'test',
+                                  'princs': testprincs}}}
+realm = K5Realm(kdc_conf=kdcconf, create_kdb=False, start_kdc=False)
+out = realm.run(['./getprincs', 'user', 'user@OTHER', realm.krbtgt_princ])
+if out != ('user: kvno 3\nuser@OTHER: not found\n%s: kvno 1\n' %
+           realm.krbtgt_princ):
+    fail('unexpected getprincs output from test module')
+
+success('KDB batch principal lookups')
@@ -0,0 +1,66 @@
+from k5test import *
+
+# Without an update log, the KDC keeps serving a cached entry after
+# another process changes it.
+conf = {'dbmodules': {'db': {'principal_cache_size': '100',
+                             'principal_cache_ttl': '1h',
+                             'principal_negative_cache_ttl': '1h'}}}
+realm = K5Realm(kdc_conf=conf)
+realm.run([kvno, realm.host_princ], expected_msg='kvno = 1')
+realm.run([kadminl, 'cpw', '-randkey', realm.host_princ])
+realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, realm.host_princ], expected_msg='kvno = 1')
+
+# AS-REQ client lookups bypass the cache.
+realm.run([kadminl, 'cpw', '-pw', 'new', realm.user_princ])
+realm.kinit(realm.user_princ, 'new')
+
+# Lookups which find nothing are cached too, including AS-REQ clients.
+mark('negative entries')
+realm.run([kvno, 'later'], expected_code=1,
+          expected_msg='not found in Kerberos database')
+realm.kinit('later', expected_code=1,
+            expected_msg='not found in Kerberos database')
+realm.run([kadminl, 'addprinc', '-pw', 'pw', 'later'])
+realm.run([kvno, 'later'], expected_code=1,
+          expected_msg='not found in Kerberos database')
+realm.kinit('later', 'pw', expected_code=1,
+            expected_msg='not found in Kerberos database')
+realm.stop()
+
+# Negative caching is off by default, so a new principal is found at
+# once.
+del conf['dbmodules']['db']['principal_negative_cache_ttl']
+realm = K5Realm(kdc_conf=conf)
+realm.run([kvno, 'later'], expected_code=1)
+realm.run([kadminl, 'addprinc', '-randkey', 'later'])
+realm.run([kvno, 'later'], expected_msg='kvno = 1')
+realm.stop()
+conf['dbmodules']['db']['principal_negative_cache_ttl'] = '1h'
+
+# With incremental propagation enabled, the KDC follows the update
+# log and discards changed entries.
+mark('ulog invalidation')
+conf['realms'] = {'$realm': {'iprop_enable': 'true',
+                             'iprop_logfile': '$testdir/db.ulog'}}
+realm = K5Realm(kdc_conf=conf)
+realm.run([kvno, realm.host_princ], expected_msg='kvno = 1')
+realm.run([kadminl, 'cpw', '-randkey', realm.host_princ])
+realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, realm.host_princ], expected_msg='kvno = 2')
+
+# A principal which was not found is found once it is created.
+realm.run([kvno, 'later'], expected_code=1)
+realm.kinit('later', expected_code=1)
+realm.run([kadminl, 'addprinc', '-pw', 'pw', 'later'])
+realm.kinit('later', 'pw')
+realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, 'later'], expected_msg='kvno = 1')
+
+# A deleted principal is no longer found.
+realm.run([kadminl, 'delprinc', realm.host_princ])
+realm.kinit(realm.user_princ, password('user'))
+realm.run([kvno, realm.host_princ], expected_code=1,
+          expected_msg='not found in Kerberos database')
+
+success('KDB principal cache')
@@ -262,6 +262,37 @@ errcode_t profile_open_file(const_profile_filespec_t filespec,
     return 0;
 }
 
+/*
+ * Create a file handle which shares the loaded tree of oldfile, without
+ * searching for or checking the file again.  A tree modified through oldfile's
+ * profile is private to that profile, so open the file afresh in that case.
+ */
+errcode_t profile_copy_file(prf_file_t oldfile, prf_file_t *ret_prof)
+{
+    prf_file_t      prf;
+    prf_data_t      data;
+
+    prf = malloc(sizeof(struct _prf_file_t));
+    if (!prf)
+        return ENOMEM;
+    memset(prf, 0, sizeof(struct _prf_file_t));
+    prf->magic = PROF_MAGIC_FILE;
+
+    k5_mutex_lock(&g_shared_trees_mutex);
+    data = oldfile->data;
+    if (!(data->flags & PROFILE_FILE_SHARED)) {
+        k5_mutex_unlock(&g_shared_trees_mutex);
+        free(prf);
+        return profile_open_file(data->filespec, ret_prof, NULL);
+    }
+    data->refcount++;
+    k5_mutex_unlock(&g_shared_trees_mutex);
+
+    prf->data = data;
+    *ret_prof = prf;
+    return 0;
+}
+
 errcode_t profile_update_file_data_locked(prf_data_t data, char **ret_modspec)
 {
     errcode_t retval;
@@ -15,6 +15,12 @@
  * A relation has as its value a pointer to allocated memory
  * containing a string.  Its first_child pointer must be null.
  *
+ * The children of a section are kept sorted by name, so nodes with the same
+ * name are adjacent.  A section with many children also gets a hash index
+ * mapping each name to the first child with that name, built on the first
+ * lookup and discarded when a child is added or renamed.  Lookups are made
+ * with the file data lock held, so the index needs no locking of its own.
+ *
  */
 
 
@@ -35,11 +41,17 @@ struct profile_node {
     int group_level;
     unsigned int final:1;           /* Indicate don't search next file */
     unsigned int deleted:1;
+    unsigned int index_checked:1;   /* index built, or not wanted */
     struct profile_node *first_child;
     struct profile_node *parent;
     struct profile_node *next, *prev;
+    struct profile_node **index;    /* open-addressed, by child name */
+    unsigned int index_mask;        /* index slots minus one */
 };
 
+/* Sections with fewer children than this are searched linearly. */
+#define INDEX_MIN_CHILDREN 8
+
 #define CHECK_MAGIC(node)                       \
     if ((node)->magic != PROF_MAGIC_NODE)       \
         return PROF_MAGIC_NODE;
@@ -63,6 +75,7 @@ void profile_free_node(struct profile_node *node)
         next = child->next;
         profile_free_node(child);
     }
+    free(node->index);
     node->magic = 0;
 
     free(node);
@@ -81,6 +94,86 @@ static char *MYstrdup (const char *s)
 }
 #endif
 
+static unsigned int
+hash_name(const char *name)
+{
+    unsigned int h = 2166136261U;
+
+    /* FNV-1a */
+    for (; *name != '\0'; name++)
+        h = (h ^ (unsigned char)*name) * 16777619U;
+    return h;
+}
+
+/* Discard the child index of section after its children change. */
+static void
+invalidate_index(struct profile_node *section)
+{
+    free(section->index);
+    section->index = NULL;
+    section->index_mask = 0;
+    section->index_checked = 0;
+}
+
+/* Build the child index of section if it has enough children.  On allocation
+ * failure, leave the section to be searched linearly. */
+static void
+build_index(struct profile_node *section)
+{
+    struct profile_node *p, **index;
+    unsigned int nchildren = 0, nnames = 0, size, h;
+
+    section->index_checked = 1;
+    for (p = section->first_child; p != NULL; p = p->next) {
+        nchildren++;
+        if (p->prev == NULL || strcmp(p->prev->name, p->name) != 0)
+            nnames++;
+    }
+    if (nchildren < INDEX_MIN_CHILDREN)
+        return;
+
+    /* Keep the load factor at or below one half. */
+    for (size = 16; size < nnames * 2; size *= 2);
+    index = calloc(size, sizeof(*index));
+    if (index == NULL)
+        return;
+    for (p = section->first_child; p != NULL; p = p->next) {
+        if (p->prev != NULL && strcmp(p->prev->name, p->name) == 0)
+            continue;
+        for (h = hash_name(p->name) & (size - 1); index[h] != NULL;
+             h = (h + 1) & (size - 1));
+        index[h] = p;
+    }
+    section->index = index;
+    section->index_mask = size - 1;
+}
+
+/* Return the first child of section named name, or NULL if there is none. */
+static struct profile_node *
+first_named_child(struct profile_node *section, const char *name)
+{
+    struct profile_node *p;
+    unsigned int h;
+
+    if (!section->index_checked)
+        build_index(section);
+    if (section->index != NULL) {
+        for (h = hash_name(name) & section->index_mask;
+             (p = section->index[h]) != NULL;
+             h = (h + 1) & section->index_mask) {
+            if (strcmp(p->name, name) == 0)
+                return p;
+        }
+        return NULL;
+    }
+
+    for (p = section->first_child; p != NULL; p = p->next) {
+        if (strcmp(p->name, name) == 0)
+            return p;
+    }
+    return NULL;
+}
+
 /*
  * Create a node
  */
@@ -179,6 +272,7 @@ errcode_t profile_add_node(struct profile_node *section, const char *name,
     retval = profile_create_node(name, value, &new);
     if (retval)
         return retval;
+    invalidate_index(section);
     new->group_level = section->group_level+1;
     new->deleted = 0;
     new->parent = section;
@@ -258,12 +352,17 @@ errcode_t profile_find_node(struct profile_node *section, const char *name,
     p = *state;
     if (p) {
         CHECK_MAGIC(p);
+    } else if (name) {
+        p = first_named_child(section, name);
     } else
         p = section->first_child;
 
     for (; p; p = p->next) {
-        if (name && (strcmp(p->name, name)))
-            continue;
+        /* Nodes with the same name are adjacent. */
+        if (name && (strcmp(p->name, name))) {
+            p = NULL;
+            break;
+        }
         if (section_flag) {
             if (p->value)
                 continue;
@@ -290,8 +389,10 @@ errcode_t profile_find_node(struct profile_node *section, const char *name,
      * there's guaranteed to be another match that's returned.
      */
     for (p = p->next; p; p = p->next) {
-        if (name && (strcmp(p->name, name)))
-            continue;
+        if (name && (strcmp(p->name, name))) {
+            p = NULL;
+            break;
+        }
         if (section_flag) {
             if (p->value)
                 continue;
@@ -527,8 +628,12 @@ get_new_file:
         section = iter->file->data->root;
         assert(section != NULL);
         for (cpp = iter->names; cpp[iter->done_idx]; cpp++) {
-            for (p=section->first_child; p; p = p->next) {
-                if (!strcmp(p->name, *cpp) && !p->value && !p->deleted)
+            for (p = first_named_child(section, *cpp); p; p = p->next) {
+                if (strcmp(p->name, *cpp)) {
+                    p = NULL;
+                    break;
+                }
+                if (!p->value && !p->deleted)
                     break;
             }
             if (!p) {
@@ -548,15 +653,20 @@ get_new_file:
             goto get_new_file;
         }
         iter->name = *cpp;
-        iter->node = section->first_child;
+        if (iter->name)
+            iter->node = first_named_child(section, iter->name);
+        else
+            iter->node = section->first_child;
     }
     /*
      * OK, now we know iter->node is set up correctly.  Let's do
      * the search.
      */
     for (p = iter->node; p; p = p->next) {
-        if (iter->name && strcmp(p->name, iter->name))
-            continue;
+        if (iter->name && strcmp(p->name, iter->name)) {
+            p = NULL;
+            break;
+        }
         if ((iter->flags & PROFILE_ITER_SECTIONS_ONLY) &&
             p->value)
             continue;
@@ -696,5 +806,6 @@ errcode_t profile_rename_node(struct profile_node *node, const char *new_name)
 
     free(node->name);
     node->name = new_string;
+    invalidate_index(node->parent);
     return 0;
 }
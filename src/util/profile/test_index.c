@@ -0,0 +1,151 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* util/profile/test_index.c - Test lookups in sections with a child index */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Look up relations and subsections in a section large enough to be indexed,
+ * including names which appear more than once and in more than one file, and
+ * make sure lookups still work after the section is modified.
+ */
+
+#include "k5-platform.h"
+#include "profile.h"
+#include "prof_int.h"
+
+static const char *file1 =
+    "[big]\n"
+    "\ta = 1\n"
+    "\tdup = x\n"
+    "\tb = 2\n"
+    "\tc = 3\n"
+    "\tsub = {\n"
+    "\t\tinner = yes\n"
+    "\t}\n"
+    "\td = 4\n"
+    "\tdup = y\n"
+    "\te = 5\n"
+    "\tf = 6\n"
+    "\tg = 7\n"
+    "\th = 8\n"
+    "\tdup = z\n"
+    "[small]\n"
+    "\tonly = one\n";
+
+static const char *file2 =
+    "[big]\n"
+    "\tdup = w\n"
+    "\tlast = 9\n";
+
+static void
+write_file(const char *name, const char *contents)
+{
+    FILE *fp;
+
+    fp = fopen(name, "w");
+    assert(fp != NULL);
+    assert(fputs(contents, fp) >= 0);
+    assert(fclose(fp) == 0);
+}
+
+static void
+check_string(profile_t pr, const char *sec, const char *name,
+             const char *expected)
+{
+    char *val;
+
+    assert(profile_get_string(pr, sec, name, NULL, NULL, &val) == 0);
+    if (expected == NULL) {
+        assert(val == NULL);
+    } else {
+        assert(val != NULL && strcmp(val, expected) == 0);
+        profile_release_string(val);
+    }
+}
+
+static void
+check_values(profile_t pr, const char *const *names, const char *const *exp)
+{
+    char **vals;
+    int i;
+
+    assert(profile_get_values(pr, names, &vals) == 0);
+    for (i = 0; exp[i] != NULL; i++)
+        assert(vals[i] != NULL && strcmp(vals[i], exp[i]) == 0);
+    assert(vals[i] == NULL);
+    profile_free_list(vals);
+}
+
+int
+main()
+{
+    profile_t pr;
+    char **vals;
+    const char *files[] = { "./test_index1.ini", "./test_index2.ini", NULL };
+    const char *dup_names[] = { "big", "dup", NULL };
+    const char *dup_vals[] = { "x", "y", "z", "w", NULL };
+    const char *inner_names[] = { "big", "sub", "inner", NULL };
+    const char *inner_vals[] = { "yes", NULL };
+    const char *new_names[] = { "big", "added", NULL };
+    const char *sub_names[] = { "big", "sub", NULL };
+    const char *renamed_names[] = { "big", "zsub", "inner", NULL };
+    const char *zz_names[] = { "big", "zz", NULL };
+    const char *zz_vals[] = { "1", "2", NULL };
+
+    write_file(files[0], file1);
+    write_file(files[1], file2);
+    assert(profile_init(files, &pr) == 0);
+
+    check_string(pr, "big", "a", "1");
+    check_string(pr, "big", "h", "8");
+    check_string(pr, "big", "last", "9");
+    check_string(pr, "big", "missing", NULL);
+    check_string(pr, "small", "only", "one");
+    check_values(pr, dup_names, dup_vals);
+    check_values(pr, inner_names, inner_vals);
+
+    /* Modify the indexed section and look again. */
+    assert(profile_add_relation(pr, new_names, "new") == 0);
+    check_string(pr, "big", "added", "new");
+    check_string(pr, "big", "a", "1");
+    assert(profile_rename_section(pr, sub_names, "zsub") == 0);
+    check_values(pr, renamed_names, inner_vals);
+    assert(profile_get_values(pr, inner_names, &vals) == PROF_NO_RELATION);
+    assert(profile_add_relation(pr, zz_names, "1") == 0);
+    assert(profile_add_relation(pr, zz_names, "2") == 0);
+    check_values(pr, zz_names, zz_vals);
+    assert(profile_clear_relation(pr, dup_names) == 0);
+    check_string(pr, "big", "dup", "w");
+
+    profile_abandon(pr);
+    (void)unlink(files[0]);
+    (void)unlink(files[1]);
+    return 0;
+}